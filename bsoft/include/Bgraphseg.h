@@ -3,10 +3,12 @@
 @brief	Graph segmentation classes.
 @author	Bernard Heymann
 @date	Created: 20110318
-@date	Modified: 20201228
+@date	Modified: 20261018
 **/
 
+#include "Vector3.h"
 #include "utilities.h"
+#include <cstring>
 
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
@@ -14,22 +16,75 @@ extern int 	verbose;		// Level of output to the screen
 #ifndef _GraphSeg_
 
 /**
-@brief Graph segmentation edge.
+@brief Graph segmentation edge list.
+
+	Each edge is stored implicitly as the index of its first voxel times 8
+	plus a direction code, with the second voxel at the offset for the
+	direction.
+	The weight is stored as the bit pattern of its single precision value,
+	which sorts as an unsigned integer in the same order as non-negative
+	weights, so that the edges are sorted with a parallel radix sort.
+	The sort is stable: edges of equal weight keep their order, so that
+	the segmentation does not depend on the number of threads.
+	The index type is 32-bit for up to 2^29 voxels, otherwise 64-bit.
 **/
-class GSedge {
+template <typename T>
+class GSedge_list {
 private:
-	long		u, v;	// GSedge ends in the 1D data array
-	float		w;		// GSedge weight: Neighbor value difference
+	vector<T>			c;		// First voxel index * 8 + direction code
+	vector<uint32_t>	k;		// Weight key
+	long				off[8];	// Index offset for each direction
 public:
-	GSedge() : u(0), v(0), w(0) {}
-	GSedge(long start, long end, double weight) : u(start), v(end), w(weight) {}
-	long		operator[](int i) { return (i%2)? u: v; }
-	void		weight(double val) { w = val; }
-	double		weight() const { return w; }
+	GSedge_list() { for ( int i=0; i<8; ++i ) off[i] = 0; }
+	void		offset(int d, long o) { off[d] = o; }
+	void		reserve(long n) { c.reserve(n); k.reserve(n); }
+	long		size() { return c.size(); }
+	long		memory() { return c.capacity()*sizeof(T) + k.capacity()*sizeof(uint32_t); }
+	void		add(long u, int d) { c.push_back(((T)u << 3) | d); k.push_back(0); }
+	long		start(long i) { return c[i] >> 3; }
+	long		end(long i) { return (c[i] >> 3) + off[c[i] & 7]; }
+	void		weight(long i, double w) { float f(w); memcpy(&k[i], &f, sizeof(float)); }
+	double		weight(long i) { float f; memcpy(&f, &k[i], sizeof(float)); return f; }
+	void		sort() {
+		long				n(c.size()), nchunk(system_processors());
+		if ( nchunk > n ) nchunk = 1;
+		long				chunk((n - 1)/nchunk + 1), shift, b, ic, t, s;
+		vector<T>			c2(n);
+		vector<uint32_t>	k2(n);
+		vector<long>		h(nchunk*256);
+		for ( shift=0; shift<32; shift+=8 ) {
+			fill(h.begin(), h.end(), 0);
+#pragma omp parallel for
+			for ( long jc=0; jc<nchunk; ++jc ) {
+				long		i, iend((jc+1)*chunk < n? (jc+1)*chunk: n);
+				long*		hc = h.data() + jc*256;
+				for ( i=jc*chunk; i<iend; ++i ) hc[(k[i] >> shift) & 255]++;
+			}
+			for ( b=0, t=0; b<256 && t<n; ++b )
+				for ( ic=0, t=0; ic<nchunk; ++ic ) t += h[ic*256 + b];
+			if ( t == n ) continue;		// All keys have the same digit
+			for ( b=0, s=0; b<256; ++b )
+				for ( ic=0; ic<nchunk; ++ic ) {
+					t = h[ic*256 + b];
+					h[ic*256 + b] = s;
+					s += t;
+				}
+#pragma omp parallel for
+			for ( long jc=0; jc<nchunk; ++jc ) {
+				long		i, j, iend((jc+1)*chunk < n? (jc+1)*chunk: n);
+				long*		hc = h.data() + jc*256;
+				for ( i=jc*chunk; i<iend; ++i ) {
+					j = hc[(k[i] >> shift) & 255]++;
+					k2[j] = k[i];
+					c2[j] = c[i];
+				}
+			}
+			k.swap(k2);
+			c.swap(c2);
+		}
+	}
 } ;
 
-//bool sort_edge(const GSedge &e1, const GSedge &e2);
-
 /**
 @brief Graph segmentation region.
 **/
@@ -60,14 +115,21 @@ public:
 
 /**
 @brief Graph segmentation container.
+
+	The edges connect each voxel to up to 7 neighbors in the positive
+	direction along x, y or z (see Bimage::graph_setup).
+	The merging functions pass the region of the edge end first to
+	region_join, which determines the region roots and their numbering.
 **/
 class GSgraph {
 private:
-	vector<GSvoxel>		r;
-	vector<GSedge>		e;
+	vector<GSvoxel>			r;
+	int						wide;	// Flag for 64-bit edge indices
+	GSedge_list<uint32_t>	e32;
+	GSedge_list<uint64_t>	e64;
 public:
+	GSgraph() : wide(0) {}
 	vector<GSvoxel>&	voxels() { return r; }
-	vector<GSedge>&		edges() { return e; }
 	GSvoxel&	voxel(long i) { return r[i]; }
 	GSvoxel&	add_voxel(long index, long nj, long nv, double avg) {
 		r.push_back(GSvoxel(index, nj, nv, avg));
@@ -79,19 +141,46 @@ public:
 			if ( r[i].index() == i ) j++;
 		return j;
 	}
-	GSedge&		edge(long i) { return e[i]; }
-	GSedge&		add_edge(long u, long v, double w) {
-		e.push_back(GSedge(u, v, w));
-		return e.back();
+	void		edge_setup(Vector3<long> size, long nedges) {
+		// Offsets: +x, +x-y-z, +x-z, +x-y, +y-z, +y, +z
+		long		dx[7] = {1,1,1,1,0,0,0};
+		long		dy[7] = {0,-1,0,-1,1,1,0};
+		long		dz[7] = {0,-1,-1,0,-1,0,1};
+		wide = ( size.volume() >= (1L << 29) );
+		for ( int d=0; d<7; ++d ) {
+			long	o((dz[d]*size[1] + dy[d])*size[0] + dx[d]);
+			e32.offset(d, o);
+			e64.offset(d, o);
+		}
+		if ( wide ) e64.reserve(nedges);
+		else e32.reserve(nedges);
+	}
+	void		add_edge(long u, int direction) {
+		if ( wide ) e64.add(u, direction);
+		else e32.add(u, direction);
+	}
+	long		edge_count() { return ( wide )? e64.size(): e32.size(); }
+	long		edge_start(long i) { return ( wide )? e64.start(i): e32.start(i); }
+	long		edge_end(long i) { return ( wide )? e64.end(i): e32.end(i); }
+	double		edge_weight(long i) { return ( wide )? e64.weight(i): e32.weight(i); }
+	void		edge_weight(long i, double w) {
+		if ( wide ) e64.weight(i, w);
+		else e32.weight(i, w);
 	}
-	long		edge_count() { return e.size(); }
 	void		edge_sort() {
-		sort (e.begin(), e.end(), [](const GSedge &e1, const GSedge &e2) { return e1.weight() < e2.weight(); });
+		if ( wide ) e64.sort();
+		else e32.sort();
+	}
+	long		memory() {
+		return r.capacity()*sizeof(GSvoxel) + e32.memory() + e64.memory();
 	}
 	long		region_find(long i) {
-		long			j(i);
-		while ( j != r[j].index() ) j = r[j].index();
-		r[i].index(j);
+		long			j(i), k;
+		while ( j != r[j].index() ) {		// Path halving
+			k = r[r[j].index()].index();
+			r[j].index(k);
+			j = k;
+		}
 		return j;
 	}
 	int			region_join(long i, long j) {
@@ -111,18 +200,18 @@ public:
 		return 1;
 	}
 	long		region_merging(double threshold) {
-		long			i, u, v, nrc(r.size());
-		GSedge			edge;
+		long			i, u, v, nrc(r.size()), ne(edge_count());
+		double			w;
 		for ( i=0; i<r.size(); ++i ) r[i].average(threshold);
-		for ( i=0; i<e.size(); ++i ) {
-			edge = e[i];
-			u = region_find(edge[0]);
-			v = region_find(edge[1]);
+		for ( i=0; i<ne; ++i ) {
+			u = region_find(edge_end(i));
+			v = region_find(edge_start(i));
 			if ( u != v ) {
-				if ( edge.weight() <= r[u].average() && edge.weight() <= r[v].average() ) {
+				w = edge_weight(i);
+				if ( w <= r[u].average() && w <= r[v].average() ) {
 					nrc -= region_join(u, v);
 					u = region_find(u);
-					r[u].average(edge.weight() + threshold/r[u].voxels());
+					r[u].average(w + threshold/r[u].voxels());
 				}
 			}
 		}
@@ -130,13 +219,13 @@ public:
 	}
 	long		statistical_region_merging(double threshold) {
 		// Find segment memberships
-		long			i, u, v, nrc(r.size());
+		long			i, u, v, nrc(r.size()), ne(edge_count());
 		double			fac(threshold*threshold);
 		double			d2, ln1, ln2, s1, s2;
 		double			lnd(2*log(6*nrc));
-		for ( i=0; i<e.size(); ++i ) {
-			u = region_find(e[i][0]);
-			v = region_find(e[i][1]);
+		for ( i=0; i<ne; ++i ) {
+			u = region_find(edge_end(i));
+			v = region_find(edge_start(i));
 			if ( u != v ) {
 				d2 = r[u].average() - r[v].average(); d2 *= d2;
 				s1 = r[u].voxels(); s2 = r[v].voxels();
@@ -152,10 +241,10 @@ public:
 	}
 	long		region_merge_small(long nrc, long min_size)	{
 		if ( min_size < 1 ) return nrc;
-		long			i, u, v;
-		for ( i=0; i<e.size(); ++i ) {
-			u = region_find(e[i][0]);
-			v = region_find(e[i][1]);
+		long			i, u, v, ne(edge_count());
+		for ( i=0; i<ne; ++i ) {
+			u = region_find(edge_end(i));
+			v = region_find(edge_start(i));
 			if ( ( u != v ) && ( r[u].voxels() < min_size || r[v].voxels() < min_size ) ) {
 				nrc -= region_join(u, v);
 			}
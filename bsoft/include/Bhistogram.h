@@ -0,0 +1,182 @@
+/**
+@file	Bhistogram.h
+@brief	Histogram with a cumulative table for repeated queries
+@author	Bernard Heymann
+@date	Created: 20261018
+@date	Modified: 20261018
+**/
+
+#include "histogram.h"
+#include "utilities.h"
+
+#ifndef _Bhistogram_
+
+/************************************************************************
+@Object: class Bhistogram
+@Description:
+	Histogram of image data with its cumulative counts.
+@Features:
+	The histogram is calculated once (see Bimage::histogram_object) and
+	percentile, Otsu, multi-threshold and clipping queries are answered
+	from the counts without rescanning the image.
+	A value v falls in bin (long) (scale*v + offset).
+	Multiple channels are stored as successive one-dimensional arrays.
+	The queries use the first channel.
+*************************************************************************/
+class Bhistogram {
+private:
+	long			nb;			// Number of bins
+	long			nc;			// Number of channels
+	double			sc, off;	// Bin scale and offset
+	double			vmin, vmax;	// Data range
+	long			nval;		// Number of data values (all channels)
+	vector<long>	h;			// Counts
+	vector<long>	cum;		// Cumulative counts, cum[i] = sum of h[0..i]
+public:
+	Bhistogram() : nb(0), nc(1), sc(1), off(0), vmin(0), vmax(0), nval(0) {}
+	Bhistogram(vector<long>& counts, long channels, double scale, double offset,
+			double min, double max, long nvalues) :
+			nc(channels), sc(scale), off(offset), vmin(min), vmax(max),
+			nval(nvalues), h(counts), cum(counts.size(), 0) {
+		if ( nc < 1 ) nc = 1;
+		nb = h.size()/nc;
+		for ( long cc=0, k=0; cc<nc; ++cc ) {
+			long	s(0);
+			for ( long i=0; i<nb; ++i, ++k ) cum[k] = s += h[k];
+		}
+	}
+	long			bins() { return nb; }
+	long			channels() { return nc; }
+	double			scale() { return sc; }
+	double			offset() { return off; }
+	double			minimum() { return vmin; }
+	double			maximum() { return vmax; }
+	vector<long>&	counts() { return h; }
+	long			count(long i, long cc=0) { return h[cc*nb+i]; }
+	long			cumulative(long i, long cc=0) { return cum[cc*nb+i]; }
+	long			total(long cc=0) { return ( nb )? cum[cc*nb+nb-1]: 0; }
+	/**
+	@brief 	Returns the value at a percentile.
+	@param 	pct			percentile (0-100).
+	@return double		value.
+
+		The cumulative fraction is tracked over the bins as in
+		Bimage::percentiles, interpolating within the bin where the
+		percentile is passed.
+	**/
+	double			percentile(double pct) {
+		if ( pct <= 0 || nb < 2 ) return vmin;
+		if ( pct >= 100 ) return vmax;
+		double			invsize(100.0/nval), fraction, fprev(0), d;
+		long			i, j0;
+		for ( i=1; i<nb; fprev = fraction, ++i ) {
+			fraction = cum[i-1]*invsize;
+			if ( fraction > pct ) {
+				j0 = (long) ceil(fprev);
+				if ( j0 < 1 ) j0 = 1;
+				if ( j0 > pct ) j0 = (long) pct;
+				d = ( fraction > j0 )? 1.0/(fraction - j0): 1;
+				return vmin + (i - d*(fraction - pct))/sc;
+			}
+		}
+		return vmax;
+	}
+	/**
+	@brief 	Calculates the threshold according to Otsu.
+	@return double		threshold.
+
+		Reference: NOBUYUKI OTSU, IEEE TRANSACTIONS ON SYSTEMS, MAN, AND CYBERNETICS, VOL. SMC-9, NO. 1, JANUARY 1979
+	**/
+	double			otsu_threshold() {
+		long			i, tot(total());
+		double			sum(0), sumB(0), wB(0), wF(0), mB, mF, mx(0), bt(0), t1(0), t2(0);
+		for ( i = 1; i < nb; ++i )
+			sum += i * h[i];
+		for ( i = 0; i < nb; ++i ) {
+			wB += h[i];
+			if ( wB == 0 ) continue;
+			wF = tot - wB;
+			if ( wF == 0 ) break;
+			sumB += i * h[i];
+			mB = sumB / wB;
+			mF = (sum - sumB) / wF;
+			bt = wB * wF * (mB - mF) * (mB - mF);
+			if ( bt >= mx ) {
+				t1 = i;
+				if ( bt > mx ) t2 = i;
+				mx = bt;
+			}
+		}
+		return ( t1 + t2 ) / (2 * sc) + vmin;
+	}
+	/**
+	@brief 	Calculates multiple thresholds.
+	@param 	number			number of clusters (one more than thresholds).
+	@return vector<double> 	thresholds.
+	**/
+	vector<double>	multi_thresholds(long number) {
+		vector<long>	h0(h.begin(), h.begin()+nb);
+		vector<double>	t = histogram_thresholds(h0, number);
+		for ( auto& v: t ) v = (v - off)/sc;
+		return t;
+	}
+	/**
+	@brief 	Calculates minimum and maximum thresholds for truncation.
+	@param 	avg			data average.
+	@param 	&tmin		minimum threshold.
+	@param 	&tmax		maximum threshold.
+	@return int			0, <0 if the extremes are not found.
+
+		The first minimum in the first quarter of the histogram and the
+		last minimum in the last quarter are taken to define the small
+		and large outliers (see Bimage::histogram_minmax).
+	**/
+	int				clip_thresholds(double avg, double& tmin, double& tmax) {
+		long			i, j, ihi, imin, nmin, imax, nmax, isig(0);
+		double			g, sigma(8.0/(nb*nb));
+		imax = (avg - vmin)*sc;
+		nmax = h[imax];
+		for ( i=imax/2, j=(nb-imax)/2; i<j; i++ ) {
+			if ( nmax < h[i] ) {
+				nmax = h[i];
+				imax = i;
+			}
+		}
+		while ( imax+isig < nb - 1 && imax-isig > 0 &&
+				h[imax] < 2*h[imax+isig] && h[imax] < 2*h[imax-isig] )
+			isig++;
+		if ( isig > 0 ) sigma = -0.5/(isig*isig);
+		for ( i=ihi=0; i<imax/2; i++ ) {
+			g = nmax*exp(sigma*(imax - i)*(imax - i));
+			if ( h[i] > 20*g ) ihi = i;
+		}
+		imin = ihi;
+		nmin = total();
+		for ( i=ihi; i<imax/2; i++ ) {
+			if ( nmin > h[i] ) {
+				nmin = h[i];
+				imin = i;
+			}
+		}
+		ihi = nb - 1;
+		for ( i=nb-1, j=(nb-imax)/2; i>j; i-- ) {
+			g = nmax*exp(sigma*(imax - i)*(imax - i));
+			if ( h[i] > 20*g ) ihi = i;
+		}
+		imax = ihi;
+		nmin = total();
+		for ( i=(nb-imax)/2; i<ihi; i++ ) {
+			if ( nmin >= h[i] ) {
+				nmin = h[i];
+				imax = i;
+			}
+		}
+		if ( imin >= imax ) return -1;
+		tmin = imin/sc + vmin;
+		tmax = imax/sc + vmin;
+		return 0;
+	}
+} ;
+
+#define _Bhistogram_
+#endif
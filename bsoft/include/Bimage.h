@@ -3,7 +3,7 @@
 @brief	Header file for image class
 @author Bernard Heymann
 @date	Created: 19990321
-@date 	Modified: 20230110
+@date 	Modified: 20261018
 **/
 
 //#include <time.h>
@@ -24,6 +24,12 @@
 #include "ps_plot.h"
 #include "Bsuperpixel.h"
 #include "Bgraphseg.h"
+#include "Bpolar_plan.h"
+#include "Bhistogram.h"
+#include "half.h"
+
+#include <atomic>
+#include <mutex>
 
 #include <fstream>
 #include <ctime>
@@ -51,6 +57,17 @@ enum FourierType {
 
 #ifndef _Bimage_
 
+/**
+@enum 	MaskMetric
+@brief 	Distance metric for dilating and eroding masks by a radius.
+**/
+enum MaskMetric {
+	MaskEuclidean = 0,	// Euclidean distance
+	MaskChessboard = 1	// Chessboard distance: largest difference along any axis
+} ;
+
+class Bimage;
+
 union TypePointer {
 	unsigned char*	uc;
 	signed char*	sc;
@@ -62,6 +79,7 @@ union TypePointer {
 	long*			sl;
 	float*			f;
 	double*			d;
+	half*			h;
 } ;
 
 
@@ -72,7 +90,9 @@ union TypePointer {
 	multi-image file.
 **/
 class Bsub_image {
+	friend class Bimage;
 private:
+	Bimage*		parent;			// Image holding this sub-image, for lazy statistics
 	double		min, max;		// Image extremes
 	double		avg, std;		// Average and standard deviation
 	double		bkg;			// Image background
@@ -99,11 +119,12 @@ private:
 public:
 	Bsub_image();
 //	~Bsub_image();
-	double		minimum() { return min; }
-	double		maximum() { return max; }
-	double		average() { return avg; }
-	double		standard_deviation() { return std; }
-	double		variance() { return std*std; }
+	Bsub_image&	operator=(const Bsub_image& s);
+	double		minimum();
+	double		maximum();
+	double		average();
+	double		standard_deviation();
+	double		variance() { double s(standard_deviation()); return s*s; }
 	void		minimum(double d) { min = d; }
 	void		maximum(double d) { max = d; }
 	void		average(double d) { avg = d; }
@@ -181,6 +202,8 @@ private:
 	FourierType		fouriertype;  	// Transform type
 	double			min, max;		// Limits
 	double			avg, std;		// Average and standard deviation
+	atomic<bool>	stats_valid;	// Flag indicating statistics are up to date
+	mutex			stats_lock;		// Serializes statistics updates of this image
 	double			smin, smax; 	// Limits for display
 	double			ss;				// Display scale
 	UnitCell		ucell;			// Unit cell dimensions (angstrom) and angles (radian)
@@ -195,6 +218,9 @@ private:
 	void			initialize(CompoundType ctype, long nx,
 						long ny, long nz, long nn);
 	void			internal_copy(const Bimage& p);
+	void			sub_images_link() {
+		for ( long nn=0; nn<n; ++nn ) image[nn].parent = this;
+	}
 public:
 	// Construction and destruction
 	Bimage();
@@ -286,7 +312,7 @@ public:
 	unsigned char*	data_assign(unsigned char* nudata);
 	unsigned char*	data_pointer() { return d.uc; }
 	unsigned char*	data_pointer(long offset) { return &d.uc[offset*data_type_size()]; }
-	void			data_pointer(unsigned char* ptr) { d.uc = ptr; }
+	void			data_pointer(unsigned char* ptr) { d.uc = ptr; statistics_invalidate(); }
 	void			data_delete();
 	long			data_offset() { return offset; }
 	void			data_offset(long doff) { offset = doff; }
@@ -551,16 +577,32 @@ public:
 				<< n << " != " << sam.size() << ")" << endl;
 		for ( long nn=0; nn<n && nn<sam.size(); ++nn ) image[nn].sampling(sam[nn]);
 	}
-	// Statistics
-	double			minimum() { return min; }
-	double			maximum() { return max; }
-	double			average() { return avg; }
-	double			standard_deviation() { return std; }
-	double			variance() { return std*std; }
+	// Statistics: calculated on demand when the data changed
+	// set() invalidates the statistics, code writing through the data pointer
+	// calls statistics_invalidate() when done
+	bool			statistics_valid() { return stats_valid.load(memory_order_acquire); }
+	void			statistics_invalidate() {
+		// Only write when valid, so that concurrent setters do not contend for the flag
+		if ( stats_valid.load(memory_order_relaxed) ) stats_valid.store(0, memory_order_release);
+	}
+	void			statistics_update() {
+		if ( stats_valid.load(memory_order_acquire) || !d.uc ) return;
+		lock_guard<mutex>	lock(stats_lock);
+		if ( !stats_valid.load(memory_order_relaxed) ) statistics();
+	}
+	double			minimum() { statistics_update(); return min; }
+	double			maximum() { statistics_update(); return max; }
+	double			average() { statistics_update(); return avg; }
+	double			standard_deviation() { statistics_update(); return std; }
+	double			variance() { statistics_update(); return std*std; }
 	void			minimum(double d) { min = d; }
 	void			maximum(double d) { max = d; }
 	void			average(double d) { avg = d; }
 	void			standard_deviation(double d) { std = d; }
+	void			statistics(double vmin, double vmax, double vavg, double vstd) {
+		min = vmin; max = vmax; avg = vavg; std = vstd;
+		stats_valid.store(1, memory_order_release);
+	}
 	double			background(long nn) {
 		return image[nn].background();
 	}
@@ -1181,6 +1223,9 @@ public:
 	int				shift_background(double bkg);
 	// Histogram methods
 	vector<long>	histogram(long bins, double& scale, double& offset);
+	void			histogram_chunk(long start, long end, long bins,
+						double scale, double offset, long* h);
+	Bhistogram		histogram_object(long bins);
 	Bplot* 			histogram(long bins);
 	Bplot*			histogram_counts(int flags=0);
 	Bplot*			percentiles();
@@ -1256,6 +1301,10 @@ public:
 						Matrix3 mat, int fill_type=0, double fill=0);
 	void			transform_voxel(long i, Bimage* pt, long nn, Vector3<double> oldorigin, 
 						Vector3<double> nuorigin, Matrix3 affmat, double fill);
+	void			transform_float(long nn, Bimage* pt, Matrix3 affmat,
+						Vector3<double> oldorigin, Vector3<double> nuorigin, double fill);
+	void			transform_sum_float(long nn, float* nudata, vector<Matrix3>& mat,
+						Vector3<double> origin, double fill);
 	Bimage*			transform(long nn, Vector3<long> nusize, Vector3<double> scale,
 						Vector3<double> origin, Vector3<double> translate,
 						Matrix3 mat, int fill_type=0, double fill=0);
@@ -1379,6 +1428,7 @@ public:
 	Bimage*			cartesian_to_cylindrical(long nannuli, long nphi, int flag=0);
 	Bimage* 		polar_transform(long nangles, long ann_min, long ann_max,
 						long dann, long zmin, long zmax, long zinc);
+	Bimage* 		polar_transform(Bpolar_plan& plan);
 	Bimage*			polar_power_spectrum(double resolution, long num_angle);
 	int				line_powerspectra(fft_plan plan);
 	int		 		radial_shells();
@@ -1440,6 +1490,13 @@ public:
 	long			mask_erode(long times=1);
 	long 			mask_open(int times=1);
 	long 			mask_close(int times=1);
+	Bimage*			mask_distance(unsigned char value);
+	long			mask_dilate_erode(unsigned char dir, double radius, MaskMetric metric);
+	long			mask_dilate_radius(double radius, MaskMetric metric=MaskEuclidean);
+	long			mask_erode_radius(double radius, MaskMetric metric=MaskEuclidean);
+	long			mask_open_radius(double radius, MaskMetric metric=MaskEuclidean);
+	long			mask_close_radius(double radius, MaskMetric metric=MaskEuclidean);
+	long			mask_soft_edge(double radius, double width);
 	long 			mask_fill(Vector3<long> voxel);
 	long			mask_shell(Vector3<double> origin, double rad_min, double rad_max) {
 		return shell(origin, rad_min, rad_max, 0.1, FILL_USER, 1.99);
@@ -1513,7 +1570,9 @@ public:
 	double 			mass_at_threshold(long img_num, double threshold, double rho);
 	Bimage*			internal_volume(double threshold);
 	Bimage*			internal_volume(double threshold, int mask_out_freq);
-	Bimage*			kmeans_segment(long nregion=2, long max_iter=10, double ratio=1);
+	Bimage*			kmeans_segment(long nregion=2, long max_iter=10, double ratio=1,
+						int local=0, unsigned long seed=0);
+	Bimage*			kmeans_segment_local(long nregion, long max_iter, double ratio);
 	GSgraph			graph_setup(int connect_type);
 	GSgraph			graph_segment(int type=1, int connect_type=0,
 						double complexity=0, long min_size=0);
@@ -1526,6 +1585,12 @@ public:
 	vector<Bsuperpixel>	superpixels(long step, double colorweight=0.2, long iterations=10, long bin_levels=1, double stop=1);
 	int				impose_superpixels(Bimage* pmask, vector<Bsuperpixel>& seg, int impose);
 } ;
+
+inline double	Bsub_image::minimum() { if ( parent ) parent->statistics_update(); return min; }
+inline double	Bsub_image::maximum() { if ( parent ) parent->statistics_update(); return max; }
+inline double	Bsub_image::average() { if ( parent ) parent->statistics_update(); return avg; }
+inline double	Bsub_image::standard_deviation() { if ( parent ) parent->statistics_update(); return std; }
+
 #define _Bimage_
 #endif
 
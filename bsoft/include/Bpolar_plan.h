@@ -0,0 +1,140 @@
+/**
+@file	Bpolar_plan.h
+@brief	Precomputed sampling plan for polar transforms
+@author	Bernard Heymann
+@date	Created: 20261018
+@date	Modified: 20261018
+**/
+
+#include "Vector3.h"
+#include "utilities.h"
+
+#ifndef _Bpolar_plan_
+
+/************************************************************************
+@Object: class Bpolar_plan
+@Description:
+	Sampling plan for transforming images to polar form.
+@Features:
+	For a given image size, origin, annular range and number of angles,
+	the bilinear source indices and weights are calculated once.
+	Each polar pixel accumulates the samples over the annular width and
+	the z block, matching the interpolation in Bimage::interpolate.
+	The plan can be applied to any number of images of the same size.
+*************************************************************************/
+class Bpolar_plan {
+private:
+	Vector3<long>	isize;		// Input image size
+	Vector3<double>	ori;		// Origin used to set up the plan
+	long			na;			// Number of angles
+	long			amin, amax;	// Annular range
+	long			da;			// Annular width
+	long			nr;			// Number of annuli
+	long			zmin, zmax;	// Z range
+	long			zinc;		// Z block thickness
+	long			nz;			// Number of z blocks
+	vector<long>	beg;		// Start of the terms for each polar pixel in a slice
+	vector<long>	idx;		// Source index within a slice
+	vector<double>	wt;			// Interpolation weight
+public:
+	Bpolar_plan(Vector3<long> size, Vector3<double> origin, long nangles,
+			long ann_min, long ann_max, long dann=1, long z_min=0,
+			long z_max=0, long z_inc=1) :
+			isize(size), ori(origin), na(nangles), amin(ann_min), amax(ann_max),
+			da(dann), zmin(z_min), zmax(z_max), zinc(z_inc) {
+		if ( na < 1 ) na = 1;
+		if ( da < 1 ) da = 1;
+		if ( amin >= isize[0]/2 ) amin = isize[0]/2;
+		if ( amax < 1 || amax >= isize[0]/2 ) amax = isize[0]/2;
+		if ( amax >= isize[1]/2 ) amax = isize[1]/2;
+		if ( amin > amax ) swap(amin, amax);
+		if ( amin == amax ) amax = amin + da;
+		if ( zinc < 1 ) zinc = 1;
+		if ( zmin > zmax ) swap(zmin, zmax);
+		if ( zmin == zmax ) zmax = zmin + zinc;
+		if ( zmax >= isize[2] ) zmax = isize[2] - 1;
+		nr = (amax - amin)/da + 1;
+		nz = (zmax - zmin)/zinc + 1;
+
+		long			ann, ang, r, ix, iy, xk, yk, nxk, nyk, j;
+		double			a, cosa, sina, xx, yy, fx, fy, w, ws;
+		double			dang(M_PI*2.0/na);
+		long			ij[4];
+		double			wk[4];
+
+		beg.reserve(nr*na + 1);
+		idx.reserve(4*nr*na*da);
+		wt.reserve(4*nr*na*da);
+
+		for ( ann=amin; ann<=amax; ann+=da ) {
+			for ( ang=0; ang<na; ang++ ) {
+				beg.push_back(idx.size());
+				a = dang*ang;
+				cosa = cos(a);
+				sina = sin(a);
+				for ( r=ann; r<ann+da; r++ ) {
+					xx = r*cosa + ori[0];
+					yy = r*sina + ori[1];
+					if ( xx < 0 || xx >= isize[0] ) continue;
+					if ( yy < 0 || yy >= isize[1] ) continue;
+					ix = (long) xx;
+					iy = (long) yy;
+					nxk = (isize[0] < ix + 2)? 1: 2;
+					nyk = (isize[1] < iy + 2)? 1: 2;
+					fx = xx - ix;
+					fy = yy - iy;
+					for ( yk=0, j=0, ws=0; yk<nyk; yk++ ) {
+						fy = 1.0L - fy;
+						for ( xk=0; xk<nxk; xk++, j++ ) {
+							fx = 1.0L - fx;
+							w = fx*fy;
+							ws += w;
+							ij[j] = (iy + yk)*isize[0] + ix + xk;
+							wk[j] = w;
+						}
+					}
+					if ( ws ) for ( long k=0; k<j; k++ ) if ( wk[k] ) {
+						idx.push_back(ij[k]);
+						wt.push_back(wk[k]/ws);
+					}
+				}
+			}
+		}
+		beg.push_back(idx.size());
+	}
+	Vector3<long>	image_size() { return isize; }
+	Vector3<double>	origin() { return ori; }
+	Vector3<long>	polar_size() { return Vector3<long>(na, nr, nz); }
+	long			angles() { return na; }
+	long			annulus_min() { return amin; }
+	long			annulus_max() { return amax; }
+	long			annulus_width() { return da; }
+	long			z_min() { return zmin; }
+	long			z_max() { return zmax; }
+	long			z_increment() { return zinc; }
+	long			terms() { return idx.size(); }
+	/**
+	@brief 	Transforms one image to polar form.
+	@param 	*src		input image data (size given by the plan).
+	@param 	*dst		polar image data (size given by polar_size()).
+	**/
+	void			apply(float* src, float* dst) {
+		long			i, j, k, zz, iz, zend;
+		long			slice(isize[0]*isize[1]), npol(na*nr);
+		float*			s;
+		double			v;
+		for ( k=0, zz=zmin; k<nz; ++k, zz+=zinc ) {
+			zend = (zz + zinc < isize[2])? zz + zinc: isize[2];
+			for ( i=0; i<npol; ++i ) {
+				for ( iz=zz, v=0; iz<zend; ++iz ) {
+					s = src + iz*slice;
+					for ( j=beg[i]; j<beg[i+1]; ++j ) v += wt[j]*s[idx[j]];
+				}
+				dst[k*npol + i] = v;
+			}
+		}
+	}
+} ;
+
+#define _Bpolar_plan_
+#endif
@@ -3,12 +3,18 @@
 @brief	Header file for clustering functions 
 @author Bernard Heymann 
 @date	Created: 20070417
-@date	Modified: 20210508
+@date	Modified: 20261018
 **/
 
 #include "Matrix.h"
 
 // Function prototypes 
+vector<long>	k_means(long n, long d, float* data, long k, unsigned long seed,
+				long batch, vector<double>& centres);
 vector<long>	k_means(long n, float* data, long k);
 vector<long>	affin_prop_clustering(Matrix s, long maxit, long convit, double lambda, long& ncluster);
+vector<long>	affin_prop_clustering(long n, vector<long>& row, vector<long>& col,
+				vector<double>& sim, long maxit, long convit, double lambda, long& ncluster);
+long			similarity_neighbors(Matrix& s, long nneighbors, vector<long>& row,
+				vector<long>& col, vector<double>& sim);
 
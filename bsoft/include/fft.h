@@ -3,7 +3,7 @@
 @brief	General FFT for n-dimensional data
 @author Bernard Heymann
 @date	Created: 19980805
-@date	Modified: 20151002
+@date	Modified: 20261018
 		Implementing the FFTW library
 **/
 
@@ -24,5 +24,6 @@ typedef fftwf_plan fft_plan;
 /* Function prototypes */
 fft_plan	fft_setup_plan(long x, long y, long z, fft_direction dir, int opt);
 fft_plan	fft_setup_plan(Vector3<long> size, fft_direction dir, int opt);
+fft_plan	fft_setup_plan_many(Vector3<long> size, long nbatch, fft_direction dir, int opt, long dist);
 int			fft_destroy_plan(fft_plan plan);
 int			fftw(fft_plan plan, Complex<float>* a);
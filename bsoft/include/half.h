@@ -0,0 +1,101 @@
+/**
+@file	half.h
+@brief	Half precision (16-bit) floating point type
+@author	Bernard Heymann
+@date	Created: 20261018
+@date	Modified: 20261018
+**/
+
+#include <string.h>
+
+#ifndef _half_
+
+/**
+@brief 	Converts an IEEE 754 half precision bit pattern to single precision.
+@param 	h			half precision bits.
+@return float		value.
+
+	Subnormal values are normalized, infinities and NaN are preserved.
+
+**/
+inline float	half_to_float(unsigned short h)
+{
+	unsigned int	s((h & 0x8000) << 16), e((h >> 10) & 0x1f), m(h & 0x3ff), u;
+
+	if ( e == 0x1f ) u = s | 0x7f800000 | (m << 13);		// Infinity or NaN
+	else if ( e ) u = s | ((e + 112) << 23) | (m << 13);	// Normal
+	else if ( m ) {											// Subnormal
+		for ( e=113; !(m & 0x400); --e ) m <<= 1;
+		u = s | (e << 23) | ((m & 0x3ff) << 13);
+	} else u = s;											// Zero
+
+	float			f;
+	memcpy(&f, &u, sizeof(float));
+
+	return f;
+}
+
+/**
+@brief 	Converts a single precision value to an IEEE 754 half precision bit pattern.
+@param 	f			value.
+@return unsigned short	half precision bits.
+
+	The value is rounded to the nearest representable value, with ties to even.
+	Values beyond the half precision range become infinite, small values
+	become subnormal or zero, and NaN stays NaN.
+
+**/
+inline unsigned short	float_to_half(float f)
+{
+	unsigned int	u, s, a, r, rem, sh, m;
+
+	memcpy(&u, &f, sizeof(float));
+	s = (u >> 16) & 0x8000;
+	a = u & 0x7fffffff;
+
+	if ( a >= 0x7f800000 )				// Infinity or NaN (quiet)
+		return s | 0x7c00 | ( ( a > 0x7f800000 )? 0x200 | ((a >> 13) & 0x3ff): 0 );
+	if ( a >= 0x477ff000 ) return s | 0x7c00;	// Rounds beyond 65504
+	if ( a < 0x33000000 ) return s;				// Rounds to zero
+
+	if ( a < 0x38800000 ) {				// Subnormal
+		sh = 126 - (a >> 23);
+		m = (a & 0x7fffff) | 0x800000;
+		r = m >> sh;
+		rem = m & ((1U << sh) - 1);
+		if ( rem > (1U << (sh - 1)) || ( rem == (1U << (sh - 1)) && ( r & 1 ) ) ) r++;
+		return s | r;
+	}
+
+	r = (a - 0x38000000) >> 13;			// Normal: rebias the exponent
+	rem = a & 0x1fff;
+	if ( rem > 0x1000 || ( rem == 0x1000 && ( r & 1 ) ) ) r++;
+
+	return s | r;
+}
+
+/************************************************************************
+@Object: class half
+@Description:
+	Half precision (16-bit) floating point value.
+@Features:
+	The IEEE 754 binary16 format is stored: 1 sign bit, 5 exponent bits
+	and 10 mantissa bits, with a range of +-65504 and about 3 decimal digits.
+	The value converts implicitly to and from single precision, so that
+	templates written for the simple data types also work for this type.
+*************************************************************************/
+class half {
+private:
+	unsigned short	b;		// Bit pattern
+public:
+	half() : b(0) {}
+	half(float f) : b(float_to_half(f)) {}
+	half(double d) : b(float_to_half((float) d)) {}
+	half(int i) : b(float_to_half((float) i)) {}
+	operator float() const { return half_to_float(b); }
+	unsigned short	bits() const { return b; }
+	void			bits(unsigned short h) { b = h; }
+} ;
+
+#define _half_
+#endif
@@ -3,7 +3,7 @@
 @brief	Header file for functions to align micrographs or coordinates from micrographs and apply the resultant transformation.
 @author Bernard Heymann and Samuel Payne
 @date	Created: 20000505
-@date	Modified: 20211004
+@date	Modified: 20261018
 **/
 
 #include "mg_processing.h"
@@ -25,10 +25,16 @@ double		project_write_aligned_images(Bproject* project, Bimage* pgr,
 				Bstring& imgfile, DataType datatype);
 double		project_write_frame_sums(Bproject* project, Bimage* pgr,
 				DataType datatype, Bstring& subset, double sampling_ratio, int flag);
+Vector3<double>	frame_local_shift(Bframe* frame, Vector3<long> size, double xx, double yy);
+double		mg_align_frame_patches(Bmicrograph* mg, Bimage* p, long ref_num,
+				Vector3<long> patches, double hi_res, double lo_res,
+				double shift_limit, double lambda);
+long		img_frames_correct_local(Bimage* p, Bframe* framelist);
 double		project_align_frames(Bproject* project, int ref_img, long window, long step,
 				Bimage* pgr, Bimage* pmask, Vector3<double> origin, double hi_res, double lo_res,
 				double shift_limit, double edge_width, double gauss_width,
-				long bin, Bstring& subset, int flag);
+				long bin, Vector3<long> patches, double lambda,
+				long nconcurrent, double mem_budget, Bstring& subset, int flag);
 double		project_align_series(Bproject* project, int ref_img, Bimage* pgr, 
 				Bimage* pmask, Vector3<double> origin, double hi_res, double lo_res,
 				double shift_limit, double edge_width, double gauss_width,
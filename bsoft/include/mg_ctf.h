@@ -3,7 +3,7 @@
 @brief	Functions for CTF (contrast transfer function) processing
 @author 	Bernard Heymann
 @date	Created: 19970715
-@date	Modified: 20230127
+@date	Modified: 20261018
 **/
 
 #include "mg_processing.h"
@@ -43,7 +43,11 @@ int			img_ctf_apply_to_proj(Bimage* proj, CTFparam em_ctf, double defocus,
 int 		project_ctf_prepare(Bproject* project, int action, double lores,
 				double hires, Vector3<long> tile_size, 
 				double def_start, double def_end, double def_inc,
-				Bstring& path, Bstring& newname, int flags);
+				Bstring& path, Bstring& newname, int flags, long bin=1);
+long		project_ctf_fit_cached(Bproject* project, double lores, double hires,
+				Vector3<long> tile_size, long bin,
+				double def_start, double def_end, double def_inc,
+				Bstring& cache, int flags);
 int 		project_ctf(Bproject* project, int action, double lores,
 				double hires, Vector3<long> tile_size, double wiener, 
 				DataType datatype, Bstring& partpath, Bstring& newname, int flags);
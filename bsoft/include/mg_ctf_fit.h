@@ -3,7 +3,7 @@
 @brief	Header file for CTF (contrast transfer function) functions
 @author 	Bernard Heymann
 @date	Created: 20000426
-@date	Modified: 20221213
+@date	Modified: 20261018
 **/
 
 #include "rwimg.h"
@@ -25,6 +25,8 @@ double		img_ctf_find_defocus(Bimage* p, long n, CTFparam& em_ctf,
 				double lores, double hires, 
 				double def_start=1e3, double def_end=2e5, double def_inc=1e3);
 double		img_ctf_fit_astigmatism(Bimage* p, long n, CTFparam& em_ctf, double lores, double hires);
+double		img_ctf_fit_astigmatism_2D(Bimage* p, long n, CTFparam& em_ctf, double lores, double hires,
+				double def_start=1e3, double def_end=2e5, double def_inc=1e3);
 vector<map<pair<long,long>,double>>	img_aberration_phase_fit(Bimage* p, double lores, double hires,
 			int flag=0, long iter=0);
 vector<map<pair<long,long>,double>>	img_aberration_phase_fit(Bimage* p, double lores, double hires,
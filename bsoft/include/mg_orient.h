@@ -3,7 +3,7 @@
 @brief	Library routines for single particle analysis
 @author	Bernard Heymann and David M. Belnap
 @date	Created: 20010403
-@date	Modified: 20190826 (BH)
+@date	Modified: 20261018 (BH)
 **/
 
 #include "mg_processing.h"
@@ -22,9 +22,10 @@ int 		project_determine_orientations(Bproject* project, Bimage* proj, Bstring& m
 				double res_lo, double res_hi, double res_polar, int ann_min, int ann_max,
 				double shift_limit, double angle_limit, double edge_radius, int flags);
 int 		project_determine_orientations2(Bproject* project, Bimage* proj, Bstring& mask_file,
-int bin, Bsymmetry& sym, int part_select, vector<double>& band,
-double res_lo, double res_hi, double res_polar, int ann_min, int ann_max,
-double shift_limit, double angle_limit, double edge_radius, int flags);
+				int bin, Bsymmetry& sym, int part_select, vector<double>& band,
+				double res_lo, double res_hi, double res_polar, int ann_min, int ann_max,
+				double shift_limit, double angle_limit, double edge_radius, int flags,
+				int levels=1, long topk=5, vector<double> level_res=vector<double>());
 int 		project_determine_origins(Bproject* project, Bimage* proj, int bin,
 				Bsymmetry& sym, int part_select, double res_lo, double res_hi,
 				double shift_limit, int flags);
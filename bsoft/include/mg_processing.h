@@ -3,7 +3,7 @@
 @brief	Header file for micrograph processing
 @author Bernard Heymann
 @date	Created: 20000426
-@date	Modified: 20220813
+@date	Modified: 20261018
 **/
 
 #include "ctf.h"
@@ -73,6 +73,9 @@ class Breconstruction;
 	Movie frame parameter structure.
 @Features:
 	Shift for each frame.
+	Optional local deformation coefficients: the spatial polynomial terms
+	(1, x, y[, x2, xy, y2]) for the x shift followed by those for the y shift,
+	with x and y relative to the frame center and scaled to [-1,1].
 *************************************************************************/
 class Bframe {
 private:
@@ -88,6 +91,7 @@ public:
 	Vector3<double>	shift;			// Shift relative to reference frame
 	double			fom;			// Figure-of-merit
 	long			sel;			// Selection flag
+	vector<double>	local;			// Local deformation coefficients
 	Bframe() { initialize(); }
 } ;
 
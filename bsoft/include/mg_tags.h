@@ -3,7 +3,7 @@
 @brief	All STAR and XML file format tags for micrographs and reconstructions
 @author Bernard Heymann
 @date	Created: 20000419
-@date	Modified: 20220106
+@date	Modified: 20261018
 **/
 
 // Do not change the constant names because they are referenced in code
@@ -70,6 +70,7 @@
 #define	MICROGRAPH_FRAME_SHIFT_Y	"micrograph_frame.shift_y"
 #define	MICROGRAPH_FRAME_SELECT		"micrograph_frame.select"
 #define	MICROGRAPH_FRAME_FOM		"micrograph_frame.fom"
+#define	MICROGRAPH_FRAME_LOCAL		"micrograph_frame.local_shift"
 #define	MICROGRAPH_PARTICLE_FILE	"micrograph_particle.file_name"	// deprecated
 #define	MICROGRAPH_FILAMENT_FILE	"micrograph_filament.file_name"	// deprecated
 #define	MICROGRAPH_TRANSFORM_FILE	"micrograph_fourier_transform.file_name"
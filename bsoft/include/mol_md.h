@@ -3,7 +3,7 @@
 @brief	Header for molecular dynamics
 @author Bernard Heymann
 @date	Created: 20010828
-@date	Modified: 20060412
+@date	Modified: 20261018
 **/
 
 #include "rwmd.h"
@@ -11,6 +11,36 @@
 #include "mol_util.h"
 #include "utilities.h"
 
+#ifndef _Bmdsetup_
+#define _Bmdsetup_
+/************************************************************************
+@Object: struct Bmdsetup
+@Description:
+	Flat indexed arrays for molecular dynamics force calculations.
+@Features:
+	The atoms, bonds and angles are resolved into index arrays once.
+	The Van der Waals distances are tabulated per atom type pair.
+	The Verlet neighbour list holds all pairs within the cutoff plus a
+	skin distance and is only rebuilt when an atom moved more than half
+	the skin distance.
+*************************************************************************/
+struct Bmdsetup {
+	vector<Batom*>			atom;		// Atom pointers
+	vector<long>			type;		// Atom type index for each atom
+	long					ntype;		// Number of atom types
+	vector<float>			vdw;		// Van der Waals distance for each type pair
+	vector<long>			bond;		// Atom index pairs for bonds
+	vector<double>			bondlen;	// Reference bond lengths
+	vector<long>			angle;		// Atom index triplets for angles
+	vector<double>			anglecos;	// Cosines of the reference angles
+	double					skin;		// Skin distance for the neighbour list
+	vector<long>			nstart;		// Neighbour list offset for each atom
+	vector<long>			nlist;		// Neighbour list atom indices
+	vector<Vector3<double>>	ref;		// Coordinates at the last neighbour list build
+	long					nbuild;		// Number of neighbour list builds
+} ;
+#endif
+
 // Function prototypes
 double		md_leapfrog(Bmolgroup* molgroup, Bmd* md, int max_iter, double velocitylimit);
 int			md_zero_forces(Bmolgroup* molgroup);
@@ -18,6 +48,12 @@ double		md_bond_forces(Bmolgroup* molgroup, double Kbond, int wrap);
 double		md_angular_forces(Bmolgroup* molgroup, double Kangle, int wrap);
 double		md_nonbonded_forces(Bmolgroup* molgroup, Bmd* md);
 int			atom_nonbonded_forces(Batom* atom1, Batom* atom2, Bmd* md, Vector3<double> box);
+Bmdsetup	md_setup(Bmolgroup* molgroup, Bmd* md);
+long		md_neighbor_list(Bmdsetup& mds, Bmolgroup* molgroup, Bmd* md);
+int			md_neighbor_list_check(Bmdsetup& mds, Bmolgroup* molgroup, Bmd* md);
+double		md_bond_forces(Bmdsetup& mds, Bmolgroup* molgroup, double Kbond, int wrap);
+double		md_angular_forces(Bmdsetup& mds, Bmolgroup* molgroup, double Kangle, int wrap);
+double		md_nonbonded_forces(Bmdsetup& mds, Bmolgroup* molgroup, Bmd* md);
 double		md_point_force(Bmolgroup* molgroup, Vector3<double> point, double Kpoint, double decay);
 
 
@@ -3,7 +3,7 @@
 @brief	Header file for reading and writing MRC files
 @author Bernard Heymann
 @date	Created: 19990321
-@date	Modified: 20111217
+@date	Modified: 20261018
 
 	Format: 3D crystallographic image file format for the MRC package
 **/
@@ -84,7 +84,7 @@ struct MRChead {                		// file header for MRC data
         int nx;                 		//  0   0	image size
         int ny;                 		//  1   4
         int nz;                 		//  2   8	mz*#vol
-        int mode;               		//  3		0=schar,1=short,2=float,3=complex_ushort,4=complex_float,6=ushort
+        int mode;               		//  3		0=schar,1=short,2=float,3=complex_ushort,4=complex_float,6=ushort,12=half,101=4-bit
         int nxStart;            		//  4		unit cell offset
         int nyStart;            		//  5
         int nzStart;            		//  6
@@ -124,4 +124,4 @@ struct MRChead {                		// file header for MRC data
 
 // I/O prototypes
 int 		readMRC(Bimage* p, int readdata, int img_select);
-int 		writeMRC(Bimage* p);
+int 		writeMRC(Bimage* p, int flags);
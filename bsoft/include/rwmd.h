@@ -3,7 +3,7 @@
 @brief	Header to read and write molecular dynamics parameters in STAR format
 @author Bernard Heymann
 @date	Created: 20030919
-@date	Modified: 20060424
+@date	Modified: 20261018
 **/
 
 #include "rwatomprop.h"
@@ -67,6 +67,7 @@ struct Bmd {
 	double		VdWcoeff2;		// Second Van der Waals coefficient (default 1/6)
 	double		sepdist;		// Separation distance grid sampling
 	double		cutoff;			// Distance cutoff for non-bonded calculations
+	double		skin;			// Skin distance for the Verlet neighbour list
 	double		pointdecay;		// Decay constant for the point force
 	int			bondsteps;		// Number of sampling intervals along a bond
 	int			wrap;			// Flag to turn periodic boundaries on
@@ -3,7 +3,7 @@
 @brief	Nelder and Mead downhill simplex method for generalized parameter fitting
 @author Bernard Heymann
 @date	Created: 20000426
-@date	Modified: 20220119
+@date	Modified: 20261018
 
 	Adapted from Numerical Recipes, 2nd edition, Press et al. 1992
 	The function "funk" is user-defined and references the "Bsimplex" structure.
@@ -50,6 +50,7 @@ private:
 	vector<double>	c;			// Constant values
 	vector<double>	x;			// Independent variables: npoint*nvar array
 	vector<double>	fx;			// Function values
+	long			rseed;		// Seed for a local random state, 0 uses the global generator
 	double		calculate_dependent_variance() {
 		double		yavg(0);
 		yvar = 0;
@@ -62,7 +63,7 @@ private:
 		return yvar;
 	}
 public:
-	Bsimplex() { }
+	Bsimplex() : rseed(0) { }
 	Bsimplex(long nv, long np, long nc, long n, vector<double>& ax, vector<double>& ay);
 	long		variables() { return nvar; }
 	long		constants() { return nconstant; }
@@ -90,6 +91,8 @@ public:
 	void		limits_high(long n, vector<double>& p) {
 		for ( int i=0; i<nparam && i<n; i++ ) hi[i] = p[i];
 	}
+	void		seed(long s) { rseed = s; }
+	long		seed() { return rseed; }
 	vector<double>& independent_values() { return x; }
 	vector<double>& dependent_values() { return fx; }
 	double		dependent_variance() {
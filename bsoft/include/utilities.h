@@ -3,7 +3,7 @@
 @brief	Header file for general utilities 
 @author Bernard Heymann
 @date	Created: 19990722
-@date	Modified: 20220713
+@date	Modified: 20261018
 **/
 
 #define BVERSION "2.1.4-20230131"
@@ -167,6 +167,7 @@ enum DataType {
 	Long = 9,			// Signed integer (4 or 8 byte, depending on system)
 	Float = 10,			// Floating point (4-byte)
 	Double = 11,		// Double precision floating point (8-byte)
+	Half = 12,			// Half precision floating point (2-byte)
 } ;
 
 /**
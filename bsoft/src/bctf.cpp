@@ -3,7 +3,7 @@
 @brief	A program to determine and correct for the CTF (contrast transfer function) in electron micrographs.
 @author Bernard Heymann
 @date	Created: 19970715
-@date	Modified: 20230127
+@date	Modified: 20261018
 **/
 
 #include "rwimg.h"
@@ -38,7 +38,8 @@ const char* use[] = {
 "-invertaxis              Inverts the tilt axis to correct for improper setup.",
 "-filter                  Filter extremes before doing anything with the image.",
 "-background              Correct background after applying CTF (default not).",
-"-fitastigmatism 2        Fit astigmatism for individual micrographs (1) or combined (2) (default not).",
+"-fitastigmatism 2        Fit astigmatism for individual micrographs (1), combined (2),",
+"                         or directly on the 2D power spectrum (4) (default not).",
 "-isotropy                Assess the power spectrum isotropy.",
 "-toparticle              Transfer micrograph CTF parameters to particle records (default not).",
 //"-noaberration odd        Delete aberration weights (all, odd or even).",
@@ -58,6 +59,9 @@ const char* use[] = {
 "-pspath dir/subdir       Set the power spectrum file paths.",
 "-partpath dir/subdir     Set the particle file paths.",
 "-tile 1024,1024,1        Size of power spectrum generated during preparation (default 512,512,1).",
+"-bin 2                   Binning of micrographs before calculating power spectra (default 1).",
+"-cache dir/subdir        Calculate and fit power spectra for all micrographs in parallel,",
+"                         caching the power spectra in this directory (with prepfit).",
 "-micrograph              Use micrograph file given in parameter file instead of particle file.",
 "-frames                  Use micrograph frames file given in parameter file instead of particle file.",
 "-sampling 1.5,1.5,1.5    Sampling (angstrom/pixel, a single value sets all three).",
@@ -156,6 +160,8 @@ int 		main(int argc, char **argv)
 	Bstring			partpath;				// Particle file path
 	Vector3<double>	sam;    				// Pixel size
 	Vector3<long>	tile_size(512,512,1);	// Size of power spectrum
+	long			bin(1);					// Micrograph binning for power spectra
+	Bstring			cache;					// Power spectrum cache directory
 	double			resolution_lo(0);		// Low resolution limit
 	double			resolution_hi(0);		// High resolution limit
 	int 			action(0); 				// Default no CTF operation
@@ -178,8 +184,8 @@ int 		main(int argc, char **argv)
 	int				setDefocus(0);			// Flags
 	int				setbase(0);
 	int				setenv(0);
-	int				flags(0);				// Flags for using mg (1), filter extremes (2), background (4), astigmatism (8), use frames (16), invert contrast (32)
-	int				fitastig(0);			// Flag to fit astigmatism individually (1) or global (2)
+	int				flags(0);				// Flags for using mg (1), filter extremes (2), background (4), astigmatism (8), use frames (16), invert contrast (32), 2D astigmatism (64)
+	int				fitastig(0);			// Flag to fit astigmatism individually (1), global (2) or in 2D (4)
 	int				simulate(0);			// Flag to simulate a tilted micrograph
 	Vector3<long>	size(1,1,1);			// Size of CTF output file
 	Bstring			outfile;				// Output parameter file name
@@ -213,6 +219,16 @@ int 		main(int argc, char **argv)
 			size = curropt->size();
 		if ( curropt->tag == "center" ) ctf_flag |= 1;
 		if ( curropt->tag == "power" ) ctf_flag |= 2;
+		if ( curropt->tag == "bin" )
+			if ( ( bin = curropt->value.integer() ) < 1 )
+				cerr << "-bin: A bin size must be specified!" << endl;
+		if ( curropt->tag == "cache" ) {
+			cache = curropt->value;
+			if ( cache.length() < 1 )
+				cerr << "-cache: The power spectrum cache path must be specified!" << endl;
+			else
+				if ( cache[-1] != '/' ) cache += "/";
+		}
 		if ( curropt->tag == "tile" ) {
 			tile_size = curropt->size();
 			if ( tile_size.volume() < 1 )
@@ -232,6 +248,7 @@ int 		main(int argc, char **argv)
 			fitastig = curropt->value.integer();
 			if ( fitastig == 1 ) flags |= 8;
 			else if ( fitastig == 3 ) flags |= 32;
+			else if ( fitastig == 4 ) flags |= 64;
 		}
 		if ( curropt->tag == "isotropy" )
 			isotropy = 1;
@@ -576,9 +593,12 @@ int 		main(int argc, char **argv)
 	if ( action > 0 && action < 11 )
 		project_ctf(project, action, resolution_lo, resolution_hi, tile_size, wiener, 
 				nudatatype, partpath, newfilename, flags);
+	else if ( action == 13 && cache.length() && project->select < 1 )
+		project_ctf_fit_cached(project, resolution_lo, resolution_hi, tile_size, bin,
+				def_start, def_end, def_inc, cache, flags);
 	else if ( action > 10 )
 		project_ctf_prepare(project, action, resolution_lo, resolution_hi, tile_size,
-				def_start, def_end, def_inc, pspath, newfilename, flags);
+				def_start, def_end, def_inc, pspath, newfilename, flags, bin);
 
 	if ( isotropy )
 		project_powerspectrum_isotropy(project, resolution_lo, resolution_hi);
@@ -3,7 +3,7 @@
 @brief	General image processing program
 @author Bernard Heymann
 @date	Created: 19990321
-@date	Modified: 20210624
+@date	Modified: 20261018
 **/
 
 #include "rwimg.h"
@@ -59,7 +59,8 @@ const char* use[] = {
 " ",
 "Output:",
 "-std stdev.mrc           Standard deviation map.",
-"-compression 2           Compression type: 5=LZW (TIFF only).",
+"-compression 2           Compression type: 4=4-bit (MRC only), 5=LZW, 8=deflate (TIFF only),",
+"                         add 16 for a predictor (TIFF only, e.g. 24=deflate with predictor).",
 " ",
 NULL
 };
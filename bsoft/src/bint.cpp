@@ -3,7 +3,7 @@
 @brief	Interpolation of 2D and 3D images.
 @author Bernard Heymann
 @date	Created: 19990904
-@date	Modified: 20190424
+@date	Modified: 20261018
 **/
 
 #include "rwimg.h"
@@ -56,7 +56,8 @@ const char* use[] = {
 "-unitcell 10,23,77,90,90,90 Unit cell parameters.",
 " ",
 "Output:",
-"-compression 2           Compression type: 5=LZW (TIFF only).",
+"-compression 2           Compression type: 4=4-bit (MRC only), 5=LZW, 8=deflate (TIFF only),",
+"                         add 16 for a predictor (TIFF only, e.g. 24=deflate with predictor).",
 " ",
 NULL
 };
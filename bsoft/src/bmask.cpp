@@ -3,7 +3,7 @@
 @brief	Generating and manipulating masks.
 @author Bernard Heymann
 @date	Created: 20030831
-@date	Modified: 20190821
+@date	Modified: 20261018
 **/
 
 #include "rwimg.h"
@@ -37,6 +37,9 @@ const char* use[] = {
 "-erode 3                 Erode mask a number of times.",
 "-open 4                  Open (erode-dilate) mask a number of times.",
 "-close 2                 Close (dilate-erode) mask a number of times.",
+"-dilateradius 12.5       Dilate mask by a Euclidean distance (voxels).",
+"-eroderadius 6.5         Erode mask by a Euclidean distance (voxels).",
+"-softedge 3,8            Extend mask by a distance and add a cosine edge of a given width (voxels).",
 "-hole 3,56,23            Fill a hole indicated by the voxel.",
 "-plane 0.3,0.5,-0.1,0,3,25 Mask on one side of a plane with the given normal and origin.",
 "-rectangle 40,20,45      Rectangular mask with given length, width and rotation angle.",
@@ -114,6 +117,9 @@ int 		main(int argc, char **argv)
 	int				erode(0);					// Number of times to erode
 	int				open(0);					// Number of times to open
 	int				close(0);					// Number of times to close
+	double			dilate_rad(0);				// Euclidean dilation radius
+	double			erode_rad(0);				// Euclidean erosion radius
+	double			soft_rad(0), soft_width(0);	// Soft edge extension and width
 	Vector3<long>	fill_voxel;					// Voxel to fill from
 	Bstring			color;						// Generate RGBA image: random or size-based colors
 	int				convert_size(0);			// Flag to cenvert level mask to region size
@@ -194,6 +200,15 @@ int 		main(int argc, char **argv)
 		if ( curropt->tag == "close" )
        	    if ( ( close = curropt->value.integer() ) < 1 )
 				cerr << "-close: A number of times to close must be specified!" << endl;
+		if ( curropt->tag == "dilateradius" )
+       	    if ( ( dilate_rad = curropt->value.real() ) <= 0 )
+				cerr << "-dilateradius: A radius must be specified!" << endl;
+		if ( curropt->tag == "eroderadius" )
+       	    if ( ( erode_rad = curropt->value.real() ) <= 0 )
+				cerr << "-eroderadius: A radius must be specified!" << endl;
+		if ( curropt->tag == "softedge" )
+			if ( curropt->values(soft_rad, soft_width) < 2 )
+				cerr << "-softedge: A radius and an edge width must be specified!" << endl;
 		if ( curropt->tag == "hole" )
 			if ( curropt->values(fill_voxel[0], fill_voxel[1], fill_voxel[2]) < 3 )
 				cerr << "-hole: A voxel must be specified!" << endl;
@@ -308,15 +323,26 @@ int 		main(int argc, char **argv)
 	if ( close > 0 )
 		pmask->mask_close(close);
 	
+	if ( dilate_rad > 0 )
+		pmask->mask_dilate_radius(dilate_rad);
+	
+	if ( erode_rad > 0 )
+		pmask->mask_erode_radius(erode_rad);
+	
 	if ( fill_voxel.length() )
 		pmask->mask_fill(fill_voxel);
 	
 	if ( invert ) pmask->mask_invert();
 	
+	if ( soft_width > 0 )
+		pmask->mask_soft_edge(soft_rad, soft_width);
+	
 	if ( p ) {
 		if ( nustd > 0 ) {
 			p->rescale_to_avg_std(nuavg, nustd, pmask);
 			p->multiply(pmask);
+		} else if ( apply_flag && soft_width > 0 ) {
+			p->multiply(pmask);		// Soft edge mask
 		} else if ( apply_flag ) {
 			p->mask(pmask, fill);	// For output of image
 		} else {
@@ -3,7 +3,7 @@
 @brief	Program to process matrices.
 @author Bernard Heymann
 @date	Created: 20010723
-@date	Modified: 20200916
+@date	Modified: 20261018
 **/
 
 #include "cluster.h"
@@ -38,6 +38,7 @@ const char* use[] = {
 "-verbose 7               Verbosity of output.",
 "-ln_1_R                  Use the -ln(1-R) conversion of the input matrix.",
 "-lambda 0.6              Damping factor for clustering (default 0.5).",
+"-neighbors 20            Cluster using only the most similar neighbors of each point.",
 " ",
 "Parameters for image output:",
 "-datatype b              Force writing of a new data type.",
@@ -64,6 +65,7 @@ int 		main(int argc, char** argv)
 	int 			window(0);				// Window for linear sorting
 	double			pref(-1e37);			// Preference value for clustering
 	double			lambda(0.5);			// Damping factor for clustering
+	long			nneighbors(0);			// Number of neighbors for sparse clustering
 	int 			log_1_R(0);
 	Bstring			vector_file;			// Vector input file name
 	Bstring			vecout_file;			// Vector output file name
@@ -102,6 +104,9 @@ int 		main(int argc, char** argv)
 		if ( curropt->tag == "lambda" )
 			if ( ( lambda = curropt->value.real() ) < 0.001 )
 				cerr << "-lambda: A damping factor must be specified!" << endl;
+		if ( curropt->tag == "neighbors" )
+			if ( ( nneighbors = curropt->value.integer() ) < 1 )
+				cerr << "-neighbors: A number of neighbors must be specified!" << endl;
 		if ( curropt->tag == "datatype" )
 			nudatatype = curropt->datatype();
 		if ( curropt->tag == "scale" )
@@ -171,7 +176,14 @@ int 		main(int argc, char** argv)
 	if ( pref > -1e36 ) {
 		for ( i=0; i<matrix.rows(); i++ )
 			matrix[i][i] = pref;
-		affin_prop_clustering(matrix, 500, 50, lambda, ncluster);
+		if ( nneighbors > 0 ) {
+			std::vector<long>	row, col;
+			std::vector<double>	sim;
+			similarity_neighbors(matrix, nneighbors, row, col, sim);
+			affin_prop_clustering(matrix.rows(), row, col, sim, 500, 50, lambda, ncluster);
+		} else {
+			affin_prop_clustering(matrix, 500, 50, lambda, ncluster);
+		}
 	}
 	
 	if ( vector.rows() )
@@ -3,7 +3,7 @@
 @brief	Molecular dynamics - humble beginnings
 @author Bernard Heymann
 @date	Created: 20001014
-@date 	Modified: 20060412
+@date 	Modified: 20261018
 **/
 
 #include "rwmd.h"
@@ -48,6 +48,7 @@ const char* use[] = {
 "-Kvdw 0.1                Van der Waals strength (default 0).",
 "-Kelectrostatic 0.4      Electrostatic strength (default 0).",
 "-cutoff 7.8              Distance cutoff for non-bonded forces (default 5 A).",
+"-skin 1.5                Skin distance for the non-bonded neighbour list (default 1 A).",
 " ",
 "Input:",
 "-parameters md.star      Molecular dynamics parameter file (default md_param.star).",
@@ -75,6 +76,7 @@ int 	main(int argc, char **argv)
 	double			Kelec(0);				// Electrostatic strength
 	double			Kvdw(0);				// Van der Waals strength
 	double			cutoff(5);				// Distance cutoff for non-bonded forces
+	double			skin(1);				// Skin distance for the neighbour list
     Bstring    		atom_select("all");
 	Bstring			paramfile("md_param.star");	// Default parameter file
 	Bstring			paramout;				// Output parameter file
@@ -123,6 +125,9 @@ int 	main(int argc, char **argv)
 		if ( curropt->tag == "cutoff" )
 			if ( ( cutoff = curropt->value.real() ) < 1e-6 )
 				cerr << "-cutoff: The cutoff distance must be specified!" << endl;
+		if ( curropt->tag == "skin" )
+			if ( ( skin = curropt->value.real() ) < 0 )
+				cerr << "-skin: The skin distance must be positive!" << endl;
 		if ( curropt->tag == "parameters" )
 			paramfile = curropt->filename();
 		if ( curropt->tag == "output" )
@@ -157,6 +162,7 @@ int 	main(int argc, char **argv)
 	md->Kelec = Kelec;
 	md->Kvdw = Kvdw;
 	md->cutoff = cutoff;
+	md->skin = skin;
 	md->wrap = wrap;
 
 	md_show_bonds(molgroup);
@@ -3,7 +3,7 @@
 @brief	Determines orientation angles and x,y origins of single particle images 
 @author	Bernard Heymann and David M. Belnap
 @date	Created: 20010403
-@date	Modified: 20220906 (BH)
+@date	Modified: 20261018 (BH)
 **/
 
 #include "mg_orient.h"
@@ -59,6 +59,10 @@ const char* use[] = {
 "-shiftlimit 3.5          Limit on origin shift relative to nominal center (default 10% of box edge size).",
 "-rotationlimit 16.7      Limit on in-plane rotation change from input orientation (default not applied).",
 "-edge 125                Edge mask radius using previous particle origins (default not used).",
+"-hierarchy 3,5           Coarse-to-fine search: number of levels and candidates kept per level",
+"                         (default 1: compare all projections).",
+"-levelresolution 40,25   High resolution limits for the coarser search levels (angstrom,",
+"                         default double the high resolution limit per level).",
 "-fom 0.3                 Set FOM threshold for selection (default 0).",
 #ifdef HAVE_GCD
 "-nothreads               Do not use threads (default parallel processing).",
@@ -102,6 +106,9 @@ int			main(int argc, char** argv)
 	double			shift_limit(-1);			// Maximum shift from nominal box origin
 	double			angle_limit(0);				// Maximum in-plane rotation from input orientation
 	double			edge_radius(0);				// Edge mask radius
+	int				levels(1);					// Number of hierarchical search levels
+	long			topk(5);					// Candidates kept per search level
+	vector<double>	level_res;					// Resolution limits for coarser search levels
 	double 			FOM_cut(0); 				// Threshold to accept orientations
 	int				mode(0);					// Only polar power spectrum
 	int				transform_output(0);		// Flag to output transformed images
@@ -187,6 +194,19 @@ int			main(int argc, char** argv)
 		if ( curropt->tag == "edge" )
 			if ( ( edge_radius = curropt->value.real() ) < 0 )
 				cerr << "-edge: An edge radius must be specified!" << endl;
+		if ( curropt->tag == "hierarchy" ) {
+			if ( curropt->values(levels, topk) < 1 )
+				cerr << "-hierarchy: A number of levels must be specified!" << endl;
+			else {
+				if ( levels < 1 ) levels = 1;
+				if ( topk < 1 ) topk = 1;
+			}
+		}
+		if ( curropt->tag == "levelresolution" ) {
+			level_res = curropt->value.split_into_doubles(",");
+			if ( level_res.size() < 1 )
+				cerr << "-levelresolution: At least one resolution limit must be specified!" << endl;
+		}
 		if ( curropt->tag == "CTF" ) flags |= APPLY_CTF;
 		if ( curropt->tag == "multiple" ) flags |= MULTI_FILE;
 		if ( curropt->tag == "fom" )
@@ -285,7 +305,8 @@ int			main(int argc, char** argv)
 		} else {
 			if ( project_determine_orientations2(project, proj, mask_filename,
 					bin, sym, part_select, band, res_lo, res_hi, res_polar,
-					ann_min, ann_max, shift_limit, angle_limit, edge_radius, flags) < 0 ) {
+					ann_min, ann_max, shift_limit, angle_limit, edge_radius, flags,
+					levels, topk, level_res) < 0 ) {
 				cerr << "Error: Alignment failed!" << endl;
 				bexit(-1);
 			}
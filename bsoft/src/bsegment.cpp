@@ -3,7 +3,7 @@
 @brief	Segment images into density regions
 @author Bernard Heymann
 @date	Created: 19981222
-@date	Modified: 20160315
+@date	Modified: 20261018
 **/
 
 #include "rwimg.h"
@@ -36,6 +36,7 @@ const char* use[] = {
 "                         Output binary mask (data type byte, values 0 and 1).",
 "-multiple 1.2            Generate multiple regions above this threshold.",
 "-kmeans 12,25,0.8        K-means segmentation: K, iterations and density:distance ratio.",
+"-local                   Compare voxels only with nearby K-means regions (faster for large K).",
 "-innervolume 2.3,15      Calculate internal volume below this threshold, output mask frequency.",
 " ",
 "Selections:",
@@ -51,6 +52,7 @@ const char* use[] = {
 "                         1=positive density; -1=negative density).",
 "-rho 0.8                 Protein density (default 0.81 Da/A3, use with -mass).",
 "-fill 0.02               Fill value for extraction: average (default), background, or value.",
+"-seed 1234               Random number seed for K-means (default from process id).",
 " ",
 "Input:",
 "-Mask mask.tif           Input mask (must be integer and same size as input image).",
@@ -71,6 +73,8 @@ int 	main(int argc, char* argv[])
 	long			nregions(0);				// Number of regions for K-means
 	long			max_iter(10);				// Maximum kmeans iterations
 	double			ratio(1);					// Density-distance ratio
+	int				kmeans_local(0);			// Flag to only compare nearby K-means regions
+	unsigned long	seed(0);					// Random number seed for K-means
 	int				region_mask(0);				// Flag to generate a mask of regions
 	Vector3<double> origin;						// New image origin
 	int				set_origin(0);				// Flag to set origin
@@ -129,6 +133,11 @@ int 	main(int argc, char* argv[])
 		if ( curropt->tag == "kmeans" )
 			if ( curropt->values(nregions, max_iter, ratio) < 1 )
 				cerr << "-kmeans: A number of regions must be specified!" << endl;
+		if ( curropt->tag == "local" )
+			kmeans_local = 1;
+		if ( curropt->tag == "seed" )
+			if ( ( seed = curropt->value.integer() ) < 1 )
+				cerr << "-seed: A positive random number seed must be specified!" << endl;
 		if ( curropt->tag == "select" ) {
 			level_select = curropt->value;
 			if ( level_select.length() < 1 )
@@ -200,7 +209,7 @@ int 	main(int argc, char* argv[])
 	if ( mask_file.length() ) {
 		pmask = read_img(mask_file, 1, -1);
 	} else if ( nregions > 1 ) {
-		pmask = p->kmeans_segment(nregions, max_iter, ratio);
+		pmask = p->kmeans_segment(nregions, max_iter, ratio, kmeans_local, seed);
 	} else if ( region_mask ) {
 		pmask = p->regions(threshold, sign);
 	} else if ( mol_weight > 0 ) {
@@ -3,7 +3,7 @@
 @brief	Program to align and analyze series of images
 @author	Bernard Heymann
 @date	Created: 20040407
-@date	Modified: 20210915
+@date	Modified: 20261018
 **/
 
 #include "mg_processing.h"
@@ -47,6 +47,8 @@ const char* use[] = {
 "-shiftlimit 3.5          Limit on origin shift relative to nominal center (default 10% of box edge size).",
 "-edge 23,12              Smooth the edge to a given width, with gaussian decay of a given width.",
 "-subset 2-8,12           Subset of micrographs to align and average.",
+"-patches 5,4,0.005       Local frame alignment in a grid of patches, with regularization (default 0.001).",
+"-concurrent 4,16         Number of movies aligned concurrently and memory budget in GB (default 1, no limit).",
 " ",
 "Input:",
 "-Gainreference gr.tif    Gain reference to correct the input micrographs.",
@@ -83,6 +85,10 @@ int			main(int argc, char** argv)
 //	int 			fill_type(FILL_BACKGROUND);
 //	double			fill(0);
 	long		 	bin(1);						// Binning before alignment and analysis
+	Vector3<long>	patches(1,1,1);				// Patches for local frame alignment
+	double			lambda(0.001);				// Regularization of local frame alignment
+	long			nconcurrent(1);				// Number of movies aligned concurrently
+	double			mem_budget(0);				// Memory budget for concurrent movies (GB)
 	Bstring			subset;						// Subset of micrographs to average
 	JSvalue			dose_frac(JSobject);		// Container for dose fractionation parameters
 	Bstring			paramfile;					// Output parameter file
@@ -141,6 +147,12 @@ int			main(int argc, char** argv)
 				cerr << "-bin: An ineteger greater than zero must be specified!" << endl;
 		if ( curropt->tag == "subset" )
 			subset = curropt->value;
+		if ( curropt->tag == "patches" )
+			if ( curropt->values(patches[0], patches[1], lambda) < 2 )
+				cerr << "-patches: The number of patches in x and y must be specified." << endl;
+		if ( curropt->tag == "concurrent" )
+			if ( curropt->values(nconcurrent, mem_budget) < 1 )
+				cerr << "-concurrent: The number of concurrent movies must be specified." << endl;
 		if ( curropt->tag == "Gainreference" )
 			grfile = curropt->filename();
 		if ( curropt->tag == "Mask" )
@@ -195,7 +207,8 @@ int			main(int argc, char** argv)
 	if ( ref_img > -1 ) {
 		if ( frames )
 			project_align_frames(project, ref_img, window, step, pgr, pmask, origin, hi_res, lo_res,
-				shift_limit, edge_width, gauss_width, bin, subset, flags);
+				shift_limit, edge_width, gauss_width, bin, patches, lambda,
+				nconcurrent, mem_budget*1e9, subset, flags);
 		else
 			project_align_series(project, ref_img, pgr, pmask, origin, hi_res, lo_res,
 				shift_limit, edge_width, gauss_width, bin, subset, flags);
@@ -3,7 +3,7 @@
 @brief	Program to generate symmetry axes for point group symmetries
 @author Bernard Heymann
 @date	Created: 20001119
-@date	Modified: 20191104
+@date	Modified: 20261018
 **/
 
 #include "rwimg.h"
@@ -36,6 +36,7 @@ const char* use[] = {
 "-check C,D,I             Check symmetry in correctly oriented map.",
 "-find 1.5,2,1            Find orientation: angle step, binning, and",
 "                         flag to skip major axis (use with -symmetry).",
+"-fast                    Fast axis search by harmonic power (use with -find).",
 "-change C5,C6            Change point group symmetry.",
 "-Views                   Output all symmetry-related views, (filename: out_??.img).",
 "-asu 3                   Output a single or multi-level mask of asymmetric units (use with -symmetry).",
@@ -79,6 +80,7 @@ int 	main(int argc, char **argv)
 	double			find_angle(0);				// Angle step size for symmetry search
 	int				find_bin(1);				// Binning for searching
 	int				flags(0);					// Only search for minor axes
+	int				fast(0);					// Fast axis search
 	double			radius(0);					// Radius to derive shift for symmetry change
 	double			z_slope(0);					// Slope along z to adjust the radius
 	Vector3<double>	origin;						// Origin
@@ -122,6 +124,7 @@ int 	main(int argc, char **argv)
 			else
 				find_angle *= M_PI/180.0;
 		}
+		if ( curropt->tag == "fast" ) fast = 2;
 		if ( curropt->tag == "change" ) {
 			sym = Bsymmetry(curropt->value.pre(','));
 			symnu = Bsymmetry(curropt->value.post(','));
@@ -248,7 +251,7 @@ int 	main(int argc, char **argv)
 					delete p;
 					p = pmask;
 				} else if ( find_angle > 0 ) {
-					p->find_point_group(sym, find_angle, find_bin, hires, lores, flags);
+					p->find_point_group(sym, find_angle, find_bin, hires, lores, flags | fast);
 				} else if ( replicate > 0 ) {
 					p->replicate_asymmetric_unit(sym);
 				} else if ( symnu.point() > 101 ) {
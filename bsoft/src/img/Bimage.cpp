@@ -3,7 +3,7 @@
 @brief	Methods for the image class
 @author Bernard Heymann
 @date	Created: 20110603
-@date 	Modified: 20220105
+@date 	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -23,6 +23,7 @@ extern int 		verbose;		// Level of output to the screen
 **/
 Bsub_image::Bsub_image()
 {
+	parent = NULL;
 	min = max = avg = std = 0;
 	bkg = 0;
 	ux = uy = uz = 1;
@@ -34,6 +35,33 @@ Bsub_image::Bsub_image()
 //	cout << "sub-image initialized" << endl;
 }
 
+/**
+@brief Copies sub-image parameters.
+@param 	s		sub-image to copy.
+@return Bsub_image&		this sub-image.
+
+	The link to the parent image is kept so that statistics are
+	still calculated for the image this sub-image belongs to.
+
+**/
+Bsub_image&	Bsub_image::operator=(const Bsub_image& s)
+{
+	min = s.min;
+	max = s.max;
+	avg = s.avg;
+	std = s.std;
+	bkg = s.bkg;
+	ux = s.ux; uy = s.uy; uz = s.uz;
+	ox = s.ox; oy = s.oy; oz = s.oz;
+	vx = s.vx; vy = s.vy; vz = s.vz;
+	angle = s.angle;
+	mag = s.mag;
+	fom = s.fom;
+	sel = s.sel;
+	
+	return *this;
+}
+
 /**
 @brief Initializes an image.
 
@@ -266,6 +294,7 @@ void		Bimage::initialize()
 	offset = 0;
 	
 	min = max = avg = std = 0;
+	statistics_invalidate();
 	smin = smax = 0;
 
 	ucell = UnitCell();
@@ -373,6 +402,7 @@ void		Bimage::images(long nn) {
 	n = nn;
 	if ( !image ) {
 		image = new Bsub_image[nn];
+		sub_images_link();
 		meta_data_update();
 	}
 }
@@ -422,6 +452,8 @@ void		Bimage::internal_copy(const Bimage& p)
 		d.uc = new unsigned char[allocsize];
 		for ( long j=0; j<datasize; j++ ) set(j, p[j]);
 	}
+	
+	stats_valid.store(p.stats_valid.load(memory_order_acquire), memory_order_release);
 //	cout << "data pointer:" << &d.uc << "." << endl;
 	
 }
@@ -499,6 +531,7 @@ void			Bimage::check()
 	if ( max > dtmax ) check_stats = 1;
 	
 	if ( check_stats ) statistics();
+	else stats_valid.store(1, memory_order_release);
 	
 	if ( smin == 0 && smax == 0 ) {
 		smin = min;
@@ -847,6 +880,8 @@ unsigned char*	Bimage::data_alloc(long nbytes)
 //	for ( long j=0; j<nbytes; j++ ) d.uc[j] = 0;
 
 	data_size();
+	
+	statistics_invalidate();
 
 	return d.uc;
 }
@@ -906,6 +941,8 @@ unsigned char*	Bimage::data_assign(unsigned char* nudata)
 	d.uc = nudata;
 	
 	data_size();
+	
+	statistics_invalidate();
 
 	if ( verbose & VERB_DEBUG )
 		cout << "DEBUG Bimage::data_assign: datasize=" << datasize << endl;
@@ -963,6 +1000,7 @@ double		Bimage::operator[](long j) const
 		case Long:		return d.sl[j];
 		case Float:		return d.f[j];
 		case Double:	return d.d[j];
+		case Half:		return d.h[j];
 		default:		return 0;
 	}
 }
@@ -1125,6 +1163,7 @@ TypePointer		Bimage::fill_value(double v)
 		case Long:			fp.sl[0] = (long)v; break;
 		case Float:			fp.f[0] = v; break;
 		case Double:		fp.d[0] = v; break;
+		case Half:			fp.h[0] = v; break;
 		default: ;
 	}
 	
@@ -1136,6 +1175,8 @@ TypePointer		Bimage::fill_value(double v)
 @param 	j		index.
 @param 	v		value.
 
+	The statistics are marked as out of date.
+
 **/
 void		Bimage::set(long j, double v)
 {
@@ -1158,8 +1199,11 @@ void		Bimage::set(long j, double v)
 		case Long:		d.sl[j] = (long)v; break;
 		case Float:		d.f[j] = v; break;
 		case Double:	d.d[j] = v; break;
+		case Half:		d.h[j] = v; break;
 		default: ;
 	}
+	
+	statistics_invalidate();
 }
 
 /**
@@ -1613,6 +1657,7 @@ long		Bimage::data_type_bits() const
 		case ULong: case Long: 			bits = 8*sizeof(long); break;
 		case Float:						bits = 8*sizeof(float); break;
 		case Double:					bits = 8*sizeof(double); break;
+		case Half:						bits = 8*sizeof(half); break;
 		default: 		bits = 0;
 	}
 	
@@ -1638,6 +1683,7 @@ long		Bimage::data_type_size() const
 		case ULong: case Long: 	typesize = sizeof(long); break;
 		case Float:				typesize = sizeof(float); break;
 		case Double:			typesize = sizeof(double); break;
+		case Half:				typesize = sizeof(half); break;
 		default: typesize = 0;
 	}
 	
@@ -1668,6 +1714,7 @@ double		Bimage::data_type_min()
 		case Long: min = LONG_MIN; break;
 		case Float: min = -FLT_MAX; break;
 		case Double: min = -DBL_MAX; break;
+		case Half: min = -65504; break;
 		default: break;
 	}
 
@@ -1698,6 +1745,7 @@ double		Bimage::data_type_max()
 		case Long: max = LONG_MAX; break;
 		case Float: max = FLT_MAX; break;
 		case Double: max = DBL_MAX; break;
+		case Half: max = 65504; break;
 		default: break;
 	}
 
@@ -1724,6 +1772,7 @@ Bstring		Bimage::data_type_string()
 		case Long:				string = "long"; break;
 		case Float: 			string = "float"; break;
 		case Double: 			string = "double"; break;
+		case Half: 				string = "half"; break;
 		default: string = "unknown";
 	}
 	
@@ -1800,6 +1849,7 @@ void		Bimage::change_type(char letter)
 		case 'l': nutype = Long; break;
 		case 'f': nutype = Float; break;
 		case 'd': nutype = Double; break;
+		case 'h': nutype = Half; break;
 		case 'S': nutype = Short; break;
 		case 'I': nutype = Integer; break;
 		case 'F': nutype = Float; break;
@@ -1840,6 +1890,7 @@ void		Bimage::change_type(char* string)
 		else if ( strstr(string, "long") ) nutype = Long;
 		else if ( strstr(string, "float") ) nutype = Float;
 		else if ( strstr(string, "double") ) nutype = Double;
+		else if ( strstr(string, "half") ) nutype = Half;
 	}
 	
 	change_type(nutype);
@@ -1853,6 +1904,8 @@ void		Bimage::change_type(DataType nutype)
 {
 	if ( datatype == nutype || nutype == Unknown_Type ) return;
 	
+	statistics_update();
+	
 	if ( max - min < 1e-37 ) max = min + 1;
 	
 	long			j, k, l, m;
@@ -1914,6 +1967,10 @@ void		Bimage::change_type(DataType nutype)
 			scale = (mx - mn)/(max - min);
 	}
 	
+	if ( datatype == Half && ( min < mn || max > mx ) ) {	// fit within +-65504
+			scale = mx/(( -min > max )? -min: max);
+	}
+	
 	if ( verbose & VERB_DEBUG )
 		cout << "DEBUG Bimage::change_type: scale=" << scale << " shift=" << shift << endl;
 
@@ -1924,7 +1981,26 @@ void		Bimage::change_type(DataType nutype)
 		for ( j=0; j<allocsize; j++ ) d.uc[j] = 0;
 	}
 	
-	if ( oldtype == Bit ) {
+	if ( scale == 1 && shift == 0 && ( ( oldtype == Half && datatype == Float ) ||
+			( oldtype == Float && datatype == Half ) ) ) {
+		// Direct conversion between half and single precision in parallel
+		long		chunk_size(get_chunk_size(datasize));
+		long		nchunk((datasize - 1)/chunk_size + 1);
+#ifdef HAVE_GCD
+		dispatch_apply(nchunk, dispatch_get_global_queue(0, 0), ^(size_t ic){
+			long	i, end(( (ic+1)*chunk_size < datasize )? (ic+1)*chunk_size: datasize);
+			if ( oldtype == Half ) for ( i=ic*chunk_size; i<end; ++i ) d.f[i] = p.h[i];
+			else for ( i=ic*chunk_size; i<end; ++i ) d.h[i] = p.f[i];
+		});
+#else
+#pragma omp parallel for
+		for ( long ic=0; ic<nchunk; ++ic ) {
+			long	i, end(( (ic+1)*chunk_size < datasize )? (ic+1)*chunk_size: datasize);
+			if ( oldtype == Half ) for ( i=ic*chunk_size; i<end; ++i ) d.f[i] = p.h[i];
+			else for ( i=ic*chunk_size; i<end; ++i ) d.h[i] = p.f[i];
+		}
+#endif
+	} else if ( oldtype == Bit ) {
 		for ( j=l=0; l<n*y*z; l++ )
 			for ( k=0, m=l*px; k<x; k++, j++, m++ ) set(j, ((p.uc[m/8] << (m%8)) & 0x80) == 0x80);
 	} else for ( j=l=0; j<datasize; j++, l++ ) {
@@ -1939,6 +2015,7 @@ void		Bimage::change_type(DataType nutype)
 			case Long:			v = p.sl[j]; break;
 			case Float:			v = p.f[j]; break;
 			case Double:		v = p.d[j]; break;
+			case Half:			v = p.h[j]; break;
 			default: ;
 		}
 		v = scale*v + shift;
@@ -2064,8 +2141,10 @@ void		Bimage::combine_channels(long nc, CompoundType ct)
 	n = nun;
 	c = nc;
 	compoundtype = ct;
+	
+	sub_images_link();
 
-	statistics();
+	statistics_invalidate();
 }
 
 
@@ -2136,6 +2215,7 @@ int 		Bimage::slices_to_images()
 	z = 1;
 	
 	image = new Bsub_image[n];
+	sub_images_link();
 	
 	for ( nn=0; nn<n; nn++ )
 		image[nn] = subimg;
@@ -2174,6 +2254,7 @@ int 		Bimage::images_to_slices()
 	n = 1;
 	
 	image = new Bsub_image[n];
+	sub_images_link();
 	
 	image[0] = subimg;
 
@@ -2240,6 +2321,7 @@ long	Bimage::delete_images(Bstring list, int retain)
 	delete[] image;
 	image = subimg;
 	n = ns;
+	sub_images_link();
 	
 	data_assign(nudata);
 
@@ -2604,7 +2686,7 @@ int		Bimage::information()
 	Vector3<double>	u(image->sampling());
 	cout << "Voxel units/sampling:           " << u[0] << " " << u[1] << " " << u[2] << endl;
 	cout << "Min, max, ave, std:             " << 
-			min << " " << max << " " << avg << " " << std << endl;
+			minimum() << " " << maximum() << " " << average() << " " << standard_deviation() << endl;
 	
     cout << "Text label:                     (length = " << label().length() << ")" << endl;
 	cout << label() << endl;
@@ -2761,12 +2843,12 @@ void		Bimage::get(Bstring tag)
 	else if ( tag.contains("sam") || tag.contains("pix") ) cout << sampling(0) << endl;
 	else if ( tag.contains("ori") ) cout << image->origin() << endl;
 	else if ( tag == "view" ) cout << image->view() << endl;
-	else if ( tag.contains("min") ) cout << min << endl;
-	else if ( tag.contains("max") ) cout << max << endl;
-	else if ( tag.contains("av") ) cout << avg << endl;
-	else if ( tag.contains("st") ) cout << std << endl;
-	else if ( tag.contains("var") ) cout << std*std << endl;
-	else if ( tag.contains("stat") ) cout << min << tab << max << tab << avg << tab << std << endl;
+	else if ( tag.contains("min") ) cout << minimum() << endl;
+	else if ( tag.contains("max") ) cout << maximum() << endl;
+	else if ( tag.contains("av") ) cout << average() << endl;
+	else if ( tag.contains("st") ) cout << standard_deviation() << endl;
+	else if ( tag.contains("var") ) cout << standard_deviation()*standard_deviation() << endl;
+	else if ( tag.contains("stat") ) cout << minimum() << tab << maximum() << tab << average() << tab << standard_deviation() << endl;
 	else if ( tag == "text" ) cout << label() << endl;
 	else if ( tag == "json" ) cout << metadata << endl;
 }
@@ -2858,11 +2940,12 @@ Bimage* 	Bimage::copy_header(long nu_nimg)
 	// Copy all strings
 	img->id = id;
 	
-	// Statistics
-	img->minimum(min);
-	img->maximum(max);
-	img->average(avg);
-	img->standard_deviation(std);
+	// Statistics, valid only if they are valid for this image
+	img->min = min;
+	img->max = max;
+	img->avg = avg;
+	img->std = std;
+	img->stats_valid.store(stats_valid.load(memory_order_acquire), memory_order_release);
 	img->show_minimum(smin);
 	img->show_maximum(smax);
 	img->show_image(sn);
@@ -3402,7 +3485,7 @@ void		Bimage::invert()
 			break;
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3523,7 +3606,7 @@ void		Bimage::absolute()
 	for ( long j=0; j<datasize; j++ )
 		set(j, fabs((*this)[j]));
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3545,7 +3628,7 @@ void		Bimage::add(double v)
 	for ( long nn=0; nn<n; nn++ )
 		image[nn].background(background(nn) + v);
 
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3567,7 +3650,7 @@ void		Bimage::phase_add(double v)
 	for ( long nn=0; nn<n; nn++ )
 		image[nn].background(angle_set_negPI_to_PI(background(nn) + v));
 
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3589,7 +3672,7 @@ void		Bimage::multiply(double v)
 	for ( long nn=0; nn<n; nn++ )
 		image[nn].background(background(nn) * v);
 
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3612,7 +3695,7 @@ void		Bimage::multiply(long nn, double v)
 	
 	image[nn].background(background(nn) * v);
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3631,7 +3714,7 @@ void		Bimage::power(double v)
 		set(j, v1);
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3648,7 +3731,7 @@ void		Bimage::sine()
 	for ( long j=0; j<datasize; ++j )
 		set(j, sinl((*this)[j]));
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3671,7 +3754,7 @@ void		Bimage::arcsine()
 		set(j, asinl(v));
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3688,7 +3771,7 @@ void		Bimage::cosine()
 	for ( long j=0; j<datasize; ++j )
 		set(j, cosl((*this)[j]));
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3711,7 +3794,7 @@ void		Bimage::arccosine()
 		set(j, acosl(v));
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3728,7 +3811,7 @@ void		Bimage::tangent()
 	for ( long j=0; j<datasize; ++j )
 		set(j, tanl((*this)[j]));
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3751,7 +3834,7 @@ void		Bimage::arctangent()
 		set(j, atanl(v));
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3775,11 +3858,12 @@ void		Bimage::sum_images()
 	nusub[0] = image[0];
 	delete[] image;
 	image = nusub;
+	sub_images_link();
 	
 	data_type(Float);
 	data_assign((unsigned char *) nudata);
 
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3921,7 +4005,7 @@ void		Bimage::add(Bimage* p)
 		set(j, v1);
 	}
 
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3945,7 +4029,7 @@ void		Bimage::subtract(Bimage* p)
 		set(j, v1);
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -3972,7 +4056,7 @@ void		Bimage::add(long nn, Bimage* p)
 		set(j, v1);
 	}
 
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4001,7 +4085,7 @@ void		Bimage::add(Bimage* p, double scale, double shift)
 		set(j, v1);
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4027,7 +4111,7 @@ void		Bimage::add(long nn, Bimage* p, double scale, double shift)
 		set(j, v1);
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4056,7 +4140,7 @@ void		Bimage::multiply(Bimage* p, double scale, double shift)
 		set(j, v1);
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4108,7 +4192,7 @@ void 		Bimage::multiply(Bimage* p)
 		multiply(nn, p);
 #endif
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4124,7 +4208,7 @@ void 		Bimage::multiply(Bimage* p)
 **/
 void		Bimage::divide(Bimage* p, double scale, double shift)
 {
-	double			minval = p->min*scale + shift;
+	double			minval = p->minimum()*scale + shift;
 
 	if ( size() != p->size() || n != p->n ) {
 		check_if_same_size(p);
@@ -4168,7 +4252,7 @@ void		Bimage::divide(Bimage* p, double scale, double shift)
 		}
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4221,7 +4305,7 @@ void		Bimage::divide_one(Bimage* p, double scale, double shift)
 		}
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4249,7 +4333,7 @@ void		Bimage::inverse(double minval)
 			set(j, -invminval);
 	}
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4272,7 +4356,7 @@ void		Bimage::largest(Bimage* p)
     	if ( (*this)[j] < v1 ) set(j, v1);
     }
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4296,7 +4380,7 @@ void		Bimage::smallest(Bimage* p)
     	if ( (*this)[j] > v1 ) set(j, v1);
     }
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4320,7 +4404,7 @@ void		Bimage::arctangent(Bimage* p)
     	set(j, angle_set_negPI_to_PI(v1));
     }
 	
-	statistics();
+	statistics_invalidate();
 }
 
 /**
@@ -4505,7 +4589,7 @@ void		Bimage::vector_to_simple()
 	
 	data_assign((unsigned char *) nudata);
 	
-	statistics();
+	statistics_invalidate();
 }
 
 
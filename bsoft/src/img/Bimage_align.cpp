@@ -3,7 +3,7 @@
 @brief	Functions to align images.
 @author Bernard Heymann
 @date	Created: 20000505
-@date	Modified: 20210809
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -1587,7 +1587,7 @@ double		Bimage::align2D_pps(Bimage* pref, double res_hi, double res_lo,
 @return double		correlation coefficient.
 
 	Both the image and reference is converted to polar images using the 
-	current origins. The annuli of the polar images are cross-correlated
+	current origins, with a polar sampling plan set up once. The annuli of the polar images are cross-correlated
 	to find the rotation angle. The reference is rotated and cross-correlated
 	with the image to determine a new origin for the image. This is iterated
 	untill the rotation angle and origin of the image does not change any more,
@@ -1628,10 +1628,20 @@ double		Bimage::align2D(Bimage* pref, double res_polar,
 	
 //	cout << ppart->image->origin() << tab << pproj->image->origin() << endl;
 	
-	Bimage*			pol = NULL;
-	Bimage*			polref = pproj->cartesian_to_cylindrical(nannuli, nangles, 1);
+	// One sampling plan for the particle, shared with the reference if the origins agree
+	Bpolar_plan		plan(ppart->size(), ppart->image->origin(), nangles, 0, nannuli-1);
+	Bimage*			polref = NULL;
+	if ( pproj->size() == ppart->size() && pproj->image->origin() == ppart->image->origin() ) {
+		polref = pproj->polar_transform(plan);
+	} else {
+		Bpolar_plan		planref(pproj->size(), pproj->image->origin(), nangles, 0, nannuli-1);
+		polref = pproj->polar_transform(planref);
+	}
     delete pproj;
 	
+	// The particle does not change during the iterations
+	Bimage*			pol = ppart->polar_transform(plan);
+	
 	long			i, done(0);
 	double			best_angle(0);
 	double			da, dx, dy, ap(1e37);
@@ -1640,10 +1650,8 @@ double		Bimage::align2D(Bimage* pref, double res_polar,
 	Bimage*			prot;
 
 	for ( i=0; i<5 && !done; i++ ) {
-		pol = ppart->cartesian_to_cylindrical(nannuli, nangles, 1);
 		angle = pol->correlate_annuli(polref, ann_min, ann_max, 
 			ang_min, ang_max, planf_1D, planb_1D, pimgcc);
-		delete pol;
 		prot = pref->rotate(pref->size(), fabs(angle));
 		translate = find_shift(prot, prs_mask, 0, 0, shift_limit, 0, 1, planf_2D, planb_2D, cc);
 		delete prot;
@@ -1660,6 +1668,7 @@ double		Bimage::align2D(Bimage* pref, double res_polar,
 		if ( i > 0 && da < 0.005 && dx < 0.1 && dy < 0.1 ) done = 1;
 	}
 	
+	delete pol;
 	delete polref;
     delete ppart;
 	
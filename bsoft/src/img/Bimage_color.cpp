@@ -3,7 +3,7 @@
 @brief	Library routines for mangaing color images
 @author Bernard Heymann
 @date	Created: 19990321
-@date	Modified: 20200511
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -28,8 +28,8 @@ void		Bimage::simple_to_rgb()
 	}
 
 	double				v;
-	double				scale = 255.0/(max - min);
-	double				shift = -min;
+	double				scale = 255.0/(maximum() - minimum());
+	double				shift = -minimum();
 	
 	long		ds = x*y*z*n;
 	RGB<unsigned char>*	rgb_data = new RGB<unsigned char>[ds];
@@ -65,8 +65,8 @@ void		Bimage::simple_to_rgba()
 	}
 	
 	double					v;
-	double					scale = 255.0/(max - min);
-	double					shift = -min;
+	double					scale = 255.0/(maximum() - minimum());
+	double					shift = -minimum();
 	
 	long			ds = x*y*z*n;
 	RGBA<unsigned char>*	rgba_data = new RGBA<unsigned char>[ds];
@@ -247,15 +247,15 @@ void		Bimage::cmyk_to_rgb()
 int 		Bimage::one_color(int color, double cmin, double cmax, int flag)
 {
 	if ( cmin == cmax ) {
-		cmin = min;
-		cmax = max;
+		cmin = minimum();
+		cmax = maximum();
 	}
 	
 	if ( verbose & VERB_PROCESS )
 	    cout << "Coloring the image: " << color << endl << endl;
 	
     long		   	i, cc;
-    double			gscale = 255.0/(max - min);
+    double			gscale = 255.0/(maximum() - minimum());
     double			scale = 255.0/(cmax - cmin);
 	double			v;
 
@@ -417,8 +417,8 @@ Bimage*		Bimage::color_spectrum(double cmin, double cmax)
 	change_type(Float);
 	
 	if ( cmin == cmax ) {
-		cmin = min;
-		cmax = max;
+		cmin = minimum();
+		cmax = maximum();
 	}
 	
 	if ( verbose & VERB_PROCESS )
@@ -426,7 +426,7 @@ Bimage*		Bimage::color_spectrum(double cmin, double cmax)
 	
     long				i;
 	double				value;
-    double				gscale(255.0/(max - min));
+    double				gscale(255.0/(maximum() - minimum()));
 	
     RGB<unsigned char>* nudata = new RGB<unsigned char>[datasize];
 	
@@ -528,7 +528,7 @@ Bimage*		Bimage::red_white_blue(double red_min, double white_min,
 	    cout << "Generating a color scale image: colorscale.tif" << endl << endl;
 	
 	Bimage* 	p = new Bimage(UCharacter, TRGB, 256, 20, 1, 1);
-	double		scale((max - min)/255);
+	double		scale((maximum() - minimum())/255);
 	
 //	cout << "min=" << min << tab << "max=" << max << tab << "scale=" << scale << endl;
 	
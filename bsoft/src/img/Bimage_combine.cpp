@@ -3,7 +3,7 @@
 @brief	Functions to combine two images in various ways
 @author Bernard Heymann
 @date	Created: 19990219
-@date	Modified: 20150902
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -634,7 +634,7 @@ int 		Bimage::histomatch(Bimage* p, long bins)
 	    cout << "Matching histograms in " << bins << " bins:" << endl << endl;
 	
     for ( i=0; i<datasize; i++ ) {
-		h1 = (long) (bins*((*this)[i] - min)/(max - min));
+		h1 = (long) (bins*((*this)[i] - minimum())/(maximum() - minimum()));
 		h2 = (long) (bins*((*p)[i] - p->minimum())/(p->maximum() - p->minimum()));
 		if ( h1 >= bins ) h1 = bins - 1;
 		if ( h2 >= bins ) h2 = bins - 1;
@@ -666,7 +666,7 @@ int 		Bimage::histomatch(Bimage* p, long bins)
 		else
 			fraction = 0.5;
 		map[h2] = h1;
-		dens[h2] = (h2 + fraction)*(max - min)/bins + min;
+		dens[h2] = (h2 + fraction)*(maximum() - minimum())/bins + minimum();
 	}
 	
 	if ( verbose & VERB_DEBUG ) {
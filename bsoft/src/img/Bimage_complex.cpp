@@ -3,7 +3,7 @@
 @brief	Routines to convert complex data sets
 @author Bernard Heymann
 @date	Created: 19990424
-@date	Modified: 20220715
+@date	Modified: 20261018
 **/
 	
 #include "Bimage.h"
@@ -112,6 +112,7 @@ void		Bimage::multi_channel_to_complex()
 	compoundtype = TComplex;
 	n *= c;
 	c = 2;
+	sub_images_link();
 	
 	data_assign((unsigned char *) cdata);
 	
@@ -1679,8 +1680,8 @@ Bimage*		Bimage::intensities_phase_colored(double scale)
     long				i, ds(x*y*z*n);
 	double				amp_ratio;
 	
-	if ( scale <= 0 ) scale = 1/(avg + std);
-	else scale /= avg + std;
+	if ( scale <= 0 ) scale = 1/(average() + standard_deviation());
+	else scale /= average() + standard_deviation();
 	
 	if ( verbose & VERB_PROCESS ) {
 	    cout << "Generating a phase-colored power spectrum" << endl;
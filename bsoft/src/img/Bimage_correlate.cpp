@@ -3,7 +3,7 @@
 @brief	Cross correlation functions
 @author Bernard Heymann
 @date	Created: 19980805
-@date	Modified: 20200218
+@date	Modified: 20261018
 
 		Implemented using the FFTW library
 **/
@@ -99,7 +99,7 @@ double		Bimage::correlate(Bimage* p, double rmin, double rmax, Bimage* pmask, in
 		return -1;
 	}
 	
-	if ( std <= 0 || p->std <= 0 ) return -1;
+	if ( standard_deviation() <= 0 || p->standard_deviation() <= 0 ) return -1;
 	
 	if ( rmin > x/2 ) rmin = 0;
 	if ( rmax <= rmin ) rmax = size().max();
@@ -2012,8 +2012,8 @@ Bimage*		Bimage::find_peaks(long kernelsize)
 Vector3<double>*	Bimage::find_peaks(double excl_dist, long& ncoor, 
 		double& threshold_min, double& threshold_max, double pix_min, double pix_max)
 {
-	if ( threshold_min < min ) threshold_min = min;
-	if ( threshold_max > max ) threshold_max = max;
+	if ( threshold_min < minimum() ) threshold_min = minimum();
+	if ( threshold_max > maximum() ) threshold_max = maximum();
 	
 	long			rad = (long) excl_dist/2;
 
@@ -2134,7 +2134,7 @@ Vector3<double>*	Bimage::find_peaks(double excl_dist, long& ncoor,
 double		Bimage::ccmap_confidence(long nn)
 {
 	long			i, j, imax(0), imgsize(x*y*z);
-	double			v, vmax(min), vmax2(min), zavg(0), zstd(0), pval(0);
+	double			v, vmax(minimum()), vmax2(minimum()), zavg(0), zstd(0), pval(0);
 	Vector3<long>	coor, cmax, cmax2;
 	
 	for ( i=nn*imgsize, j=0; j<imgsize; i++, j++ ) {
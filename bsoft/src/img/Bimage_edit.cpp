@@ -3,7 +3,7 @@
 @brief	Library routines used for editing image contents
 @author Bernard Heymann
 @date	Created: 19980520
-@date	Modified: 20220120
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -146,7 +146,7 @@ int			Bimage::shape(long nn, int type, Vector3<long> rect, Vector3<double> start
 		else width = 0.001;
 	}
 	
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) fill = background(nn);
 
 	if ( rect[0] < 1 ) rect[0] = x;
@@ -256,7 +256,7 @@ int			Bimage::line(Vector3<double> start, Vector3<double> end, double width, int
 		else width = 0.001;
 	}
 	
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) fill = background(long(0));
 
     long     			i, xx, yy, zz, cc;
@@ -738,7 +738,7 @@ int			Bimage::shell(long nn, Vector3<double> center, double minrad,
 		else width = 0.1;
 	}
 	
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) fill = background(nn);
 
     long     			i, xx, yy, zz, cc;
@@ -847,7 +847,7 @@ int			Bimage::shell_wrap(long nn, Vector3<double> center, double minrad,
 		else width = 0.1;
 	}
 	
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) fill = background(nn);
 
     long     			i, xx, yy, zz, cc;
@@ -950,7 +950,7 @@ int			Bimage::bar(long nn, Vector3<double> start, Vector3<double> end,
 {
 	if ( edge_width < 0.001 ) edge_width = 0.001;
 	
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) fill = background(nn);
 
 	if ( verbose & VERB_PROCESS ) {
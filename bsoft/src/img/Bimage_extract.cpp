@@ -3,7 +3,7 @@
 @brief	Library routines to extract parts of images
 @author Bernard Heymann
 @date	Created: 19990321
-@date	Modified: 20210609
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -76,7 +76,7 @@ Bimage*		Bimage::extract(long nn, Vector3<long> coords, Vector3<long> ext_size,
 	img->size(ext_size);
 	img->data_alloc();
 
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) {
 		if ( fabs(background(nn)) < 1e-20  ) calculate_background(nn);
 		fill = background(nn);
@@ -216,7 +216,7 @@ Bimage*		Bimage::extract_shell(long nn, double minrad, double maxrad)
 	Bimage*			pex = copy_header(1);
 	pex->image[0] = image[nn];
 	pex->data_alloc();
-	pex->fill(avg);
+	pex->fill(average());
 	
 	if ( verbose & VERB_PROCESS ) {
 		cout << "Extracting subimage:            " << nn << endl;
@@ -709,7 +709,7 @@ Bimage*		Bimage::extract_line(long nn, Vector3<double> start, Vector3<double> en
 **/
 Bimage*		Bimage::extract_tetrahedron(Vector3<double>* tet, int fill_type, double fill)
 {
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	
     long		     	i, j, k, nn, xx, yy, zz, cc;
 	
@@ -3,7 +3,7 @@
 @brief	Library routines used for filtering images
 @author Bernard Heymann
 @date	Created: 19990321
-@date	Modified: 20160510
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -236,7 +236,7 @@ int			Bimage::filter_average(Vector3<long> k)
 	
 	if ( verbose & VERB_PROCESS ) cout << endl;
 	
-	statistics();
+	statistics_invalidate();
 	
 	return 0;
 }
@@ -279,7 +279,7 @@ Bimage*		Bimage::gradient()
 		}
 	}
 	
-	pg->statistics();
+	pg->statistics_invalidate();
 	
 	return pg;
 }
@@ -353,7 +353,7 @@ Bimage*		Bimage::gradient3x3()
 	}
 #endif
 	
-	pg->statistics();
+	pg->statistics_invalidate();
 	
 	return pg;
 }
@@ -468,7 +468,7 @@ int			Bimage::filter_gaussian(long kernel_size, double sigma)
 	
 	delete pk;
 	
-	statistics();
+	statistics_invalidate();
 	
 	return 0;
 }
@@ -638,7 +638,7 @@ int			Bimage::convolve(Bimage* pkernel)
 
 	data_assign((unsigned char *) nudata);
 	
-	statistics();
+	statistics_invalidate();
 
 	return 0;
 }
@@ -746,7 +746,7 @@ int 		Bimage::filter_ortho(int type)
 	
 	data_assign((unsigned char *) nudata);
 	
-	statistics();
+	statistics_invalidate();
 		
 	return 0;
 }
@@ -781,7 +781,7 @@ int			Bimage::filter_dog(double sigma1, double sigma2)
 	
 	delete pk;
 
-	statistics();
+	statistics_invalidate();
 	
 	return 0;
 }
@@ -905,7 +905,7 @@ int 		Bimage::filter_bilateral(double sigma1, double sigma2,
 	// Initialize parameters
 	if ( sigma1 <= 0 ) sigma1 = 1;
 	if ( kernel_radius <= 0 ) kernel_radius = (long) (sigma1*3);
-	if ( sigma2 <= 0 ) sigma2 = std;
+	if ( sigma2 <= 0 ) sigma2 = standard_deviation();
 		
 	Vector3<long>	ksize(kernel_radius*2+1, kernel_radius*2+1, kernel_radius*2+1);
 	ksize = ksize.min(size());
@@ -940,7 +940,7 @@ int 		Bimage::filter_bilateral(double sigma1, double sigma2,
 
 	data_assign((unsigned char *) nudata);
 	
-	statistics();
+	statistics_invalidate();
 		
 	return 0;
 }
@@ -1006,8 +1006,8 @@ int 		Bimage::filter_rolling_ball(long radius, double scale)
 				for ( xx=0; xx<x; xx++, i++ ) {
 					lo[0] = kmin(xx, hk[0]);
 					hi[0] = kmax(xx, ksize[0], x);
-					if ( scale > 0 ) bcenter = max;
-					else bcenter = min;
+					if ( scale > 0 ) bcenter = maximum();
+					else bcenter = minimum();
 					for ( kz=lo[2]; kz<hi[2]; kz++ ) {
 						iz = (nn*z + zz + kz - hk[2])*y;
 						jz = kz*ksize[1];
@@ -1051,7 +1051,7 @@ int 		Bimage::filter_rolling_ball(long radius, double scale)
 
 	for ( i=0; i<datasize; i++ ) set(i, (*this)[i] - back[i]);
 	
-	statistics();
+	statistics_invalidate();
 		
 	return 0;
 }
@@ -1177,7 +1177,7 @@ int			Bimage::filter_rank(long kernel_size, double rank)
 	
 	delete[] nudata;
 	
-	statistics();
+	statistics_invalidate();
 	
 	return 0;
 }
@@ -1250,7 +1250,7 @@ Bimage*		Bimage::filter_peak(long kernel_size)
 	if ( verbose & VERB_DEBUG )
 		cout << "DEBUG Bimage::filter_peak: Done" << endl;
 	
-	ppeak->statistics();
+	ppeak->statistics_invalidate();
 	
 	return ppeak;
 }
@@ -1369,7 +1369,7 @@ Bimage*		Bimage::aniso_average(long ksize, double w)
 
 	delete pg;
 	
-	pd->statistics();
+	pd->statistics_invalidate();
 
 	return pd;
 }
@@ -1382,7 +1382,7 @@ Bimage*		Bimage::aniso_average(long ksize, double w)
 int			Bimage::filter_by_difference(Bimage* p)
 {
 	long			i, exponent(2);
-	double			v, d, f(1), b(avg);
+	double			v, d, f(1), b(average());
 	
 	for ( i=0; i<image_size(); ++i ) {
 		v = (*this)[i];
@@ -1393,7 +1393,7 @@ int			Bimage::filter_by_difference(Bimage* p)
 		set(i, f*v + (1-f)*b);
 	}
 	
-	statistics();
+	statistics_invalidate();
 	
 	return 0;
 }
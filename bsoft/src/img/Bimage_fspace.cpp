@@ -3,7 +3,7 @@
 @brief	Library routines used for modifying reciprocal space amplitudes
 @author Bernard Heymann
 @date	Created: 19990321
-@date	Modified: 20220803
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -1986,7 +1986,7 @@ int 		Bimage::fspace_positive()
 	long			i(0), ds(x*y*z);
 	double			fmax(0), scale;
 
-	fmax = ds * (avg-min);
+	fmax = ds * (average()-minimum());
 	
 	if ( compoundtype != TComplex ) {
 		tflag = 1;
@@ -3,7 +3,7 @@
 @brief	Dealing with images with helical symmetry.
 @author Bernard Heymann
 @date	Created: 20021127
-@date	Modified: 20160331
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -1598,7 +1598,7 @@ int			Bimage::extrude_cross_section(long length, double helix_rise,
 {
 	change_type(Float);
 
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	
 	long			i, xx, yy, zz;
 	double			a, ca, sa, dx, dy, cx, cy;
@@ -3,7 +3,7 @@
 @brief	Library routines to calculate histograms for images
 @author Bernard Heymann
 @date	Created: 19990321
-@date	Modified: 20210304
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -17,6 +17,29 @@
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
 
+/*
+	Adds the values in a range of a typed data array to a histogram.
+*/
+template <typename T>
+static void	histogram_add(T* data, long start, long end, long c,
+				long bins, double scale, double offset, long* h)
+{
+	long			i, j, cc;
+	
+	if ( c == 1 ) {
+		for ( i=start; i<end; ++i ) {
+			j = (long) (scale*data[i] + offset);
+			if ( j >= 0 && j < bins ) h[j]++;
+		}
+	} else {
+		for ( i=start, cc=start%c; i<end; ++i ) {
+			j = (long) (scale*data[i] + offset);
+			if ( j >= 0 && j < bins ) h[cc*bins+j]++;
+			if ( ++cc == c ) cc = 0;
+		}
+	}
+}
+
 /**
 @brief 	Calculates the histogram of an image.
 @param 	bins			number of bins in the histogram.
@@ -28,6 +51,8 @@ extern int 	verbose;		// Level of output to the screen
 	Multiple channels are output as successive one-dimensional arrays.
 	The image data is not affected.
 	The statistics for the input image must be correctly calculated.
+	The data is divided into chunks, each accumulated into its own 
+	histogram in parallel, and the chunk histograms are then added.
 
 **/
 vector<long>	Bimage::histogram(long bins, double& scale, double& offset)
@@ -39,34 +64,103 @@ vector<long>	Bimage::histogram(long bins, double& scale, double& offset)
 	
 	if ( !data_pointer() ) return histo;
 	
-    long			i, j, cc;
-//	for ( i=0; i<bins*c; i++ ) histo[i] = 0;
-	
 	if ( datatype < Float ) {
-		scale = 1/(ceil((max - min + 1)/bins));
-		offset = -scale*min;
+		scale = 1/(ceil((maximum() - minimum() + 1)/bins));
+		offset = -scale*minimum();
 	} else {
-		scale = (bins - 1)*1.0/(max - min);
-		offset = 0.5 - scale*min;
+		scale = (bins - 1)*1.0/(maximum() - minimum());
+		offset = 0.5 - scale*minimum();
 	}
 	
 	if ( verbose & VERB_DEBUG )
-		cout << "DEBUG Bimage::histogram: range=" << min << "-"
+		cout << "DEBUG Bimage::histogram: range=" << minimum() << "-"
 			<< max << " bins=" << bins << " scale=" << scale
 			<< " offset=" << offset << endl;
 
-	for ( i=0; i<n*image_size();  ) {
-		for ( cc=0; cc<c; cc++, i++ ) {
-			j = (long) (scale*(*this)[i] + offset);
-			if ( j >= 0 && j < bins ) histo[cc*bins+j]++;
-		}
-	}
+	long			nv(x*y*z*n*c);
+	long			chunk_size(get_chunk_size(nv, c));
+	long			nchunk((nv - 1)/chunk_size + 1);
+	long			hs(bins*c);
+	vector<long>	hchunk(nchunk*hs, 0);
+	long*			hc = hchunk.data();
+	double			sc(scale), off(offset);
+
+#ifdef HAVE_GCD
+	dispatch_apply(nchunk, dispatch_get_global_queue(0, 0), ^(size_t ic){
+		histogram_chunk(ic*chunk_size, (ic+1)*chunk_size, bins, sc, off, hc + ic*hs);
+	});
+#else
+#pragma omp parallel for
+	for ( long ic=0; ic<nchunk; ++ic )
+		histogram_chunk(ic*chunk_size, (ic+1)*chunk_size, bins, sc, off, hc + ic*hs);
+#endif
+
+	for ( long ic=0; ic<nchunk; ++ic )
+		for ( long i=0; i<hs; ++i ) histo[i] += hc[ic*hs+i];
 	
 //	for ( i=0; i<bins*c; i++ ) cout << i << tab << histo[i] << endl;
 	
 	return histo;
 }
 
+/**
+@brief 	Accumulates a histogram over a range of the image data.
+@param 	start			first data index.
+@param 	end				end of the range (exclusive).
+@param 	bins			number of bins per channel.
+@param 	scale			bin scale.
+@param 	offset			bin offset.
+@param 	*h				histogram to add to (bins per channel).
+
+	Simple data types are read directly from the data array.
+
+**/
+void		Bimage::histogram_chunk(long start, long end, long bins,
+				double scale, double offset, long* h)
+{
+	long			nv(x*y*z*n*c);
+	if ( end > nv ) end = nv;
+	
+	switch ( datatype ) {
+		case UCharacter: histogram_add(d.uc, start, end, c, bins, scale, offset, h); break;
+		case SCharacter: histogram_add(d.sc, start, end, c, bins, scale, offset, h); break;
+		case UShort: histogram_add(d.us, start, end, c, bins, scale, offset, h); break;
+		case Short: histogram_add(d.ss, start, end, c, bins, scale, offset, h); break;
+		case UInteger: histogram_add(d.ui, start, end, c, bins, scale, offset, h); break;
+		case Integer: histogram_add(d.si, start, end, c, bins, scale, offset, h); break;
+		case ULong: histogram_add(d.ul, start, end, c, bins, scale, offset, h); break;
+		case Long: histogram_add(d.sl, start, end, c, bins, scale, offset, h); break;
+		case Float: histogram_add(d.f, start, end, c, bins, scale, offset, h); break;
+		case Double: histogram_add(d.d, start, end, c, bins, scale, offset, h); break;
+		case Half: histogram_add(d.h, start, end, c, bins, scale, offset, h); break;
+		default:
+			for ( long i=start, j, cc=start%c; i<end; ++i ) {
+				j = (long) (scale*(*this)[i] + offset);
+				if ( j >= 0 && j < bins ) h[cc*bins+j]++;
+				if ( ++cc == c ) cc = 0;
+			}
+	}
+}
+
+/**
+@brief 	Calculates a histogram object for repeated queries.
+@param 	bins			number of bins in the histogram.
+@return Bhistogram		histogram with cumulative counts.
+
+	The histogram is calculated as in Bimage::histogram and kept with
+	its cumulative counts, so that percentiles and thresholds can be
+	obtained without rescanning the image.
+	The statistics for the input image must be correctly calculated.
+
+**/
+Bhistogram	Bimage::histogram_object(long bins)
+{
+	double			scale, offset;
+	vector<long>	h = histogram(bins, scale, offset);
+	
+	return Bhistogram(h, c, scale, offset, minimum(), maximum(), datasize);
+}
+
 /**
 @brief 	Calculates the histogram of an image.
 @param 	bins		number of bins in the histogram.
@@ -83,7 +177,7 @@ Bplot* 		Bimage::histogram(long bins)
 {
     long		  	i, j, k, cc, npage, ncol;
 	double			Hi, H;
-	double			bin_half = (max - min)/(4*bins);
+	double			bin_half = (maximum() - minimum())/(4*bins);
 	double			unit_mass = RHO * sampling(0).volume();
 	vector<long>	hsum(bins*c, 0);
     
@@ -137,8 +231,8 @@ Bplot* 		Bimage::histogram(long bins)
 		plot->page(0).column(2).color(0,1,0);
 		plot->page(0).column(3).color(0,0,1);
 	}
-	plot->page(0).axis(1).min(min - bin_half);
-	plot->page(0).axis(1).max(max + bin_half);
+	plot->page(0).axis(1).min(minimum() - bin_half);
+	plot->page(0).axis(1).max(maximum() + bin_half);
 	plot->page(0).axis(3).min(0);
 	plot->page(0).axis(3).max(hmax);
 	
@@ -154,14 +248,14 @@ Bplot* 		Bimage::histogram(long bins)
 		plot->page(1).column(1).label("Mass(MDa)");
 		plot->page(1).column(1).axis(3);
 		plot->page(1).column(1).element_size(0.5);
-		plot->page(1).axis(1).min(min - bin_half);
-		plot->page(1).axis(1).max(max + bin_half);
+		plot->page(1).axis(1).min(minimum() - bin_half);
+		plot->page(1).axis(1).max(maximum() + bin_half);
 		plot->page(1).axis(3).min(0);
 		plot->page(1).axis(3).max(hsum[0] * unit_mass);
 	}
 	
     for ( i=0; i<bins; i++ ) {
-		(*plot)[i] = min + i/scale;
+		(*plot)[i] = minimum() + i/scale;
 		for ( cc=0, j=i, k=bins+i; cc<c; cc++, j+=bins, k+=bins ) (*plot)[k] = histo[j];
 	}
 
@@ -209,7 +303,7 @@ Bplot*		Bimage::histogram_counts(int flags)
  	double			phi, scale, offset, hmax(0);
  	Complex<double>	cv;
 	
-	if ( datatype < Float ) bins = max - min + 1;
+	if ( datatype < Float ) bins = maximum() - minimum() + 1;
 	
 	vector<long>	h = histogram(bins, scale, offset);
 	
@@ -223,7 +317,7 @@ Bplot*		Bimage::histogram_counts(int flags)
 		for ( j=0; j<100; ++j ) {
 			phi = -TWOPI*i*j*1.0L/bins;
 			cv = Complex<double>(cos(phi), sin(phi));
-			ft[i] += cv*h[j]*1.0L/max;
+			ft[i] += cv*h[j]*1.0L/maximum();
 		}
 		ft[i] /= bins;
 //		cout << i << tab << h[i] << tab << ft[i].power() << endl;
@@ -476,8 +570,8 @@ Bplot*		Bimage::percentiles()
 
 	vector<double>	perc(pbins);
 
-	perc[0] = min;
-	perc[100] = max;
+	perc[0] = minimum();
+	perc[100] = maximum();
 
 	long			ncol(3);
 	Bstring			title("Percentiles");
@@ -511,7 +605,7 @@ Bplot*		Bimage::percentiles()
 	for ( i=j=1, hsum = histo[0]; i<bins; hsum += histo[i], i++ ) {
 		fraction = hsum*invsize;
 		for ( d = (fraction>j)? 1.0/(fraction - j): 1; fraction > j; j++ ) {
-			perc[j] = min + (i - d*(fraction - j))/scale;
+			perc[j] = minimum() + (i - d*(fraction - j))/scale;
 			if ( verbose )
 				cout << j << tab << i << tab << perc[j] << endl;
 			(*plot)[j] = j;
@@ -541,92 +635,27 @@ Bplot*		Bimage::percentiles()
 **/
 int			Bimage::histogram_minmax(double& tmin, double& tmax)
 {
-	if ( max <= min ) statistics();
+	if ( maximum() <= minimum() ) statistics();
 	
 	// Calculate the histogram and remove large numbers of white and black pixels
-	long			i, j, bins(256);
-	if ( (max - min)/std < 25 ) bins = 10*(max - min)/std;
-	if ( datatype <= SCharacter ) bins = (long) (max - min + 1.1);
+	long			bins(256);
+	if ( (maximum() - minimum())/standard_deviation() < 25 ) bins = 10*(maximum() - minimum())/standard_deviation();
+	if ( datatype <= SCharacter ) bins = (long) (maximum() - minimum() + 1.1);
 	
-	long			ihi, imin, nmin, imax(bins/2), nmax(0), isig(0);
-	double			g, sigma(8.0/(bins*bins));
-    double			scale, offset;
-    
-	vector<long>	hist = histogram(bins, scale, offset);
+	Bhistogram		hist = histogram_object(bins);
 	
 	if ( verbose & VERB_PROCESS ) {
 		cout << "Estimating extreme thresholds from the histogram:" << endl;
 		cout << "Bins:                           " << bins << endl;
 	}
 	
-	imax = (avg - min)*scale;
-	nmax = hist[imax];
-	
-	for ( i=imax/2, j=(bins-imax)/2; i<j; i++ ) {
-		if ( nmax < hist[i] ) { 	// Find the maximum in the middle part of the histogram	
-			nmax = hist[i];
-			imax = i;
-		}
-	}
-    
-	while ( imax+isig < bins - 1 && imax-isig > 0 && 
-			hist[imax] < 2*hist[imax+isig] && hist[imax] < 2*hist[imax-isig] )
-		isig++;
-	
-	if ( verbose & VERB_DEBUG ) {
-		cout << "DEBUG Bimage::histogram_minmax: Gaussian parameters:" << endl;
-		cout << "DEBUG Bimage::histogram_minmax: max=" << nmax << " imax=" << imax << " sigma=" << isig << endl;
-	}
-	
-	if ( isig > 0 ) sigma = -0.5/(isig*isig);
-	ihi = 0;
-	for ( i=0; i<imax/2; i++ ) {	// Find the highest peak in the first part
-		g = nmax*exp(sigma*(imax - i)*(imax - i));
-		if ( hist[i] > 20*g ) ihi = i;
-	}
-	
-	if ( verbose & VERB_DEBUG )
-		cout << "DEBUG Bimage::histogram_minmax: highest peak in first quarter = " << ihi << endl;
-	
-	imin = ihi;
-	nmin = x*y*z;
-	for ( i=ihi; i<imax/2; i++ ) {	// Find the minimum after the highest peak in the first part
-		if ( nmin > hist[i] ) {
-			nmin = hist[i];
-			imin = i;
-		}
-	}
-    	
-	ihi = bins - 1;
-	for ( i=bins-1, j=(bins-imax)/2; i>j; i-- ) {	// Find the highest peak in the last part
-		g = nmax*exp(sigma*(imax - i)*(imax - i));
-		if ( hist[i] > 20*g ) ihi = i;
-	}
-	
-	if ( verbose & VERB_DEBUG )
-		cout << "DEBUG Bimage::histogram_minmax: highest peak in last quarter = " << ihi << endl;
-	
-	imax = ihi;
-	nmin = x*y*z;
-	for ( i=(bins-imax)/2; i<ihi; i++ ) {	// Find the minumum before the highest peak in the last part
-		if ( nmin >= hist[i] ) {
-			nmin = hist[i];
-			imax = i;
-		}
-	}
-	
-//	delete[] hist;
-	
-	if ( imin >= imax ) {
+	if ( hist.clip_thresholds(average(), tmin, tmax) < 0 ) {
 		cerr << "Error in Bimage::histogram_minmax: extremes not found!" << endl;
 		return -1;
 	}
 	
-	tmin = imin/scale + min;
-	tmax = imax/scale + min;
-	
 	if ( verbose & VERB_DEBUG )
-		cout << "DEBUG Bimage::histogram_minmax: imin=" << imin << " imax=" << imax << " tmin=" << tmin << " tmax=" << tmax << endl;
+		cout << "DEBUG Bimage::histogram_minmax: tmin=" << tmin << " tmax=" << tmax << endl;
     	
 	if ( verbose & VERB_PROCESS )
 		cout << "Thresholds:                      " << tmin << tab << tmax << endl << endl;
@@ -693,36 +722,7 @@ Bplot*		Bimage::histogram_otsu_variance(long bins)
 **/
 double			Bimage::otsu_threshold(long bins)
 {
-	double			scale, offset;
-	vector<long>	h = histogram(bins, scale, offset);
-
-    long			i, total(x*y*z);
-	double			sum(0), sumB(0), wB(0), wF(0), mB, mF, mx(0), bt(0), t1(0), t2(0);
-	
-    for ( i = 1; i < bins; ++i )
-        sum += i * h[i];
-	
-    for ( i = 0; i < bins; ++i ) {
-        wB += h[i];
-        if (wB == 0)
-            continue;
-        wF = total - wB;
-        if (wF == 0)
-            break;
-        sumB += i * h[i];
-        mB = sumB / wB;
-        mF = (sum - sumB) / wF;
-        bt = wB * wF * (mB - mF) * (mB - mF);
-        if ( bt >= mx ) {
-            t1 = i;
-            if ( bt > mx ) {
-                t2 = i;
-            }
-            mx = bt;
-        }
-    }
-	
-    return ( t1 + t2 ) / (2 * scale) + min;
+	return histogram_object(bins).otsu_threshold();
 }
 
 /**
@@ -766,16 +766,11 @@ vector<double>	Bimage::otsu_variance(vector<long> h)
 **/
 vector<double>	Bimage::histogram_multi_thresholds(long bins, long number)
 {
-	double			scale, offset;
-	vector<long>	h = histogram(bins, scale, offset);
-
-	vector<double>	t = histogram_thresholds(h, number);
+	vector<double>	t = histogram_object(bins).multi_thresholds(number);
 	
-	if ( verbose )
+	if ( verbose ) {
 		cout << "Thresholds:" << endl;
-	for ( auto it=t.begin(); it!=t.end(); ++it ) {
-		*it = (*it - offset)/scale;
-		if ( verbose )
+		for ( auto it=t.begin(); it!=t.end(); ++it )
 			cout << *it << endl;
 	}
 
@@ -838,7 +833,7 @@ vector<double>	Bimage::histogram_gauss_fit(long bins, long ngauss)
 	// 3 parameters: amplitude, position, sigma
 	vector<double>	xx(bins), fx(nh);
 	for ( i=j=0; i<bins; i++ ) if ( sel[i] ) {
-		xx[j] = min + i/scale;
+		xx[j] = minimum() + i/scale;
 		fx[j] = histo[i];
 		if ( hmax < histo[i] ) hmax = histo[i];
 		j++;
@@ -861,13 +856,13 @@ vector<double>	Bimage::histogram_gauss_fit(long bins, long ngauss)
 			simp.limits(i, min, max);
 		}*/
 		if ( ngauss == 1 ) {
-			simp.limits(i, min, max);
+			simp.limits(i, minimum(), maximum());
 		} else if ( j == 0 ) {
-			simp.limits(i, min, (havg[j] + havg[j+1])/2);
+			simp.limits(i, minimum(), (havg[j] + havg[j+1])/2);
 		} else if ( j < ngauss-1 ) {
 			simp.limits(i, (havg[j-1] + havg[j])/2, (havg[j] + havg[j+1])/2);
 		} else {
-			simp.limits(i, (havg[j-1] + havg[j])/2, max);
+			simp.limits(i, (havg[j-1] + havg[j])/2, maximum());
 		}
 //		cout << tab << simp.parameter(i);
 		i++;
@@ -875,8 +870,8 @@ vector<double>	Bimage::histogram_gauss_fit(long bins, long ngauss)
 			simp.parameter(i, hstd[j]);	// Sigma
 			simp.limits(i, hstd[j]/3, 3*hstd[j]);
 		} else {
-			simp.parameter(i, std);				// Sigma
-			simp.limits(i, 1/scale, 0.5*(max - min)/n);
+			simp.parameter(i, standard_deviation());				// Sigma
+			simp.limits(i, 1/scale, 0.5*(maximum() - minimum())/n);
 		}
 //		cout << tab << simp.parameter(i) << endl;
 	}
@@ -939,7 +934,7 @@ vector<double>	Bimage::histogram_gauss_fit2(long bins, long ngauss)
 	// 3 parameters: amplitude, position, sigma
 	vector<double>	xx(bins), fx(bins);
 	for ( i=j=0; i<bins; i++ ) {
-		xx[j] = min + i/scale;
+		xx[j] = minimum() + i/scale;
 		fx[j] = histo[i];
 		if ( hmax < histo[i] ) hmax = histo[i];
 		j++;
@@ -955,18 +950,18 @@ vector<double>	Bimage::histogram_gauss_fit2(long bins, long ngauss)
 		i++;
 		simp.parameter(i, mx[j]);		// Position
 		if ( ngauss == 1 ) {
-			simp.limits(i, min+damp, max-damp);
+			simp.limits(i, minimum()+damp, maximum()-damp);
 		} else if ( j == 0 ) {
-			simp.limits(i, min+damp, (mx[0]+mx[1])/2);
+			simp.limits(i, minimum()+damp, (mx[0]+mx[1])/2);
 		} else if ( j < ngauss-1 ) {
 			simp.limits(i, (mx[j-1]+mx[j])/2, (mx[j]+mx[j+1])/2);
 		} else {
-			simp.limits(i, (mx[0]+mx[1])/2, max-damp);
+			simp.limits(i, (mx[0]+mx[1])/2, maximum()-damp);
 		}
 
 		i++;
-		simp.parameter(i, std/ngauss);	// Sigma
-		simp.limits(i, damp, std);
+		simp.parameter(i, standard_deviation()/ngauss);	// Sigma
+		simp.limits(i, damp, standard_deviation());
 //		cout << tab << simp.parameter(i) << endl;
 	}
 
@@ -1002,7 +997,7 @@ vector<double>	Bimage::histogram_gauss_fit2(long bins, long ngauss)
 Bplot* 		Bimage::histogram_gauss_plot(long bins, long ngauss)
 {
 	long			i, j, k, m, ncol(ngauss+2);
-	double			v, bin_half = (max - min)/(4*bins);
+	double			v, bin_half = (maximum() - minimum())/(4*bins);
 
 	vector<double>	gauss = histogram_gauss_fit2(bins, ngauss);
 
@@ -1035,8 +1030,8 @@ Bplot* 		Bimage::histogram_gauss_plot(long bins, long ngauss)
 	plot->page(0).column(2).color(1,0,0);
 	if ( n > 1 ) plot->page(0).column(3).color(0,1,0);
 	if ( n > 2 ) plot->page(0).column(4).color(0,0,1);
-	plot->page(0).axis(1).min(min - bin_half);
-	plot->page(0).axis(1).max(max + bin_half);
+	plot->page(0).axis(1).min(minimum() - bin_half);
+	plot->page(0).axis(1).max(maximum() + bin_half);
 	
 	for ( j=0; j<ngauss; j++ ){
 		txt = Bstring(j+1, "Gaussian %d:") + Bstring(gauss[3*j], " a=%g") +
@@ -1047,7 +1042,7 @@ Bplot* 		Bimage::histogram_gauss_plot(long bins, long ngauss)
 	plot->page(0).add_text(txt);
 	
 	for ( i=0, j=bins; i<bins; i++, j++ ) {
-		(*plot)[i] = min + i/scale;
+		(*plot)[i] = minimum() + i/scale;
 		(*plot)[j] = histo[i];
 		for ( k=0, m=i+2*bins; k<3*ngauss; k+=3, m+=bins ) {
 			v = ((*plot)[i] - gauss[k+1])/gauss[k+2];
@@ -1276,14 +1271,14 @@ double		simplex_poisson_R(Bsimplex& simp)
 */
 Bplot* 		Bimage::histogram_poisson_fit(long bins, int flag)
 {
-	if ( std <= 0 ) statistics();
+	if ( standard_deviation() <= 0 ) statistics();
 	
-	if ( bins > avg + 5*std ) bins = avg + 5*std;
+	if ( bins > average() + 5*standard_deviation() ) bins = average() + 5*standard_deviation();
 	if ( bins > 150 ) bins = 150;
 	if ( bins < 5 ) bins = 5;
 	
 	long			i, j, m, imax(0);
-	double			hmax(0), scale(bins*1.0/(avg+5*std));
+	double			hmax(0), scale(bins*1.0/(average()+5*standard_deviation()));
 		
 	vector<double>	b(bins, 0);
 	vector<double>	h(bins, 0);
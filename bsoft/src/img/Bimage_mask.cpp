@@ -3,7 +3,7 @@
 @brief	Methods for binary mask creation and manipulation.
 @author Samuel Payne and Bernard Heymann
 @date	Created: 20010710
-@date	Modified: 20200821 (BH)
+@date	Modified: 20261018 (BH)
 **/
 
 #include "Bimage.h"
@@ -55,7 +55,7 @@ long		Bimage::to_mask(double threshold)
 		return 0;
 	}
 	
-	if ( datatype == UCharacter && min == 0 && max == 1 ) return 0;
+	if ( datatype == UCharacter && minimum() == 0 && maximum() == 1 ) return 0;
 	
 	long				j, nm(0);
 	unsigned char*		mask = new unsigned char[datasize];
@@ -75,7 +75,7 @@ long		Bimage::to_mask(double threshold)
 	statistics();
 	
 	if ( verbose & VERB_DEBUG )
-		cout << "DEBUG Bimage::to_mask: max=" << max << endl;
+		cout << "DEBUG Bimage::to_mask: max=" << maximum() << endl;
 	
 	return nm;
 }
@@ -207,10 +207,10 @@ long		Bimage::mask_stats()
 //	if ( max < 1 ) statistics();
 
 	if ( verbose & VERB_DEBUG )
-		cout << "DEBUG Bimage::mask_stats: max=" << max << endl;
+		cout << "DEBUG Bimage::mask_stats: max=" << maximum() << endl;
 	
 	long			i, j, neg, sum, psum;
-	long			nlev = (long) (max + 1.5);
+	long			nlev = (long) (maximum() + 1.5);
 	if ( nlev < 2 ) nlev = 2;
 	
 	double			value, volsum;
@@ -445,9 +445,12 @@ long		Bimage::mask_dilate_erode(unsigned char dir)
 	
 	delete[] mask;
 	
-	statistics();
+	long			nv(0);
+	for ( i=0; i<datasize; ++i ) if ( d.uc[i] ) nv++;
+	
+	statistics_invalidate();
 	
-	return (long) (avg*datasize);
+	return nv;
 }
 
 /**
@@ -456,18 +459,15 @@ long		Bimage::mask_dilate_erode(unsigned char dir)
 @param 	times		the number of times to dilate the mask.
 @return long 		masked voxels.
 
-	Traditional 3^dim kernel dilation.  Any pixel with a value of 1 turns 
-	all of its neighbors to a value of 1.
+	Equivalent to repeating the traditional 3^dim kernel dilation,
+	done as separable passes with the chessboard metric.
 
 **/
 long		Bimage::mask_dilate(long times)
 {
-	long		t, nv(0);
-	
-	for ( t=0; t<times; t++ )
-		nv = mask_dilate_erode(1);
+	if ( times < 1 ) return 0;
 	
-	return nv;
+	return mask_dilate_erode(1, times, MaskChessboard);
 }
 
 /**
@@ -476,18 +476,15 @@ long		Bimage::mask_dilate(long times)
 @param 	times		the number of times to erode the mask
 @return long 		masked voxels.
 
-	Traditional 3^dim kernel erosion.  If all the neighboring pixels have
-	value of 1, then that pixel is left at 1. Otherwise it is changed to 0.
+	Equivalent to repeating the traditional 3^dim kernel erosion,
+	done as separable passes with the chessboard metric.
 
 **/
 long		Bimage::mask_erode(long times)
 {
-	long		t, nv(0);
-	
-	for ( t=0; t<times; t++ )
-		nv = mask_dilate_erode(0);
+	if ( times < 1 ) return 0;
 	
-	return nv;
+	return mask_dilate_erode(0, times, MaskChessboard);
 }
 
 /**
@@ -530,6 +527,285 @@ long 		Bimage::mask_close(int times)
 	return nv;
 }
 
+/*
+	One-dimensional squared Euclidean distance transform along a line
+	(Felzenszwalb and Huttenlocher, Theory of Computing 8, 2012):
+	The lower envelope of the parabolas rooted at each sample is 
+	constructed and then sampled.
+	The work arrays must hold n values (v) and n+1 values (zb).
+*/
+static void	mask_distance_line(float* f, long n, long stride, double* g, long* v, double* zb)
+{
+	long			i, k(0);
+	double			s;
+	
+	for ( i=0; i<n; ++i ) g[i] = f[i*stride];
+	
+	v[0] = 0;
+	zb[0] = -1e30;
+	zb[1] = 1e30;
+	for ( i=1; i<n; ++i ) {
+		s = ((g[i] + i*i) - (g[v[k]] + v[k]*v[k]))/(2.0*(i - v[k]));
+		while ( s <= zb[k] ) {
+			k--;
+			s = ((g[i] + i*i) - (g[v[k]] + v[k]*v[k]))/(2.0*(i - v[k]));
+		}
+		k++;
+		v[k] = i;
+		zb[k] = s;
+		zb[k+1] = 1e30;
+	}
+	
+	for ( i=k=0; i<n; ++i ) {
+		while ( zb[k+1] < i ) k++;
+		f[i*stride] = (i - v[k])*(i - v[k]) + g[v[k]];
+	}
+}
+
+/**
+@brief 	Calculates the Euclidean distance to the nearest voxel with a given mask value.
+@param 	value		mask value (0 or 1).
+@return Bimage*		floating point distance map in voxel units.
+
+	The exact Euclidean distance transform is calculated in linear time
+	as separable passes along x, y and z, each parallelized over lines.
+	Voxels with the given value have zero distance.
+	If no voxel has the value, the distances are larger than the image.
+
+**/
+Bimage*		Bimage::mask_distance(unsigned char value)
+{
+	to_mask();
+	
+	long			nn, imgsize(x*y*z);
+	float			far(x*x + y*y + z*z + 1);
+	
+	Bimage*			pd = new Bimage(Float, TSimple, size(), n);
+	pd->sampling(sampling(0));
+	float*			fd = (float *) pd->data_pointer();
+	
+#pragma omp parallel for
+	for ( long j=0; j<datasize; ++j ) fd[j] = ( d.uc[j] == value )? 0: far;
+	
+	for ( nn=0; nn<n; ++nn ) {
+		float*		f = fd + nn*imgsize;
+#pragma omp parallel for
+		for ( long zz=0; zz<z; ++zz ) {
+			vector<double>	g(x), zb(x+1);
+			vector<long>	v(x);
+			for ( long yy=0; yy<y; ++yy )
+				mask_distance_line(f + (zz*y + yy)*x, x, 1, g.data(), v.data(), zb.data());
+		}
+		if ( y > 1 ) {
+#pragma omp parallel for
+			for ( long zz=0; zz<z; ++zz ) {
+				vector<double>	g(y), zb(y+1);
+				vector<long>	v(y);
+				for ( long xx=0; xx<x; ++xx )
+					mask_distance_line(f + zz*y*x + xx, y, x, g.data(), v.data(), zb.data());
+			}
+		}
+		if ( z > 1 ) {
+#pragma omp parallel for
+			for ( long yy=0; yy<y; ++yy ) {
+				vector<double>	g(z), zb(z+1);
+				vector<long>	v(z);
+				for ( long xx=0; xx<x; ++xx )
+					mask_distance_line(f + yy*x + xx, z, x*y, g.data(), v.data(), zb.data());
+			}
+		}
+	}
+	
+#pragma omp parallel for
+	for ( long j=0; j<datasize; ++j ) fd[j] = sqrt(fd[j]);
+	
+	pd->statistics_invalidate();
+	
+	return pd;
+}
+
+/*
+	Sets all positions along a line within a distance of a position
+	with the given value to the value (chessboard metric in 1D).
+*/
+static void	mask_grow_line(unsigned char* m, long n, long stride, unsigned char value,
+				long r, long* dl)
+{
+	long			i, last(-r-1);
+	
+	for ( i=0; i<n; ++i ) {
+		if ( m[i*stride] == value ) last = i;
+		dl[i] = i - last;
+	}
+	
+	for ( i=n-1, last=n+r; i>=0; --i ) {
+		if ( m[i*stride] == value ) last = i;
+		if ( dl[i] <= r || last - i <= r ) m[i*stride] = value;
+	}
+}
+
+/**
+@brief 	Dilates or erodes a binary mask by a radius.
+@param 	dir			0=erode, 1=dilate.
+@param 	radius		radius in voxels.
+@param 	metric		distance metric: MaskEuclidean or MaskChessboard.
+@return long 		masked voxels.
+
+	Every voxel within the radius of a voxel with value dir is set to dir.
+	With the Euclidean metric the distances are taken from mask_distance.
+	The chessboard metric is applied as separable passes along the axes,
+	giving the same result as repeating the 3^dim kernel operation
+	radius times.
+
+**/
+long		Bimage::mask_dilate_erode(unsigned char dir, double radius, MaskMetric metric)
+{
+	to_mask();
+	
+	long			i, nn, imgsize(x*y*z);
+	
+	if ( radius <= 0 ) return (long) (average()*datasize);
+	
+	if ( metric == MaskEuclidean ) {
+		Bimage*		pd = mask_distance(dir);
+		float*		fd = (float *) pd->data_pointer();
+		for ( i=0; i<datasize; ++i )
+			if ( fd[i] <= radius + 1e-5 ) d.uc[i] = dir;
+		delete pd;
+	} else {
+		long		r((long) (radius + 1e-6));
+		for ( nn=0; nn<n; ++nn ) {
+			unsigned char*	m = d.uc + nn*imgsize;
+			if ( x > 1 ) {
+#pragma omp parallel for
+				for ( long zz=0; zz<z; ++zz ) {
+					vector<long>	dl(x);
+					for ( long yy=0; yy<y; ++yy )
+						mask_grow_line(m + (zz*y + yy)*x, x, 1, dir, r, dl.data());
+				}
+			}
+			if ( y > 1 ) {
+#pragma omp parallel for
+				for ( long zz=0; zz<z; ++zz ) {
+					vector<long>	dl(y);
+					for ( long xx=0; xx<x; ++xx )
+						mask_grow_line(m + zz*y*x + xx, y, x, dir, r, dl.data());
+				}
+			}
+			if ( z > 1 ) {
+#pragma omp parallel for
+				for ( long yy=0; yy<y; ++yy ) {
+					vector<long>	dl(z);
+					for ( long xx=0; xx<x; ++xx )
+						mask_grow_line(m + yy*x + xx, z, x*y, dir, r, dl.data());
+				}
+			}
+		}
+	}
+	
+	long			nv(0);
+	for ( i=0; i<datasize; ++i ) if ( d.uc[i] ) nv++;
+	
+	statistics_invalidate();
+	
+	return nv;
+}
+
+/**
+@brief 	Dilates a binary mask by a radius.
+@param 	radius		radius in voxels.
+@param 	metric		distance metric: MaskEuclidean or MaskChessboard.
+@return long 		masked voxels.
+**/
+long		Bimage::mask_dilate_radius(double radius, MaskMetric metric)
+{
+	return mask_dilate_erode(1, radius, metric);
+}
+
+/**
+@brief 	Erodes a binary mask by a radius.
+@param 	radius		radius in voxels.
+@param 	metric		distance metric: MaskEuclidean or MaskChessboard.
+@return long 		masked voxels.
+**/
+long		Bimage::mask_erode_radius(double radius, MaskMetric metric)
+{
+	return mask_dilate_erode(0, radius, metric);
+}
+
+/**
+@brief 	Opens a binary mask with a radius.
+@param 	radius		radius in voxels.
+@param 	metric		distance metric: MaskEuclidean or MaskChessboard.
+@return long 		masked voxels.
+
+	Opening a mask is an erosion followed by a dilation.
+
+**/
+long		Bimage::mask_open_radius(double radius, MaskMetric metric)
+{
+	mask_dilate_erode(0, radius, metric);
+	
+	return mask_dilate_erode(1, radius, metric);
+}
+
+/**
+@brief 	Closes a binary mask with a radius.
+@param 	radius		radius in voxels.
+@param 	metric		distance metric: MaskEuclidean or MaskChessboard.
+@return long 		masked voxels.
+
+	Closing a mask is a dilation followed by an erosion.
+
+**/
+long		Bimage::mask_close_radius(double radius, MaskMetric metric)
+{
+	mask_dilate_erode(1, radius, metric);
+	
+	return mask_dilate_erode(0, radius, metric);
+}
+
+/**
+@brief 	Converts a binary mask to a mask with a soft edge.
+@param 	radius		radius to extend the mask before the edge (voxels).
+@param 	width		width of the soft edge (voxels).
+@return long 		voxels within the extended mask.
+
+	The mask is extended by the radius and falls off from one to zero
+	with a cosine profile over the width, based on the Euclidean distance
+	from the original mask.
+	The mask is converted to floating point and the edge is
+	calculated in parallel.
+
+**/
+long		Bimage::mask_soft_edge(double radius, double width)
+{
+	Bimage*			pd = mask_distance(1);
+	float*			fd = (float *) pd->data_pointer();
+	
+	long			i, nv(0);
+	
+	change_type(Float);
+	
+	float*			fm = (float *) data_pointer();
+	
+#pragma omp parallel for
+	for ( long j=0; j<datasize; ++j ) {
+		double		dv = fd[j] - radius;
+		if ( dv <= 0 ) fm[j] = 1;
+		else if ( dv < width ) fm[j] = 0.5*(1 + cos(M_PI*dv/width));
+		else fm[j] = 0;
+	}
+	
+	for ( i=0; i<datasize; ++i ) if ( fd[i] <= radius ) nv++;
+	
+	delete pd;
+	
+	statistics_invalidate();
+	
+	return nv;
+}
+
 /**
 @brief 	Fills an empty part of a mask indicated by the given voxel.
 @param 	voxel		point from which to fill the mask.
@@ -709,7 +985,7 @@ long		Bimage::mask_symmetrize(Bsymmetry& sym)
 
 	statistics();
 		
-	return max;
+	return maximum();
 }
 
 /**
@@ -1345,7 +1621,7 @@ long			Bimage::mask_pack_plane(Matrix3 mat, double hi_res, double scale)
 **/
 double	 	Bimage::variance_threshold(double lowvar)
 {
-	double			varmax(max);
+	double			varmax(maximum());
 	if ( varmax <= lowvar ) varmax = 1;
 
 	long			i;
@@ -1499,7 +1775,7 @@ long			Bimage::mask_split(long voxels_per_level)
     double			value, threshold(0.5);
 	int*			mask = new int[datasize];
 	
-	if ( threshold > max/2 ) threshold = max/2;
+	if ( threshold > maximum()/2 ) threshold = maximum()/2;
 	
 	if ( verbose & VERB_PROCESS ) {
 	    cout << "Splitting a mask into multiple levels:" << endl;
@@ -1541,7 +1817,7 @@ long			Bimage::mask_split(long voxels_per_level)
 long		Bimage::levelmask_collapse()
 {
 	if ( verbose & VERB_LABEL )
-		cout << "Collapsing a multi-level mask with " << max << " levels" << endl << endl;
+		cout << "Collapsing a multi-level mask with " << maximum() << " levels" << endl << endl;
 	
     long			i, nv;
     int				value;
@@ -1621,7 +1897,7 @@ long		Bimage::levelmask_dilate(int times)
 long		Bimage::levelmask_dilate()
 {
 	long			i, j, im, nn, xx, yy, zz, kx, ky, kz;
-	long			vmax(max+1), v;
+	long			vmax(maximum()+1), v;
 	
 	Vector3<long>	k(3, 3, 3);
 	k = k.min(size());
@@ -1694,7 +1970,7 @@ long		Bimage::levelmask_select(Bstring& select_list, int flag)
 		cout << "Selecting levels " << select_list << endl;
 	
     long			i, nv;
-	long			nlev = (long) max + 1;
+	long			nlev = (long) maximum() + 1;
     int				value;
 
 	vector<int>		lev = select_numbers(select_list, nlev);
@@ -1736,7 +2012,7 @@ long		Bimage::levelmask_combine(Bstring& select_list)
 		cout << "Combining levels " << select_list << endl;
 	
     long			i, nv, first(0);
-	long			nlev = (long) max + 1;
+	long			nlev = (long) maximum() + 1;
     int				value;
 
 	vector<int>		lev = select_numbers(select_list, nlev);
@@ -1817,7 +2093,7 @@ long		Bimage::levelmask_select(Bimage* pmask)
 {
 	long			i;
 	long			v;
-	long			nsel(0), nlevel((long) (max + 1));
+	long			nsel(0), nlevel((long) (maximum() + 1));
 	vector<int>		levels(nlevel, 0);
 	
 	if ( verbose ) {
@@ -1875,7 +2151,7 @@ long		Bimage::levelmask_switch(long index1, long index2)
 
 	statistics();
 	
-	return max;
+	return maximum();
 }
 
 /**
@@ -1955,9 +2231,9 @@ long		Bimage::levelmask_symmetrize(Bsymmetry& sym)
 		cout << "Origin:                         " << image->origin() << endl << endl;
 	}
 	
-	vector<int>				symmap(max+1, 0);
-	vector<Vector3<double>>	segcom(max+1);
-	vector<int>				segnum(max+1, 0);
+	vector<int>				symmap(maximum()+1, 0);
+	vector<Vector3<double>>	segcom(maximum()+1);
+	vector<int>				segnum(maximum()+1, 0);
 
 	for ( i=zz=0; zz<z; zz++ ) {
 		v[2] = zz - image[0].origin()[2];
@@ -2018,7 +2294,7 @@ long		Bimage::levelmask_symmetrize(Bsymmetry& sym)
 	
 	statistics();
 		
-	return max;
+	return maximum();
 }
 
 /**
@@ -2034,7 +2310,7 @@ long		Bimage::levelmask_symmetrize(Bsymmetry& sym)
 **/
 Bimage* 	Bimage::level_mask_extract(Bimage* pmask, int fill_type, double fill)
 {
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) fill = image->background();
 
 	long			i, j, k, cc;
@@ -2064,7 +2340,7 @@ double	 	Bimage::levelmask_average_region_size()
 {
 	long			i;
 	long			v, nr(0);
-	long			nl((long) (max + 1.9));
+	long			nl((long) (maximum() + 1.9));
 	vector<int>		f(nl, 0);
 	double			a(0);
 	
@@ -2137,7 +2413,7 @@ long		Bimage::levelmask_colorize()
 {
 	random_seed();
 	
-	long				i, cc, nc((long) (max - min + 1));
+	long				i, cc, nc((long) (maximum() - minimum() + 1));
 	vector<RGB<unsigned char>>	lut(nc);
 
 	if ( verbose & VERB_LABEL ) {
@@ -2179,7 +2455,7 @@ Bimage*		Bimage::levelmask_color_by_size()
 	if ( verbose )
 		cout << "Coloring mask levels by size" << endl;
 		
-	long				i, j, nseg((long)(max+ 1.9));
+	long				i, j, nseg((long)(maximum()+ 1.9));
 	long				vmin(datasize), vmax(0);
 	double				vavg(0), vstd(0);
 	RGB<unsigned char>	black(0,0,0);
@@ -2229,7 +2505,7 @@ int			Bimage::levelmask_region_size()
 	if ( verbose )
 		cout << "Generating a region size level mask" << endl;
 		
-	long				i, j, nseg((long)(max+1.9));
+	long				i, j, nseg((long)(maximum()+1.9));
 	vector<int>			vol(nseg, 0);
 
 	for ( i=0; i<datasize; i++ )
@@ -2255,7 +2531,7 @@ int			Bimage::levelmask_region_size()
 **/
 Bplot*		Bimage::levelmask_size_histogram()
 {
-	long				i, j, nseg((long)(max+ 1.9));
+	long				i, j, nseg((long)(maximum()+ 1.9));
 	long				vmin(datasize), vmax(0);
 	double				vavg(0), vstd(0);
 	vector<int>			vol(nseg, 0);
@@ -2344,7 +2620,7 @@ Matrix		Bimage::mask_interface_matrix(int img_num)
 		ne = n - 1;
 	}
 	
-	long 			i, j, xx, yy, zz, nn, kx, ky, kz, m(max+1.9);
+	long 			i, j, xx, yy, zz, nn, kx, ky, kz, m(maximum()+1.9);
 	long			vi, vj;
 	long			xlo, xhi, ylo, yhi, zlo, zhi;
 	long			imgsize(x*y*z);
@@ -2556,7 +2832,7 @@ long		Bimage::mask_merge_delete(long min_size, long min_if)
 **/
 long		Bimage::apply_soft_mask(long nn, Bimage* pmask, int fill_type, double fill)
 {
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) fill = background(nn);
 
 	long		i, j;
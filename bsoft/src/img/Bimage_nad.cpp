@@ -4,7 +4,7 @@
 @author Achilleas Frangakis
 @author Bernard Heymann
 @date	Created: 20020803
-@date	Modified: 20161210 (BH)
+@date	Modified: 20261018 (BH)
 **/
 
 #include "Bimage.h"
@@ -33,7 +33,7 @@ Bimage*		Bimage::structure_tensor_2D(long nn)
 	
 	for ( i=nn*image_size(), k=yy=0; yy<y; yy++ ) {
 		for ( xx=0; xx<x; xx++, i++ ) {
-			dx = dy = -avg;
+			dx = dy = -average();
 			if ( xx > 0 ) dx = -(*this)[i-1];
 			if ( xx < x-1 ) dx += (*this)[i+1];
 			else dx += avg;
@@ -78,7 +78,7 @@ Bimage*		Bimage::structure_tensor(long zs, long zw)
 	for ( zz=zs, zf=zs+zw, k=0, i=nxy*zs; zz<zf; zz++ ) {
 		for ( yy=0; yy<y; yy++ ) {
 			for ( xx=0; xx<x; xx++, i++ ) {
-				dx = dy = dz = -avg;
+				dx = dy = dz = -average();
 				if ( xx > 0 ) dx = -(*this)[i-1];
 				if ( xx < x-1 ) dx += (*this)[i+1];
 				else dx += avg;
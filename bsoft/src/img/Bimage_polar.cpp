@@ -3,7 +3,7 @@
 @brief	Library routines for polar and spherical transformations and calculations
 @author Bernard Heymann
 @date	Created: 19990904
-@date	Modified: 20200509
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -180,7 +180,7 @@ Bimage* 	Bimage::radial(long minrad, long maxrad, double rad_step,
 	if ( verbose & VERB_DEBUG )
 		cout << "DEBUG Bimage:radial: prad size = " << prad->sizeX() << endl;
 	
-	prad->statistics();
+	prad->statistics_invalidate();
 	
 	return prad;
 }
@@ -339,13 +339,13 @@ double*		Bimage::radial_fit(Bimage* pref)
 	
 	// Amplitude scaling estimated from the standard deviations
 	simp.parameter(1, 1);
-	if ( std != 0 && pref->standard_deviation() != 0 )
-		simp.parameter(1, pref->standard_deviation()/std);
-	else if ( max - min > 0 && pref->maximum() - pref->minimum() > 0 )
-		simp.parameter(1, (pref->maximum() - pref->minimum())/(max - min));
+	if ( standard_deviation() != 0 && pref->standard_deviation() != 0 )
+		simp.parameter(1, pref->standard_deviation()/standard_deviation());
+	else if ( maximum() - minimum() > 0 && pref->maximum() - pref->minimum() > 0 )
+		simp.parameter(1, (pref->maximum() - pref->minimum())/(maximum() - minimum()));
 	
 	// Amplitude shift estimated from the averages
-	simp.parameter(2, pref->average() - avg*simp.parameter(1));
+	simp.parameter(2, pref->average() - average()*simp.parameter(1));
 //	if ( simp.parameter(2] < 1e-6 && max - min > 0 && pref->maximum() - pref->minimum() > 0 )
 //		simp.parameter(2, (pref->maximum() - pref->minimum() + max - min)/2.0;
 	
@@ -459,7 +459,7 @@ Bimage* 	Bimage::radial_to_full(Vector3<long> nusize, Vector3<double> origin)
 	if ( verbose )
 		cout << "Pixels generated:               " << nexp << endl << endl;
 	
-	p->statistics();
+	p->statistics_invalidate();
 	
 	return p;
 }
@@ -554,7 +554,7 @@ Bimage*		Bimage::cartesian_to_spherical(long nannuli, long nphi, long ntheta)
 	if ( verbose & VERB_DEBUG )
 		cout << "DEBUG Bimage::cartesian_to_spherical: Calculating statistics" << endl;
 	
-	statistics();
+	statistics_invalidate();
 
 	return psph;
 }
@@ -667,7 +667,7 @@ Bimage*		Bimage::cartesian_to_cylindrical(long nannuli, long nphi, int flag)
 	if ( verbose & VERB_DEBUG )
 		cout << "DEBUG Bimage::cartesian_to_cylindrical: Calculating statistics" << endl;
 	
-	statistics();
+	statistics_invalidate();
 
 	return pcyl;
 }
@@ -688,70 +688,83 @@ Bimage*		Bimage::cartesian_to_cylindrical(long nannuli, long nphi, int flag)
 	The resultant image contains lines corresponding to integrated blocks
 		covering 360° of angle.
 	The sampling must be isotropic.
-	The origins within the sub-image structures are used.
-	The interpolation routine actually calculates the old cartesian 
-	coordinates for each set of cylindrical coordinates.
+	Only the first sub-image is transformed, using a sampling plan set up
+	with its origin. To transform a stack, or to transform many images
+	of the same size, set up a Bpolar_plan once and use the overload 
+	taking the plan.
 
 **/
 Bimage* 	Bimage::polar_transform(long nangles, long ann_min, long ann_max,
 				long dann, long zmin, long zmax, long zinc)
 {
-	change_type(Float);
-	
-	if ( dann < 1 ) dann = 1;
-	if ( ann_min >= x/2 ) ann_min = x/2;
-	if ( ann_max < 1 || ann_max >= x/2 ) ann_max = x/2;
-	if ( ann_max >= y/2 ) ann_max = y/2;
-	if ( ann_min > ann_max ) swap(ann_min, ann_max);
-	if ( ann_min == ann_max ) ann_max = ann_min + dann;
-	
-	if ( zinc < 1 ) zinc = 1;
-	if ( zmin > zmax ) swap(zmin, zmax);
-	if ( zmin == zmax ) zmax = zmin + zinc;
-	if ( zmax >= z ) zmax = z - 1;
-
-	long			i, ann, ang, r, zz, iz;
-	long			nannuli((ann_max - ann_min)/dann + 1);
-	long			nz((zmax - zmin)/zinc + 1);
-	double			a, cosa, sina;
-	double			dang(M_PI*2.0/nangles);
-	Vector3<double>	coor;
-	
-	Bimage* 		p = new Bimage(Float, TSimple, nangles, nannuli, nz, 1);
+	Bpolar_plan		plan(size(), image->origin(), nangles, ann_min, ann_max,
+						dann, zmin, zmax, zinc);
 
 	if ( verbose & VERB_PROCESS ) {
 		cout << "Calculating a polar image from " << file_name() << endl;
-		cout << "Image size:                     " << nangles << " x " << nannuli << " x " << nz << endl;
-		cout << "Angular step size:              " << dang*180/M_PI << " degrees" << endl;
-		cout << "Annular range:                  " << ann_min << " - " << ann_max << " pixels" << endl;
-		cout << "Annular step size:              " << dann << " pixels" << endl;
-		cout << "Z range:                        " << zmin << " - " << zmax << " pixels" << endl;
-		cout << "Z step size:                    " << zinc << " pixels" << endl << endl;
+		cout << "Image size:                     " << plan.polar_size()[0] << " x " << plan.polar_size()[1] << " x " << plan.polar_size()[2] << endl;
+		cout << "Angular step size:              " << 360.0/plan.angles() << " degrees" << endl;
+		cout << "Annular range:                  " << plan.annulus_min() << " - " << plan.annulus_max() << " pixels" << endl;
+		cout << "Annular step size:              " << plan.annulus_width() << " pixels" << endl;
+		cout << "Z range:                        " << plan.z_min() << " - " << plan.z_max() << " pixels" << endl;
+		cout << "Z step size:                    " << plan.z_increment() << " pixels" << endl << endl;
 	} else if ( verbose & VERB_LABEL )
 		cout << "Calculating a polar image" << endl << endl;
 
-	for ( i=0, zz=zmin; zz<=zmax; zz+=zinc ) {
-		for ( ann=ann_min; ann<=ann_max; ann+=dann ) {
-			for ( ang=0; ang<nangles; ang++, i++ ) {
-				a = dang*ang;
-				cosa = cos(a);
-				sina = sin(a);
-				for ( iz=zz; iz<zz+zinc; iz++ ) {
-					for ( r=ann; r<ann+dann; r++ ) {
-						coor[0] = r*cosa + image->origin()[0];
-						coor[1] = r*sina + image->origin()[1];
-						coor[2] = iz;
-						p->add(i, interpolate(coor));
-					}
-				}
-			}
-		}
+	change_type(Float);
+	
+	Bimage* 		p = new Bimage(Float, TSimple, plan.polar_size(), 1);
+
+	plan.apply((float *) data_pointer(), (float *) p->data_pointer());
+	
+	p->statistics_invalidate();
+	
+	return p;
+}
+
+/**
+@brief 	Converts an image to cylindrical or polar form using a sampling plan.
+@param 	&plan		polar sampling plan for the image size.
+@return Bimage*		cylindrical image, NULL on error.
+
+	The plan holds the bilinear source indices and weights, so that 
+	each polar pixel is a short weighted sum over the input data.
+	The sub-images are transformed in parallel.
+	The image is converted to floating point.
+
+**/
+Bimage* 	Bimage::polar_transform(Bpolar_plan& plan)
+{
+	if ( plan.image_size() != size() ) {
+		cerr << "Error in Bimage::polar_transform: The plan size (" << plan.image_size()
+			<< ") does not match the image size (" << size() << ")" << endl;
+		return NULL;
 	}
 	
+	change_type(Float);
+	
+	Vector3<long>	psize(plan.polar_size());
+	long			imgsize(x*y*z), polsize(psize.volume());
+	
+	Bimage* 		p = new Bimage(Float, TSimple, psize, n);
+
+	float*			fdata = (float *) data_pointer();
+	float*			pdata = (float *) p->data_pointer();
+	
 	if ( verbose & VERB_DEBUG )
-		cout << "DEBUG Bimage::polar_transform: Calculating statistics" << endl;
+		cout << "DEBUG Bimage::polar_transform: Plan terms = " << plan.terms() << endl;
+	
+#ifdef HAVE_GCD
+	dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t nn){
+		plan.apply(fdata + nn*imgsize, pdata + nn*polsize);
+	});
+#else
+#pragma omp parallel for
+	for ( long nn=0; nn<n; nn++ )
+		plan.apply(fdata + nn*imgsize, pdata + nn*polsize);
+#endif
 	
-	p->statistics();
+	p->statistics_invalidate();
 	
 	return p;
 }
@@ -904,7 +917,7 @@ int		 	Bimage::radial_shells()
 
 	data_assign((unsigned char *) shell);
 	
-	statistics();
+	statistics_invalidate();
 
 	return 0;
 }
@@ -976,7 +989,7 @@ int		 	Bimage::cylindrical_shells()
 
 	data_assign((unsigned char *) shell);
 	
-	statistics();
+	statistics_invalidate();
 
 	return 0;
 }
@@ -1139,7 +1152,7 @@ Bimage*		Bimage::radial_sections(double rad_start, double rad_end,
 	if ( rad_end < rad_start ) rad_end = rad_start;
 	if ( rad_step <= 0 ) rad_step = 1;
 
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) {
 		if ( fabs(background(long(0))) < 1e-6 )
 			calculate_background();
@@ -1175,7 +1188,7 @@ Bimage*		Bimage::radial_sections(double rad_start, double rad_end,
 #endif
 	}
 	
-	prad->statistics();
+	prad->statistics_invalidate();
 	
 	return prad;
 }
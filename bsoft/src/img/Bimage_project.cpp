@@ -3,7 +3,7 @@
 @brief	Functions for projections
 @author Bernard Heymann
 @date	Created: 20010420
-@date	Modified: 20220620
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -54,8 +54,8 @@ Bimage*		Bimage::project(char axis, int flags)
 	
     long			   ds(n*x*y*c);
     
-    if ( mxproj ) proj->fill(min);
-    else if ( mnproj ) proj->fill(max);
+    if ( mxproj ) proj->fill(minimum());
+    else if ( mnproj ) proj->fill(maximum());
 	
 	if ( verbose & VERB_LABEL )
     	cout << "Projecting along " << axis <<  " (" << flags << ")" << endl << endl;
@@ -3,7 +3,7 @@
 @brief	Library routines to rescale images
 @author Bernard Heymann
 @date	Created: 19990321
-@date	Modified: 20210110
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -105,8 +105,8 @@ int 		Bimage::rescale_to_min_max(double numin, double numax)
 		return -1;
 	}
 	
-    double			scale = (numax - numin)/(max - min);
-	double			shift = numin - min*scale;
+    double			scale = (numax - numin)/(maximum() - minimum());
+	double			shift = numin - minimum()*scale;
     
 	if ( verbose & VERB_FULL )
 	    cout << "Rescaling to:                   " << numin << " " << numax << endl;
@@ -167,13 +167,13 @@ int 		Bimage::rescale_to_avg_std(double nuavg, double nustd)
 		return -1;
 	}
 	
-	if ( std < 1e-30 ) if ( statistics() ) {
+	if ( standard_deviation() < 1e-30 ) if ( statistics() ) {
 		cerr << tab << "in Bimage::rescale_to_avg_std" << endl;
 		return -1;
 	}
 	
-    double			scale = (std>1e-30)? nustd/std: 1;
-	double			shift = nuavg - avg*scale;
+    double			scale = (standard_deviation()>1e-30)? nustd/standard_deviation(): 1;
+	double			shift = nuavg - average()*scale;
     
 	if ( verbose & VERB_FULL )
 	    cout << "Rescaling to average and stdev: " << nuavg << " " << nustd << endl;
@@ -203,7 +203,7 @@ int 		Bimage::rescale_to_avg_std(long nn, double nuavg, double nustd)
 		return -1;
 	}
 	
-	if ( std < 1e-30 ) if ( statistics() ) {
+	if ( standard_deviation() < 1e-30 ) if ( statistics() ) {
 		cerr << tab << "in Bimage::rescale_to_avg_std" << endl;
 		return -1;
 	}
@@ -282,8 +282,8 @@ int 		Bimage::truncate(double minim, double maxim, double setmin, double setmax)
     double  	    v1;
     
 	// Make sure the extremes don't exceed the data
-	if ( setmin < min ) setmin = min;
-	if ( setmax > max ) setmax = max;
+	if ( setmin < minimum() ) setmin = minimum();
+	if ( setmax > maximum() ) setmax = maximum();
 	if ( minim < dtmin ) minim = dtmin;
 	if ( maxim > dtmax ) maxim = dtmax;
 	if ( setmin < dtmin ) setmin = dtmin;
@@ -348,7 +348,7 @@ int 		Bimage::truncate_to_min_max(double minim, double maxim)
 **/
 int 		Bimage::truncate_to_avg(double minim, double maxim)
 {
-	return truncate(minim, maxim, avg, avg);
+	return truncate(minim, maxim, average(), average());
 }
 
 /**
@@ -437,7 +437,7 @@ int 		Bimage::limit_levels(int nlevels)
 	
     long   i;
     double			unit = 255.0/(nlevels - 1);
-    double			scale = 0.999*nlevels/(max - min);
+    double			scale = 0.999*nlevels/(maximum() - minimum());
 	
     unsigned char* 	nudata = new unsigned char[datasize];
 
@@ -445,7 +445,7 @@ int 		Bimage::limit_levels(int nlevels)
 	    cout << "Restricting to " << nlevels << " levels." << endl << endl;
 	
 	for ( i=0; i<datasize; i++ )
-		nudata[i] = (unsigned char) (unit*floor(((*this)[i] - min)*scale));
+		nudata[i] = (unsigned char) (unit*floor(((*this)[i] - minimum())*scale));
     
 	data_type(UCharacter);
 
@@ -535,7 +535,7 @@ int			Bimage::normalize(long imgnum, double average, double stdev, int norm_type
 **/
 int			Bimage::normalize(double average, double stdev, int norm_type)
 {
-	int				bins = (int) max;
+	int				bins = (int) maximum();
 	if ( bins < 256 ) bins = 256;
 	if ( bins > 1024 ) bins = 1024;
 	
@@ -727,7 +727,7 @@ void		Bimage::logarithm()
 
 	if ( datatype < Float ) change_type(Float);
 	
-	double			norm = 1.0/std;
+	double			norm = 1.0/standard_deviation();
 	
 	for ( long i=0; i<datasize; i++ )
 		set(i, log(((*this)[i] - min)*norm + 1));
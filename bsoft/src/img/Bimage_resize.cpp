@@ -3,7 +3,7 @@
 @brief	Library routines to resize images
 @author Bernard Heymann
 @date	Created: 19990321
-@date	Modified: 20150618
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -37,9 +37,9 @@ int			Bimage::resize(Vector3<long> nusize, Vector3<long> translate,
 	if ( nusize[1] < 1 ) nusize[1] = y;
 	if ( nusize[2] < 1 ) nusize[2] = z;
 	
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
-	if ( fill_type == FILL_MIN ) fill = min;
-	if ( fill_type == FILL_MAX ) fill = max;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
+	if ( fill_type == FILL_MIN ) fill = minimum();
+	if ( fill_type == FILL_MAX ) fill = maximum();
 
 	long			i, j, xx, yy, zz, nn;
 	long			oldx, oldy, oldz;
@@ -133,9 +133,9 @@ Bimage*		Bimage::resize_copy(Vector3<long> nusize, Vector3<long> translate,
 	long			i, j, cc, xx, yy, zz, nn;
 	long			oldx, oldy, oldz;
 
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
-	if ( fill_type == FILL_MIN ) fill = min;
-	if ( fill_type == FILL_MAX ) fill = max;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
+	if ( fill_type == FILL_MIN ) fill = minimum();
+	if ( fill_type == FILL_MAX ) fill = maximum();
 	
 	if ( verbose & VERB_PROCESS ) {
 		cout << "Resizing:" << endl;
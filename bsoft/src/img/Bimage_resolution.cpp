@@ -3,11 +3,12 @@
 @brief	Library routines to estimate resolution 
 @author 	Bernard Heymann
 @date	Created: 20000611
-@date	Modified: 20220324
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
 #include "utilities.h"
+#include "timer.h"
 
 #define	LORESLIM	200
 
@@ -463,7 +464,7 @@ Bimage*		Bimage::fsc_shell(Bimage* p, double hi_res, double* cutoff,
 	statistics();
 	p->change_type(Float) ;
 	p->statistics();
-	p->rescale_to_avg_std(avg, std);
+	p->rescale_to_avg_std(average(), standard_deviation());
 	
 	Bimage*			pr = copy_header(nmap);
 	pr->data_type(Float);
@@ -576,6 +577,194 @@ double*		Bimage::fsc_local_voxel(Bimage* p, double hi_res, int size,
 	return res_est;
 }
 
+/*
+	Tables shared by all the local FSC boxes:
+	The window weights, the shell index tables for the half transform
+	and the batched and single transform plans.
+*/
+struct Bfsc_local {
+	long			size;			// Box size
+	long			ftsize;			// Padded box size
+	long			ftvol;			// Padded box volume
+	long			ftstep;			// Box stride in the batch, a multiple of 32 bytes
+	long			nbatch;			// Number of boxes transformed together
+	int				taper;			// Tapering function
+	double			hi_res;			// High resolution limit
+	double*			cutoff;			// FSC thresholds
+	long			nmap;			// Number of output maps
+	long			maxrad;			// Number of shells
+	double			rad_scale;		// Shell radius scale
+	vector<double>	window;			// Taper weights within the box
+	vector<long>	sidx;			// Transform index in the half transform
+	vector<long>	smir;			// Friedel mate index
+	vector<long>	shell;			// Lower shell index
+	vector<double>	frac;			// Fraction for the upper shell
+	fft_plan		planmany;		// Plan for a full batch
+	fft_plan		plan;			// Plan for a single box
+};
+
+/*
+	Extracts, tapers and pads the boxes around voxel k from both maps and
+	packs them into one complex box, as done by extract, edge/hanning_taper,
+	pad and pack_two_in_complex.
+*/
+static void	fsc_local_box(Bimage* p1, Bimage* p2, const Bfsc_local& lf, long k, Complex<float>* box)
+{
+	long			i, j, xx, yy, zz, cc, nn, bx, by, bz, ox, oy, oz;
+	long			size(lf.size), h(size/2), boxvol(size*size*size);
+	double			fill1(p1->average()), fill2(p2->average()), w, sum1(0), sum2(0);
+	float			v1, v2;
+	
+	p1->coordinates(k, cc, xx, yy, zz, nn);
+	
+	vector<float>	b1(boxvol), b2(boxvol);
+	
+	for ( i=bz=0, oz=zz-h; bz<size; ++bz, ++oz ) {
+		for ( by=0, oy=yy-h; by<size; ++by, ++oy ) {
+			for ( bx=0, ox=xx-h; bx<size; ++bx, ++ox, ++i ) {
+				if ( p1->within_boundaries(ox, oy, oz) ) {
+					j = p1->index(ox, oy, oz, nn);
+					b1[i] = (*p1)[j];
+					b2[i] = (*p2)[j];
+				} else {
+					b1[i] = b2[i] = 0;
+				}
+			}
+		}
+	}
+	
+	if ( lf.taper == 2 ) {
+		for ( i=0; i<boxvol; ++i ) {
+			w = lf.window[i];
+			b1[i] = (b1[i] - fill1)*w + fill1;
+			b2[i] = (b2[i] - fill2)*w + fill2;
+		}
+	} else if ( lf.taper == 1 ) {
+		for ( i=0; i<boxvol; ++i ) {
+			w = lf.window[i];
+			b1[i] = w * b1[i] + (1 - w) * fill1;
+			b2[i] = w * b2[i] + (1 - w) * fill2;
+			sum1 += b1[i];
+			sum2 += b2[i];
+		}
+		fill1 = sum1/boxvol;
+		fill2 = sum2/boxvol;
+	}
+	
+	v1 = fill1;
+	v2 = fill2;
+	
+	for ( i=bz=0; bz<lf.ftsize; ++bz ) {
+		for ( by=0; by<lf.ftsize; ++by ) {
+			for ( bx=0; bx<lf.ftsize; ++bx, ++i ) {
+				if ( bx < size && by < size && bz < size ) {
+					j = (bz*size + by)*size + bx;
+					box[i] = Complex<float>(b1[j], b2[j]);
+				} else {
+					box[i] = Complex<float>(v1, v2);
+				}
+			}
+		}
+	}
+}
+
+/*
+	Accumulates the FSC shell sums of both maps from one packed transform
+	and returns the resolution at each threshold, as done by fsc_dpr.
+*/
+static void	fsc_local_estimate(const Bfsc_local& lf, Complex<float>* box, double* res_est)
+{
+	long			i, k, ir, ir2;
+	double			f, f2, I1, I2, F1F2re;
+	Complex<double>	c1, c2, sf1, sf2;
+	
+	vector<double>	F1(lf.maxrad,0);
+	vector<double>	F2(lf.maxrad,0);
+	vector<double>	FSC(lf.maxrad,0);
+	
+	for ( k=0; k<lf.sidx.size(); ++k ) {
+		i = lf.sidx[k];
+		c1 = Complex<double>(box[i].real(), box[i].imag());
+		i = lf.smir[k];
+		c2 = Complex<double>(box[i].real(), box[i].imag());
+		sf1 = c1.unpack_first(c2);
+		sf2 = c1.unpack_second(c2);
+		I1 = sf1.power();
+		I2 = sf2.power();
+		F1F2re = sf1.real()*sf2.real() + sf1.imag()*sf2.imag();
+		ir = lf.shell[k];
+		ir2 = ir + 1;
+		f = lf.frac[k];
+		f2 = 1.0 - f;
+		F1[ir] += f2*I1;
+		F1[ir2] += f*I1;
+		F2[ir] += f2*I2;
+		F2[ir2] += f*I2;
+		FSC[ir] += f2*F1F2re;
+		FSC[ir2] += f*F1F2re;
+	}
+	
+	Bplot*			plot = new Bplot(1, lf.maxrad, 2);
+	
+	(*plot)[0] = 0;
+	(*plot)[lf.maxrad] = 1;
+	for ( i=1; i<lf.maxrad; i++ ) {
+		if ( F1[i]*F2[i] > SMALLFLOAT ) FSC[i] /= sqrt(F1[i]*F2[i]);
+		if ( FSC[i] < -1 ) FSC[i] = -1;
+		if ( FSC[i] > 1 ) FSC[i] = 1;
+		(*plot)[i] = i/lf.rad_scale;
+		(*plot)[lf.maxrad+i] = FSC[i];
+	}
+	
+	for ( long j=0; j<4; ++j ) {
+		res_est[j] = 0;
+		if ( lf.cutoff[j] ) {
+			res_est[j] = 1/plot->cut(1, lf.cutoff[j], -1);
+			if ( res_est[j] < lf.hi_res ) res_est[j] = lf.hi_res;
+			if ( res_est[j] > LORESLIM ) res_est[j] = LORESLIM;
+		}
+	}
+	
+	delete plot;
+}
+
+/*
+	Calculates the local resolution for all the selected voxels in one slice.
+	The boxes are packed into a contiguous stack and transformed in batches.
+*/
+static long	fsc_local_slice(Bimage* p1, Bimage* p2, Bimage* pmask, Bimage* pr,
+				const Bfsc_local& lf, long zz)
+{
+	long			i, j, k, m, nb;
+	long			slice_size(p1->sizeX()*p1->sizeY()), imgsize(p1->image_size());
+	double			res_est[4];
+	vector<long>	vox;
+	
+	for ( i=0, k=zz*slice_size; i<slice_size; ++i, ++k )
+		if ( (*pmask)[k] ) vox.push_back(k);
+	
+	if ( vox.empty() ) return 0;
+	
+	vector<Complex<float>>	stack(lf.nbatch*lf.ftstep);
+	
+	for ( m=0; m<vox.size(); m+=lf.nbatch ) {
+		nb = vox.size() - m;
+		if ( nb > lf.nbatch ) nb = lf.nbatch;
+		for ( i=0; i<nb; ++i )
+			fsc_local_box(p1, p2, lf, vox[m+i], &stack[i*lf.ftstep]);
+		if ( nb == lf.nbatch )
+			fftw(lf.planmany, stack.data());
+		else for ( i=0; i<nb; ++i )
+			fftw(lf.plan, &stack[i*lf.ftstep]);
+		for ( i=0; i<nb; ++i ) {
+			fsc_local_estimate(lf, &stack[i*lf.ftstep], res_est);
+			for ( j=0; j<lf.nmap; ++j ) pr->set(vox[m+i] + j*imgsize, res_est[j]);
+		}
+	}
+	
+	return vox.size();
+}
+
 /**
 @author Giovanni Cardone and Bernard Heymann
 @brief 	Determine the local resolution at each masked voxel in a map.
@@ -606,7 +795,7 @@ Bimage*		Bimage::fsc_local(Bimage* p, Bimage* pmask, double hi_res, double* cuto
 
 	int				dovox;
 	long   			xx, yy, zz, i, nmap(0), nvox(0);
-	long			ft_size(size), slice_size(x*y), imgsize(image_size());
+	long			ft_size(size), imgsize(image_size());
 	
 	if ( vedge[0] < 0 ) vedge = Vector3<long>(size/2, size/2 ,size/2);
 
@@ -637,7 +826,7 @@ Bimage*		Bimage::fsc_local(Bimage* p, Bimage* pmask, double hi_res, double* cuto
 	statistics();
 	p->change_type(Float) ;
 	p->statistics();
-	p->rescale_to_avg_std(avg, std);
+	p->rescale_to_avg_std(average(), standard_deviation());
 	
 	Bimage*			pr = copy_header(nmap);
 	pr->data_alloc();
@@ -671,12 +860,98 @@ Bimage*		Bimage::fsc_local(Bimage* p, Bimage* pmask, double hi_res, double* cuto
 
 //	write_img("locres_mask.map", pmask);
 
-	fft_plan		plan = fft_setup_plan(ft_size, ft_size, ft_size, FFTW_FORWARD, 1);
+	// Window weights and shell tables shared by all boxes
+	Bfsc_local		lf;
+	lf.size = size;
+	lf.ftsize = ft_size;
+	lf.ftvol = ft_size*ft_size*ft_size;
+	lf.ftstep = (lf.ftvol + 3) & ~3L;		// Keeps every box aligned like the first for FFTW
+	lf.nbatch = (1L<<22)/(lf.ftstep*sizeof(Complex<float>));
+	if ( lf.nbatch < 1 ) lf.nbatch = 1;
+	if ( lf.nbatch > 16 ) lf.nbatch = 16;
+	lf.taper = taper;
+	lf.hi_res = hi_res;
+	lf.cutoff = cutoff;
+	lf.nmap = nmap;
+	
+	Vector3<long> 	boxsize(size,size,size);
+	if ( taper == 1 ) {
+		Vector3<long> 	taper_size(boxsize/2);
+		Vector3<double> taper_start(boxsize/4);
+		Bimage*			pbox = new Bimage(Float, TSimple, boxsize, 1);
+		Bimage*			pedge = pbox->edge_mask(1, taper_size, taper_start, size/4.0);
+		for ( i=0; i<pedge->image_size(); ++i ) lf.window.push_back((*pedge)[i]);
+		delete pbox;
+		delete pedge;
+	} else if ( taper == 2 ) {
+		Vector3<double>	han;
+		double			cx = M_PI * 2.0L / ( size - 1);
+		for ( zz=0; zz<size; ++zz ) {
+			han[2] = 0.5 * (1. - cos(cx*zz));
+			for ( yy=0; yy<size; ++yy ) {
+				han[1] = 0.5 * (1. - cos(cx*yy));
+				for ( xx=0; xx<size; ++xx ) {
+					han[0] = 0.5 * (1. - cos(cx*xx));
+					lf.window.push_back(han.volume());
+				}
+			}
+		}
+	}
+	
+	Bimage*			pft = new Bimage(Float, TComplex, ft_size, ft_size, ft_size, 1);
+	pft->sampling(image->sampling());
+	double			hi_box(hi_res);
+	pft->check_resolution(hi_box);
+	Vector3<double>	freq_scale(1/pft->real_size());
+	lf.rad_scale = pft->real_size()[0];
+	lf.maxrad = (long) (2 + lf.rad_scale/hi_box);
+	delete pft;
+	
+	long			j, ix, iy, iz, ir;
+	double			rx, ry, rz, radius;
+	for ( zz=0; zz<ft_size; zz++ ) {
+		rz = zz;
+		if ( rz > (ft_size - 1)/2 ) rz -= ft_size;
+		rz *= freq_scale[2];
+		iz = -zz;
+		if ( iz < 0 ) iz += ft_size;
+		for ( yy=0; yy<ft_size; yy++ ) {
+			ry = yy;
+			if ( ry > (ft_size - 1)/2 ) ry -= ft_size;
+			ry *= freq_scale[1];
+			iy = -yy;
+			if ( iy < 0 ) iy += ft_size;
+			for ( xx=0; xx<ft_size/2; xx++ ) {
+				i = (zz*ft_size + yy)*ft_size + xx;
+				rx = xx;
+				if ( xx > (ft_size - 1)/2 ) rx -= ft_size;
+				rx *= freq_scale[0];
+				ix = -xx;
+				if ( ix < 0 ) ix += ft_size;
+				radius = lf.rad_scale*sqrt(rx*rx + ry*ry + rz*rz);
+				ir = (long) radius;
+				if ( ir + 1 < lf.maxrad ) {
+					j = (iz*ft_size + iy)*ft_size + ix;
+					lf.sidx.push_back(i);
+					lf.smir.push_back(j);
+					lf.shell.push_back(ir);
+					lf.frac.push_back(radius - ir);
+				}
+			}
+		}
+	}
+
+	lf.planmany = fft_setup_plan_many(Vector3<long>(ft_size, ft_size, ft_size), lf.nbatch, FFTW_FORWARD, 1, lf.ftstep);
+	lf.plan = fft_setup_plan(ft_size, ft_size, ft_size, FFTW_FORWARD, 1);
 	
 	if ( verbose ) {
 		for ( i=nvox=0; i<datasize; i++ ) if ( (*pmask)[i] ) nvox++;
-		cout << "Boxes to calculate:             " << nvox << endl << endl;
+		cout << "Boxes to calculate:             " << nvox << endl;
+		cout << "Boxes per transform batch:      " << lf.nbatch << endl << endl;
 	}
+	
+	double			ti = timer_start();
+	
 /*
 #ifdef HAVE_GCD
 	__block	long		ndone(0);
@@ -718,39 +993,22 @@ Bimage*		Bimage::fsc_local(Bimage* p, Bimage* pmask, double hi_res, double* cuto
 	__block	long		ndone(0);
 	dispatch_queue_t 	myq = dispatch_queue_create(NULL, NULL);
 	dispatch_apply(z, dispatch_get_global_queue(0, 0), ^(size_t zz){
-		long			i, k;
-		for ( i=0, k=zz*slice_size; i<slice_size; ++i, ++k ) {
-			if ( (*pmask)[k] ) {
-				double*		res_est = fsc_local_voxel(p, hi_res,
-								size, pad, taper, cutoff, plan, k);
-				for ( long j=0; j<nmap; ++j ) pr->set(k + j*imgsize, res_est[j]);
-				delete[] res_est;
-				ndone++;
-			}
-		}
-		if ( verbose ) {
-			dispatch_sync(myq, ^{
+		long			nd = fsc_local_slice(this, p, pmask, pr, lf, zz);
+		dispatch_sync(myq, ^{
+			ndone += nd;
+			if ( verbose )
 				cerr << "Complete:                       " << setprecision(3)
 						<< ndone*100.0/nvox << " %    \r" << flush;
-			});
-		}
+		});
 	});
 #else
 	long				ndone(0);
 #pragma omp parallel for
 	for ( long zz=0; zz<z; zz++ ) {
-		long			i, k;
-		for ( i=0, k=zz*slice_size; i<slice_size; ++i, ++k ) {
-			if ( (*pmask)[k] ) {
-				double*		res_est = fsc_local_voxel(p, hi_res,
-							size, pad, taper, cutoff, plan, k);
-				for ( long j=0; j<nmap; ++j ) pr->set(k + j*imgsize, res_est[j]);
-				delete[] res_est;
-				ndone++;
-			}
-		}
+		long			nd = fsc_local_slice(this, p, pmask, pr, lf, zz);
 	#pragma omp critical
 		{
+			ndone += nd;
 			if ( verbose )
 					cerr << "Complete:                       " << setprecision(3)
 							<< ndone*100.0/nvox << " %    \r" << flush;
@@ -758,7 +1016,8 @@ Bimage*		Bimage::fsc_local(Bimage* p, Bimage* pmask, double hi_res, double* cuto
 	}
 #endif
 
-	fft_destroy_plan(plan);
+	fft_destroy_plan(lf.planmany);
+	fft_destroy_plan(lf.plan);
 	
 	for ( i=nvox=0; i<imgsize; i++ ) if ( fabs((*pr)[i] - fill) > 1e-10 ) nvox++;
 	
@@ -767,6 +1026,9 @@ Bimage*		Bimage::fsc_local(Bimage* p, Bimage* pmask, double hi_res, double* cuto
 		cout << "Boxes calculated:               " << nvox << endl << endl;
 	}
 	
+	if ( verbose & VERB_TIME )
+		cout << "Local resolution time:          " << getwalltime() - ti << " s" << endl << endl;
+	
 	if ( verbose & VERB_FULL ) {
 		cout << "x\ty\tz\tResolution" << endl;
 		for ( zz=0; zz<pr->sizeZ(); zz+=step ) {
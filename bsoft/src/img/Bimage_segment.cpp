@@ -3,7 +3,7 @@
 @brief	Methods for segmentation.
 @author	Bernard Heymann and Samuel Payne
 @date	Created: 20010516
-@date	Modified: 20210118 (BH)
+@date	Modified: 20261018 (BH)
 **/
 
 #include "rwimg.h"
@@ -41,7 +41,7 @@ Bimage* 	Bimage::regions(double threshold, int sign)
 	else if ( sign > 0 ) sign = 1;
 	else {
 		sign = 1;
-		if ( threshold < avg ) sign = -1;
+		if ( threshold < average() ) sign = -1;
 	}
 	
 	long	   		i, count(0), rsize;
@@ -108,7 +108,7 @@ long		Bimage::region_assign(Bimage* pmask, long idx,
 	else if ( sign > 0 ) sign = 1;
 	else {
 		sign = 1;
-		if ( threshold < avg ) sign = -1;
+		if ( threshold < average() ) sign = -1;
 	}
 	
 	double			abs_threshold(sign*threshold);
@@ -574,7 +574,7 @@ long 		Bimage::blobs(double threshold, double min_size, double max_size,
 	else if ( sign > 0 ) sign = 1;
 	else {
 		sign = 1;
-		if ( threshold < avg ) sign = -1;
+		if ( threshold < average() ) sign = -1;
 	}
 	
 	if ( verbose & ( VERB_LABEL | VERB_PROCESS ) ) {
@@ -652,13 +652,13 @@ int			Bimage::filter_extremes()
 {
 	statistics();
 	
-	double		threshold = avg + 3*std;
-	if ( threshold >= max ) threshold = (max - avg)*0.75 + avg;
+	double		threshold = average() + 3*standard_deviation();
+	if ( threshold >= maximum() ) threshold = (maximum() - average())*0.75 + average();
 	
 	blobs(threshold, 100, 1e30, avg, 0);
 
-	threshold = avg - 3*std;
-	if ( threshold <= min ) threshold = (min - avg)*0.75 + avg;
+	threshold = average() - 3*standard_deviation();
+	if ( threshold <= minimum() ) threshold = (minimum() - average())*0.75 + average();
 	
 	blobs(threshold, 1000, 1e30, avg, 0);
 	
@@ -706,8 +706,8 @@ int			Bimage::filter_extremes(double tmin, double tmax, int kernel)
 {
 	if ( !data_pointer() ) return -1;
 	
-    if ( tmin < min ) tmin = min;
-    if ( tmax > max ) tmax = max;
+    if ( tmin < minimum() ) tmin = minimum();
+    if ( tmax > maximum() ) tmax = maximum();
 	if ( tmin > tmax ) swap(tmin, tmax);
 	if ( kernel < 3 ) kernel = 3;
    
@@ -795,7 +795,7 @@ long		Bimage::replace_maxima(double threshold)
 						if ( rmax[j][1] < yy ) rmax[j][1] = yy;
 						if ( rmax[j][2] < zz ) rmax[j][2] = zz;
 						val = kernel_average(i, 3, -1e30, threshold);
-						if ( val > min ) {
+						if ( val > minimum() ) {
 							a[j] += val;
 							na[j]++;
 						}
@@ -920,7 +920,7 @@ double 		Bimage::mass_threshold(long img_num, double mol_weight, double rho)
 	double			thresh_step;
 	double			vol_diff;
 	double			min_vol(vs);
-	double			min_step(1e-6*std);
+	double			min_step(1e-6*standard_deviation());
 	
 	if ( verbose & VERB_LABEL ) {
 		cout << "Finding the threshold for image " << img_num+1 << ":" << endl;
@@ -940,8 +940,8 @@ double 		Bimage::mass_threshold(long img_num, double mol_weight, double rho)
 	for ( nn=0; nn<n; nn++ ) {
 		if ( verbose & VERB_FULL )
 			cout << " Threshold\tThreshStep\tVolume(A3)\tDifference\tMass" << endl;
-		threshold = avg;
-		thresh_step = std/2;
+		threshold = average();
+		thresh_step = standard_deviation()/2;
 		nvox = 0;
 		mass = 0;
 		vol_diff = 1e30;
@@ -1035,7 +1035,7 @@ Bimage*		Bimage::internal_volume(double threshold)
 	Vector3<long>	lo, hi, nk(3,3,3), k;
 
 	int				sign(1);
-	if ( threshold < avg ) sign = -1;
+	if ( threshold < average() ) sign = -1;
 	
 	Bimage*			pv = copy();
 	pv->fill(0);
@@ -1109,7 +1109,7 @@ Bimage*		Bimage::internal_volume(double threshold, int mask_out_freq)
 	
 	int				nb, nbcut(6), sign(1);
 	if ( z < 2 ) nbcut = 2;
-	if ( threshold < avg ) sign = -1;
+	if ( threshold < average() ) sign = -1;
 	
 	Bimage*			pv = copy();
 	pv->fill(0);
@@ -1203,6 +1203,8 @@ Bimage*		Bimage::internal_volume(double threshold, int mask_out_freq)
 @param 	nregion 		number of regions.
 @param 	max_iter 	maximum number of iterations.
 @param 	ratio	 	balance between density and distance.
+@param 	local	 	flag to only compare voxels with nearby region centres.
+@param 	seed	 	random number seed for the initial centres (0 = process id).
 @return Bimage* 		segmentation mask.
 
 	The metric to choose region membership is based on the minimum of:
@@ -1214,15 +1216,30 @@ Bimage*		Bimage::internal_volume(double threshold, int mask_out_freq)
 		v:		density.
 		<v>:	region average density.
 		r:		ratio.
+	The initial region centres are placed randomly, reproducibly for a
+	given non-zero seed.
+	In the local mode (similar to SLIC superpixels), the region centres
+	are binned in a coarse grid with a spacing equal to the average region
+	size, and each voxel is only compared with the centres in the 3x3x3
+	neighbouring grid cells, or with all centres if none are nearby.
+	The image is then processed in slabs in parallel, each with its own
+	sums for the new centres.
+	If the image spans at most two grid cells along each dimension, the
+	result is the same as for the full comparison.
 
 **/
-Bimage*		Bimage::kmeans_segment(long nregion, long max_iter, double ratio)
+Bimage*		Bimage::kmeans_segment(long nregion, long max_iter, double ratio,
+				int local, unsigned long seed)
 {
-	random_seed();
+	if ( seed ) srandom(seed);
+	else random_seed();
+	
+	if ( local )
+		return kmeans_segment_local(nregion, max_iter, ratio);
 	
 	long			i, j, j4, h, k, m;
 	double			v, dv, mdv, da(1e30);
-	double			r(ratio/std);
+	double			r(ratio/standard_deviation());
 	Vector3<long> 	coor;
 	Vector3<double> vec, start, end(size()-1);
 
@@ -1304,6 +1321,210 @@ Bimage*		Bimage::kmeans_segment(long nregion, long max_iter, double ratio)
 	return pseg;
 }
 
+
+/*
+	Assigns the voxels in a range of rows (image, slice and line) to the
+	nearest region centre among the candidates for each grid cell, and
+	accumulates the sums for the new centres.
+*/
+static void	kmeans_assign_rows(long rstart, long rend, Vector3<long> size,
+				float* data, int* seg, long nregion, double* a, double r, int dens,
+				Vector3<long> cs, Vector3<long> nc, vector<long>& cbeg,
+				vector<long>& cand, long* nm, double* an)
+{
+	long			row, xx, yy, zz, k, j, j4, h, m, c, ci, cyz;
+	double			v, dv, mdv;
+	double			coor[3];
+	
+	for ( row=rstart; row<rend; ++row ) {
+		yy = row%size[1];
+		zz = (row/size[1])%size[2];
+		k = row*size[0];
+		coor[1] = yy;
+		coor[2] = zz;
+		cyz = ((zz/cs[2])*nc[1] + yy/cs[1])*nc[0];
+		for ( xx=0; xx<size[0]; ++xx, ++k ) {
+			v = data[k];
+			coor[0] = xx;
+			c = cyz + xx/cs[0];
+			for ( ci=cbeg[c], m=-1, mdv=1e30; ci<cbeg[c+1]; ++ci ) {
+				j = cand[ci];
+				j4 = 4*j;
+				dv = ( dens )? r * fabs(a[j4+3] - v): 0;
+				for ( h=0; h<3; h++ ) dv += fabs(a[j4+h] - coor[h])/size[h];
+				if ( mdv > dv || ( mdv == dv && m > j ) ) {
+					mdv = dv;
+					m = j;
+				}
+			}
+			if ( m < 0 ) {		// No nearby centres
+				for ( j=j4=0; j<nregion; j++, j4+=4 ) {
+					dv = ( dens )? r * fabs(a[j4+3] - v): 0;
+					for ( h=0; h<3; h++ ) dv += fabs(a[j4+h] - coor[h])/size[h];
+					if ( mdv > dv ) {
+						mdv = dv;
+						m = j;
+					}
+				}
+			}
+			an[4*m+3] += v;
+			for ( h=0; h<3; h++ ) an[4*m+h] += coor[h];
+			nm[m]++;
+			seg[k] = m;
+		}
+	}
+}
+
+/**
+@brief 	Segments an image based on K-means, comparing only nearby regions.
+@param 	nregion 		number of regions.
+@param 	max_iter 	maximum number of iterations.
+@param 	ratio	 	balance between density and distance.
+@return Bimage* 		segmentation mask.
+
+	See Bimage::kmeans_segment, which sets up the random number seed.
+
+**/
+Bimage*		Bimage::kmeans_segment_local(long nregion, long max_iter, double ratio)
+{
+	long			i, j, j4, h, c, ic, ix, iy, iz;
+	double			da(1e30);
+	double			r(ratio/standard_deviation());
+	Vector3<double> vec, start, end(size()-1);
+	
+	// Grid cells with the average region spacing
+	double			spacing = ( z > 1 )? pow(x*y*z*1.0/nregion, 1.0/3.0): sqrt(x*y*1.0/nregion);
+	Vector3<long>	cs((long) ceil(spacing), (long) ceil(spacing), (z > 1)? (long) ceil(spacing): 1);
+	Vector3<long>	nc((x - 1)/cs[0] + 1, (y - 1)/cs[1] + 1, (z - 1)/cs[2] + 1);
+	long			ncell(nc.volume());
+	vector<long>	cbin(ncell+1), cbeg(ncell+1), cand;
+	vector<long>	ccell(nregion), corder(nregion);
+
+	long			nrow(n*z*y), nchunk(system_processors());
+	if ( nchunk > nrow ) nchunk = nrow;
+	long			chunk((nrow - 1)/nchunk + 1);
+	vector<long>	nmc(nchunk*nregion);
+	vector<double>	anc(nchunk*4*nregion);
+	vector<double>	a(4*nregion), an(4*nregion);
+	vector<long>	nm(nregion);
+
+	Bimage*			pseg = copy_header();
+	pseg->data_type(Integer);
+	pseg->data_alloc_and_clear();
+	int*			seg = (int *) pseg->data_pointer();
+	
+	vector<float>	fdata;
+	float*			data = (float *) data_pointer();
+	if ( data_type() != Float ) {
+		fdata.resize(datasize);
+		for ( i=0; i<datasize; ++i ) fdata[i] = (*this)[i];
+		data = fdata.data();
+	}
+	
+	if ( verbose ) {
+		cout << "Segmentation using K-means:" << endl;
+		cout << "Number of regions:             " << nregion << endl;
+		cout << "Density:distance ratio:        " << ratio << endl;
+		cout << "Local grid cell size:          " << cs << endl;
+		cout << "Local grid cells:              " << nc << endl << endl;
+	}
+	
+	// Initial averages
+	for ( j=j4=0; j<nregion; j++, j4+=4 ) {
+		vec = vector3_random(start, end);
+		for ( h=0; h<3; h++ ) a[j4+h] = vec[h];
+		a[j4+3] = get(0, vec);
+		if ( verbose & VERB_FULL )
+			cout << j+1 << tab << vec << tab << a[j4+3] << endl;
+	}
+	
+	// Iterations
+	if ( verbose )
+		cout << "#\tChange" << endl;
+	for ( i=0; i<max_iter && da > 0.001; ++i ) {
+		// Bin the centres in the grid
+		std::fill(cbin.begin(), cbin.end(), 0);
+		for ( j=0; j<nregion; j++ ) {
+			ix = (long) (a[4*j]/cs[0]);
+			iy = (long) (a[4*j+1]/cs[1]);
+			iz = (long) (a[4*j+2]/cs[2]);
+			ix = (ix < 0)? 0: (ix >= nc[0])? nc[0]-1: ix;
+			iy = (iy < 0)? 0: (iy >= nc[1])? nc[1]-1: iy;
+			iz = (iz < 0)? 0: (iz >= nc[2])? nc[2]-1: iz;
+			ccell[j] = (iz*nc[1] + iy)*nc[0] + ix;
+			cbin[ccell[j]+1]++;
+		}
+		for ( c=0; c<ncell; c++ ) cbin[c+1] += cbin[c];
+		vector<long>	cpos(cbin.begin(), cbin.end()-1);
+		for ( j=0; j<nregion; j++ ) corder[cpos[ccell[j]]++] = j;
+		
+		// Candidate centres for each cell from its neighbours
+		cand.clear();
+		for ( c=iz=0; iz<nc[2]; iz++ ) for ( iy=0; iy<nc[1]; iy++ ) for ( ix=0; ix<nc[0]; ix++, c++ ) {
+			cbeg[c] = cand.size();
+			for ( long kz=(iz>0)?iz-1:0; kz<=iz+1 && kz<nc[2]; kz++ )
+				for ( long ky=(iy>0)?iy-1:0; ky<=iy+1 && ky<nc[1]; ky++ )
+					for ( long kx=(ix>0)?ix-1:0; kx<=ix+1 && kx<nc[0]; kx++ ) {
+						long	k = (kz*nc[1] + ky)*nc[0] + kx;
+						for ( long l=cbin[k]; l<cbin[k+1]; l++ ) cand.push_back(corder[l]);
+					}
+		}
+		cbeg[ncell] = cand.size();
+		
+		std::fill(nmc.begin(), nmc.end(), 0);
+		std::fill(anc.begin(), anc.end(), 0);
+		int				dens(i > 0);	// First iteration only distance
+		
+#ifdef HAVE_GCD
+		dispatch_apply(nchunk, dispatch_get_global_queue(0, 0), ^(size_t ich){
+			long	rend = (ich+1)*chunk;
+			if ( rend > nrow ) rend = nrow;
+			kmeans_assign_rows(ich*chunk, rend, size(), data, seg, nregion, a.data(), r, dens,
+				cs, nc, cbeg, cand, nmc.data() + ich*nregion, anc.data() + ich*4*nregion);
+		});
+#else
+#pragma omp parallel for
+		for ( long ich=0; ich<nchunk; ich++ ) {
+			long	rend = (ich+1)*chunk;
+			if ( rend > nrow ) rend = nrow;
+			kmeans_assign_rows(ich*chunk, rend, size(), data, seg, nregion, a.data(), r, dens,
+				cs, nc, cbeg, cand, nmc.data() + ich*nregion, anc.data() + ich*4*nregion);
+		}
+#endif
+
+		std::fill(nm.begin(), nm.end(), 0);
+		std::fill(an.begin(), an.end(), 0);
+		for ( ic=0; ic<nchunk; ic++ ) {
+			for ( j=0; j<nregion; j++ ) nm[j] += nmc[ic*nregion + j];
+			for ( j=0; j<4*nregion; j++ ) an[j] += anc[ic*4*nregion + j];
+		}
+
+		for ( j=j4=0, da=0; j<nregion; j++, j4+=4 ) {
+			if ( nm[j] < 1 ) {
+				vec = vector3_random(start, end);
+				for ( h=0; h<3; h++ ) an[j4+h] = vec[h];
+				an[j4+3] = get(0, vec);
+			}
+			if ( verbose & VERB_FULL )
+				cout << j+1 << tab << nm[j];
+			for ( h=0; h<4; h++ ) {
+				if ( nm[j] ) an[j4+h] /= nm[j];
+				da += fabs(a[j4+h] - an[j4+h]);
+				a[j4+h] = an[j4+h];
+				if ( verbose & VERB_FULL )
+					cout << tab << a[j4+h];
+			}
+			if ( verbose & VERB_FULL )
+				cout << endl;
+		}
+		da /= 4*nregion;
+		if ( verbose )
+			cout << i+1 << tab << da << endl;
+	}
+	
+	return pseg;
+}
+
 /**
 @brief 	Initializing voxels and edges for graph-based segmentation.
 @param 	connect_type	connection type: 0=direct neighbors, 1=all neighbors.
@@ -1312,15 +1533,24 @@ Bimage*		Bimage::kmeans_segment(long nregion, long max_iter, double ratio)
 	IEEE Trans. Pattern Anal. Mach. Intell. 26(11): 1452-1458 (2004)
 
 	Edges are set up with 6 or 26 neighbors.
+	Each edge is stored as a voxel index and a direction code:
+		0		+x
+		1-3		+x with -y and/or -z
+		4		+y-z
+		5		+y
+		6		+z
+	The weights are calculated in parallel and the edges sorted with a
+	radix sort (see GSedge_list).
 
 **/
 GSgraph		Bimage::graph_setup(int connect_type)
 {
-	long			i, xx, yy, zz, x1, y1, z1;
+	long			i, xx, yy, zz, z1, y1;
 	double			a;
 	GSgraph			g;
 
 	// Sets up voxels
+	g.voxels().reserve(image_size());
 	for ( i=0; i<image_size(); ++i ) {
 		a = (*this)[i];
 		if ( compound_type() == TRGB )
@@ -1329,46 +1559,48 @@ GSgraph		Bimage::graph_setup(int connect_type)
 	}
 
 	// Sets up edges
+	g.edge_setup(size(), (connect_type)? 7*image_size(): 3*image_size());
+	
 	for ( i=zz=0; zz<z; ++zz ) {
 		for ( yy=0; yy<y; ++yy ) {
 			for ( xx=0; xx<x; ++xx, ++i ) {
 				if ( xx < x - 1 ) {
-					x1 = xx + 1;
 					if ( connect_type ) {
 						for ( z1=(zz>0)?zz-1:zz; z1<zz+1 && z1<z; z1++ ) {
 							for ( y1=(yy>0)?yy-1:yy; y1<yy+1 && y1<y; y1++ ) {
-								g.add_edge(i, (z1*y + y1)*x + x1, 0);
+								g.add_edge(i, (y1<yy)? ((z1<zz)? 1: 3): ((z1<zz)? 2: 0));
 							}
 						}
 					} else {
-						g.add_edge(i, (zz*y + yy)*x + x1, 0);
+						g.add_edge(i, 0);
 					}
 				}
 				if ( yy < y - 1 ) {
-					y1 = yy + 1;
 					if ( connect_type ) {
 						for ( z1=(zz>0)?zz-1:zz; z1<zz+1 && z1<z; z1++ ) {
-							g.add_edge(i, (z1*y + y1)*x + xx, 0);
+							g.add_edge(i, (z1<zz)? 4: 5);
 						}
 					} else {
-						g.add_edge(i, (zz*y + y1)*x + xx, 0);
-
+						g.add_edge(i, 5);
 					}
 				}
 				if ( zz < z - 1 ) {
-					z1 = zz + 1;
-					g.add_edge(i, (z1*y + yy)*x + xx, 0);
+					g.add_edge(i, 6);
 				}
 			}
 		}
 	}
 	
+	long			ne(g.edge_count());
+	
 	if ( compound_type() == TSimple ) {
-		for ( i=0; i<g.edge_count(); ++i )
-			g.edge(i).weight(fabs((*this)[g.edge(i)[0]] - (*this)[g.edge(i)[1]]));
+#pragma omp parallel for
+		for ( long j=0; j<ne; ++j )
+			g.edge_weight(j, fabs((*this)[g.edge_start(j)] - (*this)[g.edge_end(j)]));
 	} else if ( compound_type() == TRGB ) {
-		for ( i=0; i<g.edge_count(); ++i )
-			g.edge(i).weight(fabs((rgb(g.edge(i)[0]) - rgb(g.edge(i)[1])).rms()));
+#pragma omp parallel for
+		for ( long j=0; j<ne; ++j )
+			g.edge_weight(j, fabs((rgb(g.edge_start(j)) - rgb(g.edge_end(j))).rms()));
 	}
 	
 	g.edge_sort();
@@ -1400,7 +1632,7 @@ GSgraph		Bimage::graph_segment(int type, int connect_type,
 				double complexity, long min_size)
 {
 	long			dim = (z > 1)? 3: 2;
-	double			threshold(std/complexity);
+	double			threshold(standard_deviation()/complexity);
 	
 	if ( verbose ) {
     	cout << "Segmenting image:" << endl;
@@ -1421,8 +1653,10 @@ GSgraph		Bimage::graph_segment(int type, int connect_type,
 	
 	GSgraph			g = graph_setup(connect_type);
 	
-	if ( verbose )
+	if ( verbose ) {
 		cout << "Number of edges:                " << g.edge_count() << endl;
+		cout << "Graph memory:                   " << g.memory()/1048576.0 << " MB" << endl;
+	}
 	
 	long			i, j, nrc(image_size());
 	
@@ -1795,7 +2029,7 @@ long		segments_setup_neighbors(vector<Bsuperpixel>& seg, long step)
 **/
 vector<Bsuperpixel>	Bimage::superpixels_from_mask(long cc, long step)
 {
-	long			nseg = (long) (max + 1.9);
+	long			nseg = (long) (maximum() + 1.9);
 	
 	if ( verbose )
 		cout << "Setting up " << nseg << " segments" << endl;
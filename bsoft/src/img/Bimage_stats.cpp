@@ -3,7 +3,7 @@
 @brief	Functions to calculate statistics on image regions
 @author Bernard Heymann
 @date	Created: 19990321
-@date	Modified: 20210806
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -15,6 +15,95 @@
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
 
+#define	STATS_BLOCK		65536	// Number of values per block for partial statistics
+
+/*
+	Partial statistics for a block of values.
+*/
+struct Bstats_block {
+	double		vmin;
+	double		vmax;
+	double		sum;
+	double		ssum;
+	long		notfin;
+} ;
+
+/*
+	Calculates the statistics of a block of values of a simple data type.
+	Values that are not finite are set to zero and counted.
+*/
+template <typename T>
+static Bstats_block	stats_block(T* data, long nv)
+{
+	Bstats_block	b = {DBL_MAX, -DBL_MAX, 0, 0, 0};
+	double			v;
+	
+	for ( long i=0; i<nv; ++i ) {
+		v = data[i];
+		if ( isfinite(v) ) {
+			if ( b.vmin > v ) b.vmin = v;
+			if ( b.vmax < v ) b.vmax = v;
+			b.sum += v;
+			b.ssum += v*v;
+		} else {
+			data[i] = 0;
+			b.notfin++;
+		}
+	}
+	
+	return b;
+}
+
+/*
+	Calculates the statistics of an array in fixed blocks processed in
+	parallel. The block sums are combined in order with compensated
+	(Kahan) summation, so the result does not depend on the number
+	of threads.
+*/
+template <typename T>
+static long	stats_array(T* data, long nv, double& vmin, double& vmax, double& sum, double& ssum)
+{
+	long			nb((nv + STATS_BLOCK - 1)/STATS_BLOCK);
+	Bstats_block*	blk = new Bstats_block[nb];
+	
+#ifdef HAVE_GCD
+	dispatch_apply(nb, dispatch_get_global_queue(0, 0), ^(size_t ib){
+		long		start(ib*STATS_BLOCK);
+		blk[ib] = stats_block(data + start, (start + STATS_BLOCK < nv)? STATS_BLOCK: nv - start);
+	});
+#else
+#pragma omp parallel for
+	for ( long ib=0; ib<nb; ++ib ) {
+		long		start(ib*STATS_BLOCK);
+		blk[ib] = stats_block(data + start, (start + STATS_BLOCK < nv)? STATS_BLOCK: nv - start);
+	}
+#endif
+
+	long			ib, notfin(0);
+	double			cs(0), css(0), t, y;
+	
+	vmin = DBL_MAX;
+	vmax = -DBL_MAX;
+	sum = ssum = 0;
+	for ( ib=0; ib<nb; ++ib ) {
+		if ( vmin > blk[ib].vmin ) vmin = blk[ib].vmin;
+		if ( vmax < blk[ib].vmax ) vmax = blk[ib].vmax;
+		y = blk[ib].sum - cs;
+		t = sum + y;
+		cs = (t - sum) - y;
+		sum = t;
+		y = blk[ib].ssum - css;
+		t = ssum + y;
+		css = (t - ssum) - y;
+		ssum = t;
+		notfin += blk[ib].notfin;
+	}
+	
+	delete[] blk;
+	
+	return notfin;
+}
+
 /**
 @brief 	Calculates the statistics for an image.
 @return long			number of errors.
@@ -33,32 +122,37 @@ long			Bimage::statistics()
 		cout << "DEBUG Bimage::statistics: ave=" << avg << " std=" << std << endl;
 	}
 
+	// A single image is processed in parallel blocks within statistics(long)
+	if ( n == 1 ) {
+		statistics(0);
+	} else {
 #ifdef HAVE_GCD
-	dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t i){
-   		statistics(i);
-	});
+		dispatch_apply(n, dispatch_get_global_queue(0, 0), ^(size_t i){
+			statistics(i);
+		});
 #else
 #pragma omp parallel for
-    for ( long i=0; i<n; i++ )
-   		statistics(i);
+		for ( long i=0; i<n; i++ )
+			statistics(i);
 #endif
+	}
 	
 	if ( notfin ) {
 		cerr << "Error in Bimage:statistics: " << notfin << " values not finite!" << endl;
 		cerr << tab << "Image: " << file_name() << endl;
 	}
 	
-	min = image->minimum();
-	max = image->maximum();
+	// The sub-image values are read directly to avoid triggering another update
+	min = image->min;
+	max = image->max;
 	avg = std = 0;
 	for ( nn=0; nn<n; nn++ ) {
-		avg += image[nn].average();
-		std += image[nn].standard_deviation()
-			*image[nn].standard_deviation();
-		if ( min > image[nn].minimum() ) min = image[nn].minimum();
-		if ( max < image[nn].maximum() ) max = image[nn].maximum();
+		avg += image[nn].avg;
+		std += image[nn].std*image[nn].std;
+		if ( min > image[nn].min ) min = image[nn].min;
+		if ( max < image[nn].max ) max = image[nn].max;
 		if ( verbose & VERB_DEBUG )
-			cout << "DEBUG Bimage::statistics: avg[" << nn << "] = " << image[nn].average() << " std[" << nn << "] = " << image[nn].standard_deviation() << endl;
+			cout << "DEBUG Bimage::statistics: avg[" << nn << "] = " << image[nn].avg << " std[" << nn << "] = " << image[nn].std << endl;
 	}
 	
 	// Dubious fix!!!
@@ -71,8 +165,11 @@ long			Bimage::statistics()
     std = std/n;
     if ( std > 0 ) std = sqrt(std);
 	else std = 0;
-	show_minimum(minimum());
-	show_maximum(maximum());
+	
+	stats_valid.store(1, memory_order_release);
+	
+	show_minimum(min);
+	show_maximum(max);
 
 	if ( verbose & VERB_STATS ) {
 		cout << "Data size:                      " << c << " x " << x << 
@@ -111,7 +208,24 @@ long			Bimage::statistics(long img_num)
 	if ( verbose & VERB_DEBUG )
 		cout << "DEBUG Bimage::statistics: image = " << img_num << endl;
 
-	for ( j=0, k=img_num*imagesize; j<imagesize; k++, j++ ) {
+	k = img_num*imagesize;
+	if ( compoundtype != TComplex && datatype > Bit ) {
+		// Typed loops over blocks in parallel
+		switch ( datatype ) {
+			case UCharacter: notfin = stats_array(d.uc + k, imagesize, imin, imax, iavg, istd); break;
+			case SCharacter: notfin = stats_array(d.sc + k, imagesize, imin, imax, iavg, istd); break;
+			case UShort: notfin = stats_array(d.us + k, imagesize, imin, imax, iavg, istd); break;
+			case Short: notfin = stats_array(d.ss + k, imagesize, imin, imax, iavg, istd); break;
+			case UInteger: notfin = stats_array(d.ui + k, imagesize, imin, imax, iavg, istd); break;
+			case Integer: notfin = stats_array(d.si + k, imagesize, imin, imax, iavg, istd); break;
+			case ULong: notfin = stats_array(d.ul + k, imagesize, imin, imax, iavg, istd); break;
+			case Long: notfin = stats_array(d.sl + k, imagesize, imin, imax, iavg, istd); break;
+			case Float: notfin = stats_array(d.f + k, imagesize, imin, imax, iavg, istd); break;
+			case Double: notfin = stats_array(d.d + k, imagesize, imin, imax, iavg, istd); break;
+			case Half: notfin = stats_array(d.h + k, imagesize, imin, imax, iavg, istd); break;
+			default: break;
+		}
+	} else for ( j=0; j<imagesize; k++, j++ ) {
 		if ( compoundtype != TComplex ) {
 			v = (*this)[k];
 			if ( isfinite(v) ) {
@@ -196,9 +310,9 @@ long			Bimage::statistics(Bimage* pmask, double& regavg, double& regstd)
 **/
 double			Bimage::poisson_statistics_check()
 {
-	if ( std <= 0 ) statistics();
+	if ( standard_deviation() <= 0 ) statistics();
 	
-	double		var(std*std/avg);
+	double		var(standard_deviation()*standard_deviation()/average());
 	
 	if ( fabs(var-1) > 0.05 )
 		cerr << "Warning: Poisson statistics error! (Scale = " << var << ")" << endl;
@@ -238,8 +352,8 @@ vector<double>	Bimage::stats_within_radii(long nn, Vector3<double> loc,
 	if ( verbose & VERB_DEBUG ) {
 		cout << "DEBUG Bimage::stats_within_radii: Data size: " << size() << "x" << c << "x" << n << "=" << datasize << endl;
 		cout << "DEBUG Bimage::stats_within_radii: datatype=" << datatype << endl;
-		cout << "DEBUG Bimage::stats_within_radii: min=" << min << " max=" << max << endl;
-		cout << "DEBUG Bimage::stats_within_radii: ave=" << avg << " std=" << std << endl;
+		cout << "DEBUG Bimage::stats_within_radii: min=" << minimum() << " max=" << maximum() << endl;
+		cout << "DEBUG Bimage::stats_within_radii: ave=" << average() << " std=" << standard_deviation() << endl;
 	}
 
 	for ( zz=0; zz<z; zz++ ) {
@@ -388,7 +502,7 @@ vector<double>	Bimage::stats_in_shape(long nn, int type,
 	}
 	
 	if ( verbose & VERB_DEBUG )
-		cout << "DEBUG Bimage::stats_in_shape: npx=" << npx << " avg=" << vavg << " vstd=" << std << endl;
+		cout << "DEBUG Bimage::stats_in_shape: npx=" << npx << " avg=" << vavg << " vstd=" << standard_deviation() << endl;
 	
 	return stats;
 }
@@ -3,7 +3,7 @@
 @brief	Symmetry function library for crystallography
 @author Bernard Heymann
 @date	Created: 19990509
-@date	Modified: 20191104
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -24,6 +24,9 @@ extern int 	verbose;		// Level of output to the screen
 	The point group symmetry operations are applied to an image with an
 	orientation defined by the reference symmetry axis (default {0,0,1}). 
 	The fill value is taken from image's background value.
+	The point group is expanded into all its rotation matrices and
+	each voxel is set to the sum of the values interpolated at all the
+	symmetry-related positions, requiring only one additional map.
 	The symmetry FOM is taken as the ratio of the power after to before
 	symmetrization. 
 
@@ -32,9 +35,14 @@ double 		Bimage::symmetrize(Bsymmetry sym, View ref_view, int flag)
 {
 	if ( sym.point() < 102 ) return 0;
 	
+	if ( compoundtype > TSimple ) {
+		error_show("Error in Bimage::symmetrize: Symmetry not applied to compound data types!", __FILE__, __LINE__);
+		return -1;
+	}
+	
 	long			theorder(sym.order());
-	long 			i, m;
-	double			pwr(std*std);
+	long 			i, nn, imgsize(x*y*z);
+	double			pwr(standard_deviation()*standard_deviation());
 	
 	if ( z == 1 ) {
 		if ( sym.label()[0] != 'C' ) {
@@ -50,46 +58,35 @@ double 		Bimage::symmetrize(Bsymmetry sym, View ref_view, int flag)
 		cout << "Applying symmetry " << sym.label() << ":" << endl;
 		cout << "Transformation origin:          " << image->origin() << endl;
 		cout << "Reference view:                 " << ref_view << endl;
-		cout << "Fill value:                     " << background(long(0)) << endl << endl;
+		cout << "Fill value:                     " << background(long(0)) << endl;
+		for ( i=0; i<sym.operations(); ++i )
+			cout << "Order[" << i+1 << "] = " << sym[i].order() << endl;
 	}
 	
 	change_type(Float);
 
 	Matrix3			mat = ref_view.matrix();
 	
-	Vector3<double>	new_axis(ref_view.vector3());
+	sym.transform(mat);
+	
+	vector<Matrix3>	symmat = symmetry_get_all_matrices(sym);
+	
+	if ( verbose & VERB_PROCESS )
+		cout << "Symmetry matrices:              " << symmat.size() << endl << endl;
 
-	Bimage**		plist;
-	for ( i=0; i<sym.operations(); ++i ) {
-		m = sym[i].order();
-		if ( verbose & VERB_PROCESS )
-			cout << "Order[" << i+1 << "] = " << m << endl;
-		new_axis = mat * sym[i].axis();
-		plist = new Bimage*[m];
-		plist[0] = copy();
-#ifdef HAVE_GCD
-		dispatch_apply(m-1, dispatch_get_global_queue(0, 0), ^(size_t k){
-			long 	j = k + 1;
-			plist[j] = rotate(size(), new_axis, j*M_PI*2.0/m);
-		});
-#else
-#pragma omp parallel for
-		for ( long j=1; j<m; j++ )
-			plist[j] = rotate(size(), new_axis, j*M_PI*2.0/m);
-#endif
-		sum(m, plist);
-		for ( long j=0; j<m; j++ ) delete plist[j];
-		delete[] plist;
-	}
-	if ( verbose )
-		cout << endl;
+	float*			nudata = new float[n*imgsize];
+	
+	for ( nn=0; nn<n; nn++ )
+		transform_sum_float(nn, nudata + nn*imgsize, symmat,
+				image[nn].origin(), image[nn].background());
+	
+	data_assign((unsigned char *) nudata);
 	
 	if ( flag ) multiply(1.0L/theorder);
 	
-	statistics();
 	calculate_background();
 	
-	double		f(std*std/pwr);
+	double		f(standard_deviation()*standard_deviation()/pwr);
 	if ( !flag ) f /= theorder;
 	
 	if ( verbose & VERB_PROCESS )
@@ -282,6 +279,117 @@ double 		Bimage::find_cyclic_point_group(Bsymmetry& sym,
 	return cc;
 }
 
+/*
+	Interpolates a shell of a spherical image (see Bimage::cartesian_to_spherical)
+	in the direction of a unit vector.
+*/
+static double	spherical_shell_value(float* data, long nann, long nphi, long ntheta,
+				long ann, Vector3<double>& d)
+{
+	double			theta(acos((d[2] > 1)? 1: (d[2] < -1)? -1: d[2]));
+	double			phi(atan2(-d[1], d[0]));
+	if ( phi < 0 ) phi += TWOPI;
+	
+	double			ft(theta*ntheta/M_PI), fp(phi*nphi/TWOPI);
+	long			it((long) ft), ip((long) fp);
+	if ( it >= ntheta - 1 ) {
+		it = ntheta - 1;
+		ft = it;
+	}
+	ft -= it;
+	fp -= ip;
+	ip %= nphi;
+	
+	long			it1((it < ntheta - 1)? it + 1: it), ip1((ip + 1)%nphi);
+	
+	double			v = (1-ft)*((1-fp)*data[(it*nphi + ip)*nann + ann] +
+							fp*data[(it*nphi + ip1)*nann + ann]) +
+						ft*((1-fp)*data[(it1*nphi + ip)*nann + ann] +
+							fp*data[(it1*nphi + ip1)*nann + ann]);
+	
+	return v;
+}
+
+/*
+	Scores a candidate axis for a rotational order from a spherical image.
+	On each shell, rings are sampled at polar angles around the axis and
+	the power in each cylindrical harmonic is calculated from the ring.
+	The score is the fraction of the non-zero harmonic power in the
+	multiples of the order: close to 1 for a true axis and about 1/order
+	for an arbitrary direction.
+*/
+static double	symmetry_order_score(Bimage* psph, Vector3<double> axis, long order,
+				long nring, long nang)
+{
+	long			nann(psph->sizeX()), nphi(psph->sizeY()), ntheta(psph->sizeZ());
+	long			ann, ir, ia, m, mmax(nang/2);
+	double			beta, cb, sb, psi, re, im, p, pwr(0), pwr_order(0);
+	float*			data = (float *) psph->data_pointer();
+	Vector3<double>	e1, e2, d;
+	vector<double>	v(nang), cs(nang*mmax), sn(nang*mmax);
+	
+	axis.normalize();
+	e1 = axis.cross(Vector3<double>(0,0,1));
+	if ( e1.length() < 0.1 ) e1 = axis.cross(Vector3<double>(1,0,0));
+	e1.normalize();
+	e2 = axis.cross(e1);
+	
+	for ( m=1; m<=mmax; m++ ) for ( ia=0; ia<nang; ia++ ) {
+		psi = TWOPI*m*ia/nang;
+		cs[(m-1)*nang + ia] = cos(psi);
+		sn[(m-1)*nang + ia] = sin(psi);
+	}
+	
+	for ( ann=2; ann<nann; ann++ ) {
+		for ( ir=1; ir<nring; ir++ ) {
+			beta = M_PI*ir/nring;
+			cb = cos(beta);
+			sb = sin(beta);
+			for ( ia=0; ia<nang; ia++ ) {
+				psi = TWOPI*ia/nang;
+				d = axis*cb + (e1*cos(psi) + e2*sin(psi))*sb;
+				v[ia] = spherical_shell_value(data, nann, nphi, ntheta, ann, d);
+			}
+			for ( m=1; m<=mmax; m++ ) {
+				for ( ia=0, re=im=0; ia<nang; ia++ ) {
+					re += v[ia]*cs[(m-1)*nang + ia];
+					im += v[ia]*sn[(m-1)*nang + ia];
+				}
+				p = re*re + im*im;
+				pwr += p;
+				if ( m%order == 0 ) pwr_order += p;
+			}
+		}
+	}
+	
+	if ( pwr <= 0 ) return 0;
+	
+	return pwr_order/pwr;
+}
+
+/*
+	Selects the highest scoring candidates that are separated by more than
+	the given angle (axes are taken as lines) and returns their indices.
+*/
+static vector<long>	symmetry_top_axes(Vector3<double>* axis, vector<double>& score,
+				long ntop, double separation)
+{
+	long			i, j;
+	vector<long>	order(score.size()), top;
+	double			cmax(cos(separation));
+	
+	for ( i=0; i<(long)order.size(); i++ ) order[i] = i;
+	sort(order.begin(), order.end(), [&score](long a, long b) { return score[a] > score[b]; });
+	
+	for ( i=0; i<(long)order.size() && (long)top.size() < ntop; i++ ) {
+		for ( j=0; j<(long)top.size(); j++ )
+			if ( fabs(axis[order[i]].scalar(axis[top[j]])) > cmax ) break;
+		if ( j == (long)top.size() ) top.push_back(order[i]);
+	}
+	
+	return top;
+}
+
 /**
 @brief 	Finds the orientation for an image with a specific point group symmetry.
 @param 	sym			point group.
@@ -289,11 +397,20 @@ double 		Bimage::find_cyclic_point_group(Bsymmetry& sym,
 @param 	binfac		binning for faster searching (limited to 1,2,3).
 @param 	hires		high resolution limit in angstroms.
 @param 	lores		low resolution limit in angstroms.
-@param 	flags		flag to search only for minor axes.
+@param 	flags		1=search only for minor axes, 2=fast axis search.
 @return double		symmetry correlation coefficient.
 
 	The point group symmetry operations are applied to an image with an
 	orientation defined by the reference symmetry axis (default {0,0,1}). 
+	The default search correlates rotated copies in real space at every
+	grid point.
+	With the fast axis search, the binned map is converted once to
+	spherical coordinates around its origin and each candidate axis is
+	scored by the fraction of its angular power in the cylindrical
+	harmonics that are multiples of the symmetry order.
+	Only the best scoring axes are correlated in real space before the
+	usual refinement, for both the major and the minor axes.
+	The fast search assumes that the symmetry center is close to the origin.
 
 **/
 double 		Bimage::find_point_group(Bsymmetry& sym, double angle_step,
@@ -383,13 +500,47 @@ double 		Bimage::find_point_group(Bsymmetry& sym, double angle_step,
 		cout << "Resolution:                     " << hires << " - " << lores << " A" << endl;
 		cout << "Bin factor:                     " << binfac << endl;
 		cout << "Grid points:                    " << grid_points << endl;
-		cout << "Major axis (" << sym[op0].order() << "-fold):" << endl;
 	}
 
+	// Fast search: score the grid from the angular power per order
+	long				nmax(grid_points), ntop(6);
+	long				nring(16), nang(4*sym[op0].order());
+	Bimage*				psph = NULL;
+	vector<double>		score;
+	vector<long>		top;
+	if ( nang < 32 ) nang = 32;
+	if ( ( flags & 2 ) && z > 1 ) {
+		psph = pb->cartesian_to_spherical(pb->sizeX()/2, 2*pb->sizeX(), pb->sizeX());
+		score.resize(grid_points);
+#ifdef HAVE_GCD
+		dispatch_apply(grid_points, dispatch_get_global_queue(0, 0), ^(size_t i){
+			score[i] = symmetry_order_score(psph, axis[i], sym[op0].order(), nring, nang);
+		});
+#else
+#pragma omp parallel for
+		for ( i=0; i<grid_points; i++ )
+			score[i] = symmetry_order_score(psph, axis[i], sym[op0].order(), nring, nang);
+#endif
+		top = symmetry_top_axes(axis, score, ntop, 2*angle_step);
+		if ( verbose )
+			cout << "Axes scored by harmonic power:  " << top.size() << " of " << grid_points << endl;
+		if ( verbose & VERB_LABEL ) {
+			cout << "#\tax\tay\taz\tScore" << endl;
+			for ( i=0; i<(long)top.size(); i++ )
+				cout << top[i]+1 << tab << axis[top[i]] << tab << score[top[i]] << endl;
+		}
+		vector<Vector3<double>>	topaxis;
+		for ( auto j: top ) topaxis.push_back(axis[j]);
+		for ( i=0; i<(long)top.size(); i++ ) axis[i] = topaxis[i];
+		nmax = top.size();
+	}
+	
+	if ( verbose )
+		cout << "Major axis (" << sym[op0].order() << "-fold):" << endl;
+
 	if ( verbose & VERB_LABEL )
 		cout << "#\tax\tay\taz\tCC" << endl;
 
-	long				nmax(grid_points);
 	double				da(angle_step), amin, amax;
 	Quaternion			q1, q, qv;
 	if ( flags & 1 ) da = 0;
@@ -474,13 +625,34 @@ double 		Bimage::find_point_group(Bsymmetry& sym, double angle_step,
 		axis = new Vector3<double>[nax];
 		origin = new Vector3<double>[nax];
 		cc = new double[nax];
+		double*		ang = new double[nax];
 	
 		while ( da > 0.00175 ) {		// 0.1 degree limit
 			for ( angle=amin, i=0; angle<amax; angle+=da, i++ ) {
 				mat = Matrix3(bestaxis, angle);
 				axis[i] = mat * axis2;
+				ang[i] = angle;
 			}
 			nax = i;
+			
+			// Fast search: only the best scoring angles of the first grid
+			if ( psph && da == angle_step ) {
+				score.resize(nax);
+				for ( i=0; i<nax; i++ )
+					score[i] = symmetry_order_score(psph, axis[i], sym[op1].order(), nring, nang);
+				top = symmetry_top_axes(axis, score, ntop, 2*angle_step);
+				vector<Vector3<double>>	topaxis;
+				vector<double>			topang;
+				for ( auto j: top ) {
+					topaxis.push_back(axis[j]);
+					topang.push_back(ang[j]);
+				}
+				for ( i=0; i<(long)top.size(); i++ ) {
+					axis[i] = topaxis[i];
+					ang[i] = topang[i];
+				}
+				nax = top.size();
+			}
 		
 #ifdef HAVE_GCD
 			dispatch_apply(nax, dispatch_get_global_queue(0, 0), ^(size_t i){
@@ -497,18 +669,18 @@ double 		Bimage::find_point_group(Bsymmetry& sym, double angle_step,
 			}
 #endif
 
-			for ( angle=amin, i=0; angle<amax; angle+=da, i++ ) {
+			for ( i=0; i<nax; i++ ) {
 				if ( bestcc < cc[i] ) {
 					bestcc = cc[i];
 					bestaxis2 = axis[i];
-					bestangle = angle;
+					bestangle = ang[i];
 					bestorigin2 = origin[i];
 				}
 
 				if ( verbose & VERB_LABEL )
 					cout << i+1 << tab << axis[i] << tab << cc[i] << endl;
 				if ( verbose & VERB_TIME )
-					cout << "Angles done:  " << i+1 << " (" << angle*100.0/M_PI << "%)  Best: " << bestcc << "\r" << flush;
+					cout << "Angles done:  " << i+1 << " (" << ang[i]*100.0/M_PI << "%)  Best: " << bestcc << "\r" << flush;
 			}
 			da /= 2;
 			amin = bestangle - da;
@@ -524,9 +696,11 @@ double 		Bimage::find_point_group(Bsymmetry& sym, double angle_step,
 		delete[] axis;
 		delete[] origin;
 		delete[] cc;
+		delete[] ang;
 	}
 
 	delete pb;
+	delete psph;
     fft_destroy_plan(planf);
     fft_destroy_plan(planb);
 
@@ -633,7 +807,7 @@ int			Bimage::change_symmetry(Bsymmetry& symold, Bsymmetry& symnu,
 	
 	data_assign((unsigned char *) nudata);
 
-	statistics();
+	statistics_invalidate();
 	
 	return 0;
 }
@@ -1020,7 +1194,7 @@ int			Bimage::replicate_asymmetric_unit(Bsymmetry& sym)
 	
 	data_assign((unsigned char *) nudata);
 	
-	statistics();
+	statistics_invalidate();
 	
 	return 0;
 }
@@ -3,7 +3,7 @@
 @brief	Functions to convert between 2D topology images to 3D surfaces.
 @author Bernard Heymann
 @date	Created: 19990124
-@date	Modified: 20170613
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -73,7 +73,7 @@ Bimage*		Bimage::topograph_to_surface(Bimage* psd, long nz, double density, doub
 	}
 	
     double			loz(show_minimum()/image->sampling()[2]);
-	scale = (show_maximum()-show_minimum())/(image->sampling()[2]*(max-min));
+	scale = (show_maximum()-show_minimum())/(image->sampling()[2]*(maximum()-minimum()));
     if ( show_minimum() > show_maximum() ) factor *= -1;
 	
     if ( verbose & VERB_PROCESS ) {
@@ -3,7 +3,7 @@
 @brief	Library routines for transforming images
 @author Bernard Heymann
 @date	Created: 19990904
-@date	Modified: 20190214
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -112,6 +112,251 @@ void		Bimage::transform_voxel(long i, Bimage* pt, long nn, Vector3<double> oldor
 		pt->add(i, interpolate(cc, old, nn, fill));
 }
 
+/*
+	Trilinear interpolation directly on a floating point array.
+	The weights and accumulation follow Bimage::interpolate exactly,
+	so that the result is identical to the generic path.
+	The location must be within the image boundaries.
+*/
+static inline double	interpolate_float(const float* data, long x, long y, long z,
+				double xx, double yy, double zz)
+{
+	long			ix = (long) xx;
+	long			iy = (long) yy;
+	long			iz = (long) zz;
+
+	long			nx = (x < ix + 2)? 1: 2;
+	long			ny = (y < iy + 2)? 1: 2;
+	long			nz = (z < iz + 2)? 1: 2;
+
+	long			i, xk, yk, zk;
+	double			fx = xx - ix;
+	double			fy = yy - iy;
+	double			fz = zz - iz;
+	
+	double			value(0), w(0), ws(0), wyz;
+	
+	const float*	pz = data + iz*y*x;
+	const float*	py;
+	
+	for ( zk=0; zk<nz; zk++, pz+=x*y ) {
+		fz = 1.0L - fz;
+		py = pz + iy*x;
+		for ( yk=0; yk<ny; yk++, py+=x ) {
+			fy = 1.0L - fy;
+			wyz = fy*fz;
+			for ( xk=0, i=ix; xk<nx; xk++, i++ ) {
+				fx = 1.0L - fx;
+				w = fx*wyz;
+				ws += w;
+				value += py[i] * w;
+			}
+		}
+	}
+	
+	return value/ws;
+}
+
+/*
+	Finds the range of positions [lo,hi) along a row where the
+	back-transformed coordinate start + xx*step is inside the image.
+	The analytical limits are refined with the same test used
+	in Bimage::interpolate to avoid rounding differences.
+*/
+static void	transform_row_limits(Vector3<double>& start, Vector3<double>& step,
+				Vector3<long> size, long nx, long& lo, long& hi)
+{
+	long			k;
+	double			l(0), h(nx), t0, t1;
+	
+	for ( k=0; k<3; ++k ) {
+		if ( step[k] == 0 ) {
+			if ( start[k] < 0 || start[k] >= size[k] ) h = 0;
+		} else {
+			t0 = -start[k]/step[k];
+			t1 = (size[k] - start[k])/step[k];
+			if ( t0 > t1 ) swap(t0, t1);
+			if ( l < t0 ) l = t0;
+			if ( h > t1 ) h = t1;
+		}
+	}
+	
+	if ( h <= l ) {
+		lo = hi = 0;
+		return;
+	}
+	
+	lo = (long) ceil(l);
+	hi = (long) ceil(h);
+	if ( lo < 0 ) lo = 0;
+	if ( hi > nx ) hi = nx;
+	
+	auto	inside = [&](long xx) {
+		for ( long j=0; j<3; ++j ) {
+			double	v = start[j] + xx*step[j];
+			if ( v < 0 || v >= size[j] ) return false;
+		}
+		return true;
+	};
+	
+	while ( lo > 0 && inside(lo-1) ) lo--;
+	while ( lo < hi && !inside(lo) ) lo++;
+	while ( hi < nx && inside(hi) ) hi++;
+	while ( hi > lo && !inside(hi-1) ) hi--;
+}
+
+/**
+@brief 	Transforms a single-channel floating point sub-image.
+@param	nn				sub-image to process.
+@param 	*pt				new floating point image.
+@param 	affmat			back-transformation matrix.
+@param 	oldorigin		3-value origin in the old image.
+@param 	nuorigin		3-value origin in the new image.
+@param 	fill			value to fill in empty regions.
+
+	The old coordinates of the first voxel in each row are calculated
+	and stepped along the row by the first column of the matrix.
+	Each row is clipped against the old image boundaries and the 
+	interpolation is done directly on the data arrays.
+
+**/
+void		Bimage::transform_float(long nn, Bimage* pt, Matrix3 affmat,
+				Vector3<double> oldorigin, Vector3<double> nuorigin, double fill)
+{
+	const float*	data = (float *) data_pointer(nn*x*y*z);
+	float*			nudata = (float *) pt->data_pointer();
+	float			ffill(fill);
+	long			nux(pt->x), nuy(pt->y), nuz(pt->z);
+	Vector3<long>	oldsize(size());
+	Vector3<double>	step(affmat[0][0], affmat[1][0], affmat[2][0]);
+	
+#ifdef HAVE_GCD
+	dispatch_apply(nuz, dispatch_get_global_queue(0, 0), ^(size_t zz){
+		long			yy, xx, lo, hi;
+		Vector3<double>	nu, start, old;
+		Vector3<double>	rstep(step);
+		float*			row;
+		nu[2] = (double)zz - nuorigin[2];
+		nu[0] = -nuorigin[0];
+		for ( yy=0; yy<nuy; yy++ ) {
+			nu[1] = (double)yy - nuorigin[1];
+			start = affmat * nu + oldorigin;
+			row = nudata + (zz*nuy + yy)*nux;
+			transform_row_limits(start, rstep, oldsize, nux, lo, hi);
+			for ( xx=0; xx<lo; xx++ ) row[xx] = ffill;
+			for ( ; xx<hi; xx++ ) {
+				old = start + rstep * xx;
+				row[xx] = interpolate_float(data, x, y, z, old[0], old[1], old[2]);
+			}
+			for ( ; xx<nux; xx++ ) row[xx] = ffill;
+		}
+	});
+#else
+#pragma omp parallel for
+	for ( long zz=0; zz<nuz; zz++ ) {
+		long			yy, xx, lo, hi;
+		Vector3<double>	nu, start, old;
+		float*			row;
+		nu[2] = (double)zz - nuorigin[2];
+		nu[0] = -nuorigin[0];
+		for ( yy=0; yy<nuy; yy++ ) {
+			nu[1] = (double)yy - nuorigin[1];
+			start = affmat * nu + oldorigin;
+			row = nudata + (zz*nuy + yy)*nux;
+			transform_row_limits(start, step, oldsize, nux, lo, hi);
+			for ( xx=0; xx<lo; xx++ ) row[xx] = ffill;
+			for ( ; xx<hi; xx++ ) {
+				old = start + step * xx;
+				row[xx] = interpolate_float(data, x, y, z, old[0], old[1], old[2]);
+			}
+			for ( ; xx<nux; xx++ ) row[xx] = ffill;
+		}
+	}
+#endif
+}
+
+/**
+@brief 	Sums a single-channel floating point sub-image transformed by a set of matrices.
+@param	nn				sub-image to process.
+@param 	*nudata			new data block for one sub-image.
+@param 	&mat			transformation matrices.
+@param 	origin			3-value origin for the transformations.
+@param 	fill			value for positions outside the old image.
+
+	Each new voxel is the sum of the values interpolated at the positions
+	back-calculated with every matrix, without intermediate images.
+	The old coordinates are stepped along each row as in transform_float.
+
+**/
+void		Bimage::transform_sum_float(long nn, float* nudata, vector<Matrix3>& mat,
+				Vector3<double> origin, double fill)
+{
+	const float*	data = (float *) data_pointer(nn*x*y*z);
+	long			k, nmat(mat.size());
+	Vector3<long>	oldsize(size());
+	vector<Matrix3>	affmat(nmat);
+	vector<Vector3<double>>	step(nmat);
+	
+	for ( k=0; k<nmat; ++k ) {
+		affmat[k] = mat[k].transpose();
+		step[k] = Vector3<double>(affmat[k][0][0], affmat[k][1][0], affmat[k][2][0]);
+	}
+	
+	Matrix3*			am = affmat.data();
+	Vector3<double>*	st = step.data();
+	
+#ifdef HAVE_GCD
+	dispatch_apply(z, dispatch_get_global_queue(0, 0), ^(size_t zz){
+		long			yy, xx, j, lo, hi;
+		Vector3<double>	nu, start, old;
+		vector<double>	row(x);
+		nu[2] = (double)zz - origin[2];
+		nu[0] = -origin[0];
+		for ( yy=0; yy<y; yy++ ) {
+			nu[1] = (double)yy - origin[1];
+			for ( xx=0; xx<x; xx++ ) row[xx] = 0;
+			for ( j=0; j<nmat; ++j ) {
+				start = am[j] * nu + origin;
+				transform_row_limits(start, st[j], oldsize, x, lo, hi);
+				for ( xx=0; xx<lo; xx++ ) row[xx] += fill;
+				for ( ; xx<hi; xx++ ) {
+					old = start + st[j] * xx;
+					row[xx] += interpolate_float(data, x, y, z, old[0], old[1], old[2]);
+				}
+				for ( ; xx<x; xx++ ) row[xx] += fill;
+			}
+			float*		nurow = nudata + (zz*y + yy)*x;
+			for ( xx=0; xx<x; xx++ ) nurow[xx] = row[xx];
+		}
+	});
+#else
+#pragma omp parallel for
+	for ( long zz=0; zz<z; zz++ ) {
+		long			yy, xx, j, lo, hi;
+		Vector3<double>	nu, start, old;
+		vector<double>	row(x);
+		nu[2] = (double)zz - origin[2];
+		nu[0] = -origin[0];
+		for ( yy=0; yy<y; yy++ ) {
+			nu[1] = (double)yy - origin[1];
+			for ( xx=0; xx<x; xx++ ) row[xx] = 0;
+			for ( j=0; j<nmat; ++j ) {
+				start = am[j] * nu + origin;
+				transform_row_limits(start, st[j], oldsize, x, lo, hi);
+				for ( xx=0; xx<lo; xx++ ) row[xx] += fill;
+				for ( ; xx<hi; xx++ ) {
+					old = start + st[j] * xx;
+					row[xx] += interpolate_float(data, x, y, z, old[0], old[1], old[2]);
+				}
+				for ( ; xx<x; xx++ ) row[xx] += fill;
+			}
+			float*		nurow = nudata + (zz*y + yy)*x;
+			for ( xx=0; xx<x; xx++ ) nurow[xx] = row[xx];
+		}
+	}
+#endif
+}
+
 /**
 @brief 	Transforms a sub-image by translation, rotation, scaling and skewing, returning a single new image.
 @param	nn				sub-image to process.
@@ -187,22 +432,26 @@ Bimage*		Bimage::transform(long nn, Vector3<long> nusize, Vector3<double> scale,
 	Bimage*			pt = new Bimage(datatype, compoundtype, nusize, 1);
 	pt->sampling(nusampling);
 
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) fill = image[nn].background();
 
 	// Note: the matrix is used in a back-calculation of old coordinates corresponding to new
-	for ( i=zz=0; zz<pt->z; zz++ ) {
-		nu[2] = (double)zz - nuorigin[2];
-		for ( yy=0; yy<pt->y; yy++ ) {
-			nu[1] = (double)yy - nuorigin[1];
-			for ( xx=0; xx<pt->x; xx++ ) {
-				nu[0] = (double)xx - nuorigin[0];
-				old = affmat * nu + oldorigin;
-//				if ( old[1] < 0 )
-//					cout << old << endl;
-				for ( cc=0; cc<c; cc++, i++ )
-					pt->add(i, interpolate(cc, old, nn, fill));
-//					pt->add(i, interpolate_wrap(cc, old, nn));
+	if ( datatype == Float && c == 1 ) {
+		transform_float(nn, pt, affmat, oldorigin, nuorigin, fill);
+	} else {
+		for ( i=zz=0; zz<pt->z; zz++ ) {
+			nu[2] = (double)zz - nuorigin[2];
+			for ( yy=0; yy<pt->y; yy++ ) {
+				nu[1] = (double)yy - nuorigin[1];
+				for ( xx=0; xx<pt->x; xx++ ) {
+					nu[0] = (double)xx - nuorigin[0];
+					old = affmat * nu + oldorigin;
+//					if ( old[1] < 0 )
+//						cout << old << endl;
+					for ( cc=0; cc<c; cc++, i++ )
+						pt->add(i, interpolate(cc, old, nn, fill));
+//						pt->add(i, interpolate_wrap(cc, old, nn));
+				}
 			}
 		}
 	}
@@ -614,7 +863,7 @@ int 		Bimage::shift(long nn, Vector3<double> vec, int fill_type, double fill)
 	long			imgsize = c*image_size();
 	vector<float>	temp(imgsize);
 
-	if ( fill_type == FILL_AVERAGE ) fill = avg;
+	if ( fill_type == FILL_AVERAGE ) fill = average();
 	if ( fill_type == FILL_BACKGROUND ) fill = background(nn);
 
 	for ( j=zz=0; zz<z; zz++ ) {
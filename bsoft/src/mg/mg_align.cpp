@@ -3,7 +3,7 @@
 @brief	Functions to align micrographs or coordinates from micrographs and apply the resultant transformation.
 @author Bernard Heymann and Samuel Payne
 @date	Created: 20000505
-@date	Modified: 20211004
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -22,6 +22,8 @@
 #include "utilities.h"
 
 #include <sys/stat.h>
+#include <mutex>
+#include <condition_variable>
 
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
@@ -1111,8 +1113,14 @@ double		mg_write_frame_sum(Bmicrograph* mg, Bimage* pgr,
 	if ( verbose )
 		cout << "Micrograph: " << mg->id << " with " << nimg << " frames at " << mg->dose/p->images() << " e/Å2/frame" << endl;
 
-	for ( n=0, frame = mg->frame; frame; frame = frame->next, ++n )
-		p->image[n].origin(frame->shift + p->size()/2);
+	if ( mg->frame && mg->frame->local.size() ) {
+		if ( verbose )
+			cout << "Correcting local frame motion" << endl;
+		img_frames_correct_local(p, mg->frame);
+	} else {
+		for ( n=0, frame = mg->frame; frame; frame = frame->next, ++n )
+			p->image[n].origin(frame->shift + p->size()/2);
+	}
 
 	Bimage*			psum = p->fspace_shift_sum();
 
@@ -1190,10 +1198,387 @@ double		project_write_frame_sums(Bproject* project, Bimage* pgr,
 	return 0;
 }
 
+/*
+@brief 	Calculates the spatial polynomial terms for local frame deformation.
+@param 	nb			number of terms (3 or 6).
+@param 	xx			x location scaled to [-1,1].
+@param 	yy			y location scaled to [-1,1].
+@param 	*b			array for the terms.
+*/
+static void	frame_local_basis(long nb, double xx, double yy, double* b)
+{
+	b[0] = 1;
+	b[1] = xx;
+	b[2] = yy;
+	if ( nb > 3 ) {
+		b[3] = xx*xx;
+		b[4] = xx*yy;
+		b[5] = yy*yy;
+	}
+}
+
+/**
+@brief 	Calculates the shift of a frame at a location.
+@param 	*frame		frame parameters.
+@param 	size		frame size.
+@param 	xx			x location.
+@param 	yy			y location.
+@return Vector3<double>	shift at the location.
+
+	The local deformation polynomial, if present, is added to the
+	global frame shift.
+
+**/
+Vector3<double>	frame_local_shift(Bframe* frame, Vector3<long> size, double xx, double yy)
+{
+	Vector3<double>	shift(frame->shift);
+	
+	long			i, nb(frame->local.size()/2);
+	if ( nb < 3 ) return shift;
+	
+	double			b[6];
+	frame_local_basis(nb, 2*xx/size[0] - 1, 2*yy/size[1] - 1, b);
+	
+	for ( i=0; i<nb; ++i ) {
+		shift[0] += frame->local[i]*b[i];
+		shift[1] += frame->local[nb+i]*b[i];
+	}
+	
+	return shift;
+}
+
+/*
+@brief 	Determines the trajectory of a patch through a stack of frames.
+@param 	*p				frames (floating point).
+@param 	&sh				global frame shifts.
+@param 	start			patch start in the aligned frame.
+@param 	ps				patch size.
+@param 	hi_res			high resolution limit.
+@param 	lo_res			low resolution limit.
+@param 	shift_limit		maximum shift relative to the global shift.
+@param 	planf			forward Fourier transform plan for the patch size.
+@param 	planb			backward Fourier transform plan for the patch size.
+@return vector<Vector3<double>>	deviation from the global shift for each frame, with the CC in the third element.
+
+	The patch is extracted from each frame following the global shift, 
+	and each patch is aligned to the sum of the other patches.
+	The second iteration uses the aligned sum as reference.
+*/
+static vector<Vector3<double>>	frame_patch_trajectory(Bimage* p, vector<Vector3<double>>& sh,
+				Vector3<long> start, long ps, double hi_res, double lo_res, double shift_limit,
+				fft_plan planf, fft_plan planb)
+{
+	long			nn, yy, iter;
+	long			nf(p->images()), nx(p->sizeX()), ny(p->sizeY()), h(ps/2);
+	double			cc(0);
+	Vector3<long>	ts;
+	Vector3<double>	s;
+	vector<Vector3<double>>	off(nf), loc(nf);
+	
+	Bimage*			pp = new Bimage(Float, TSimple, ps, ps, 1, nf);
+	pp->sampling(p->sampling(0));
+	pp->origin(pp->size()/2);
+	
+	float*			fp = (float *) p->data_pointer();
+	float*			fd = (float *) pp->data_pointer();
+	
+	for ( nn=0; nn<nf; ++nn ) {
+		ts[0] = start[0] - (long) floor(sh[nn][0] + 0.5);
+		ts[1] = start[1] - (long) floor(sh[nn][1] + 0.5);
+		if ( ts[0] < 0 ) ts[0] = 0;
+		if ( ts[1] < 0 ) ts[1] = 0;
+		if ( ts[0] > nx - ps ) ts[0] = nx - ps;
+		if ( ts[1] > ny - ps ) ts[1] = ny - ps;
+		off[nn] = Vector3<double>(start[0] - ts[0], start[1] - ts[1], 0);
+		for ( yy=0; yy<ps; ++yy )
+			memcpy(fd + (nn*ps + yy)*ps, fp + (nn*ny + ts[1] + yy)*nx + ts[0], ps*sizeof(float));
+	}
+	pp->statistics_invalidate();
+	
+	Bimage*			pa = pp->copy();
+	Bimage*			psum, *pref, *p1;
+	
+	for ( iter=0; iter<2; ++iter ) {
+		psum = pa->extract(0);
+		for ( nn=1; nn<nf; ++nn ) {
+			p1 = pa->extract(nn);
+			psum->add(p1);
+			delete p1;
+		}
+		for ( nn=0; nn<nf; ++nn ) {
+			pref = psum->copy();
+			p1 = pa->extract(nn);
+			pref->subtract(p1);
+			delete p1;
+			p1 = pp->extract(nn);
+			s = p1->find_shift(pref, NULL, hi_res, lo_res, shift_limit, 0, 1, planf, planb, cc);
+			delete p1;
+			delete pref;
+			if ( s[0] >= h ) s[0] -= ps;
+			if ( s[1] >= h ) s[1] -= ps;
+			loc[nn] = -s;
+			loc[nn][2] = cc;
+		}
+		delete psum;
+		delete pa;
+		pa = pp->copy();
+		for ( nn=0; nn<nf; ++nn )
+			pa->shift_wrap(nn, Vector3<double>(loc[nn][0], loc[nn][1], 0));
+	}
+	
+	delete pa;
+	delete pp;
+	
+	for ( nn=0; nn<nf; ++nn ) {
+		loc[nn][0] += off[nn][0] - sh[nn][0];
+		loc[nn][1] += off[nn][1] - sh[nn][1];
+	}
+	
+	return loc;
+}
+
+/**
+@brief 	Aligns micrograph frames in patches and fits a local deformation model.
+@param 	*mg				micrograph with global frame shifts.
+@param 	*p				frames (converted to floating point).
+@param 	ref_num			reference frame.
+@param 	patches			number of patches in x and y.
+@param 	hi_res			high resolution limit.
+@param 	lo_res			low resolution limit.
+@param 	shift_limit		maximum local deviation from the global shift.
+@param 	lambda			regularization weight.
+@return double			root-mean-square residual of the fit (pixels).
+
+	The frames are divided into a grid of patches overlapping by half.
+	The trajectory of each patch through the frames is determined by
+	cross-correlation, with the patches aligned in parallel.
+	The deviations from the global trajectory are fitted with a polynomial
+	in x, y and t:
+		d(x,y,t) = sum_ij c_ij b_i(x,y) t^j	j = 1..3
+	where the spatial terms b_i are quadratic for at least 3x3 patches
+	and linear otherwise, and t is the frame number relative to the 
+	reference frame divided by the number of frames.
+	A constant offset per patch is absorbed by centering each patch trajectory.
+	The regularization weight, relative to the total weight of the
+	measurements, pulls the model towards the global trajectory.
+	The patch measurements are weighted by their average correlation coefficient.
+	The spatial coefficients for each frame are stored in the frame structures.
+
+**/
+double		mg_align_frame_patches(Bmicrograph* mg, Bimage* p, long ref_num,
+				Vector3<long> patches, double hi_res, double lo_res,
+				double shift_limit, double lambda)
+{
+	long			nf(p->images()), nx(p->sizeX()), ny(p->sizeY());
+	if ( nf < 2 || !mg->frame ) return 0;
+	if ( ref_num < 0 || ref_num >= nf ) ref_num = 0;
+	if ( patches[0] < 1 ) patches[0] = 1;
+	if ( patches[1] < 1 ) patches[1] = 1;
+	if ( lambda < 0 ) lambda = 0;
+	
+	long			i, j, k, l, nn, ix, iy;
+	long			np(patches[0]*patches[1]);
+	long			ps(2*min(nx/(patches[0]+1), ny/(patches[1]+1)));
+	ps -= ps%2;
+	
+	if ( ps < 32 ) {
+		cerr << "Error in mg_align_frame_patches: The patch size (" << ps << ") is too small!" << endl;
+		return -1;
+	}
+	
+	if ( shift_limit < 1 ) shift_limit = ps/4;
+	
+	p->change_type(Float);
+	
+	Bframe*			frame;
+	vector<Vector3<double>>	sh(nf);
+	for ( nn=0, frame = mg->frame; nn<nf && frame; ++nn, frame = frame->next )
+		sh[nn] = frame->shift;
+	
+	vector<Vector3<long>>	start(np);
+	vector<Vector3<double>>	pos(np);
+	for ( k=iy=0; iy<patches[1]; ++iy ) {
+		for ( ix=0; ix<patches[0]; ++ix, ++k ) {
+			start[k][0] = (patches[0] > 1)? ix*(nx - ps)/(patches[0] - 1): (nx - ps)/2;
+			start[k][1] = (patches[1] > 1)? iy*(ny - ps)/(patches[1] - 1): (ny - ps)/2;
+			pos[k][0] = 2.0*(start[k][0] + ps/2)/nx - 1;
+			pos[k][1] = 2.0*(start[k][1] + ps/2)/ny - 1;
+		}
+	}
+	
+	if ( verbose ) {
+		cout << "Aligning frames in patches:" << endl;
+		cout << "Patches:                       " << patches[0] << " x " << patches[1] << endl;
+		cout << "Patch size:                    " << ps << endl;
+		cout << "Local shift limit:             " << shift_limit << endl;
+		cout << "Regularization:                " << lambda << endl;
+	}
+	
+	fft_plan		planf = fft_setup_plan(ps, ps, 1, FFTW_FORWARD, 0);
+	fft_plan		planb = fft_setup_plan(ps, ps, 1, FFTW_BACKWARD, 0);
+
+	vector<vector<Vector3<double>>>	dev(np);
+	
+#ifdef HAVE_GCD
+	dispatch_apply(np, dispatch_get_global_queue(0, 0), ^(size_t k){
+		dev[k] = frame_patch_trajectory(p, sh, start[k], ps, hi_res, lo_res,
+				shift_limit, planf, planb);
+	});
+#else
+#pragma omp parallel for
+	for ( long k=0; k<np; ++k )
+		dev[k] = frame_patch_trajectory(p, sh, start[k], ps, hi_res, lo_res,
+				shift_limit, planf, planb);
+#endif
+
+    fft_destroy_plan(planf);
+    fft_destroy_plan(planb);
+	
+	// Least squares fit of the deviations, with a ridge term
+	long			nb((patches[0] > 2 && patches[1] > 2)? 6: 3);
+	long			nt((nf > 3)? 3: nf - 1);
+	long			nc(nb*nt);
+	double			w, ws(0), b[6], tv;
+	vector<double>	tp(nf*nt), tm(nt, 0), pw(np, 0), f(nc);
+	vector<double>	cx(nc, 0), cy(nc, 0);
+	vector<Vector3<double>>	davg(np);
+	Matrix			a(nc, nc);
+	
+	for ( nn=0; nn<nf; ++nn ) {
+		tv = (nn - ref_num)*1.0/nf;
+		for ( j=0; j<nt; ++j ) {
+			tp[nn*nt+j] = (j)? tp[nn*nt+j-1]*tv: tv;
+			tm[j] += tp[nn*nt+j]/nf;
+		}
+	}
+	
+	for ( k=0; k<np; ++k ) {
+		for ( nn=0; nn<nf; ++nn ) {
+			pw[k] += dev[k][nn][2]/nf;
+			davg[k] += dev[k][nn]/nf;
+		}
+		if ( pw[k] < 0.01 ) pw[k] = 0.01;
+		frame_local_basis(nb, pos[k][0], pos[k][1], b);
+		for ( nn=0; nn<nf; ++nn ) {
+			for ( i=l=0; i<nb; ++i )
+				for ( j=0; j<nt; ++j, ++l )
+					f[l] = b[i]*(tp[nn*nt+j] - tm[j]);
+			for ( i=0; i<nc; ++i ) {
+				cx[i] += pw[k]*f[i]*(dev[k][nn][0] - davg[k][0]);
+				cy[i] += pw[k]*f[i]*(dev[k][nn][1] - davg[k][1]);
+				for ( j=0; j<nc; ++j ) a[i][j] += pw[k]*f[i]*f[j];
+			}
+			ws += pw[k];
+		}
+	}
+	
+	for ( i=0; i<nc; ++i ) a[i][i] += lambda*ws;
+	
+	a.LU_decomposition(cx);
+	a.multiply_in_place(cy);
+	
+	// Residuals with and without the model
+	double			r, r0(0), r1(0);
+	for ( k=0; k<np; ++k ) {
+		frame_local_basis(nb, pos[k][0], pos[k][1], b);
+		for ( nn=0; nn<nf; ++nn ) {
+			Vector3<double>	d(dev[k][nn] - davg[k]);
+			for ( i=l=0; i<nb; ++i ) {
+				for ( j=0; j<nt; ++j, ++l ) {
+					w = b[i]*(tp[nn*nt+j] - tm[j]);
+					d[0] -= cx[l]*w;
+					d[1] -= cy[l]*w;
+				}
+			}
+			r = dev[k][nn][0] - davg[k][0];
+			r0 += pw[k]*r*r;
+			r = dev[k][nn][1] - davg[k][1];
+			r0 += pw[k]*r*r;
+			r1 += pw[k]*(d[0]*d[0] + d[1]*d[1]);
+		}
+	}
+	r0 = sqrt(r0/ws);
+	r1 = sqrt(r1/ws);
+	
+	// Spatial coefficients for each frame
+	for ( nn=0, frame = mg->frame; nn<nf && frame; ++nn, frame = frame->next ) {
+		frame->local.assign(2*nb, 0);
+		for ( i=l=0; i<nb; ++i ) {
+			for ( j=0; j<nt; ++j, ++l ) {
+				frame->local[i] += cx[l]*tp[nn*nt+j];
+				frame->local[nb+i] += cy[l]*tp[nn*nt+j];
+			}
+		}
+	}
+	
+	if ( verbose ) {
+		cout << "Model terms (spatial x time):  " << nb << " x " << nt << endl;
+		cout << "Deviation from global shifts:  " << r0 << " pixels" << endl;
+		cout << "Residual after local model:    " << r1 << " pixels" << endl << endl;
+	}
+	
+	return r1;
+}
+
+/**
+@brief 	Applies local frame shifts by interpolation at every pixel.
+@param 	*p				frames (converted to floating point).
+@param 	*framelist		frame parameters with local deformation coefficients.
+@return long			number of frames corrected.
+
+	Each pixel is interpolated at the location displaced by the global
+	frame shift plus the local deformation at that pixel.
+	The frame origins are reset to the center so that a subsequent
+	shifted sum does not apply the global shift again.
+
+**/
+long		img_frames_correct_local(Bimage* p, Bframe* framelist)
+{
+	p->change_type(Float);
+	
+	long			nn, nf(0);
+	Vector3<long>	size(p->size());
+	long			imgsize(size.volume());
+	double			fill(p->average());
+	float*			fp = (float *) p->data_pointer();
+	float*			buf = new float[imgsize];
+	Bframe*			frame;
+
+	for ( nn=0, frame = framelist; nn<p->images() && frame; ++nn, frame = frame->next ) {
+#ifdef HAVE_GCD
+		dispatch_apply(size[1], dispatch_get_global_queue(0, 0), ^(size_t yy){
+			Vector3<double>	s;
+			for ( long xx=0, i=yy*size[0]; xx<size[0]; ++xx, ++i ) {
+				s = frame_local_shift(frame, size, xx, yy);
+				buf[i] = p->interpolate(0, xx - s[0], yy - s[1], 0, nn, fill);
+			}
+		});
+#else
+#pragma omp parallel for
+		for ( long yy=0; yy<size[1]; ++yy ) {
+			Vector3<double>	s;
+			for ( long xx=0, i=yy*size[0]; xx<size[0]; ++xx, ++i ) {
+				s = frame_local_shift(frame, size, xx, yy);
+				buf[i] = p->interpolate(0, xx - s[0], yy - s[1], 0, nn, fill);
+			}
+		}
+#endif
+		memcpy(fp + nn*imgsize, buf, imgsize*sizeof(float));
+		p->image[nn].origin(size/2);
+		nf++;
+	}
+	
+	delete[] buf;
+	
+	p->statistics_invalidate();
+	
+	return nf;
+}
+
 double		mg_align_frames(Bmicrograph* mg, long ref_num, long window, long step,
 				Bimage* pgr, Bimage* pmask, double hi_res, double lo_res,
 				double shift_limit, double edge_width, double gauss_width, 
-				long bin, Bstring& subset, int flag)
+				long bin, Vector3<long> patches, double lambda, Bstring& subset, int flag)
 {
 	if ( bin < 1 ) bin = 1;
 	
@@ -1241,6 +1626,10 @@ double		mg_align_frames(Bmicrograph* mg, long ref_num, long window, long step,
 	Vector3<long>	aln_bin(1,1,1);
 	if ( hi_res > 3*p->image->sampling()[0] ) aln_bin = Vector3<long>(2,2,1);
 	
+	// The global alignment modifies the frames: keep a copy for the patches
+	Bimage*			pf = NULL;
+	if ( patches[0]*patches[1] > 1 ) pf = p->copy();
+	
 	vector<Vector3<double>>	sh = p->align(ref_num, window, step, pmask, hi_res, lo_res, shift_limit,
 						edge_width, gauss_width, aln_bin, mode);
 
@@ -1254,6 +1643,7 @@ double		mg_align_frames(Bmicrograph* mg, long ref_num, long window, long step,
 		frame->shift[0] = sh[i][0];
 		frame->shift[1] = sh[i][1];
 		frame->fom = sh[i][2];
+		frame->local.clear();
 		if ( i ) {
 			shift = (frame->shift - pshift)*mg->pixel_size;
 			d = shift.length();
@@ -1280,9 +1670,90 @@ double		mg_align_frames(Bmicrograph* mg, long ref_num, long window, long step,
 
 	delete p;
 	
+	if ( pf ) {
+		mg_align_frame_patches(mg, pf, ref_num, patches, hi_res, lo_res,
+				shift_limit, lambda);
+		delete pf;
+	}
+	
 	return mg->fom;
 }
 
+/*
+	Residency limits shared by concurrent frame alignments.
+*/
+struct Bframes_gate {
+	mutex				m;
+	condition_variable	cv;
+	long				nres = 0;		// Number of resident movies
+	double				mem = 0;		// Estimated memory of resident movies
+};
+
+/*
+	Estimates the peak memory to align the frames of a micrograph:
+	the movie as read, its floating point form and the transforms,
+	with an extra copy for patch alignment.
+*/
+static double	mg_frames_memory(Bmicrograph* mg, Vector3<long> patches)
+{
+	Bimage*			p = read_img(mg->fframe, 0, -1);
+	if ( !p ) return 0;
+	
+	double			npix(p->size().volume()*p->images());
+	double			mem(npix*(p->data_type_size() + 2*sizeof(float)));
+	if ( patches[0]*patches[1] > 1 ) mem += npix*sizeof(float);
+	
+	delete p;
+	
+	return mem;
+}
+
+/*
+	Waits until a movie fits within the limits on the number of resident
+	movies and their memory, and registers it as resident.
+	A movie is always admitted when no other movie is resident.
+*/
+static void		frames_gate_enter(Bframes_gate* gate, double mem, long nmax, double mem_max)
+{
+	unique_lock<mutex>	lock(gate->m);
+	gate->cv.wait(lock, [&]{ return gate->nres < 1 ||
+		( gate->nres < nmax && ( mem_max <= 0 || gate->mem + mem <= mem_max ) ); });
+	gate->nres++;
+	gate->mem += mem;
+}
+
+static void		frames_gate_leave(Bframes_gate* gate, double mem)
+{
+	{
+		lock_guard<mutex>	lock(gate->m);
+		gate->nres--;
+		gate->mem -= mem;
+	}
+	gate->cv.notify_all();
+}
+
+/*
+	Reports the frame alignment of a micrograph on one line, written
+	under the gate lock so that concurrent reports do not interleave.
+*/
+static void		frames_gate_report(Bframes_gate* gate, Bmicrograph* mg)
+{
+	long			nf(0);
+	Vector3<double>	first, last;
+	
+	for ( Bframe* frame = mg->frame; frame; frame = frame->next, ++nf ) {
+		if ( !nf ) first = frame->shift;
+		last = frame->shift;
+	}
+	
+	ostringstream	s;
+	s << "Micrograph " << mg->id << ": " << nf << " frames, CC average " << mg->fom <<
+		", total drift " << ((last - first)*mg->pixel_size).length() << " A" << endl;
+	
+	lock_guard<mutex>	lock(gate->m);
+	cout << s.str() << flush;
+}
+
 /**
 @brief 	Aligns a series of micrographs by cross-correlation.
 @param 	*project		project parameter structure.
@@ -1298,12 +1769,26 @@ double		mg_align_frames(Bmicrograph* mg, long ref_num, long window, long step,
 @param 	edge_width		edge smoothing width (not done if 0).
 @param 	gauss_width		edge decay width.
 @param 	bin				integer bin factor.
+@param 	patches			number of patches in x and y for local alignment.
+@param 	lambda			regularization weight for the local deformation model.
+@param 	nconcurrent		maximum number of movies aligned concurrently.
+@param 	mem_budget		maximum memory for resident movies (bytes, 0 = no limit).
 @param	subset			a subset to sum.
 @param 	flag			options flag.
 @return double			root-mean-square of offsets.
 
 	Each micrograph frame is cross-correlated with the reference
 	frame and the shift determined.
+	If more than one patch is specified, the frames are also aligned
+	in patches to fit a local deformation model (see mg_align_frame_patches).
+	The micrographs are aligned concurrently, each with an equal share
+	of the available threads. A movie only starts when its estimated
+	memory fits within the budget, unless no other movie is resident.
+	The memory is only estimated, from the movie headers, with a budget.
+	With concurrent alignment the detailed output for each movie is
+	replaced by a one-line report per movie.
+	Each movie is aligned independently, so the results are the same
+	as aligning the micrographs one by one.
 	Options encoded in the flag:
 	1	rescale image based on histogram.
 	2	weigh by accumulated dose.
@@ -1315,7 +1800,8 @@ double		mg_align_frames(Bmicrograph* mg, long ref_num, long window, long step,
 double		project_align_frames(Bproject* project, int ref_img, long window, long step,
 				Bimage* pgr, Bimage* pmask, Vector3<double> origin, double hi_res, double lo_res,
 				double shift_limit, double edge_width, double gauss_width,
-				long bin, Bstring& subset, int flag)
+				long bin, Vector3<long> patches, double lambda,
+				long nconcurrent, double mem_budget, Bstring& subset, int flag)
 {
 	if ( bin < 1 ) bin = 1;
 	if ( window < 1 ) window = 1;
@@ -1324,6 +1810,15 @@ double		project_align_frames(Bproject* project, int ref_img, long window, long s
 	Bmicrograph*	mg;
 	long			nmg = project_count_micrographs(project);
 	double			d(0);
+	
+	if ( nmg < 1 ) return 0;
+	
+	if ( nconcurrent < 1 ) nconcurrent = 1;
+	if ( nconcurrent > nmg ) nconcurrent = nmg;
+	
+	long			nthreads(system_processors());
+	long			ninner(nthreads/nconcurrent);
+	if ( ninner < 1 ) ninner = 1;
 
 //	if ( verbose & ( VERB_LABEL | VERB_PROCESS ) ) {
 	if ( verbose ) {
@@ -1335,6 +1830,8 @@ double		project_align_frames(Bproject* project, int ref_img, long window, long s
 		cout << "Shift limit:                    " << shift_limit << endl;
 		cout << "Edge masking width & smoothing: " << edge_width << " " << gauss_width << endl;
 		cout << "Binning:                        " << bin << endl;
+		if ( patches[0]*patches[1] > 1 )
+			cout << "Local alignment patches:        " << patches[0] << " x " << patches[1] << endl;
 		if ( pgr )
 			cout << "Gain reference file:            " << pgr->file_name() << endl;
 		if ( pmask )
@@ -1343,16 +1840,68 @@ double		project_align_frames(Bproject* project, int ref_img, long window, long s
 			cout << "Initial alignment mode:         local" << endl;
 		else
 			cout << "Initial alignment mode:         progressive" << endl;
+		cout << "Concurrent micrographs:         " << nconcurrent << endl;
+		cout << "Threads per micrograph:         " << ninner << endl;
+		if ( mem_budget > 0 )
+			cout << "Memory budget:                  " << mem_budget/1e9 << " GB" << endl;
 		cout << endl;
 	}
 
-	for ( nmg=0, field = project->field; field; field = field->next ) {
-		for ( mg = field->mg; mg; mg = mg->next, nmg++ ) {
-			mg_align_frames(mg, ref_img, window, step, pgr, pmask, hi_res, lo_res, shift_limit,
-				edge_width, gauss_width, bin, subset, flag);
-			d += mg->fom;
+	// Shared images must not be converted while in use by concurrent alignments
+	if ( pgr ) pgr->change_type(Float);
+	if ( pmask ) pmask->change_type(Float);
+
+	vector<Bmicrograph*>	mg_arr;
+	vector<double>			mg_mem;
+	
+	for ( field = project->field; field; field = field->next )
+		for ( mg = field->mg; mg; mg = mg->next ) {
+			mg_arr.push_back(mg);
+			mg_mem.push_back(( mem_budget > 0 )? mg_frames_memory(mg, patches): 0);
 		}
-	}
+
+	Bframes_gate	gate;
+	Bframes_gate*	pgate = &gate;
+	Bmicrograph**	pmg = mg_arr.data();
+	double*			pmem = mg_mem.data();
+	
+	// The detailed output of concurrent alignments would interleave
+	int				verb(verbose);
+	if ( nconcurrent > 1 ) verbose = 0;
+
+#ifdef HAVE_GCD
+	dispatch_apply(nmg, dispatch_get_global_queue(0, 0), ^(size_t i){
+		frames_gate_enter(pgate, pmem[i], nconcurrent, mem_budget);
+		mg_align_frames(pmg[i], ref_img, window, step, pgr, pmask, hi_res, lo_res, shift_limit,
+			edge_width, gauss_width, bin, patches, lambda, subset, flag);
+		frames_gate_leave(pgate, pmem[i]);
+		if ( verb && nconcurrent > 1 ) frames_gate_report(pgate, pmg[i]);
+	});
+#else
+#ifdef HAVE_OMP
+	int				levels = omp_get_max_active_levels();
+	if ( nconcurrent > 1 ) omp_set_max_active_levels(2);
+#pragma omp parallel for num_threads(nconcurrent) schedule(dynamic,1)
+#endif
+	for ( long i=0; i<nmg; ++i ) {
+#ifdef HAVE_OMP
+		if ( nconcurrent > 1 ) omp_set_num_threads(ninner);
+#endif
+		frames_gate_enter(pgate, pmem[i], nconcurrent, mem_budget);
+		mg_align_frames(pmg[i], ref_img, window, step, pgr, pmask, hi_res, lo_res, shift_limit,
+			edge_width, gauss_width, bin, patches, lambda, subset, flag);
+		frames_gate_leave(pgate, pmem[i]);
+		if ( verb && nconcurrent > 1 ) frames_gate_report(pgate, pmg[i]);
+	}
+#ifdef HAVE_OMP
+	omp_set_max_active_levels(levels);
+#endif
+#endif
+	
+	verbose = verb;
+	
+	// Sum in micrograph order so that the result does not depend on the schedule
+	for ( long i=0; i<nmg; ++i ) d += mg_arr[i]->fom;
 	
 	d /= nmg;
 
@@ -2379,8 +2928,14 @@ int			mg_frames_snr(Bmicrograph* mg, double res_hi, long window, Bstring& subset
 	if ( verbose )
 		cout << "Micrograph: " << mg->id << " with " << nimg << " frames at " << mg->dose/p->images() << " e/Å2/frame" << endl;
 
-	for ( n=0, frame = mg->frame; frame; frame = frame->next, ++n )
-		p->image[n].origin(frame->shift + p->size()/2);
+	if ( mg->frame && mg->frame->local.size() ) {
+		if ( verbose )
+			cout << "Correcting local frame motion" << endl;
+		img_frames_correct_local(p, mg->frame);
+	} else {
+		for ( n=0, frame = mg->frame; frame; frame = frame->next, ++n )
+			p->image[n].origin(frame->shift + p->size()/2);
+	}
 
 	Bimage*			psum = p->fspace_subset_sums(window, 1|(flag&2));
 	
@@ -3,7 +3,7 @@
 @brief	Classifies raw single particle images with respect to multiple models
 @author Bernard Heymann
 @date	Created: 20010222
-@date	Modified: 20150424
+@date	Modified: 20261018
 **/
 
 #include "Bimage.h"
@@ -15,6 +15,7 @@
 #include "Matrix3.h"
 #include "linked_list.h"
 #include "utilities.h"
+#include "timer.h"
 
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
@@ -34,25 +35,22 @@ extern int 	verbose;		// Level of output to the screen
 	For every particle image, a projection is made from every reference map
 	according to the input orientation parameters and compared to the
 	particle image. The FOM calculated is a real space correlation coefficient.
+	The reference maps are read and prepared (Fourier transformed for
+	central sections) once into a shared read-only bank.
+	Each particle stack is read once and all references are scored 
+	against its particles in parallel.
 
 **/
 long   mg_classify(Bproject* project, double resolution_hi, double resolution_lo,
 					int fom_type, double fom_cut, FSI_Kernel* kernel, int ctf_apply, int img_out)
 {
-	// Main loop over all reference maps
-	bool			invert(0);
-	long			i, j, m, nsel(0);
-	double			maxfom, CC, PD(0), R;
-	Vector3<double>	translate, origin;
-	Matrix3 		mat(1);
+	long			i, m, nsel(0);
+	double			maxfom;
+	Vector3<double>	origin;
 	Bstring			filename;
-	Bstring			name_base;
 	Bstring			insert("_diff.");
-	Bimage*			p = NULL;
 	Bimage*			pmap = NULL;
-	Bimage*			proj = NULL;
-	Bimage*			pdiff = NULL;
-	Bimage*			mapproj = NULL;
+	Bimage*			p = NULL;
 
 	long			nmap = count_list((char *)project->reference);
 	Bstring*		map = project->reference;
@@ -84,23 +82,18 @@ long   mg_classify(Bproject* project, double resolution_hi, double resolution_lo
 			cout << "Output differences" << endl;
 	}
 
-	pmap = read_img(*(project->reference), 0, 0);
-
-	fft_plan		planf_2D = fft_setup_plan(pmap->sizeX(), pmap->sizeY(), 1, FFTW_FORWARD, 1);
-	fft_plan		planb_2D = fft_setup_plan(pmap->sizeX(), pmap->sizeY(), 1, FFTW_BACKWARD, 1);
+	double			ti = timer_start();
 	
-	delete pmap;
-	
-	if ( verbose & VERB_RESULT ) {
-		cout << endl << "Map\tFile\tPart\t";
-		if ( fom_type == 1 ) cout << "R" << endl;
-		else if ( fom_type == 2 ) cout << "dPhi" << endl;
-		else cout << "CC" << endl;
-	}
-	for ( i=0, map = project->reference; map; map = map->next, i++ ) {
+	// Shared bank of prepared reference maps
+	vector<Bimage*>	pmaps;
+	vector<Bstring*>	refs;
+	for ( map = project->reference; map; map = map->next ) {
+		refs.push_back(map);
 		pmap = read_img(map->str(), 1, 0);
-		if ( !pmap )
+		if ( !pmap ) {
+			for ( auto pm: pmaps ) delete pm;
 			return error_show("mg_classify", __FILE__, __LINE__);
+		}
 		pmap->change_type(Float);
 		pmap->statistics();
 		pmap->calculate_background();
@@ -113,107 +106,158 @@ long   mg_classify(Bproject* project, double resolution_hi, double resolution_lo
 			pmap->fft();
 			pmap->phase_shift_to_origin();
 		}
-		name_base = Bstring(i+1, "map%02d");
-		m = 0;
-		for ( field=project->field; field; field=field->next ) {
-			for ( mg=field->mg; mg; mg=mg->next ) {
-				p = read_img(mg->fpart, 0, -1);
-				if ( !p )
-					return error_show("mg_classify", __FILE__, __LINE__);
-				proj = p->copy_header(p->images());
-				delete p;
-//				filename = p->file_name();
+		pmaps.push_back(pmap);
+	}
+	
+	if ( nmap < 1 ) return 0;
+	
+	fft_plan		planf_2D = fft_setup_plan(pmaps[0]->sizeX(), pmaps[0]->sizeY(), 1, FFTW_FORWARD, 1);
+	fft_plan		planb_2D = fft_setup_plan(pmaps[0]->sizeX(), pmaps[0]->sizeY(), 1, FFTW_BACKWARD, 1);
+	
+	if ( verbose & VERB_TIME )
+		cout << "Reference preparation time:     " << getwalltime() - ti << " s" << endl;
+	
+	if ( verbose & VERB_RESULT ) {
+		cout << endl << "Map\tFile\tPart\t";
+		if ( fom_type == 1 ) cout << "R" << endl;
+		else if ( fom_type == 2 ) cout << "dPhi" << endl;
+		else cout << "CC" << endl;
+	}
+	
+	m = 0;
+	for ( field=project->field; field; field=field->next ) {
+		for ( mg=field->mg; mg; mg=mg->next ) {
+			vector<Bparticle*>	parts;
+			for ( part=mg->part; part; part=part->next ) parts.push_back(part);
+			// A stack without particles still gets its (empty) output files
+			p = read_img(mg->fpart, !parts.empty(), -1);
+			if ( !p ) {
+				for ( auto pm: pmaps ) delete pm;
+				return error_show("mg_classify", __FILE__, __LINE__);
+			}
+			if ( p->data_pointer() ) p->change_type(Float);
+			vector<Bimage*>	proj(nmap), pdiff(nmap);
+			for ( i=0; i<nmap; i++ ) {
+				proj[i] = p->copy_header(p->images());
 				filename = mg->fpart;
-				filename = filename.pre_rev('.') + "_" + name_base + "." + filename.post_rev('.');
-				proj->file_name(filename.str());
-				proj->data_type(Float);
-				proj->data_alloc();
-				pdiff = proj->copy_header(proj->images());
+				filename = filename.pre_rev('.') + "_" + Bstring(i+1, "map%02d") + "." + filename.post_rev('.');
+				proj[i]->file_name(filename.str());
+				proj[i]->data_type(Float);
+				proj[i]->data_alloc_and_clear();
+				pdiff[i] = proj[i]->copy_header(p->images());
 				filename = filename.pre_rev('.') + insert + filename.post_rev('.');
-				pdiff->file_name(filename.str());
-				pdiff->data_alloc();
-				for ( j=0, part=mg->part; part; part=part->next, j++ ) {
-					p = read_img(mg->fpart, 1, part->id-1);
-					if ( !p )
-						return error_show("Error in mg_classify", __FILE__, __LINE__);
-					p->change_type(Float);
-					p->statistics();
-					if ( !p->rescale_to_avg_std(0, 1) ) {
-						// Calculate the projected reference image
-						if ( verbose & VERB_FULL )
-							cout << "View and origin: " << part->view << tab << part->ori << endl;
-						mat = part->view.matrix();
-						if ( part->mag ) mat *= part->mag;
-						translate[0] = part->ori[0] - pmap->sizeX()/2;
-						translate[1] = part->ori[1] - pmap->sizeY()/2;
-						if ( kernel ) {
-							mapproj = pmap->central_section(mat, resolution_hi, kernel); 
-							mapproj->phase_shift_to_center();
-							if ( ctf_apply )
-								img_ctf_apply_to_proj(mapproj, *(mg->ctf), part->def, 1e6, resolution_hi, invert, planf_2D, planb_2D);
-							mapproj->fft_back(planb_2D);
-							mapproj->shift(translate);
-							mapproj->correct_background();
-						} else {
-							mapproj = pmap->rotate_project(mat, translate, pmap->sizeX()/2.0);
-							if ( ctf_apply )
-								img_ctf_apply_to_proj(mapproj, *(mg->ctf), part->def, 1e6, resolution_hi, invert, planf_2D, planb_2D);
-						}
-						mapproj->statistics();
-						mapproj->rescale_to_avg_std(0, 1);
-						// Compare two 2D images ===> FOM
-						p->sampling(part->pixel_size);
-						p->origin(part->ori);
-						proj->image[j].origin(part->ori);
-						pdiff->image[j].origin(part->ori);
-						proj->image[j].view(part->view);
-						pdiff->image[j].view(part->view);
-						proj->replace(j, mapproj);
-						if ( fom_type == 0 ) {
-							CC = p->correlate(mapproj);
-							fom[m*nmap+i] = CC;
-						} else if ( fom_type == 2 ) {
-							PD = mapproj->average_phase_difference(p,
-								resolution_hi, resolution_lo, 1);
-							fom[m*nmap+i] = cos(PD);
-						}
-						R = mapproj->linear_fit(p, NULL, 0);
-						mapproj->invert();
-						if ( fom_type == 1 ) fom[m*nmap+i] = 1 - R;
-						pdiff->replace(j, mapproj);
-						delete p;
-						delete mapproj;
-						if ( verbose & VERB_RESULT ) {
-							cout << *map << tab << mg->fpart << tab << part->id << tab;
+				pdiff[i]->file_name(filename.str());
+				pdiff[i]->data_alloc_and_clear();
+			}
+#pragma omp parallel for
+			for ( long j=0; j<parts.size(); j++ ) {
+				Bparticle*		pt = parts[j];
+				if ( j >= p->images() || pt->id < 1 || pt->id > p->images() ) continue;
+				Bimage*			pp;
+#pragma omp critical
+				pp = p->extract(pt->id-1);
+				pp->statistics();
+				if ( pp->rescale_to_avg_std(0, 1) ) {
+					delete pp;
+					continue;
+				}
+				pp->sampling(pt->pixel_size);
+				pp->origin(pt->ori);
+				Matrix3			mat = pt->view.matrix();
+				if ( pt->mag ) mat *= pt->mag;
+				for ( long k=0; k<nmap; k++ ) {
+					Bimage*			pm = pmaps[k];
+					Bimage*			mapproj = NULL;
+					Vector3<double>	translate;
+					double			CC(0), PD(0), R;
+					// Calculate the projected reference image
+					if ( verbose & VERB_FULL ) {
+#pragma omp critical
+						cout << "View and origin: " << pt->view << tab << pt->ori << endl;
+					}
+					translate[0] = pt->ori[0] - pm->sizeX()/2;
+					translate[1] = pt->ori[1] - pm->sizeY()/2;
+					if ( kernel ) {
+						mapproj = pm->central_section(mat, resolution_hi, kernel); 
+						mapproj->phase_shift_to_center();
+						if ( ctf_apply )
+							img_ctf_apply_to_proj(mapproj, *(mg->ctf), pt->def, 1e6, resolution_hi, 0, planf_2D, planb_2D);
+						mapproj->fft_back(planb_2D);
+						mapproj->shift(translate);
+						mapproj->correct_background();
+					} else {
+						mapproj = pm->rotate_project(mat, translate, pm->sizeX()/2.0);
+						if ( ctf_apply )
+							img_ctf_apply_to_proj(mapproj, *(mg->ctf), pt->def, 1e6, resolution_hi, 0, planf_2D, planb_2D);
+					}
+					mapproj->statistics();
+					mapproj->rescale_to_avg_std(0, 1);
+					// Compare two 2D images ===> FOM
+#pragma omp critical (mg_classify_output)
+					{
+						proj[k]->image[j].origin(pt->ori);
+						proj[k]->image[j].view(pt->view);
+						proj[k]->replace(j, mapproj);
+					}
+					if ( fom_type == 0 ) {
+						CC = pp->correlate(mapproj);
+						fom[(m+j)*nmap+k] = CC;
+					} else if ( fom_type == 2 ) {
+						PD = mapproj->average_phase_difference(pp,
+							resolution_hi, resolution_lo, 1);
+						fom[(m+j)*nmap+k] = cos(PD);
+					}
+					R = mapproj->linear_fit(pp, NULL, 0);
+					mapproj->invert();
+					if ( fom_type == 1 ) fom[(m+j)*nmap+k] = 1 - R;
+#pragma omp critical (mg_classify_output)
+					{
+						pdiff[k]->image[j].origin(pt->ori);
+						pdiff[k]->image[j].view(pt->view);
+						pdiff[k]->replace(j, mapproj);
+					}
+					delete mapproj;
+					if ( verbose & VERB_RESULT ) {
+#pragma omp critical
+						{
+							cout << *refs[k] << tab << mg->fpart << tab << pt->id << tab;
 							if ( fom_type == 1 ) cout << R << endl;
 							else if ( fom_type == 2 ) cout << PD*180.0/M_PI << endl;
 							else cout << CC << endl;
 						}
 					}
-					m++;
 				}
+				delete pp;
+			}
+			m += parts.size();
+			delete p;
+			for ( i=0; i<nmap; i++ ) {
 				if ( img_out%2 == 1 ) {
-					proj->statistics();
-					cout << "Writing " << proj->file_name() << endl;
-					write_img(proj->file_name(), proj, 0);
-					mg->fpart = proj->file_name();
+					proj[i]->statistics();
+					cout << "Writing " << proj[i]->file_name() << endl;
+					write_img(proj[i]->file_name(), proj[i], 0);
+					mg->fpart = proj[i]->file_name();
 				}
 				if ( img_out > 1 ) {
-					pdiff->statistics();
-					cout << "Writing " << pdiff->file_name() << endl;
-					write_img(pdiff->file_name(), pdiff, 0);
-					mg->fpart = pdiff->file_name();
+					pdiff[i]->statistics();
+					cout << "Writing " << pdiff[i]->file_name() << endl;
+					write_img(pdiff[i]->file_name(), pdiff[i], 0);
+					mg->fpart = pdiff[i]->file_name();
 				}
-				delete proj;
-				delete pdiff;
+				delete proj[i];
+				delete pdiff[i];
 			}
 		}
-		delete pmap;
 	}
 
+	for ( auto pm: pmaps ) delete pm;
+	
     fft_destroy_plan(planf_2D);
     fft_destroy_plan(planb_2D);
 
+	if ( verbose & VERB_TIME )
+		cout << "Classification time:            " << getwalltime() - ti << " s" << endl;
+
 	// Get the best FOM and assign the particle to that map
 	if ( verbose & VERB_RESULT ) {
 		cout << endl << "File\tPart\tMap\tFOM=";
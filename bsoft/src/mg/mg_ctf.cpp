@@ -3,7 +3,7 @@
 @brief	Functions for CTF (contrast transfer function) processing
 @author 	Bernard Heymann
 @date	Created: 19970715
-@date	Modified: 20230105
+@date	Modified: 20261018
 **/
 
 #include "rwimg.h"
@@ -17,6 +17,7 @@
 #include "timer.h"
 
 #include <sys/stat.h>
+#include <unistd.h>
 
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
@@ -921,7 +922,7 @@ int			mg_ps_name(Bmicrograph* mg, int img_num, Bstring& path, Bstring& newname,
 
 
 Bimage*		mg_ctf_prepare(Bmicrograph* mg, int action, double lores, double hires,
-				Vector3<long> tile_size, double def_start, double def_end, double def_inc, int flags)
+				Vector3<long> tile_size, double def_start, double def_end, double def_inc, int flags, long bin)
 {
 	int				img_type(0), img_num(-1);
 	int				ps_flags(7);
@@ -987,6 +988,7 @@ Bimage*		mg_ctf_prepare(Bmicrograph* mg, int action, double lores, double hires,
 		p->sampling(pixel_size);
 		p->change_type(Float);
 		if ( ( flags & 16 ) && p->sizeZ() > 1 ) p->slices_to_images();
+		if ( bin > 1 ) p->bin(Vector3<long>(bin, bin, 1));
 	}
 	
 	if ( !p ) return NULL;
@@ -1114,6 +1116,7 @@ int 		rec_ctf_prepare(Breconstruction* rec, int action, double lores, double hir
 @param 	&path		new power spectrum directory for output.
 @param 	&newname	new file name for output.
 @param 	flags		1=use mg or rec, 2=filter, 4=background, 8=astigmatism, 16=frames, 32=aberration fit
+@param	bin			micrograph binning before power spectrum calculation.
 @return int			0, <0 on error.
 
 	The default is to use the particle file. If the particle file is not
@@ -1123,7 +1126,7 @@ int 		rec_ctf_prepare(Breconstruction* rec, int action, double lores, double hir
 int 		project_ctf_prepare(Bproject* project, int action, double lores,
 				double hires, Vector3<long> tile_size,
 				double def_start, double def_end, double def_inc,
-				Bstring& path, Bstring& newname, int flags)
+				Bstring& path, Bstring& newname, int flags, long bin)
 {
 	if ( action < 1 ) return 0;
 	
@@ -1182,7 +1185,7 @@ int 		project_ctf_prepare(Bproject* project, int action, double lores,
 				onefile = 1;
 			} else onefile = 0;
 			for ( mg = field->mg; mg; mg = mg->next ) {
-				ps1 = mg_ctf_prepare(mg, action, lores, hires, tile_size, def_start, def_end, def_inc, flags);
+				ps1 = mg_ctf_prepare(mg, action, lores, hires, tile_size, def_start, def_end, def_inc, flags, bin);
 				if ( ps1 ) { 
 					if ( action == 11 || action == 13 ) {
 						if ( onefile == 1 ) {
@@ -1223,6 +1226,187 @@ int 		project_ctf_prepare(Bproject* project, int action, double lores,
 }
 
 
+/*
+	Returns the name of the cached power spectrum for a micrograph.
+	The source is selected as in mg_ctf_prepare for calculating and fitting.
+	The name includes a hash of the source file path, its modification time,
+	the sub-image number, the tile size, the binning, the flags affecting
+	the power spectrum and the pixel size.
+	An empty name is returned when the source file cannot be found.
+	Tilted micrographs are never cached, because their power spectra
+	depend on the defocus, which is changed by the fit.
+*/
+static Bstring	mg_ps_cache_name(Bmicrograph* mg, Vector3<long> tile_size, long bin,
+				Bstring& cache, int flags, Vector3<double>& pixel_size)
+{
+	Bstring			filename, cachename;
+	long			img_num(-1);
+
+	pixel_size = mg->pixel_size;
+	
+	if ( flags & 1 ) {
+		if ( mg->fframe.length() && ( flags & 16 ) ) {
+			filename = mg->fframe;
+		} else {
+			filename = mg->fmg;
+			img_num = mg->img_num;
+		}
+	} else if ( mg->fpart.length() ) {
+		filename = mg->fpart;
+		if ( mg->part && mg->part->pixel_size[0] > 0 )
+			pixel_size = mg->part->pixel_size;
+	}
+	
+	if ( fabs(mg->tilt_angle) > 1e-6 ) return cachename;
+	
+	struct stat		st;
+	if ( !filename.length() || stat(filename.c_str(), &st) ) return cachename;
+	
+	ostringstream	key;
+	key << filename << tab << st.st_mtime << tab << img_num << tab << tile_size << tab
+		<< bin << tab << (flags & 19) << tab << pixel_size;
+
+	// FNV-1a hash of the key
+	unsigned long	h(14695981039346656037UL);
+	for ( auto c: key.str() ) {
+		h ^= (unsigned char) c;
+		h *= 1099511628211UL;
+	}
+	
+	cachename = cache + filename.base() + Bstring(h, "_%016lx_ps.mrc");
+	
+	return cachename;
+}
+
+/**
+@brief 	Calculates power spectra and fits CTF curves for all micrographs in parallel.
+@param 	*project	project parameter structure.
+@param 	lores		low resolution limit for CTF operations.
+@param 	hires		high resolution limit for CTF operations.
+@param 	tile_size	tile size for power spectrum generation.
+@param	bin			micrograph binning before power spectrum calculation.
+@param	def_start	defocus search start (default 1e3).
+@param	def_end		defocus search end (default 2e5).
+@param	def_inc		defocus search increment (default 1e3).
+@param 	&cache		power spectrum cache directory.
+@param 	flags		1=use mg, 2=filter, 8=astigmatism, 16=frames, 32=aberration fit, 64=2D astigmatism
+@return long		number of micrographs fitted.
+
+	The micrographs are processed concurrently, each calculating the tiled
+	and averaged power spectrum and fitting it as in project_ctf_prepare.
+	Each power spectrum is written to the cache directory under a name
+	derived from the source file path and modification time, the tile size,
+	the binning and other parameters affecting the power spectrum.
+	If the cached file exists, it is read instead of calculating the power
+	spectrum again, so that fitting with different resolution limits or
+	defocus ranges only repeats the fits.
+	A cached file with a size different from the tile size is recalculated.
+	A new power spectrum is written to a temporary file and renamed, so that
+	an interrupted run does not leave an incomplete file in the cache.
+	Micrographs sharing a cached file (same source image and settings) each
+	write their own temporary file, and the last rename replaces an identical
+	power spectrum.
+	Tilted micrographs are not cached.
+	The power spectrum file name of each micrograph is set to the cached file.
+
+**/
+long		project_ctf_fit_cached(Bproject* project, double lores, double hires,
+				Vector3<long> tile_size, long bin,
+				double def_start, double def_end, double def_inc,
+				Bstring& cache, int flags)
+{
+	double			ti = timer_start();
+
+	if ( lores < 0 ) lores = 0;
+	if ( lores > 0 && lores < hires ) swap(lores, hires);
+	if ( bin < 1 ) bin = 1;
+	
+	if ( cache.length() < 1 ) cache = "ps_cache";
+	mkdir(cache.c_str(), (mode_t)0755);
+	if ( cache[-1] != '/' ) cache += "/";
+	
+	Bfield*				field;
+	Bmicrograph*		mg;
+	vector<Bmicrograph*>	mgs;
+	
+	for ( field = project->field; field; field = field->next )
+		for ( mg = field->mg; mg; mg = mg->next ) {
+			if ( !mg->ctf ) mg->ctf = new CTFparam;
+			mgs.push_back(mg);
+		}
+	
+	if ( mgs.empty() ) {
+		cerr << "Error: No micrographs in the project!" << endl;
+		return 0;
+	}
+	
+	if ( verbose ) {
+		cout << "Calculating and fitting power spectra in parallel:" << endl;
+		if ( mgs[0]->ctf ) mgs[0]->ctf->show();
+		cout << "Micrographs:                    " << mgs.size() << endl;
+		cout << "Power spectrum cache:           " << cache << endl;
+		cout << "Tile size and binning:          " << tile_size << tab << bin << endl;
+		cout << "Defocus min, max, inc:          " << def_start << " - " << def_end << " ∆ " << def_inc << endl;
+		cout << "Resolution range:               " << hires << " - ";
+		if ( lores > 0 ) cout << lores << " A" << endl;
+		else cout << "inf A" << endl;
+		cout << "Flags:                          " << flags << endl << endl;
+	}
+	
+	long			nfit(0), ncached(0);
+	
+#pragma omp parallel for reduction(+:nfit,ncached)
+	for ( long i=0; i<mgs.size(); ++i ) {
+		Bmicrograph*	mgi = mgs[i];
+		Bimage*			ps = NULL;
+		Vector3<double>	pixel_size;
+		Bstring			psname = mg_ps_cache_name(mgi, tile_size, bin, cache, flags, pixel_size);
+		struct stat		st;
+		if ( psname.length() && stat(psname.c_str(), &st) == 0 ) {
+			if ( ( ps = read_img(psname, 1, -1) ) &&
+					( ps->sizeX() != tile_size[0] || ps->sizeY() != tile_size[1] ) ) {
+				delete ps;
+				ps = NULL;
+			}
+			if ( ps ) {
+				pixel_size[0] *= bin;
+				pixel_size[1] *= bin;
+				ps->sampling(pixel_size);
+				ps->origin(ps->size()/2);
+				ps->statistics();
+				ncached++;
+			}
+		}
+		if ( !ps ) {
+			ps = mg_ctf_prepare(mgi, 11, lores, hires, tile_size, def_start, def_end, def_inc, flags, bin);
+			if ( ps && psname.length() ) {
+				Bstring		tmpname(psname.pre_rev('.') + Bstring((long)getpid(), "_%ld") + Bstring(i, "_%ld.mrc"));
+				if ( write_img(tmpname, ps, 0) || rename(tmpname.c_str(), psname.c_str()) ) {
+					remove(tmpname.c_str());
+					psname = 0;
+				}
+			}
+		}
+		if ( ps ) {
+			if ( psname.length() ) mgi->fps = psname;
+			mgi->wri = img_ctf_fit(ps, 0, *mgi->ctf, lores, hires, def_start, def_end, def_inc, flags);
+			nfit++;
+			delete ps;
+		} else {
+#pragma omp critical
+			cerr << "Warning: No power spectrum calculated for micrograph " << mgi->id << endl;
+		}
+	}
+	
+	if ( verbose )
+		cout << "Micrographs fitted:             " << nfit << " (" << ncached << " cached)" << endl << endl;
+
+	timer_report(ti);
+
+	return nfit;
+}
+
+
 int 		part_ctf(Bparticle* partlist, int action, double lores, double hires,
 				double wiener, DataType datatype, Bstring& partpath,
 				Bstring& newname, int flags)
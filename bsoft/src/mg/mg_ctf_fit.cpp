@@ -3,7 +3,7 @@
 @brief	Functions for CTF (contrast transfer function) processing
 @author 	Bernard Heymann
 @date	Created: 19970715
-@date	Modified: 20221213
+@date	Modified: 20261018
 **/
 
 #include "rwimg.h"
@@ -20,6 +20,9 @@
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
 
+// Fixed seed for the simplex fits to make CTF fits reproducible and independent of threads
+#define CTF_SIMPLEX_SEED	0x1234ABCD
+
 // Internal function prototypes
 double		ctf_fit_baseline(Bimage* prad, double real_size, CTFparam& em_ctf, double lores, double hires);
 double		ctf_fit_envelope(Bimage* prad, double real_size, CTFparam& em_ctf, double lores, double hires);
@@ -562,6 +565,10 @@ double		img_ctf_fit(Bimage* p, long n, CTFparam& em_ctf, double lores, double hi
 		em_ctf.aberration_weights(wa);
 		
 		delete pf;
+	} else if ( flag & 64 ) {
+		fom = img_ctf_fit_astigmatism_2D(p, n, em_ctf, lores, hires, def_start, def_end, def_inc);
+		img_ctf_fit_baseline(p, n, em_ctf, lores, hires);
+		img_ctf_fit_envelope(p, n, em_ctf, lores, hires);
 	}
 	
 	if ( verbose )
@@ -1112,6 +1119,236 @@ double		img_ctf_fit_astigmatism(Bimage* p, long n, CTFparam& em_ctf, double lore
 	return best_fom;
 }
 
+/*
+	Correlates the power spectrum pixel table in the simplex structure
+	with the squared CTF for a defocus and astigmatism components (dx, dy):
+		dphi = base + t2*(def*s2 + dx*s2*cos(2a) + dy*s2*sin(2a))
+	Variables per pixel: s2, s2*cos(2a), s2*sin(2a), base phase
+	Constants: t2, sum of values, sum of squared values, chunk size
+	The pixels are processed in chunks in parallel.
+*/
+double		ctf_2D_correlation(Bsimplex& simp, double def, double dx, double dy)
+{
+	long			np(simp.points());
+	long			chunk_size(simp.constant(3));
+	long			nchunk((np - 1)/chunk_size + 1);
+	double			t2(simp.constant(0));
+	double*			x = simp.independent_values().data();
+	double*			f = simp.dependent_values().data();
+	vector<double>	sm(nchunk, 0), smm(nchunk, 0), svm(nchunk, 0);
+	double*			am = sm.data();
+	double*			amm = smm.data();
+	double*			avm = svm.data();
+
+#ifdef HAVE_GCD
+	dispatch_apply(nchunk, dispatch_get_global_queue(0, 0), ^(size_t ic){
+		long	i, end(( (ic+1)*chunk_size < np )? (ic+1)*chunk_size: np);
+		double	m, *xi;
+		for ( i=ic*chunk_size; i<end; ++i ) {
+			xi = x + 4*i;
+			m = sin(xi[3] + t2*(def*xi[0] + dx*xi[1] + dy*xi[2]));
+			m *= m;
+			am[ic] += m;
+			amm[ic] += m*m;
+			avm[ic] += f[i]*m;
+		}
+	});
+#else
+#pragma omp parallel for
+	for ( long ic=0; ic<nchunk; ++ic ) {
+		long	i, end(( (ic+1)*chunk_size < np )? (ic+1)*chunk_size: np);
+		double	m, *xi;
+		for ( i=ic*chunk_size; i<end; ++i ) {
+			xi = x + 4*i;
+			m = sin(xi[3] + t2*(def*xi[0] + dx*xi[1] + dy*xi[2]));
+			m *= m;
+			am[ic] += m;
+			amm[ic] += m*m;
+			avm[ic] += f[i]*m;
+		}
+	}
+#endif
+
+	double			m(0), mm(0), vm(0);
+	for ( long ic=0; ic<nchunk; ++ic ) {
+		m += sm[ic];
+		mm += smm[ic];
+		vm += svm[ic];
+	}
+	
+	double			v(simp.constant(1)), vv(simp.constant(2));
+	double			d((vv - v*v/np)*(mm - m*m/np));
+	
+	if ( d <= 0 ) return 0;
+	
+	return (vm - v*m/np)/sqrt(d);
+}
+
+double		ctf_2D_R(Bsimplex& simp)
+{
+	return 1 - ctf_2D_correlation(simp, simp.parameter(0), simp.parameter(1), simp.parameter(2));
+}
+
+/**
+@brief 	Fits the defocus and astigmatism directly to a 2D power spectrum.
+@param 	*p			image structure.
+@param	n			sub-image number.
+@param 	&em_ctf		CTF parameter structure.
+@param 	lores		low resolution limit.
+@param 	hires		high resolution limit.
+@param 	def_start	defocus search start.
+@param 	def_end		defocus search end.
+@param 	def_inc		defocus search increment.
+@return double		correlation coefficient (larger is better).
+
+	The baseline-subtracted power spectrum values between the resolution
+	limits, together with the squared spatial frequency and its angular
+	components, are tabulated once for half of the power spectrum.
+	A candidate defocus and astigmatism is scored by the correlation
+	between these values and the squared 2D CTF, calculated directly from
+	the tables in parallel over the pixels.
+	The defocus increment is reduced so that the phase changes by at most
+	a quarter period at the high resolution limit.
+	The average defocus is searched on this grid without astigmatism,
+	followed by a grid search of the astigmatism components around the best
+	defocus, and refined by the downhill simplex method.
+	The new parameters are written into the CTFparam structure.
+
+**/
+double		img_ctf_fit_astigmatism_2D(Bimage* p, long n, CTFparam& em_ctf, double lores, double hires,
+				double def_start, double def_end, double def_inc)
+{
+	p->check_resolution(hires);
+	if ( lores < hires ) lores = p->real_size()[0];
+	if ( def_start > def_end ) swap(def_start, def_end);
+	if ( def_start < 1 ) def_start = 1;
+	
+	long			i, x, y;
+	double			real_size(p->real_size()[0]);
+	double			yscale(p->sizeX()*1.0L/p->sizeY());
+	double			smin2(1/(lores*lores)), smax2(1/(hires*hires));
+	double			dx, dy, s, s2, a;
+	double			t2(-M_PI*em_ctf.lambda());
+	vector<double>	tab, val;
+	
+	// Aberrations other than defocus and astigmatism
+	CTFparam		cb(em_ctf);
+	cb.defocus_average(0);
+	cb.astigmatism(0, 0);
+	
+	for ( y=0; y<p->sizeY(); ++y ) {
+		dy = ((double)y - p->image[n].origin()[1])*yscale;
+		if ( dy < 0 ) continue;
+		for ( x=0; x<p->sizeX(); ++x ) {
+			dx = (double)x - p->image[n].origin()[0];
+			s2 = (dx*dx + dy*dy)/(real_size*real_size);
+			if ( s2 < smin2 || s2 > smax2 ) continue;
+			s = sqrt(s2);
+			a = atan2(dy, dx);
+			tab.push_back(s2);
+			tab.push_back(s2*cos(2*a));
+			tab.push_back(s2*sin(2*a));
+			tab.push_back(cb.delta_phi(s2, a));
+			val.push_back((*p)[p->index(0,x,y,0,n)] - em_ctf.calc_baseline(s));
+		}
+	}
+	
+	long			np(val.size());
+	
+	if ( np < 10 ) {
+		cerr << "Error in img_ctf_fit_astigmatism_2D: Too few pixels within the resolution limits!" << endl;
+		return 0;
+	}
+	
+	Bsimplex		simp(4, 3, 4, np, tab, val);
+	simp.seed(CTF_SIMPLEX_SEED);
+	
+	double			sv(0), svv(0);
+	for ( auto f: val ) {
+		sv += f;
+		svv += f*f;
+	}
+	simp.constant(0, t2);
+	simp.constant(1, sv);
+	simp.constant(2, svv);
+	simp.constant(3, get_chunk_size(np));
+	
+	double			def_step(0.5/(em_ctf.lambda()*smax2));
+	if ( def_inc > 0 && def_inc < def_step ) def_step = def_inc;
+	
+	if ( verbose & VERB_PROCESS ) {
+		cout << "Fitting the 2D power spectrum:" << endl;
+		cout << "Resolution range:               " << hires << " - " << lores << " A" << endl;
+		cout << "Pixels:                         " << np << endl;
+		cout << "Defocus min, max, step:         " << def_start << " - " << def_end << " ∆ " << def_step << endl;
+	}
+	
+	// Average defocus without astigmatism
+	long			nd((long) ((def_end - def_start)/def_step) + 1);
+	double			best_def(def_start), best_dx(0), best_dy(0), cc, best_cc(-1);
+	
+	for ( i=0; i<nd; ++i ) {
+		cc = ctf_2D_correlation(simp, def_start + i*def_step, 0, 0);
+		if ( best_cc < cc ) {
+			best_cc = cc;
+			best_def = def_start + i*def_step;
+		}
+	}
+
+	if ( verbose & VERB_FULL )
+		cout << "Isotropic defocus:              " << best_def << " (" << best_cc << ")" << endl;
+
+	// Astigmatism components around the best defocus, up to 10% deviation
+	long			j, k, ns((long) (0.1*best_def/def_step));
+	if ( ns < 2 ) ns = 2;
+	if ( ns > 16 ) ns = 16;
+	double			def0(best_def), def;
+	
+	for ( i=-1; i<=1; ++i ) {
+		def = def0 + i*def_step;
+		for ( j=-ns; j<=ns; ++j ) {
+			for ( k=-ns; k<=ns; ++k ) {
+				cc = ctf_2D_correlation(simp, def, k*def_step, j*def_step);
+				if ( best_cc < cc ) {
+					best_cc = cc;
+					best_def = def;
+					best_dx = k*def_step;
+					best_dy = j*def_step;
+				}
+			}
+		}
+	}
+
+	if ( verbose & VERB_FULL )
+		cout << "Grid defocus and astigmatism:   " << best_def << " " << best_dx << " " << best_dy << " (" << best_cc << ")" << endl;
+
+	// Local refinement
+	simp.parameter(0, best_def);
+	simp.parameter(1, best_dx);
+	simp.parameter(2, best_dy);
+	simp.limits(0, best_def - def_step, best_def + def_step);
+	simp.limits(1, best_dx - def_step, best_dx + def_step);
+	simp.limits(2, best_dy - def_step, best_dy + def_step);
+	
+	cc = 1 - simp.run(200, 1e-6, ctf_2D_R);
+	
+	if ( cc > best_cc ) {
+		best_cc = cc;
+		best_def = simp.parameter(0);
+		best_dx = simp.parameter(1);
+		best_dy = simp.parameter(2);
+	}
+	
+	em_ctf.defocus_average(best_def);
+	em_ctf.astigmatism(sqrt(best_dx*best_dx + best_dy*best_dy), atan2(best_dy, best_dx)/2);
+	
+	if ( verbose & VERB_PROCESS )
+		cout << "Astigmatism refined:            " << em_ctf.defocus_average() << " +- " 
+			<< em_ctf.defocus_deviation() << " @ " << em_ctf.astigmatism_angle()*180.0/M_PI << " (CC = " << best_cc << ")" << endl << endl;
+
+	return best_cc;
+}
+
 /**
 @brief 	Fits a phase image with aberration functions.
 @param 	*p			image structure.
@@ -1293,6 +1530,7 @@ double		img_aberration_phase_fit_iter_old(Bimage* p, long nn, double lores, doub
 	}
 
 	Bsimplex			simp(nt, nt, 0, phases.size(), terms, phases);
+	simp.seed(CTF_SIMPLEX_SEED);
 	
 	j = 0;
 	for ( auto w: wa ) {
@@ -1387,6 +1625,7 @@ double		img_aberration_phase_fit_iter(Bimage* p, long nn, double lores, double h
 	}
 
 	Bsimplex			simp(nt, nt, nc, phases.size(), terms, phases);
+	simp.seed(CTF_SIMPLEX_SEED);
 	if ( nc ) simp.constant(0, wa[{4,0}]);
 	
 	if ( verbose )
@@ -1689,6 +1928,7 @@ vector<double>	img_fit_water_ring(Bimage* p)
 	}
 
 	Bsimplex			simp(2, 5, 0, fx.size(), x, fx);
+	simp.seed(CTF_SIMPLEX_SEED);
 
 	simp.parameter(0, fx.back());	// Constant baseline
 	simp.parameter(1, 1);			// Water ring power
@@ -1861,6 +2101,7 @@ double 		ctf_fit_double_gaussian_baseline(vector<double>& x, vector<double>& y,
 	if ( coeff[4] > -0.01 ) coeff[4] = -100;
 
 	Bsimplex			simp(1, 5, 0, y.size(), x, y);
+	simp.seed(CTF_SIMPLEX_SEED);
 	
 	simp.parameters(5, coeff);
 	simp.limits(0, ymin/2, 2*ymin);
@@ -1895,6 +2136,7 @@ double 		ctf_fit_eman_to_baseline(vector<double>& x, vector<double>& y, vector<d
 	long				i;
 
 	Bsimplex			simp(1, 4, 0, y.size(), x, y);
+	simp.seed(CTF_SIMPLEX_SEED);
 	
 	simp.parameters(4, coeff);
 	simp.limits(0, 0, 1000);
@@ -1929,6 +2171,7 @@ double 		ctf_fit_gaussian(vector<double>& x, vector<double>& y, vector<double>&
 	if ( coeff[2] > -0.01 ) coeff[2] = -10;
 	
 	Bsimplex			simp(1, 3, 0, y.size(), x, y);
+	simp.seed(CTF_SIMPLEX_SEED);
 	
 	simp.parameters(3, coeff);
 	if ( coeff[0] ) simp.limits(0, 0, 2*coeff[0]);
@@ -1973,6 +2216,7 @@ double		ctf_fit_baseline_bump(vector<double>& x, vector<double>& y, vector<doubl
 	if ( coeff[6] < 0.25 || coeff[6] > 0.28 ) coeff[6] = 0.265;
 		
 	Bsimplex			simp(1, 5, 0, ns, xb, yb);
+	simp.seed(CTF_SIMPLEX_SEED);
 	
 //	simp.parameters(5, &coeff[3]);
 	simp.parameter(0, inter);
@@ -2023,6 +2267,7 @@ double 		ctf_fit_double_gaussian_envelope(vector<double>& x, vector<double>& y,
 	if ( coeff[4] > -0.01 ) coeff[4] = -10;
 
 	Bsimplex			simp(1, 5, 0, y.size(), x, y);
+	simp.seed(CTF_SIMPLEX_SEED);
 	
 	simp.parameters(5, coeff);
 	if ( coeff[0] ) simp.limits(0, 0, 2*coeff[0]);
@@ -3,7 +3,7 @@
 @brief	Functions to extract particles from micrographs
 @author	Bernard Heymann
 @date	Created: 20040406
-@date	Modified: 20200616
+@date	Modified: 20261018
 **/
 
 #include "mg_extract.h"
@@ -13,6 +13,7 @@
 #include "utilities.h"
 
 #include <sys/stat.h>
+#include <future>
 
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
@@ -143,6 +144,16 @@ Vector3<double>*	vector3_spline_from_nodes(Bfilnode* fnode, long& nspline)
 	return spline;
 }
 
+/*
+	Reads the micrograph image from which particles are extracted.
+*/
+static Bimage*	mg_read_for_extraction(Bmicrograph* mg)
+{
+	if ( mg->fmg.length() ) return read_img(mg->fmg, 1, mg->img_num);
+	if ( mg->ffil.length() ) return read_img(mg->ffil, 1, 0);
+	return NULL;
+}
+
 /**
 @brief 	Extracts particle images from micrographs defined in a project.
 @param 	*project	micrograph project.
@@ -157,6 +168,11 @@ Vector3<double>*	vector3_spline_from_nodes(Bfilnode* fnode, long& nspline)
 @param 	&partpath	path to particle file.
 @param 	&partext	particle file extension.
 @return long		number of particles, <0 on error.
+
+	The particle file names are set up for all micrographs first.
+	Each micrograph is then read in the background while particles
+	are extracted from the previous one.
+
 **/
 long		project_extract_particles(Bproject* project, double scale,
 				int back_flag, int norm_flag, int fill_type, double fill, int mask_width,
@@ -206,6 +222,7 @@ long		project_extract_particles(Bproject* project, double scale,
 	}
 	
 	if ( project->select < 1 ) {
+		vector<Bmicrograph*>	mg_arr;
 		for ( field = project->field; field; field = field->next ) {
 			for ( mg=field->mg; mg; mg=mg->next, i++ ) {
 				if ( mg->next ) {
@@ -247,23 +264,32 @@ long		project_extract_particles(Bproject* project, double scale,
 						if ( partpath.length() > 1 ) mkdir(partpath.c_str(), (mode_t)0755);
 //						cout << mg->fmg << " ---> " << mg->fpart << endl;
 					}
-					if ( mg->fmg.length() ) p = read_img(mg->fmg, 1, mg->img_num);
-					else if ( mg->ffil.length() ) p = read_img(mg->ffil, 1, 0);
-					if ( !p ) {
-						error_show(mg->fmg.c_str() , __FILE__, __LINE__);
-						return -1;
-					}
-					if ( fill_type == FILL_AVERAGE ) fill = p->average();
-					if ( fill_type == FILL_BACKGROUND ) {
-						if ( fabs(p->background(long(0))) < 1e-6 )
-							p->calculate_background();
-						fill = p->background(long(0));
-					}
-					micrograph_extract_particles(mg, p, scale, back_flag, norm_flag, fill, mask_width);
-					delete p;
+					mg_arr.push_back(mg);
 				}
 			}
 		}
+		// Read the next micrograph in the background while extracting the current one
+		future<Bimage*>		next;
+		if ( mg_arr.size() ) next = async(launch::async, mg_read_for_extraction, mg_arr[0]);
+		for ( size_t k=0; k<mg_arr.size(); ++k ) {
+			mg = mg_arr[k];
+			p = next.get();
+			if ( k+1 < mg_arr.size() )
+				next = async(launch::async, mg_read_for_extraction, mg_arr[k+1]);
+			if ( !p ) {
+				error_show(mg->fmg.c_str() , __FILE__, __LINE__);
+				if ( next.valid() ) delete next.get();
+				return -1;
+			}
+			if ( fill_type == FILL_AVERAGE ) fill = p->average();
+			if ( fill_type == FILL_BACKGROUND ) {
+				if ( fabs(p->background(long(0))) < 1e-6 )
+					p->calculate_background();
+				fill = p->background(long(0));
+			}
+			micrograph_extract_particles(mg, p, scale, back_flag, norm_flag, fill, mask_width);
+			delete p;
+		}
 	} else if ( project->select == 1 ) {
 		for ( rec=project->rec; rec; rec=rec->next, i++ ) {
 			npart = particle_count(rec->part);
@@ -468,6 +494,131 @@ Bparticle*		reconstruction_project_extract_particles(Breconstruction* rec, Bimag
 	return part2D;
 }
 
+/*
+	Bad areas binned on a grid for lookup during extraction.
+	Each bad area covers the same voxels as the mask painted by
+	Bimage::sphere with a sharp edge, so the lookup replaces a
+	full-size mask image.
+*/
+struct Bbad_lookup {
+	Vector3<long>			size;		// Image size
+	Vector3<long>			cell;		// Grid cell size
+	Vector3<long>			ncell;		// Number of cells
+	vector<Vector3<long>>	lo, hi;		// Sphere bounding boxes
+	vector<Vector3<double>>	cen, hr;	// Sphere centers and half sizes
+	vector<vector<long>>	bin;		// Bad areas overlapping each cell
+};
+
+static Bbad_lookup*	bad_lookup_setup(Bbadarea* bad_areas, Vector3<long> size, double bad_radius)
+{
+	Bbad_lookup*	bl = new Bbad_lookup;
+	Bbadarea*		bad;
+	long			i, x, y, z;
+	double			edge(0.003);		// 3 times the minimum sphere edge width
+	Vector3<long>	rect((long) (2*bad_radius+0.5), (long) (2*bad_radius+0.5), (long) (2*bad_radius+0.5));
+	Vector3<double>	start, h;
+	
+	if ( size[2] < 2 ) rect[2] = size[2];
+	
+	bl->size = size;
+	bl->cell = rect.max(16);
+	bl->ncell = (size - 1)/bl->cell + 1;
+	bl->bin.resize(bl->ncell.volume());
+	
+	for ( i=0, bad = bad_areas; bad; bad = bad->next, ++i ) {
+		start = bad->loc;
+		start -= rect/2;
+		if ( size[2] < 2 ) start[2] = 0;
+		h = rect/2;
+		bl->cen.push_back(start + h);
+		bl->hr.push_back(h.max(1));
+		Vector3<long>	l(start - edge), u(start + rect + edge);
+		if ( size[2] < 2 ) u[2] = 0;
+		l = l.max(0);
+		for ( int k=0; k<3; ++k ) if ( u[k] >= size[k] ) u[k] = size[k] - 1;
+		bl->lo.push_back(l);
+		bl->hi.push_back(u);
+		if ( l[0] > u[0] || l[1] > u[1] || l[2] > u[2] ) continue;
+		for ( z=l[2]/bl->cell[2]; z<=u[2]/bl->cell[2]; ++z )
+			for ( y=l[1]/bl->cell[1]; y<=u[1]/bl->cell[1]; ++y )
+				for ( x=l[0]/bl->cell[0]; x<=u[0]/bl->cell[0]; ++x )
+					bl->bin[(z*bl->ncell[1] + y)*bl->ncell[0] + x].push_back(i);
+	}
+	
+	return bl;
+}
+
+/*
+	Tests whether a voxel is within a bad area.
+	The sharp edge criterion is that of Bimage::shape for an oval.
+*/
+static bool		bad_lookup_test(Bbad_lookup* bl, long x, long y, long z)
+{
+	long			k = ((z/bl->cell[2])*bl->ncell[1] + y/bl->cell[1])*bl->ncell[0] + x/bl->cell[0];
+	double			a(-GOLDEN/0.001), f, ld, lde, edge;
+	Vector3<double>	d;
+	
+	for ( auto i: bl->bin[k] ) {
+		if ( x < bl->lo[i][0] || x > bl->hi[i][0] ) continue;
+		if ( y < bl->lo[i][1] || y > bl->hi[i][1] ) continue;
+		if ( z < bl->lo[i][2] || z > bl->hi[i][2] ) continue;
+		d = Vector3<double>(x, y, z) - bl->cen[i];
+		ld = d.length();
+		if ( ld < 1 ) return 1;
+		lde = (d/bl->hr[i]).length();
+		f = ( lde > 1e-20 )? ld*(1.0 - 1.0/lde): 0;
+		f *= a;
+		edge = ( f > 50 )? 1e30: exp(f);
+		if ( edge/(1+edge) >= 1 ) return 1;
+	}
+	
+	return 0;
+}
+
+/*
+	Cuts one particle into an image in a particle stack.
+	The particle mask is 1 within the particle and 0 in the background.
+*/
+static void		particle_cut(Bparticle* part, Bimage* p, Bbad_lookup* bl,
+				Bimage* ppart, Bimage* partmask, long n, Vector3<long> radius,
+				double iscale, double halfwidth, int back_flag)
+{
+	long				i(n*ppart->image_size()), k, c, x, y, z;
+	long				oldx, oldy, oldz, oldn(0);
+	double				d(0), dh(0);
+	Vector3<double>		u, v;
+	Euler				euler(part->view);
+	
+	u[0] = cos(euler.psi());
+	u[1] = -sin(euler.psi());
+	
+	for ( z=0; z<ppart->sizeZ(); z++ ) {
+		oldz = (z - radius[2])*iscale + (long) part->loc[2];
+		v[2] = z - ppart->image[n].origin()[2];
+		for ( y=0; y<ppart->sizeY(); y++ ) {
+			oldy = (y - radius[1])*iscale + (long) part->loc[1];
+			v[1] = y - ppart->image[n].origin()[1];
+			for ( x=0; x<ppart->sizeX(); x++, i++ ) {
+				oldx = (x - radius[0])*iscale + (long) part->loc[0];
+				v[0] = x - ppart->image[n].origin()[0];
+				if ( oldx >= 0 && oldx < p->sizeX() && oldy >= 0 && oldy < p->sizeY() && oldz >= 0 && oldz < p->sizeZ()) {
+					if ( halfwidth > 0 ) dh = (u.cross(v)).length() - halfwidth;
+					if ( back_flag ) d = (v/ppart->size()).length() - 0.5;
+					if ( ( bl && bad_lookup_test(bl, oldx, oldy, oldz) ) || ( d > 0 ) || ( dh > 0 ) ) {
+						partmask->set(i, 0);
+						if ( back_flag ) for ( c=0, k=i*p->channels(); c<p->channels(); c++ )
+							ppart->set(k++, p->average(c, oldx, oldy, oldz, oldn, iscale));
+					} else {
+						partmask->set(i, 1);
+						for ( c=0, k=i*p->channels(); c<p->channels(); c++ )
+							ppart->set(k++, p->average(c, oldx, oldy, oldz, oldn, iscale));
+					}
+				}
+			}
+		}
+	}
+}
+
 /**
 @brief 	Extracts particle images from an image.
 @param 	*particles	particle parameters.
@@ -486,6 +637,9 @@ Bparticle*		reconstruction_project_extract_particles(Breconstruction* rec, Bimag
 	background, defined as outside the inscribing circle.
 	The mask is set within every bad area in the micrograph and
 	transferred to the mask for a particle where it overlaps.
+	The bad areas are binned on a grid to test only nearby areas.
+	Without splitting, the particles are cut in parallel into
+	a preallocated stack.
 	
 **/
 Bimage*		particle_extract(Bparticle* particles, Bbadarea* bad_areas, Bimage* p, 
@@ -499,18 +653,14 @@ Bimage*		particle_extract(Bparticle* particles, Bbadarea* bad_areas, Bimage* p,
 	
 //	if ( mask_width < 1 ) mask_width = (p->sizeX() > p->sizeY())? p->sizeX(): p->sizeY();
 	
-	long				id, i, j, k, c, n, x, y, z;
-	long				oldx, oldy, oldz, oldn(0);
-	double				d(0), dh(0), halfwidth(mask_width/2.0), ori_tol;
+	long				id, n;
+	double				halfwidth(mask_width/2.0), ori_tol;
 	double				iscale(1/scale);
 	Bparticle*			part = particles;
-	Bbadarea*			bad;
-	Bimage*				pmask = NULL;
+	Bbad_lookup*		bl = NULL;
 	Bimage*				ppart = NULL;
 	Bimage*				partmask = NULL;
 	Vector3<long>		box, radius;
-	Vector3<double>		u, v;
-	Euler				euler;
 
 	long				npart = particle_count(particles);
 
@@ -558,66 +708,27 @@ Bimage*		particle_extract(Bparticle* particles, Bbadarea* bad_areas, Bimage* p,
 		cout << endl;
 	}
 
-	if ( bad_areas && bad_radius > 1 ) {
-		pmask = new Bimage(UCharacter, p->compound_type(), p->size(), p->images());
-		for ( bad = bad_areas; bad; bad = bad->next )
-			pmask->sphere(bad->loc, bad_radius, 0, FILL_USER, 1);
+	if ( bad_areas && bad_radius > 1 )
+		bl = bad_lookup_setup(bad_areas, p->size(), bad_radius);
+	
+	vector<Bparticle*>	parr;
+	for ( id=1, part = particles; part; part = part->next, id++ ) {
+		part->id = id;
+		if ( part->ori.distance(radius) > ori_tol ) part->ori = radius;
+		part->pixel_size = pixel_size;
+		parr.push_back(part);
 	}
 	
 	if ( split ) {
 		partmask = new Bimage(UCharacter, TSimple, box, 1);
-	} else {
-		ppart = new Bimage(p->data_type(), p->compound_type(), box, npart);
-		ppart->fill(fill);
-		partmask = new Bimage(UCharacter, TSimple, box, npart);
-	}
-	
-	for ( id=1, i=n=0, part = particles; part; part = part->next, n++, id++ ) {
-		if ( split ) {
-			i = n = 0;
+		for ( n=0; n<npart; n++ ) {
+			part = parr[n];
 			ppart = new Bimage(p->data_type(), p->compound_type(), box, 1);
 			ppart->fill(fill);
-		}
-//		cout << "extracting " << id << endl;
-		part->id = id;
-		if ( part->ori.distance(radius) > ori_tol ) part->ori = radius;
-		part->pixel_size = pixel_size;
-		ppart->sampling(pixel_size);
-		ppart->origin(n, part->ori);
-		ppart->image[n].view(part->view);
-		euler = Euler(part->view);
-		u[0] = cos(euler.psi());
-		u[1] = -sin(euler.psi());
-		for ( z=0; z<ppart->sizeZ(); z++ ) {
-			oldz = (z - radius[2])*iscale + (long) part->loc[2];
-			v[2] = z - ppart->image[n].origin()[2];
-			for ( y=0; y<ppart->sizeY(); y++ ) {
-				oldy = (y - radius[1])*iscale + (long) part->loc[1];
-				v[1] = y - ppart->image[n].origin()[1];
-				for ( x=0; x<ppart->sizeX(); x++, i++ ) {
-					oldx = (x - radius[0])*iscale + (long) part->loc[0];
-					v[0] = x - ppart->image[n].origin()[0];
-					if ( oldx >= 0 && oldx < p->sizeX() && oldy >= 0 && oldy < p->sizeY() && oldz >= 0 && oldz < p->sizeZ()) {
-						j = (((oldn*p->sizeZ() + oldz)*p->sizeY() + oldy)*p->sizeX() + oldx)*p->channels();
-						if ( halfwidth > 0 ) dh = (u.cross(v)).length() - halfwidth;
-						if ( back_flag ) d = (v/ppart->size()).length() - 0.5;
-//						cout << "d=" << d << endl;
-						if ( ( pmask && (*pmask)[j] > 0 ) || ( d > 0 ) || ( dh > 0 ) ) {
-							partmask->set(i, 0);
-							if ( back_flag ) for ( c=0, k=i*p->channels(); c<p->channels(); c++ )
-//								ppart->set(k++, (*p)[j++]);
-								ppart->set(k++, p->average(c, oldx, oldy, oldz, oldn, iscale));
-						} else {
-							partmask->set(i, 1);
-							for ( c=0, k=i*p->channels(); c<p->channels(); c++ )
-//								ppart->set(k++, (*p)[j++]);
-								ppart->set(k++, p->average(c, oldx, oldy, oldz, oldn, iscale));
-						}
-					}
-				}
-			}
-		}
-		if ( split ) {
+			ppart->sampling(pixel_size);
+			ppart->origin(long(0), part->ori);
+			ppart->image->view(part->view);
+			particle_cut(part, p, bl, ppart, partmask, 0, radius, iscale, halfwidth, back_flag);
 			if ( back_flag ) ppart->correct_background(partmask, 1);	// The mask is 1 for the background
 			else ppart->calculate_background();
 			ppart->statistics();
@@ -631,9 +742,30 @@ Bimage*		particle_extract(Bparticle* particles, Bbadarea* bad_areas, Bimage* p,
 			delete ppart;
 			ppart = NULL;
 		}
+	} else {
+		ppart = new Bimage(p->data_type(), p->compound_type(), box, npart);
+		ppart->fill(fill);
+		ppart->sampling(pixel_size);
+		partmask = new Bimage(UCharacter, TSimple, box, npart);
+		for ( n=0; n<npart; n++ ) {
+			ppart->origin(n, parr[n]->ori);
+			ppart->image[n].view(parr[n]->view);
+		}
+		Bparticle**		pa = parr.data();
+#ifdef HAVE_GCD
+		dispatch_apply(npart, dispatch_get_global_queue(0, 0), ^(size_t nn){
+			particle_cut(pa[nn], p, bl, ppart, partmask, nn, radius, iscale, halfwidth, back_flag);
+		});
+#else
+#pragma omp parallel for
+		for ( long nn=0; nn<npart; nn++ )
+			particle_cut(pa[nn], p, bl, ppart, partmask, nn, radius, iscale, halfwidth, back_flag);
+#endif
+		ppart->statistics_invalidate();
+		partmask->statistics_invalidate();
 	}
 		
-	delete pmask;
+	delete bl;
 	
 //	cout << "pixel size = " << ppart->sampling(0) << endl;
 	
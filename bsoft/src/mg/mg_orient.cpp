@@ -3,7 +3,7 @@
 @brief	Determines orientation angles and x,y origins of single particle images 
 @author	Bernard Heymann and David M. Belnap
 @date	Created: 20010403
-@date	Modified: 20220813 (BH)
+@date	Modified: 20261018 (BH)
 **/
 
 #include "mg_orient.h"
@@ -18,6 +18,7 @@
 #include "utilities.h"
 
 #include <fstream>
+#include <algorithm>
 #include <sys/stat.h>
 #include <fcntl.h>
 
@@ -847,54 +848,41 @@ Bparticle	part_compare(Bimage* p, Bimage* proj, Bimage* prs_mask,
 	return part;
 }
 
-int 		part_determine_orientation2(Bparticle* part, Bimage* proj, Bimage* part_mask,
-				Bimage* prs_mask, Bsymmetry& sym, int bin,
-				double res_lo, double res_hi, double res_polar, int ann_min, int ann_max,
-				double shift_limit, double angle_limit, double edge_radius, int flags,
-				fft_plan planf_1D, fft_plan planb_1D, fft_plan planf_2D, fft_plan planb_2D)
+/*
+	Opens the particle log file if requested, and reads and prepares the
+	particle image for projection matching: binning, normalization,
+	masking and edge masking around the previous origin.
+	Returns NULL on error.
+*/
+static Bimage*	part_orient_prepare(Bparticle* part, Bimage* part_mask, int bin,
+				double edge_radius, int flags, ofstream& flog)
 {
-	FOMType 	fom_tag[NFOM] = {FOM, FOM_CV};
-
-	if ( flags & CHECK_PPX )
-		if ( ppx_check(part, fom_tag) ) return 0;
-	
-	if ( verbose & VERB_DEBUG )
-		cout << "DEBUG part_determine_orientation: id=" << part->id << " flags=" << flags << endl;
-		
-	int				ctf_apply = (flags & APPLY_CTF)? 1: 0;
-	int				part_log = (flags & PART_LOG)? 1: 0;
-	bool			invert(flags & INVERT);
-
-	long 			k, imax(0), nproj(proj->images());
-	
 	Bmicrograph*	mg = part->mg;
-	if ( !mg )
-		return error_show("part_determine_orientation", __FILE__, __LINE__);
-
 	Vector3<double>	pixel_size = part->pixel_size*bin;
-	ofstream		flog;
-	Bstring			log_name;
 	long			edge_size = (long) (2*edge_radius);
 	Vector3<long>	size(edge_size, edge_size, 1);
 	Vector3<double>	start, shift;
-
+	Bstring			log_name;
 	Bimage*			p = NULL;
 	Bimage*			pm;
-	Bimage*			proj1;
 	
-	if ( part_log ) {
+	if ( flags & PART_LOG ) {
 		log_name = "log/" + mg->id + "_" + Bstring(part->id, "%04d") + "_orient.log";
 		flog.open(log_name.c_str());
-		if ( flog.fail() )
-			return error_show("Log file cannot be written!", __FILE__, __LINE__);
+		if ( flog.fail() ) {
+			error_show("Log file cannot be written!", __FILE__, __LINE__);
+			return NULL;
+		}
 		flog << mg->id << ": " << part->id << endl;
 	}
 	
 //	cout << "Reading particle " << part->id << endl;
 	if ( part->fpart.length() ) p = read_img(part->fpart, 1, 0);
 	else if ( mg->fpart.length() ) p = read_img(mg->fpart, 1, part->id - 1);
-	if ( !p )
-		return error_show("part_determine_orientation", __FILE__, __LINE__);
+	if ( !p ) {
+		error_show("part_orient_prepare", __FILE__, __LINE__);
+		return NULL;
+	}
 	
 //	cout << "Preparing particle " << part->id << endl;
 	p->change_type(Float);
@@ -927,11 +915,96 @@ int 		part_determine_orientation2(Bparticle* part, Bimage* proj, Bimage* part_ma
 		p->edge(1, size, start, 1, FILL_BACKGROUND, 0);
 	}
 	
+	if ( verbose & VERB_DEBUG )
+		cout << "DEBUG part_orient_prepare: preprocessing done for image " << part->id << endl;
+	
+	return p;
+}
+
+/*
+	Completes the orientation of a particle once the best projection
+	is selected and the particle origin and view are set:
+	cross-validation against the best projection and reduction to the
+	asymmetric unit. The particle origin is in unbinned pixels.
+*/
+static int		part_orient_finish(Bparticle* part, Bimage* p, Bimage* proj, long imax,
+				Bimage* prs_mask, Bsymmetry& sym, int bin, double res_hi, int flags,
+				fft_plan planf_2D, fft_plan planb_2D)
+{
+	Bmicrograph*	mg = part->mg;
+	Bimage*			proj1;
+	
+	if ( prs_mask->minimum() < 0 ) {
+		proj1 = proj->extract(imax);
+		if ( !proj1 )
+			return error_show("Error in part_orient_finish", __FILE__, __LINE__);
+		proj1->sampling(part->pixel_size*bin);
+		if ( (flags & APPLY_CTF) && mg->ctf )
+			img_ctf_apply_to_proj(proj1, *(mg->ctf), part->def, 1e6, res_hi, flags & INVERT, planf_2D, planb_2D);
+		p->image->origin(part->ori/bin);
+		p->image->view(part->view);
+		part->fom[1] = img_cross_validate(p, proj1, prs_mask, planf_2D);
+		delete proj1;
+	}
+	
+	part->view = find_asymmetric_unit_view(sym, part->view);
+	part->view[3] = angle_set_negPI_to_PI(part->view.angle());
+	part->sel = imax + 1;
+	
+	return 0;
+}
+
+/*
+	Writes the final particle parameters to the log file and,
+	if requested, to the particle parameter file.
+*/
+static void		part_orient_report(Bparticle* part, int flags, ofstream& flog)
+{
+	FOMType 		fom_tag[NFOM] = {FOM, FOM_CV};
+	
+	if ( flags & PART_LOG ) {
+		flog << fixed << setprecision(4) <<
+			part->id << tab << part->ori[0] << tab << part->ori[1] << tab <<
+			part->view[0] << tab << part->view[1] << tab <<
+			part->view[2] << tab << part->view.angle()*180.0/M_PI << tab <<
+			part->fom[0] << tab << part->fom[1] << endl;
+		flog.close();
+	}
+
+	if ( flags & WRITE_PPX ) {
+		Bstring			ppx_name = ppx_filename(part->mg->id, part->id);
+		write_particle(ppx_name, part, 0, 0, fom_tag);
+	}
+}
+
+int 		part_determine_orientation2(Bparticle* part, Bimage* proj, Bimage* part_mask,
+				Bimage* prs_mask, Bsymmetry& sym, int bin,
+				double res_lo, double res_hi, double res_polar, int ann_min, int ann_max,
+				double shift_limit, double angle_limit, double edge_radius, int flags,
+				fft_plan planf_1D, fft_plan planb_1D, fft_plan planf_2D, fft_plan planb_2D)
+{
+	FOMType 	fom_tag[NFOM] = {FOM, FOM_CV};
+
+	if ( flags & CHECK_PPX )
+		if ( ppx_check(part, fom_tag) ) return 0;
+	
+	if ( verbose & VERB_DEBUG )
+		cout << "DEBUG part_determine_orientation: id=" << part->id << " flags=" << flags << endl;
+		
+	int				part_log = (flags & PART_LOG)? 1: 0;
+
+	long 			k, imax(0), nproj(proj->images());
+	
+	if ( !part->mg )
+		return error_show("part_determine_orientation", __FILE__, __LINE__);
+
+	ofstream		flog;
+	Bimage*			p = part_orient_prepare(part, part_mask, bin, edge_radius, flags, flog);
+	if ( !p ) return -1;
+	
 	Bparticle*		partarr = new Bparticle[nproj];
 //	vector<Bparticle>	partarr(nproj);
 	
-	if ( verbose & VERB_DEBUG )
-		cout << "DEBUG part_determine_orientation: preprocessing done for image " << part->id << endl;
 	if ( part_log )
 		flog << "PartID\tProjID\tox\toy\tvx\tvy\tvz\tva\tcc" << endl;
 
@@ -978,48 +1051,295 @@ int 		part_determine_orientation2(Bparticle* part, Bimage* proj, Bimage* part_ma
 	part->ori = partarr[imax].ori;
 	part->view = partarr[imax].view;
 	
-	if ( prs_mask->minimum() < 0 ) {
-		proj1 = proj->extract(imax);
-		if ( !proj1 )
-			return error_show("Error in part_determine_orientation", __FILE__, __LINE__);
-		proj1->sampling(pixel_size);
-		if ( ctf_apply && mg->ctf )
-			img_ctf_apply_to_proj(proj1, *(mg->ctf), part->def, 1e6, res_hi, invert, planf_2D, planb_2D);
-		p->image->origin(part->ori);
-		p->image->view(part->view);
-//		p->image->view_angle(angle[imax]);
-		part->fom[1] = img_cross_validate(p, proj1, prs_mask, planf_2D);
-		delete proj1;
-	}
+	delete[] partarr;
 	
-	part->view = find_asymmetric_unit_view(sym, part->view);
-	part->view[3] = angle_set_negPI_to_PI(part->view.angle());
-	part->sel = imax + 1;
+	if ( part_orient_finish(part, p, proj, imax, prs_mask, sym, bin, res_hi,
+			flags, planf_2D, planb_2D) < 0 ) {
+		delete p;
+		return -1;
+	}
 	
-	if ( part_log ) {
+	if ( part_log )
 		flog << "Particle, min, max, avg, std, max/avg, cv:" << tab <<
 			part->id << tab << cc_min << tab << part->fom[0] << tab <<
 			cc_avg << tab << cc_std << tab << part->fom[0]/cc_avg << tab << part->fom[1] << endl;
-		flog << fixed << setprecision(4) <<
-			part->id << tab << part->ori[0] << tab << part->ori[1] << tab <<
-			part->view[0] << tab << part->view[1] << tab <<
-			part->view[2] << tab << part->view.angle()*180.0/M_PI << tab <<
-			part->fom[0] << tab << part->fom[1] << endl;
-		flog.close();
-	}
+	
+	part_orient_report(part, flags, flog);
 
 	delete p;
+	
+	return 1;
+}
+
+
+/*
+	One level of the hierarchical orientation search:
+	The projections sampled at the level's angular step and the
+	projections, mask and plans at the level's binning.
+*/
+struct Borient_level {
+	long			bin;			// Binning relative to the input projections
+	double			res_hi;			// High resolution limit
+	double			step;			// Angular step size
+	vector<long>	sel;			// Projections sampled at this level
+	Bimage*			proj;			// Projections at this binning
+	Bimage*			prs_mask;		// Reciprocal space mask at this binning
+	fft_plan		planf_2D;
+	fft_plan		planb_2D;
+};
+
+/**
+@brief 	Sets up the levels for a hierarchical orientation search.
+@param 	*proj			reference projections.
+@param 	&dir			projection view directions.
+@param 	pixel_size		projection pixel size.
+@param 	levels			number of levels.
+@param 	&level_res		high resolution limits for the coarser levels (angstrom).
+@param 	res_lo			low resolution limit (angstrom).
+@param 	res_hi			high resolution limit (angstrom).
+@param 	*prs_mask		reciprocal space mask for the finest level.
+@param 	planf_2D		FFT forward plan for the finest level.
+@param 	planb_2D		FFT backward plan for the finest level.
+@return vector<Borient_level>	levels.
+
+	The angular step of the projections is estimated as the average
+	angle to the nearest neighbouring view. Each coarser level doubles
+	the angular step and samples the projections at that step.
+	If the resolution for a coarser level is not given, it is doubled
+	for each level. The projections are binned for each coarser level
+	as far as the resolution limit allows.
+	The finest level uses all the input projections.
+
+**/
+static vector<Borient_level>	orient_levels_setup(Bimage* proj, vector<Vector3<double>>& dir,
+				Vector3<double> pixel_size, int levels, vector<double>& level_res,
+				double res_lo, double res_hi, Bimage* prs_mask,
+				fft_plan planf_2D, fft_plan planb_2D)
+{
+	long			i, k, l, nproj(proj->images());
+	double			a, amin, step(0);
+	
+	dir.resize(nproj);
+	for ( k=0; k<nproj; ++k ) dir[k] = proj->image[k].view().vector3();
+	
+	for ( k=0; k<nproj; ++k ) {
+		for ( i=0, amin=M_PI; i<nproj; ++i ) if ( i != k ) {
+			a = dir[k].angle(dir[i]);
+			if ( amin > a ) amin = a;
+		}
+		step += amin;
+	}
+	if ( nproj > 1 ) step /= nproj;
+	
+	vector<Borient_level>	lev(levels);
+	
+	for ( l=0; l<levels; ++l ) {
+		Borient_level&	lv = lev[l];
+		long			f = 1L<<(levels-1-l);
+		lv.step = step*f;
+		lv.res_hi = res_hi*f;
+		if ( l < level_res.size() && level_res[l] > 0 ) lv.res_hi = level_res[l];
+		if ( l == levels - 1 || lv.res_hi < res_hi ) lv.res_hi = res_hi;
+		lv.bin = (long) (lv.res_hi/(2*pixel_size[0]));
+		if ( l == levels - 1 || lv.bin < 1 ) lv.bin = 1;
+		if ( lv.bin > 4 ) lv.bin = 4;
+		while ( lv.bin > 1 && proj->sizeX()/lv.bin < 16 ) lv.bin--;
+		if ( l == levels - 1 ) {
+			for ( k=0; k<nproj; ++k ) lv.sel.push_back(k);
+			lv.proj = proj;
+			lv.prs_mask = prs_mask;
+			lv.planf_2D = planf_2D;
+			lv.planb_2D = planb_2D;
+		} else {
+			for ( k=0; k<nproj; ++k ) {
+				for ( i=0; i<lv.sel.size(); ++i )
+					if ( dir[k].angle(dir[lv.sel[i]]) < 0.99*lv.step ) break;
+				if ( i >= lv.sel.size() ) lv.sel.push_back(k);
+			}
+			lv.proj = proj->copy();
+			if ( lv.bin > 1 ) lv.proj->bin(lv.bin);
+			lv.prs_mask = new Bimage(SCharacter, TSimple, lv.proj->size(), 1);
+			lv.prs_mask->sampling(pixel_size*lv.bin);
+			vector<double>	band = lv.prs_mask->fspace_default_bands(res_lo, lv.res_hi);
+			lv.prs_mask->mask_fspace_banded(band);
+			lv.planf_2D = fft_setup_plan(lv.proj->sizeX(), lv.proj->sizeY(), 1, FFTW_FORWARD, 1);
+			lv.planb_2D = fft_setup_plan(lv.proj->sizeX(), lv.proj->sizeY(), 1, FFTW_BACKWARD, 1);
+		}
+	}
+	
+	if ( verbose & VERB_RESULT ) {
+		cout << "Hierarchical search:" << endl;
+		cout << "Level\tBin\tRes(A)\tStep\tProjections" << endl;
+		for ( l=0; l<levels; ++l )
+			cout << l+1 << tab << lev[l].bin << tab << fixed << setprecision(2) <<
+				lev[l].res_hi << tab << lev[l].step*180.0/M_PI << tab << lev[l].sel.size() << endl;
+		cout << endl;
+	}
+	
+	return lev;
+}
+
+/**
+@brief 	Releases the coarser levels of a hierarchical orientation search.
+@param 	&lev			levels.
+**/
+static void		orient_levels_kill(vector<Borient_level>& lev)
+{
+	for ( long l=0; l<(long)lev.size()-1; ++l ) {
+		delete lev[l].proj;
+		delete lev[l].prs_mask;
+		fft_destroy_plan(lev[l].planf_2D);
+		fft_destroy_plan(lev[l].planb_2D);
+	}
+	
+	lev.clear();
+}
+
+/**
+@brief 	Finds the orientation and origin of a particle with a coarse-to-fine search.
+@param 	*part			particle.
+@param 	&lev			search levels.
+@param 	&dir			projection view directions.
+@param 	topk			number of candidates kept at each level.
+@param 	*part_mask		mask to apply to the particle.
+@param 	&sym			point group symmetry structure.
+@param 	bin				data compression by binning.
+@param 	res_lo			low resolution limit (angstrom).
+@param 	res_polar       resolution limit for in-plane angular alignment (angstrom).
+@param 	ann_min			minimum annulus (>=0).
+@param 	ann_max			maximum annulus (< image radius).
+@param 	shift_limit		maximum shift from nominal origin of box.
+@param 	angle_limit		maximum rotation from original in-plane rotation angle.
+@param 	edge_radius		edge radius to mask background using previous origin.
+@param 	flags			option flags.
+@param 	planf_1D		FFT forward plan for polar images.
+@param 	planb_1D		FFT backward plan for polar images.
+@param 	&neval			number of projections compared.
+@return int				1 if processed, 0 if skipped, <0 on error.
+
+	The particle is compared with the projections sampled at the coarsest
+	level, at the binning and resolution of that level. The best topk
+	candidates are kept, and the projections of the next level within
+	the angular neighbourhood of the candidates are compared.
+	The last level uses the input projections at full resolution.
+
+**/
+int 		part_determine_orientation_hierarchical(Bparticle* part,
+				vector<Borient_level>& lev, vector<Vector3<double>>& dir, long topk,
+				Bimage* part_mask, Bsymmetry& sym, int bin,
+				double res_lo, double res_polar, int ann_min, int ann_max,
+				double shift_limit, double angle_limit, double edge_radius, int flags,
+				fft_plan planf_1D, fft_plan planb_1D, long& neval)
+{
+	FOMType 	fom_tag[NFOM] = {FOM, FOM_CV};
+
+	if ( flags & CHECK_PPX )
+		if ( ppx_check(part, fom_tag) ) return 0;
+	
+	if ( verbose & VERB_DEBUG )
+		cout << "DEBUG part_determine_orientation_hierarchical: id=" << part->id << " flags=" << flags << endl;
+		
+	int				part_log = (flags & PART_LOG)? 1: 0;
+
+	long 			i, j, k, l, nc, imax(0), nlev(lev.size());
+	
+	if ( !part->mg )
+		return error_show("part_determine_orientation_hierarchical", __FILE__, __LINE__);
+
+	ofstream		flog;
+	Bimage*			p = part_orient_prepare(part, part_mask, bin, edge_radius, flags, flog);
+	if ( !p ) return -1;
+	
+	if ( part_log )
+		flog << "Level\tProjID\tcc" << endl;
+
+	vector<long>	cand(lev[0].sel);
+	Bparticle*		partarr = NULL;
+	
+	for ( l=0; l<nlev; ++l ) {
+		Borient_level*	lv = &lev[l];
+		Bimage*			pl = p;
+		if ( lv->bin > 1 ) {
+			pl = p->copy();
+			pl->bin(lv->bin);
+		}
+		long*			ci = cand.data();
+		nc = cand.size();
+		delete[] partarr;
+		partarr = new Bparticle[nc];
+#ifdef HAVE_GCD
+		dispatch_apply(nc, dispatch_get_global_queue(0, 0), ^(size_t i){
+			Bmicrograph*	mg = part->mg;
+			partarr[i] = part_compare(pl, lv->proj, lv->prs_mask, ci[i], bin*lv->bin, mg->ctf,
+						res_lo, lv->res_hi, res_polar, ann_min/lv->bin, ann_max/lv->bin,
+						shift_limit/lv->bin, angle_limit, edge_radius, flags,
+						planf_1D, planb_1D, lv->planf_2D, lv->planb_2D);
+		});
+#else
+#pragma omp parallel for
+		for ( i=0; i<nc; ++i ) {
+			Bmicrograph*	mg = part->mg;
+			partarr[i] = part_compare(pl, lv->proj, lv->prs_mask, ci[i], bin*lv->bin, mg->ctf,
+						res_lo, lv->res_hi, res_polar, ann_min/lv->bin, ann_max/lv->bin,
+						shift_limit/lv->bin, angle_limit, edge_radius, flags,
+						planf_1D, planb_1D, lv->planf_2D, lv->planb_2D);
+		}
+#endif
+		if ( pl != p ) delete pl;
+		neval += nc;
+		
+		if ( part_log )
+			for ( i=0; i<nc; ++i )
+				flog << l+1 << tab << cand[i]+1 << tab << fixed << setprecision(4) << partarr[i].fom[0] << endl;
+		
+		if ( l == nlev - 1 ) break;
+		
+		// Keep the best candidates and collect their neighbours at the next level
+		vector<long>	rank(nc);
+		for ( i=0; i<nc; ++i ) rank[i] = i;
+		sort(rank.begin(), rank.end(), [&](long a, long b) { return partarr[a].fom[0] > partarr[b].fom[0]; });
+		if ( rank.size() > topk ) rank.resize(topk);
+		
+		vector<long>	next;
+		for ( i=0; i<rank.size(); ++i ) next.push_back(cand[rank[i]]);
+		for ( j=0; j<lev[l+1].sel.size(); ++j ) {
+			k = lev[l+1].sel[j];
+			if ( find(next.begin(), next.end(), k) != next.end() ) continue;
+			for ( i=0; i<rank.size(); ++i )
+				if ( dir[k].angle(dir[cand[rank[i]]]) <= 1.5*lv->step ) break;
+			if ( i < rank.size() ) next.push_back(k);
+		}
+		cand = next;
+	}
+	
+	part->fom[0] = -1;
+	for ( i=0; i<nc; ++i ) {
+		if ( part->fom[0] < partarr[i].fom[0] ) {
+			part->fom[0] = partarr[i].fom[0];
+			imax = i;
+		}
+	}
+	
+	part->ori = partarr[imax].ori;
+	part->view = partarr[imax].view;
+	imax = cand[imax];
+	
 	delete[] partarr;
 	
-	if ( flags & WRITE_PPX ) {
-		log_name = ppx_filename(mg->id, part->id);
-		write_particle(log_name, part, 0, 0, fom_tag);
+	Borient_level&	lf = lev[nlev-1];
+	if ( part_orient_finish(part, p, lf.proj, imax, lf.prs_mask, sym, bin, lf.res_hi,
+			flags, lf.planf_2D, lf.planb_2D) < 0 ) {
+		delete p;
+		return -1;
 	}
 	
+	part_orient_report(part, flags, flog);
+
+	delete p;
+	
 	return 1;
 }
 
-
 /**
 @brief 	Find the orientation and origin of every image in a project.
 @param 	*project		image processing parameter structure.
@@ -1038,6 +1358,9 @@ int 		part_determine_orientation2(Bparticle* part, Bimage* proj, Bimage* part_ma
 @param 	angle_limit		maximum rotation from original in-plane rotation angle.
 @param 	edge_radius		edge radius to mask background using previous origin.
 @param 	flags			option flags.
+@param 	levels			number of levels for a hierarchical search (1 = exhaustive).
+@param 	topk			number of candidates kept at each level.
+@param 	level_res		high resolution limits for the coarser levels (angstrom).
 @return int				error code.
 
 	The polar power spectrum (pps) of the reference projection is cross correlated
@@ -1052,6 +1375,12 @@ int 		part_determine_orientation2(Bparticle* part, Bimage* proj, Bimage* part_ma
 	The angle and the x and y values are stored in the view_angle, and ox and oy
 	arrays of the micrograph parameter structure.
 	The projections must already be binned.
+	With more than one level, a coarse-to-fine search is done:
+	The coarsest level compares a subset of the projections sampled at
+	a larger angular step, at lower resolution and with binning.
+	Only the projections around the best topk candidates of each level
+	are compared at the next level, ending with the input projections
+	at full resolution.
 	Flags:
 		MODE		projection matching mode
 		APPLY_CTF	apply CTF to projections
@@ -1061,7 +1390,8 @@ int 		part_determine_orientation2(Bparticle* part, Bimage* proj, Bimage* part_ma
 int 		project_determine_orientations2(Bproject* project, Bimage* proj, Bstring& mask_file,
 				int bin, Bsymmetry& sym, int part_select, vector<double>& band,
 				double res_lo, double res_hi, double res_polar, int ann_min, int ann_max,
-				double shift_limit, double angle_limit, double edge_radius, int flags)
+				double shift_limit, double angle_limit, double edge_radius, int flags,
+				int levels, long topk, vector<double> level_res)
 {
 	int				mode = flags & MODE;
 	int				ctf_apply = (flags & APPLY_CTF)? 1: 0;
@@ -1146,6 +1476,17 @@ int 		project_determine_orientations2(Bproject* project, Bimage* proj, Bstring&
 	long			npart(0);
 	Bparticle**		partarr = project_mg_particle_array(project, part_select, npart);
 	
+	if ( levels < 1 ) levels = 1;
+	if ( topk < 1 ) topk = 1;
+	
+	long			neval(0);
+	vector<Vector3<double>>	dir;
+	vector<Borient_level>	lev;
+	
+	if ( levels > 1 )
+		lev = orient_levels_setup(proj, dir, pixel_size, levels, level_res,
+				res_lo, res_hi, prs_mask, planf_2D, planb_2D);
+	
 	if ( verbose & VERB_RESULT ) {
 		cout << "Determining orientations:" << endl;
 		if ( mode == 0 ) cout << "Mode:                           PPS based followed by one CC (fast)" << endl;
@@ -1173,6 +1514,10 @@ int 		project_determine_orientations2(Bproject* project, Bimage* proj, Bstring&
 			cout << "Angle limit:                    " << angle_limit*180.0/M_PI << " degrees" << endl;
     	if ( edge_radius ) cout << "Edge mask radius:               " << edge_radius << " pixels" << endl;
     	if ( mask_file.length() ) cout << "Real space mask file:           " << mask_file << endl;
+		if ( levels > 1 ) {
+			cout << "Search levels:                  " << levels << endl;
+			cout << "Candidates per level:           " << topk << endl;
+		}
     	cout << endl;
 		cout << "Micrograph\tPID\tOriX\tOriY\tViewX\tViewY\tViewZ\tAngle\tCC\tCV\tTime" << endl;
 	}
@@ -1194,7 +1539,14 @@ int 		project_determine_orientations2(Bproject* project, Bimage* proj, Bstring&
 	for ( i=0; i<npart; ++i ) {
 		part = partarr[i];
 		mg = part->mg;
-		part_determine_orientation2(part, proj, part_mask,
+		if ( levels > 1 )
+			part_determine_orientation_hierarchical(part, lev, dir, topk,
+				part_mask, sym, bin,
+				res_lo, res_polar, ann_min, ann_max,
+				shift_limit, angle_limit, edge_radius, flags,
+				planf_1D, planb_1D, neval);
+		else
+			part_determine_orientation2(part, proj, part_mask,
 				prs_mask, sym, bin,
 				res_lo, res_hi, res_polar, ann_min, ann_max,
 				shift_limit, angle_limit, edge_radius, flags,
@@ -1221,9 +1573,16 @@ int 		project_determine_orientations2(Bproject* project, Bimage* proj, Bstring&
 	if ( verbose & VERB_RESULT && npart ) {
 		cout << "Time:                           " << ts << " s (" << hr << ":" << min << ":" << sec << ")" << endl;
 		cout << "Time per particle:              " << ts*1.0/npart << " s/particle" << endl;
-		cout << "Algorithm time:                 " << ts*1.0e6/(npart*nproj*npix) << " us/pixel" << endl << endl;
+		cout << "Algorithm time:                 " << ts*1.0e6/(npart*nproj*npix) << " us/pixel" << endl;
+		if ( levels > 1 ) {
+			cout << "Projections compared:           " << neval << endl;
+			cout << "Exhaustive comparisons:         " << npart*nproj << endl;
+			cout << "Fraction compared:              " << neval*1.0/(npart*nproj) << endl;
+		}
+		cout << endl;
 	}
 
+	orient_levels_kill(lev);
 	delete[] partarr;
 	delete prs_mask;
 	delete part_mask;
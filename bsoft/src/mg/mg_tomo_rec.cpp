@@ -3,7 +3,7 @@
 @brief	Functions to do a tomographic reconstruction
 @author	Bernard Heymann
 @date	Created: 20020416
-@date	Modified: 20181221
+@date	Modified: 20261018
 **/
 
 #include "mg_tomo_rec.h"
@@ -1404,6 +1404,7 @@ long   gettypesize(DataType type)
 		case ULong: case Long: 	size = sizeof(long); break;
 		case Float:				size = sizeof(float); break;
 		case Double:			size = sizeof(double); break;
+		case Half:				size = sizeof(half); break;
 		default: size = 0;
 	}
 	
@@ -1465,6 +1466,10 @@ int			set_value_with_datatype(char* ptr, double value, DataType datatype)
 				double 			dval = (double)         value;
 				memcpy(ptr, &dval, typesize); break;
 			}
+		case Half: {
+				half 			hval(value);
+				memcpy(ptr, &hval, typesize); break;
+			}
 		default: ;
 	}
 	
@@ -1504,7 +1509,8 @@ int			img_write_data_block_with_type(fstream* ftemp, Bimage* p,
 		case Short:			scale = SHRT_MAX/(p->maximum() - p->minimum()); break;
 		case Integer:		scale = 2e9/(p->maximum() - p->minimum()); break;
 		case Float:
-		case Double:		scale = 1;  break;
+		case Double:
+		case Half:			scale = 1;  break;
 		default: ;		
 	}
 		
@@ -3,7 +3,7 @@
 @brief	Function to generate a map from a model.
 @author Bernard Heymann
 @date	Created: 20081112
-@date	Modified: 20220419
+@date	Modified: 20261018
 **/
 
 #include "rwmodel.h"
@@ -700,6 +700,8 @@ int			model_component_symmetry(Bmodel* model, long nangles,
 	Bimage*			p = NULL;
 	Bimage*			pex = NULL;
 	Bimage*			pps = NULL;
+	Bpolar_plan*	pplan = NULL;	// Reused while the box size and annuli stay the same
+	long			plan_ann_min(-1), plan_ann_max(-1);
 	
 	for ( i=0; i<=maxorder; i++ ) fomsym[i] = nsym[i] = 0;
 
@@ -744,7 +746,15 @@ int			model_component_symmetry(Bmodel* model, long nangles,
 				ann_max = 3*ann_min;
 				ann_width = ann_max - ann_min + 1;
 			}
-			pps = pex->polar_transform(nangles, ann_min, ann_max, ann_width, zmin, zmax, zinc);
+			if ( !pplan || pplan->image_size() != pex->size() || pplan->origin() != pex->image->origin() ||
+					plan_ann_min != ann_min || plan_ann_max != ann_max ) {
+				delete pplan;
+				pplan = new Bpolar_plan(pex->size(), pex->image->origin(), nangles,
+							ann_min, ann_max, ann_width, zmin, zmax, zinc);
+				plan_ann_min = ann_min;
+				plan_ann_max = ann_max;
+			}
+			pps = pex->polar_transform(*pplan);
 			delete pex;
 			pps->line_powerspectra(plan);
 			comp_set_fom_sym(comp, pps, minorder, maxorder);
@@ -762,6 +772,7 @@ int			model_component_symmetry(Bmodel* model, long nangles,
 	
 	if ( i ) sep_avg /= i;
 	
+	delete pplan;
     fft_destroy_plan(plan);
 
 	for ( i=minorder; i<=maxorder; i++ ) if ( nsym[i]) {
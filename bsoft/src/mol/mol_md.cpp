@@ -3,7 +3,7 @@
 @brief	Functions for molecular dynamics
 @author Bernard Heymann
 @date	Created: 20010828
-@date	Modified: 20110816
+@date	Modified: 20261018
 **/
 
 #include "mol_md.h"
@@ -13,6 +13,9 @@
 #include "Matrix.h"
 #include "linked_list.h"
 #include "utilities.h"
+#include "timer.h"
+
+#include <unordered_map>
 
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
@@ -33,6 +36,9 @@ extern int 	verbose;		// Level of output to the screen
 			dt:	time step
 			m: atomic mass
 	The velocity is limited each time step to damp chaotic oscillations.
+	The bond, angle and non-bonded parameters are resolved once into flat
+	arrays and the non-bonded interactions are calculated from a Verlet
+	neighbour list that is only rebuilt when required.
 
 **/
 double		md_leapfrog(Bmolgroup* molgroup, Bmd* md, int max_iter, double velocitylimit)
@@ -83,10 +89,15 @@ double		md_leapfrog(Bmolgroup* molgroup, Bmd* md, int max_iter, double velocityl
 		cout << "Kelectrostatic:                 " << md->Kelec << endl;
 		cout << "KVanderWaals:                   " << md->Kvdw << endl;
 		cout << "Non-bonded cutoff distance:     " << md->cutoff << " A" << endl;
+		cout << "Neighbour list skin distance:   " << md->skin << " A" << endl;
 	
 		cout << endl << "Cycle\tEbond\tEangle\tEelec\tEvdw\tEpoint\tEnergy\tdE\tEkin" << endl;
 	}
 	
+	Bmdsetup		mds = md_setup(molgroup, md);
+	
+	double			ti = getwalltime();
+	
 //	while ( cycle < max_iter && fabs(dE) > 1e-37 ) {
 	while ( cycle < max_iter && isfinite(E) ) {
 		
@@ -98,13 +109,13 @@ double		md_leapfrog(Bmolgroup* molgroup, Bmd* md, int max_iter, double velocityl
 		md_zero_forces(molgroup);
 		
 		// Bond forces
-		md->Ebond = md_bond_forces(molgroup, md->Kbond, md->wrap);
+		md->Ebond = md_bond_forces(mds, molgroup, md->Kbond, md->wrap);
 		
 		// Angle forces
-		md->Eangle = md_angular_forces(molgroup, md->Kangle, md->wrap);
+		md->Eangle = md_angular_forces(mds, molgroup, md->Kangle, md->wrap);
 		
 		// Nonbonded forces
-		md_nonbonded_forces(molgroup, md);
+		md_nonbonded_forces(mds, molgroup, md);
 
 		md->Epoint = md_point_force(molgroup, md->point, md->Kpoint, md->pointdecay);
 		
@@ -147,8 +158,15 @@ double		md_leapfrog(Bmolgroup* molgroup, Bmd* md, int max_iter, double velocityl
 
 	}
 	
-	if ( verbose )
+	ti = getwalltime() - ti;
+	
+	if ( verbose ) {
+		cout << endl;
+		cout << "Neighbour list builds:          " << mds.nbuild << endl;
+		if ( ti > 0 )
+			cout << "Steps per second:               " << cycle/ti << endl;
 		cout << endl;
+	}
 
 	return E;
 }
@@ -264,6 +282,23 @@ double		md_angular_forces(Bmolgroup* molgroup, double Kangle, int wrap)
 	return energy;
 }
 
+/*
+	Excludes the same atom and atoms one or two positions apart in the
+	atom list from the non-bonded interactions.
+*/
+static int	md_nonbonded_excluded(Batom* atom, Batom* atom2)
+{
+	if ( atom2 == atom ) return 1;					// Same atom
+	if ( atom2->next == atom ) return 1;			// Bonded atoms
+	if ( atom2 == atom->next ) return 1;			// Bonded atoms
+	if ( atom2->next ) {							// Atom 2 bonds away
+		if ( atom2->next->next == atom ) return 1;
+	} else if ( atom->next ) {						// Atom 2 bonds away
+		if ( atom2 == atom->next->next ) return 1;
+	}
+	return 0;
+}
+
 /**
 @brief 	Calculates the non-bonded forces and energy.
 @param 	*molgroup		molecular structure.
@@ -286,7 +321,6 @@ double		md_nonbonded_forces(Bmolgroup* molgroup, Bmd* md)
 	if ( md->Kelec < 0 ) md->Kelec = 0;
 	if ( md->Kvdw <= 0 && md->Kelec <= 0 ) return 0;
 	
-	int				dononbond;
 	long			i, ii, x, y, z, xx, yy, zz, ix, iy, iz;
 	Vector3<double>	box = molgroup->box;
 	Vector3<double>	sampling(md->cutoff, md->cutoff, md->cutoff);
@@ -320,18 +354,8 @@ double		md_nonbonded_forces(Bmolgroup* molgroup, Bmd* md)
 								if ( ix >= size[0] ) ix -= size[0];
 								ii = (iz*size[1] + iy)*size[0] + ix;
 								for ( latom2 = alist[ii]; latom2; latom2 = latom2->next ) {
-									dononbond = 1;
-									if ( latom2->atom == latom->atom ) dononbond = 0;	// Same atom
-									else if ( latom2->atom->next == latom->atom ) dononbond = 0;	// Bonded atoms
-									else if ( latom2->atom == latom->atom->next ) dononbond = 0;	// Bonded atoms
-									else if ( latom2->atom->next ) {	// Atom 2 bonds away
-										if ( latom2->atom->next->next == latom->atom ) dononbond = 0;	
-									} else if ( latom->atom->next ) {	// Atom 2 bonds away
-										if ( latom2->atom == latom->atom->next->next ) dononbond = 0;
-									}
-									if ( dononbond ) {
+									if ( !md_nonbonded_excluded(latom->atom, latom2->atom) )
 										atom_nonbonded_forces(latom->atom, latom2->atom, md, box);
-									}
 								}
 							}
 						}
@@ -406,6 +430,425 @@ int			atom_nonbonded_forces(Batom* atom, Batom* atom2, Bmd* md, Vector3<double>
 	return 0;
 }
 
+/**
+@brief 	Sets up flat indexed arrays for molecular dynamics.
+@param 	*molgroup		molecular structure.
+@param 	*md				molecular dynamics parameters.
+@return Bmdsetup		molecular dynamics setup.
+
+	The atoms are collected into an array and each atom is assigned a
+	type index through a hash of its type and element.
+	The Van der Waals distance for every pair of atom types is found 
+	once in the bond type list and stored in a flat table.
+	The bond and angle lists are converted to atom index arrays.
+	The neighbour list is built for the first time.
+
+**/
+Bmdsetup	md_setup(Bmolgroup* molgroup, Bmd* md)
+{
+	long			i, j;
+	Bmolecule*		mol;
+	Bresidue*		res;
+	Batom*  		atom;
+	Bbond*			bond;
+	Bangle*			angle;
+	Bbondtype*		bt;
+	Bmdsetup		mds;
+	
+	unordered_map<string, long>		typehash;
+	unordered_map<Batom*, long>		atomhash;
+	vector<Batom*>	typeatom;
+	
+	for ( mol = molgroup->mol; mol; mol = mol->next ) {
+		for( res = mol->res; res; res = res->next ) {
+			for ( atom = res->atom; atom; atom = atom->next ) {
+				string		key = string(atom->type) + " " + string(atom->el);
+				auto		it = typehash.find(key);
+				if ( it == typehash.end() ) {
+					it = typehash.emplace(key, typeatom.size()).first;
+					typeatom.push_back(atom);
+				}
+				atomhash[atom] = mds.atom.size();
+				mds.atom.push_back(atom);
+				mds.type.push_back(it->second);
+			}
+		}
+	}
+	
+	mds.ntype = typeatom.size();
+	mds.vdw.resize(mds.ntype*mds.ntype, 0);
+	
+	for ( i=0; i<mds.ntype; ++i ) {
+		for ( j=0; j<mds.ntype; ++j ) {
+			bt = md_find_bond_type(typeatom[i], typeatom[j], md->bond);
+			if ( bt ) mds.vdw[i*mds.ntype+j] = bt->vdwdist;
+		}
+	}
+	
+	for ( bond = molgroup->bond; bond; bond = bond->next ) {
+		mds.bond.push_back(atomhash[bond->atom1]);
+		mds.bond.push_back(atomhash[bond->atom2]);
+		mds.bondlen.push_back(bond->l);
+	}
+	
+	for ( angle = molgroup->angle; angle; angle = angle->next ) {
+		mds.angle.push_back(atomhash[angle->atom1]);
+		mds.angle.push_back(atomhash[angle->atom2]);
+		mds.angle.push_back(atomhash[angle->atom3]);
+		mds.anglecos.push_back(cos(angle->a));
+	}
+	
+	mds.skin = md->skin;
+	if ( mds.skin < 0 ) mds.skin = 0;
+	mds.nbuild = 0;
+	
+	if ( verbose & VERB_PROCESS ) {
+		cout << "Molecular dynamics setup:" << endl;
+		cout << "Atoms:                          " << mds.atom.size() << endl;
+		cout << "Atom types:                     " << mds.ntype << endl;
+		cout << "Bonds:                          " << mds.bondlen.size() << endl;
+		cout << "Angles:                         " << mds.anglecos.size() << endl << endl;
+	}
+	
+	md_neighbor_list(mds, molgroup, md);
+	
+	return mds;
+}
+
+/**
+@brief 	Builds the Verlet neighbour list.
+@param 	&mds			molecular dynamics setup.
+@param 	*molgroup		molecular structure.
+@param 	*md				molecular dynamics parameters.
+@return long			number of neighbour pairs.
+
+	All non-excluded atom pairs closer than the cutoff plus the skin 
+	distance are listed for each atom, using a grid of cells at least 
+	as large as the list distance.
+	With periodic boundaries the grid spans the box, otherwise it spans
+	the extent of the atomic coordinates.
+	Both orders of each pair are stored so that the forces on each atom
+	can be calculated independently.
+
+**/
+long		md_neighbor_list(Bmdsetup& mds, Bmolgroup* molgroup, Bmd* md)
+{
+	long			i, j, k, na(mds.atom.size());
+	long			x, y, z, xx, yy, zz, ix, iy, iz;
+	double			rl(md->cutoff + mds.skin), rl2(rl*rl);
+	Vector3<double>	box(molgroup->box), d;
+	Vector3<double>	lo(1e30,1e30,1e30), hi(-1e30,-1e30,-1e30), width;
+	Vector3<long>	size, cell;
+	vector<long>	atomcell(na);
+	
+	if ( md->wrap ) {
+		lo = Vector3<double>(0,0,0);
+		hi = box;
+	} else {
+		for ( i=0; i<na; ++i ) {
+			lo = lo.min(mds.atom[i]->coord);
+			hi = hi.max(mds.atom[i]->coord);
+		}
+	}
+	
+	for ( j=0; j<3; ++j ) {
+		if ( md->wrap ) {
+			size[j] = (long) (box[j]/rl);
+			if ( size[j] < 1 ) size[j] = 1;
+			width[j] = box[j]/size[j];
+		} else {
+			size[j] = (long) ((hi[j] - lo[j])/rl) + 1;
+			width[j] = rl;
+		}
+	}
+	
+	long			ncell(size.volume());
+	vector<long>	cellstart(ncell+1, 0), cellatom(na);
+	
+	for ( i=0; i<na; ++i ) {
+		for ( j=0; j<3; ++j ) {
+			cell[j] = (long) floor((mds.atom[i]->coord[j] - lo[j])/width[j]);
+			if ( md->wrap ) {
+				cell[j] %= size[j];
+				if ( cell[j] < 0 ) cell[j] += size[j];
+			} else {
+				if ( cell[j] < 0 ) cell[j] = 0;
+				if ( cell[j] >= size[j] ) cell[j] = size[j] - 1;
+			}
+		}
+		atomcell[i] = (cell[2]*size[1] + cell[1])*size[0] + cell[0];
+		cellstart[atomcell[i]+1]++;
+	}
+	
+	for ( i=0; i<ncell; ++i ) cellstart[i+1] += cellstart[i];
+	
+	vector<long>	cellfill(cellstart.begin(), cellstart.end()-1);
+	for ( i=0; i<na; ++i ) cellatom[cellfill[atomcell[i]]++] = i;
+	
+	vector<vector<long>>	neighbors(na);
+	
+#pragma omp parallel for private(j,k,x,y,z,xx,yy,zz,ix,iy,iz,d)
+	for ( i=0; i<na; ++i ) {
+		Batom*			atom = mds.atom[i];
+		long			ic = atomcell[i];
+		vector<long>	nbcell;
+		x = ic%size[0];
+		y = (ic/size[0])%size[1];
+		z = ic/(size[0]*size[1]);
+		for ( zz=z-1; zz<=z+1; zz++ ) {
+			iz = zz;
+			if ( md->wrap ) {
+				if ( iz < 0 ) iz += size[2];
+				if ( iz >= size[2] ) iz -= size[2];
+			} else if ( iz < 0 || iz >= size[2] ) continue;
+			for ( yy=y-1; yy<=y+1; yy++ ) {
+				iy = yy;
+				if ( md->wrap ) {
+					if ( iy < 0 ) iy += size[1];
+					if ( iy >= size[1] ) iy -= size[1];
+				} else if ( iy < 0 || iy >= size[1] ) continue;
+				for ( xx=x-1; xx<=x+1; xx++ ) {
+					ix = xx;
+					if ( md->wrap ) {
+						if ( ix < 0 ) ix += size[0];
+						if ( ix >= size[0] ) ix -= size[0];
+					} else if ( ix < 0 || ix >= size[0] ) continue;
+					nbcell.push_back((iz*size[1] + iy)*size[0] + ix);
+				}
+			}
+		}
+		sort(nbcell.begin(), nbcell.end());
+		nbcell.erase(unique(nbcell.begin(), nbcell.end()), nbcell.end());
+		for ( auto c: nbcell ) {
+			for ( k=cellstart[c]; k<cellstart[c+1]; ++k ) {
+				j = cellatom[k];
+				if ( md_nonbonded_excluded(atom, mds.atom[j]) ) continue;
+				if ( md->wrap )
+					d = vector3_difference_PBC(mds.atom[j]->coord, atom->coord, box);
+				else
+					d = mds.atom[j]->coord - atom->coord;
+				if ( d.length2() < rl2 ) neighbors[i].push_back(j);
+			}
+		}
+		sort(neighbors[i].begin(), neighbors[i].end());
+	}
+	
+	mds.nstart.resize(na+1);
+	mds.nstart[0] = 0;
+	for ( i=0; i<na; ++i ) mds.nstart[i+1] = mds.nstart[i] + neighbors[i].size();
+	
+	mds.nlist.resize(mds.nstart[na]);
+	for ( i=0; i<na; ++i )
+		copy(neighbors[i].begin(), neighbors[i].end(), mds.nlist.begin() + mds.nstart[i]);
+	
+	mds.ref.resize(na);
+	for ( i=0; i<na; ++i ) mds.ref[i] = mds.atom[i]->coord;
+	
+	mds.nbuild++;
+	
+	if ( verbose & VERB_DEBUG )
+		cout << "DEBUG md_neighbor_list: cells=" << size << " pairs=" << mds.nstart[na] << endl;
+	
+	return mds.nstart[na];
+}
+
+/**
+@brief 	Checks the Verlet neighbour list and rebuilds it if needed.
+@param 	&mds			molecular dynamics setup.
+@param 	*molgroup		molecular structure.
+@param 	*md				molecular dynamics parameters.
+@return int				1 if the list was rebuilt, 0 otherwise.
+
+	The list is rebuilt when any atom moved more than half the skin
+	distance since the last build.
+
+**/
+int			md_neighbor_list_check(Bmdsetup& mds, Bmolgroup* molgroup, Bmd* md)
+{
+	long			i, na(mds.atom.size());
+	double			lim(0.25*mds.skin*mds.skin);
+	int				rebuild(0);
+	Vector3<double>	d;
+	
+	if ( mds.ref.size() != na ) rebuild = 1;
+	
+	for ( i=0; i<na && !rebuild; ++i ) {
+		if ( md->wrap )
+			d = vector3_difference_PBC(mds.atom[i]->coord, mds.ref[i], molgroup->box);
+		else
+			d = mds.atom[i]->coord - mds.ref[i];
+		if ( d.length2() > lim ) rebuild = 1;
+	}
+	
+	if ( rebuild ) md_neighbor_list(mds, molgroup, md);
+	
+	return rebuild;
+}
+
+/**
+@brief 	Calculates the covalent bond length forces and energy from flat arrays.
+@param 	&mds			molecular dynamics setup.
+@param 	*molgroup		molecular structure.
+@param 	Kbond			bond energy constant.
+@param 	wrap			flag to wrap around periodic boundaries.
+@return double			total bond length energy.
+
+	The energy and force are the same as for the bond list version.
+
+**/
+double		md_bond_forces(Bmdsetup& mds, Bmolgroup* molgroup, double Kbond, int wrap)
+{
+	if ( Kbond <= 0 ) return 0;
+	
+	long			i, nb(mds.bondlen.size());
+	double			dist, dev, fac, energy(0);
+	Vector3<double>	d, Force;
+	Batom*			atom1;
+	Batom*			atom2;
+	
+	for ( i=0; i<nb; ++i ) {
+		atom1 = mds.atom[mds.bond[2*i]];
+		atom2 = mds.atom[mds.bond[2*i+1]];
+		if ( wrap )
+			d = vector3_difference_PBC(atom1->coord, atom2->coord, molgroup->box);
+		else
+			d = atom1->coord - atom2->coord;
+		dist = d.length();
+		dev = dist - mds.bondlen[i];
+		energy += Kbond*dev*dev;
+		fac = -2*Kbond*dev/dist;
+		Force = d * fac;
+		atom1->F += Force;
+		atom2->F -= Force;
+	}
+
+	return energy;
+}
+
+/**
+@brief 	Calculates the covalent bond angular forces and energy from flat arrays.
+@param 	&mds			molecular dynamics setup.
+@param 	*molgroup		molecular structure.
+@param 	Kangle			bond angle energy constant.
+@param 	wrap			flag to wrap around periodic boundaries.
+@return double			total bond angle energy.
+
+	The energy and force are the same as for the angle list version.
+
+**/
+double		md_angular_forces(Bmdsetup& mds, Bmolgroup* molgroup, double Kangle, int wrap)
+{
+	if ( Kangle <= 0 ) return 0;
+	
+	long			i, na(mds.anglecos.size());
+	double			d1len2, d2len2, dot, fac, dcosa, c11, c12, c22, energy(0);
+	Vector3<double>	d1, d2, Force;
+	Batom*			atom1;
+	Batom*			atom2;
+	Batom*			atom3;
+	
+	for ( i=0; i<na; ++i ) {
+		atom1 = mds.atom[mds.angle[3*i]];
+		atom2 = mds.atom[mds.angle[3*i+1]];
+		atom3 = mds.atom[mds.angle[3*i+2]];
+		if ( wrap ) {
+			d1 = vector3_difference_PBC(atom2->coord, atom1->coord, molgroup->box);
+			d2 = vector3_difference_PBC(atom2->coord, atom3->coord, molgroup->box);
+		} else {
+			d1 = atom2->coord - atom1->coord;
+			d2 = atom2->coord - atom3->coord;
+		}
+		d1len2 = d1.length2();
+		d2len2 = d2.length2();
+		dot = d1.scalar(d2);
+		fac = 1/sqrt(d1len2*d2len2);
+		dcosa = mds.anglecos[i] - dot*fac;
+		energy += Kangle*dcosa*dcosa;
+		c12 = 2*Kangle*fac*dcosa;
+		c11 = c12*dot/d1len2;
+		c22 = c12*dot/d2len2;
+		Force = (d1 * c11) - (d2 * c12);
+		atom1->F += Force;
+		Force = (d2 * c22) - (d1 * c12);
+		atom3->F += Force;
+	}
+
+	return energy;
+}
+
+/**
+@brief 	Calculates the non-bonded forces and energy from the neighbour list.
+@param 	&mds			molecular dynamics setup.
+@param 	*molgroup		molecular structure.
+@param 	*md				molecular dynamics structure.
+@return double			total non-bonded energy.
+
+	The energy and force are the same as for the cell list version, 
+	but the atom pairs are taken from the Verlet neighbour list, which
+	is rebuilt first if necessary, and the Van der Waals distances 
+	from the atom type pair table.
+	The forces on each atom are calculated in parallel.
+
+**/
+double		md_nonbonded_forces(Bmdsetup& mds, Bmolgroup* molgroup, Bmd* md)
+{
+	if ( md->Kvdw < 0 ) md->Kvdw = 0;
+	if ( md->Kelec < 0 ) md->Kelec = 0;
+	if ( md->Kvdw <= 0 && md->Kelec <= 0 ) return 0;
+	
+	md_neighbor_list_check(mds, molgroup, md);
+	
+	long			i, na(mds.atom.size());
+	double			cutoff2(md->cutoff*md->cutoff);
+	double			Evdw(0), Eelec(0);
+	Vector3<double>	box(molgroup->box);
+	
+#pragma omp parallel for reduction(+:Evdw,Eelec)
+	for ( i=0; i<na; ++i ) {
+		long			j, k;
+		float			vd;
+		double			rd2, rd6, rd12, dist2, invdist2, fac;
+		Batom*			atom = mds.atom[i];
+		Batom*			atom2;
+		Vector3<double>	d, F;
+		const float*	vdw = &mds.vdw[mds.type[i]*mds.ntype];
+		for ( k=mds.nstart[i]; k<mds.nstart[i+1]; ++k ) {
+			j = mds.nlist[k];
+			atom2 = mds.atom[j];
+			if ( md->wrap )
+				d = vector3_difference_PBC(atom2->coord, atom->coord, box);
+			else
+				d = atom2->coord - atom->coord;
+			dist2 = d.length2();
+			if ( dist2 >= cutoff2 ) continue;
+			invdist2 = 1/dist2;
+			if ( md->Kvdw ) {
+				vd = vdw[mds.type[j]];
+				if ( vd > 0 ) {
+					rd2 = vd*vd*invdist2;
+					rd6 = rd2*rd2*rd2;
+					rd12 = rd6*rd6;
+					Evdw += md->Kvdw*(md->VdWcoeff1*rd12 - md->VdWcoeff2*rd6);
+					fac = -md->Kvdw*(rd12 - rd6)*invdist2;
+					F += d * fac;
+				}
+			}
+			if ( md->Kelec ) {
+				fac = md->Kelec*atom->chrg*atom2->chrg*sqrt(invdist2);
+				Eelec += fac;
+				fac *= invdist2;
+				F += d * fac;
+			}
+		}
+		atom->F += F;
+	}
+	
+	md->Evdw = Evdw;
+	md->Eelec = Eelec;
+	
+	return md->Eelec+md->Evdw;
+}
+
 /**
 @brief 	Calculates the atomic forces and energy resulting from a single point force.
 @param 	*molgroup		molecular structure.
@@ -3,7 +3,7 @@
 @brief	Functions for reading and writing Digital Micrograph files
 @author Bernard Heymann
 @date	Created: 20020619
-@date 	Modified: 20170126
+@date 	Modified: 20261018
 **/
 
 #include "rwDM.h"
@@ -83,6 +83,8 @@ int 	writeDM(Bimage* p)
  	DMhead* 	header = new DMhead;
 	memset(header, 0, sizeof(DMhead));
 	
+	if ( p->data_type() == Half ) p->change_type(Float);
+	
 	long	 	datatypesize = p->channels()*p->data_type_size();
 	long		datasize = p->data_size();
 	
@@ -3,7 +3,7 @@
 @brief	Functions for reading and writing MRC files
 @author Bernard Heymann
 @date	Created: 19990321
-@date 	Modified: 20180712
+@date 	Modified: 20261018
 **/
 
 #include "rwMRC.h"
@@ -28,6 +28,39 @@ struct SERIhead {
 	short		dose2;
 };
 
+/*
+	Unpacks 4-bit values into bytes for one frame, the first value of
+	each byte from the low-order bits.
+	Each row starts on a byte boundary, so for an odd row width the last
+	byte of a row holds only one value.
+	The inner loop uses masks and shifts, which vectorize.
+*/
+static void		mrc_unpack_4bit_frame(unsigned char* packed, unsigned char* data, long nx, long ny)
+{
+	long			xx, yy, np(nx/2), rowsize((nx + 1)/2);
+	
+	for ( yy=0; yy<ny; ++yy, packed+=rowsize, data+=nx ) {
+		for ( xx=0; xx<np; ++xx ) {
+			data[2*xx] = packed[xx] & 15;
+			data[2*xx+1] = packed[xx] >> 4;
+		}
+		if ( nx & 1 ) data[nx-1] = packed[np] & 15;
+	}
+}
+
+/*
+	Packs bytes with values 0-15 into 4-bit values for one frame.
+*/
+static void		mrc_pack_4bit_frame(unsigned char* data, unsigned char* packed, long nx, long ny)
+{
+	long			xx, yy, np(nx/2), rowsize((nx + 1)/2);
+	
+	for ( yy=0; yy<ny; ++yy, packed+=rowsize, data+=nx ) {
+		for ( xx=0; xx<np; ++xx ) packed[xx] = (data[2*xx] & 15) | (data[2*xx+1] << 4);
+		if ( nx & 1 ) packed[np] = data[nx-1] & 15;
+	}
+}
+
 /**
 @brief	Reading a MRC map image file format.
 @param	*p			the image structure.
@@ -50,7 +83,12 @@ A 3D image format used in electron microscopy.
 	Byte order determination:	Data type and third dimension values
 								must be less than 256*256.
 	Data types: 				0 = signed byte, 1 = short, 2 = float,
-								3 = complex short, 4 = complex float.
+								3 = complex short, 4 = complex float,
+								6 = unsigned short, 7 = int,
+								12 = half precision float, 16 = RGB byte,
+								101 = 4-bit unsigned, two per byte (first
+								in the low-order bits, rows padded to bytes).
+								The 4-bit values are unpacked to bytes.
 	Transform type: 			Centered hermitian
 								The x-dimension contains the x-size
 								of the full transform
@@ -174,6 +212,7 @@ int 	readMRC(Bimage* p, int readdata, int img_select)
 		case 4: p->data_type(Float); p->compound_type(TComplex); p->channels(2); break;
 		case 6: p->data_type(UShort); break;
 		case 7: p->data_type(Integer); break;
+		case 12: p->data_type(Half); break;
 		case 16: p->data_type(UCharacter); p->compound_type(TRGB); p->channels(3); break;
 		default: p->data_type(UCharacter); break;
 	}
@@ -240,6 +279,8 @@ int 	readMRC(Bimage* p, int readdata, int img_select)
 		fimg->seekg(0, ios::beg);
 	}
 	
+	int				mode(header->mode);
+	
 	delete header;
 	
 	if ( verbose & VERB_DEBUG )
@@ -253,7 +294,32 @@ int 	readMRC(Bimage* p, int readdata, int img_select)
 	
 	if ( readdata ) {
 		p->data_alloc();
-		if ( p->compound_type() == TSimple ) {
+		if ( mode == 101 ) {
+			// Read blocks of frames and unpack the frames in parallel
+			long			nx(p->sizeX()), ny(p->sizeY());
+			long			nf(p->sizeZ()*p->images());
+			long			framesize(ny*((nx + 1)/2));
+			long			f, nb, bf(system_processors());
+			if ( bf > nf ) bf = nf;
+			unsigned char*	udata = p->data_pointer();
+			size_t			offset(p->data_offset() + img_select*nf*framesize);
+			data = new unsigned char[bf*framesize];
+			for ( f=0; f<nf; f+=nb ) {
+				nb = ( f + bf < nf )? bf: nf - f;
+				fread_large(data, nb*framesize, offset + f*framesize, fimg);
+				unsigned char*	ud = udata + f*nx*ny;
+#ifdef HAVE_GCD
+				dispatch_apply(nb, dispatch_get_global_queue(0, 0), ^(size_t i){
+					mrc_unpack_4bit_frame(data + i*framesize, ud + i*nx*ny, nx, ny);
+				});
+#else
+#pragma omp parallel for
+				for ( long i=0; i<nb; ++i )
+					mrc_unpack_4bit_frame(data + i*framesize, ud + i*nx*ny, nx, ny);
+#endif
+			}
+			delete[] data;
+		} else if ( p->compound_type() == TSimple ) {
 			fread_large(p->data_pointer(), readsize, p->data_offset() + img_select*readsize, fimg);
 			if ( sb ) swapbytes(readsize, p->data_pointer(), p->data_type_size());
 		} else {
@@ -277,18 +343,42 @@ int 	readMRC(Bimage* p, int readdata, int img_select)
 /**
 @brief	Writing a MRC map image file format.
 @param	*p			the image structure.
+@param	flags		4=pack 4-bit values (mode 101).
 @return	int					error code (<0 means failure).
 A 3D image format used in electron microscopy.
+	For 4-bit packing the data must be integers in the range 0-15.
 **/
-int 	writeMRC(Bimage* p)
+int 	writeMRC(Bimage* p, int flags)
 {
 	p->color_to_simple();
 
 	if ( p->compound_type() == TComplex ) p->change_type(Float);
 	
 	string			ext(extension(p->file_name()));
+	
+	int				pack4(flags == 4);
+	
+	if ( pack4 ) {
+		if ( p->compound_type() != TSimple || p->minimum() < 0 || p->maximum() > 15 ) {
+			cerr << "Error: The image " << p->file_name() << " must have simple values in the range 0-15 for 4-bit packing!" << endl;
+			cerr << tab << "min = " << p->minimum() << " max = " << p->maximum() << endl;
+			return -1;
+		}
+		if ( p->data_type() != UCharacter ) {
+			long			i;
+			for ( i=0; i<p->data_size() && (*p)[i] == floor((*p)[i]); ++i ) ;
+			if ( i < p->data_size() ) {
+				cerr << "Error: The image " << p->file_name() << " must have integer values for 4-bit packing!" << endl;
+				return -1;
+			}
+			unsigned char*	ub = new unsigned char[p->data_size()];
+			for ( i=0; i<p->data_size(); ++i ) ub[i] = (unsigned char) (*p)[i];
+			p->data_type(UCharacter);
+			p->data_assign(ub);
+		}
+	}
     
-    switch ( p->data_type() ) {
+    if ( !pack4 ) switch ( p->data_type() ) {
 		case Bit: case UCharacter:
 			p->change_type(UCharacter); break;
 		case SCharacter:
@@ -297,6 +387,8 @@ int 	writeMRC(Bimage* p)
 			break;
     	case UShort: case Short:
 			p->change_type(Short); break;
+    	case Half:
+			break;
     	default:
 			p->change_type(Float); break;
     }
@@ -320,8 +412,10 @@ int 	writeMRC(Bimage* p)
 		case UShort: header->mode = 6; break;
 		case Short: header->mode = 1; if ( p->compound_type() == TComplex ) header->mode = 3; break;
 		case Float: header->mode = 2; if ( p->compound_type() == TComplex ) header->mode = 4; break;
+		case Half: header->mode = 12; break;
 		default: header->mode = 0; break;
 	}
+	if ( pack4 ) header->mode = 101;
 	if ( p->image->origin()[0] >= 0 )
 		header->nxStart = (int) -(p->image->origin()[0] + 0.5);
 	else
@@ -430,8 +524,26 @@ int 	writeMRC(Bimage* p)
 		else fimg.write((char *)symop, header->nsymbt);
 	}
 	
+	if ( pack4 ) datasize = (long)header->ny*header->nz*((header->nx + 1)/2);
+	
 	if ( p->data_pointer() ) {
-		if ( p->compound_type() < TComplex ) {
+		if ( pack4 ) {
+			long			nx(header->nx), ny(header->ny);
+			long			framesize(ny*((nx + 1)/2));
+			unsigned char*	udata = p->data_pointer();
+			data = new unsigned char[datasize];
+#ifdef HAVE_GCD
+			dispatch_apply(header->nz, dispatch_get_global_queue(0, 0), ^(size_t i){
+				mrc_pack_4bit_frame(udata + i*nx*ny, data + i*framesize, nx, ny);
+			});
+#else
+#pragma omp parallel for
+			for ( long i=0; i<header->nz; ++i )
+				mrc_pack_4bit_frame(udata + i*nx*ny, data + i*framesize, nx, ny);
+#endif
+			fimg.write((char *)data, datasize);
+			delete[] data;
+		} else if ( p->compound_type() < TComplex ) {
 			fimg.write((char *)p->data_pointer(), datasize);
 		} else {
 			data = new unsigned char[datasize];
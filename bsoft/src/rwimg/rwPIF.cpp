@@ -3,7 +3,7 @@
 @brief	Functions for reading and writing PIF files
 @author Bernard Heymann
 @date	Created: 19991112
-@date 	Modified: 20120706
+@date 	Modified: 20261018
 **/
 
 #include "rwPIF.h"
@@ -376,6 +376,7 @@ int 	writePIF(Bimage* p)
 		case Bit:
     	case SCharacter: p->change_type(UCharacter); break;
     	case UShort: p->change_type(Short); break;
+    	case Half: p->change_type(Float); break;
     	default: break;
     }
 	
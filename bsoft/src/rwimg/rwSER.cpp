@@ -3,7 +3,7 @@
 @brief	Reading FEI SER files
 @author Bernard Heymann
 @date	Created: 20150130
-@date	Modified: 20150630
+@date	Modified: 20261018
 **/
 
 #include <time.h>
@@ -111,6 +111,7 @@ int 		writeSER(Bimage* p)
 
 	if ( p->data_type() == ULong ) p->change_type(UInteger);
 	if ( p->data_type() == Long ) p->change_type(Integer);
+	if ( p->data_type() == Half ) p->change_type(Float);
 	
 	p->data_offset(126);
 	
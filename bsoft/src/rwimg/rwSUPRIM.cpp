@@ -3,7 +3,7 @@
 @brief	Functions for reading and writing SUPRIM files
 @author Bernard Heymann
 @date	Created: 19990930
-@date 	Modified: 20120409
+@date 	Modified: 20261018
 **/
 
 #include "rwSUPRIM.h"
@@ -211,6 +211,8 @@ int 	writeSUPRIM(Bimage *p)
 			p->change_type(Short); break;
     	case UInteger: case Integer:
 			p->change_type(Integer); break;
+    	case Half:
+			p->change_type(Float); break;
     	default: break;
     }
 	
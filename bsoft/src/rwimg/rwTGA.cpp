@@ -3,7 +3,7 @@
 @brief	Functions for reading and writing Truevision TGA files
 @author Bernard Heymann
 @date	Created: 20150811
-@date 	Modified: 20150815
+@date 	Modified: 20261018
 **/
 
 #include "rwTGA.h"
@@ -273,7 +273,7 @@ int 	writeTGA(Bimage *p)
 			p->change_type(UShort); break;
 		case UInteger: case Integer:
 			p->change_type(UInteger); break;
-		case Float: case Double:
+		case Float: case Double: case Half:
 			p->change_type(UInteger); break;
     	default:
 			p->change_type(UCharacter); break;
@@ -3,7 +3,7 @@
 @brief	Functions for reading and writing TIFF files
 @author Bernard Heymann
 @date	Created: 19990509
-@date 	Modified: 20210615
+@date 	Modified: 20261018
 **/
 
 #include "rwTIFF.h"
@@ -45,6 +45,172 @@ static void registerTIFFTags(TIFF *tif)
     TIFFMergeFieldInfo(tif, xtiffFieldInfo, 3);
 }
 
+/*
+	Registers the custom tags and the EER codec with the TIFF library.
+	This modifies global library state and is done only once,
+	so that files can be read concurrently.
+*/
+static int	registerTIFFExtensions()
+{
+	TIFFSetTagExtender(registerTIFFTags);
+	TIFFRegisterCODEC(TIFF_COMPRESSION_EER_V1, "EER compression", TIFFInitEER);
+	return 1;
+}
+
+/*
+	Layout of the strips or tiles of one TIFF directory.
+	Strips are treated as tiles spanning the width of the image.
+*/
+struct TIFFlayout {
+	int			tiled;			// Flag for tiles rather than strips
+	long		nx, ny, nz;		// Image size
+	long		tx, ty, tz;		// Strip or tile size
+	long		stride;			// Samples per pixel
+	long		bps;			// Bytes per sample
+	long		elementsize;	// Bytes per pixel
+};
+
+/*
+	Decodes strips or tiles first to last-1 of a directory into the image
+	data of a page, using a separate libtiff handle so that the codecs
+	of the library can run concurrently.
+	The handle is positioned at the directory offset of the main handle.
+	Strips are decoded in place, tiles are decoded to a buffer and
+	the part within the image is copied.
+	Returns 0 on success, <0 on error.
+*/
+static int	tiff_decode_striles(const char* filename, uint64_t diroff, TIFFlayout& tl,
+				long first, long last, unsigned char* page)
+{
+	TIFF*			fimg = TIFFOpen(filename, "r");
+	if ( !fimg ) return -1;
+	
+	if ( !TIFFSetSubDirectory(fimg, diroff) ) {
+		TIFFClose(fimg);
+		return -1;
+	}
+	
+	long			xpt((tl.nx + tl.tx - 1)/tl.tx), ypt((tl.ny + tl.ty - 1)/tl.ty);
+	long			rowsize(tl.tx*tl.elementsize), ntile(rowsize*tl.ty*tl.tz);
+	long			s, i, j, y, z, px, py, pz, lx, nrows;
+	vector<unsigned char>	tile;
+	if ( tl.tiled ) tile.resize(ntile);
+	
+	for ( s=first; s<last; ++s ) {
+		px = (s%xpt)*tl.tx;
+		py = ((s/xpt)%ypt)*tl.ty;
+		pz = (s/(xpt*ypt))*tl.tz;
+		if ( tl.tiled ) {
+			if ( TIFFReadEncodedTile(fimg, s, tile.data(), ntile) != ntile ) break;
+			lx = ( tl.tx < tl.nx - px )? tl.tx: tl.nx - px;
+			for ( z=0; z<tl.tz && pz+z<tl.nz; ++z ) {
+				for ( y=0; y<tl.ty && py+y<tl.ny; ++y ) {
+					i = (((pz + z)*tl.ny + py + y)*tl.nx + px)*tl.elementsize;
+					j = (z*tl.ty + y)*rowsize;
+					memcpy(page+i, tile.data()+j, lx*tl.elementsize);
+				}
+			}
+		} else {
+			nrows = ( py + tl.ty > tl.ny )? tl.ny - py: tl.ty;
+			if ( TIFFReadEncodedStrip(fimg, s, page + py*rowsize, nrows*rowsize) != nrows*rowsize ) break;
+		}
+	}
+	
+	TIFFClose(fimg);
+	
+	return ( s < last )? -1: 0;
+}
+
+/*
+	Reads the strips or tiles of the current directory into image nn.
+	The strips or tiles are divided into contiguous blocks, each decoded
+	by libtiff on its own file handle, directly into the image data.
+	Only LZW, deflate and PackBits compression with whole-byte samples
+	are handled.
+	Returns 0 on success, <0 if the directory must be read serially.
+*/
+static int	readTIFF_parallel(TIFF* fimg, Bimage* p, long nn, unsigned char* data)
+{
+	unsigned short	compression(COMPRESSION_NONE);
+	unsigned short	samplesperpixel(1), bitspersample(0);
+	unsigned short	planarconfig(PLANARCONFIG_CONTIG), photometric(0);
+	unsigned int	x(p->sizeX()), y(p->sizeY()), z(1), rowsperstrip(p->sizeY());
+	
+	TIFFGetField(fimg, TIFFTAG_COMPRESSION, &compression);
+	TIFFGetField(fimg, TIFFTAG_SAMPLESPERPIXEL, &samplesperpixel);
+	TIFFGetField(fimg, TIFFTAG_BITSPERSAMPLE, &bitspersample);
+	TIFFGetField(fimg, TIFFTAG_PLANARCONFIG, &planarconfig);
+	TIFFGetField(fimg, TIFFTAG_PHOTOMETRIC, &photometric);
+	
+	if ( compression != COMPRESSION_LZW && compression != COMPRESSION_ADOBE_DEFLATE &&
+			compression != COMPRESSION_DEFLATE && compression != COMPRESSION_PACKBITS ) return -1;
+	if ( bitspersample != 8 && bitspersample != 16 && bitspersample != 32 && bitspersample != 64 ) return -1;
+	if ( samplesperpixel > 1 && planarconfig != PLANARCONFIG_CONTIG ) return -1;
+	if ( samplesperpixel*bitspersample/8 != p->channels()*p->data_type_size() ) return -1;
+	if ( photometric == PHOTOMETRIC_YCBCR ) return -1;
+	
+	TIFFlayout		tl;
+	tl.tiled = TIFFIsTiled(fimg);
+	tl.nx = p->sizeX();
+	tl.ny = p->sizeY();
+	tl.nz = p->sizeZ();
+	tl.stride = samplesperpixel;
+	tl.bps = bitspersample/8;
+	tl.elementsize = tl.stride*tl.bps;
+	
+	if ( tl.tiled ) {
+		TIFFGetField(fimg, TIFFTAG_TILEWIDTH,  &x);
+		TIFFGetField(fimg, TIFFTAG_TILELENGTH, &y);
+		TIFFGetField(fimg, TIFFTAG_TILEDEPTH,  &z);
+		if ( z > 1 ) return -1;				// Tile sizes only cover one plane in libtiff
+		if ( TIFFTileRowSize(fimg) != x*tl.elementsize ) return -1;
+	} else {
+		if ( tl.nz > 1 ) return -1;			// Scanline rows are ambiguous for 3D images
+		TIFFGetField(fimg, TIFFTAG_ROWSPERSTRIP, &rowsperstrip);
+		if ( rowsperstrip < y ) y = rowsperstrip;
+		if ( TIFFScanlineSize(fimg) != x*tl.elementsize ) return -1;
+	}
+	
+	if ( x < 1 || y < 1 || z < 1 ) return -1;
+	
+	tl.tx = x;
+	tl.ty = y;
+	tl.tz = z;
+	
+	long			s, n = ( tl.tiled )? TIFFNumberOfTiles(fimg): TIFFNumberOfStrips(fimg);
+	long			nt(((tl.nx + tl.tx - 1)/tl.tx)*((tl.ny + tl.ty - 1)/tl.ty)*((tl.nz + tl.tz - 1)/tl.tz));
+	
+	if ( n != nt ) return -1;
+	
+	long			nblock(system_processors());
+	if ( nblock > n ) nblock = n;
+	if ( nblock < 2 ) return -1;
+	
+	if ( verbose & VERB_DEBUG )
+		cout << "DEBUG readTIFF: decoding " << n << " strips or tiles in " << nblock << " blocks" << endl;
+	
+	unsigned char*	page = data + nn*tl.nx*tl.ny*tl.nz*tl.elementsize;
+	const char*		filename = p->file_name().c_str();
+	uint64_t		diroff(TIFFCurrentDirOffset(fimg));
+	TIFFlayout*		ptl = &tl;
+	vector<int>		status(nblock, 0);
+	int*			st = status.data();
+	
+#ifdef HAVE_GCD
+	dispatch_apply(nblock, dispatch_get_global_queue(0, 0), ^(size_t i){
+		st[i] = tiff_decode_striles(filename, diroff, *ptl, i*n/nblock, (i+1)*n/nblock, page);
+	});
+#else
+#pragma omp parallel for
+	for ( long i=0; i<nblock; ++i )
+		st[i] = tiff_decode_striles(filename, diroff, *ptl, i*n/nblock, (i+1)*n/nblock, page);
+#endif
+
+	for ( s=0; s<nblock; ++s ) if ( st[s] ) return -1;
+	
+	return 0;
+}
+
 /**
 @brief	Reading a TIFF image file format.
 @param	*p			the image structure.
@@ -57,14 +223,15 @@ A 2D and 3D image format commonly used for graphics.
 							signed short, int, float
 	Color models:		gray scale, RGB, RGBA, CMYK
 	Indexed color model
+	LZW, deflate and PackBits compressed strips and tiles are decoded concurrently.
 **/
 int 	readTIFF(Bimage* p, int readdata, int img_select)
 {
 	if ( verbose & VERB_DEBUG )
 		cout << "DEBUG readTIFF: Reading image: " << p->file_name() << endl;
 
-	TIFFSetTagExtender(registerTIFFTags);
-	TIFFRegisterCODEC(TIFF_COMPRESSION_EER_V1, "EER compression", TIFFInitEER);
+	static int		registered = registerTIFFExtensions();
+	if ( !registered ) return -1;
 
     TIFF*       	fimg;
     if ( ( fimg = TIFFOpen(p->file_name().c_str(), "r") ) == NULL ) return -1;
@@ -225,6 +392,8 @@ int 	readTIFF(Bimage* p, int readdata, int img_select)
 			p->data_type(UShort);
 			if ( sampleformat == SAMPLEFORMAT_INT )
 				p->data_type(Short);
+			else if ( sampleformat == SAMPLEFORMAT_IEEEFP )
+				p->data_type(Half);
 			break;
 		case 32:
 			p->data_type(UInteger);
@@ -328,7 +497,11 @@ int 	readTIFF(Bimage* p, int readdata, int img_select)
 				cerr << "Error: Separate planes not supported!" << endl;
 				bexit(-1);
 			}
-			if ( TIFFIsTiled(fimg) ) {
+			if ( !lutsize && compression != TIFF_COMPRESSION_EER_V1 &&
+					readTIFF_parallel(fimg, p, nimg, data) == 0 ) {
+				if ( verbose & VERB_DEBUG )
+					cout << "DEBUG readTIFF: image " << nimg << " decoded concurrently" << endl;
+			} else if ( TIFFIsTiled(fimg) ) {
 				TIFFGetField(fimg, TIFFTAG_TILEWIDTH,  &x);
 				TIFFGetField(fimg, TIFFTAG_TILELENGTH, &y);
 				TIFFGetField(fimg, TIFFTAG_TILEDEPTH,  &z);
@@ -458,6 +631,207 @@ int 	readTIFF(Bimage* p, int readdata, int img_select)
 	return 0;
 }
 
+/*
+	In-memory file for a libtiff handle, so that strips or tiles can be
+	encoded by the library codecs without writing to disk.
+*/
+struct TIFFmemfile {
+	vector<unsigned char>	data;
+	toff_t		pos;
+};
+
+static tmsize_t	tiff_mem_read(thandle_t h, void* buf, tmsize_t n)
+{
+	TIFFmemfile*	mf = (TIFFmemfile *) h;
+	if ( mf->pos >= mf->data.size() ) return 0;
+	if ( n > mf->data.size() - mf->pos ) n = mf->data.size() - mf->pos;
+	memcpy(buf, mf->data.data() + mf->pos, n);
+	mf->pos += n;
+	return n;
+}
+
+static tmsize_t	tiff_mem_write(thandle_t h, void* buf, tmsize_t n)
+{
+	TIFFmemfile*	mf = (TIFFmemfile *) h;
+	if ( mf->pos + n > mf->data.size() ) mf->data.resize(mf->pos + n);
+	memcpy(mf->data.data() + mf->pos, buf, n);
+	mf->pos += n;
+	return n;
+}
+
+static toff_t	tiff_mem_seek(thandle_t h, toff_t off, int whence)
+{
+	TIFFmemfile*	mf = (TIFFmemfile *) h;
+	if ( whence == SEEK_CUR ) off += mf->pos;
+	else if ( whence == SEEK_END ) off += mf->data.size();
+	mf->pos = off;
+	return off;
+}
+
+static int		tiff_mem_close(thandle_t h)
+{
+	return 0;
+}
+
+static toff_t	tiff_mem_size(thandle_t h)
+{
+	return ((TIFFmemfile *) h)->data.size();
+}
+
+static int		tiff_mem_map(thandle_t h, void** base, toff_t* size)
+{
+	return 0;
+}
+
+static void		tiff_mem_unmap(thandle_t h, void* base, toff_t size)
+{
+}
+
+/*
+	Copies the tags determining the encoded data from one handle to another.
+*/
+static void	tiff_copy_layout(TIFF* fin, TIFF* fout)
+{
+	unsigned int	v32, i;
+	unsigned short	v16, nextra;
+	unsigned short*	extra;
+	
+	unsigned int	tags32[] = {TIFFTAG_IMAGEWIDTH, TIFFTAG_IMAGELENGTH, TIFFTAG_IMAGEDEPTH,
+						TIFFTAG_ROWSPERSTRIP, TIFFTAG_TILEWIDTH, TIFFTAG_TILELENGTH, TIFFTAG_TILEDEPTH};
+	unsigned int	tags16[] = {TIFFTAG_SAMPLESPERPIXEL, TIFFTAG_BITSPERSAMPLE, TIFFTAG_SAMPLEFORMAT,
+						TIFFTAG_COMPRESSION, TIFFTAG_PREDICTOR, TIFFTAG_PLANARCONFIG, TIFFTAG_PHOTOMETRIC};
+	
+	for ( i=0; i<7; ++i )
+		if ( TIFFGetField(fin, tags32[i], &v32) ) TIFFSetField(fout, tags32[i], v32);
+	
+	for ( i=0; i<7; ++i )
+		if ( TIFFGetField(fin, tags16[i], &v16) ) TIFFSetField(fout, tags16[i], v16);
+	
+	if ( TIFFGetField(fin, TIFFTAG_EXTRASAMPLES, &nextra, &extra) )
+		TIFFSetField(fout, TIFFTAG_EXTRASAMPLES, nextra, extra);
+}
+
+/*
+	Opens a libtiff handle writing to a memory file, with the directory
+	layout of the main handle.
+*/
+static TIFF*	tiff_open_memory(TIFF* fimg, TIFFmemfile& mf)
+{
+	mf.pos = 0;
+	
+	TIFF*			fmem = TIFFClientOpen("memory", "w", (thandle_t) &mf,
+						tiff_mem_read, tiff_mem_write, tiff_mem_seek, tiff_mem_close,
+						tiff_mem_size, tiff_mem_map, tiff_mem_unmap);
+	
+	if ( fmem ) tiff_copy_layout(fimg, fmem);
+	
+	return fmem;
+}
+
+/*
+	Encodes strips or tiles first to last-1 from the image data of a page,
+	using the libtiff codecs on a handle writing to memory.
+	Tiles extending beyond the image are padded with zeroes.
+	The data is copied to a buffer because libtiff encodes in place.
+	The offset and size of each encoded strip or tile in the memory file
+	are returned in the offset and count arrays.
+	Returns 0 on success, <0 on error.
+*/
+static int	tiff_encode_striles(TIFF* fmem, TIFFlayout& tl, long first, long last,
+				unsigned char* page, uint64_t* offset, uint64_t* count)
+{
+	long			xpt((tl.nx + tl.tx - 1)/tl.tx), ypt((tl.ny + tl.ty - 1)/tl.ty);
+	long			rowsize(tl.tx*tl.elementsize), ntile(rowsize*tl.ty*tl.tz);
+	long			s, i, j, y, z, px, py, pz, lx, nrows;
+	vector<unsigned char>	buf(ntile);
+	
+	for ( s=first; s<last; ++s ) {
+		px = (s%xpt)*tl.tx;
+		py = ((s/xpt)%ypt)*tl.ty;
+		pz = (s/(xpt*ypt))*tl.tz;
+		if ( tl.tiled ) {
+			lx = ( tl.tx < tl.nx - px )? tl.tx: tl.nx - px;
+			if ( lx < tl.tx || py + tl.ty > tl.ny || pz + tl.tz > tl.nz )
+				fill(buf.begin(), buf.end(), 0);
+			for ( z=0; z<tl.tz && pz+z<tl.nz; ++z ) {
+				for ( y=0; y<tl.ty && py+y<tl.ny; ++y ) {
+					i = (((pz + z)*tl.ny + py + y)*tl.nx + px)*tl.elementsize;
+					j = (z*tl.ty + y)*rowsize;
+					memcpy(buf.data()+j, page+i, lx*tl.elementsize);
+				}
+			}
+			if ( TIFFWriteEncodedTile(fmem, s, buf.data(), ntile) < 0 ) break;
+		} else {
+			nrows = ( py + tl.ty > tl.ny )? tl.ny - py: tl.ty;
+			memcpy(buf.data(), page + py*rowsize, nrows*rowsize);
+			if ( TIFFWriteEncodedStrip(fmem, s, buf.data(), nrows*rowsize) < 0 ) break;
+		}
+		offset[s] = TIFFGetStrileOffset(fmem, s);
+		count[s] = TIFFGetStrileByteCount(fmem, s);
+	}
+	
+	return ( s < last )? -1: 0;
+}
+
+/*
+	Writes the data of image nn as compressed strips or tiles.
+	The strips or tiles are divided into contiguous blocks, each encoded
+	by libtiff on its own memory handle, and the encoded data is then
+	written in order as raw data to the main handle.
+	The memory handles are set up serially because reading the tags of
+	the main handle is not thread-safe in libtiff.
+	The directory tags must be set before calling this function.
+	Returns 0 on success, <0 on error.
+*/
+static int	writeTIFF_parallel(TIFF* fimg, Bimage* p, long nn, TIFFlayout& tl)
+{
+	long			s, b, n(((tl.nx + tl.tx - 1)/tl.tx)*((tl.ny + tl.ty - 1)/tl.ty)*((tl.nz + tl.tz - 1)/tl.tz));
+	long			nblock(system_processors());
+	if ( nblock > n ) nblock = n;
+	
+	if ( verbose & VERB_DEBUG )
+		cout << "DEBUG writeTIFF: encoding " << n << " strips or tiles in " << nblock << " blocks" << endl;
+	
+	unsigned char*	page = p->data_pointer() + nn*tl.nx*tl.ny*tl.nz*tl.elementsize;
+	vector<TIFFmemfile>	mem(nblock);
+	vector<TIFF*>	fmem(nblock, NULL);
+	vector<uint64_t>	offset(n, 0), count(n, 0);
+	vector<int>		status(nblock, -1);
+	TIFF**			fm = fmem.data();
+	uint64_t*		off = offset.data();
+	uint64_t*		cnt = count.data();
+	int*			st = status.data();
+	TIFFlayout*		ptl = &tl;
+	
+	for ( b=0; b<nblock; ++b ) fm[b] = tiff_open_memory(fimg, mem[b]);
+	
+#ifdef HAVE_GCD
+	dispatch_apply(nblock, dispatch_get_global_queue(0, 0), ^(size_t i){
+		if ( fm[i] ) st[i] = tiff_encode_striles(fm[i], *ptl, i*n/nblock, (i+1)*n/nblock, page, off, cnt);
+	});
+#else
+#pragma omp parallel for
+	for ( long i=0; i<nblock; ++i )
+		if ( fm[i] ) st[i] = tiff_encode_striles(fm[i], *ptl, i*n/nblock, (i+1)*n/nblock, page, off, cnt);
+#endif
+
+	int				err(0);
+	
+	for ( b=0; b<nblock; ++b ) {
+		if ( st[b] ) err = -1;
+		for ( s=b*n/nblock; !err && s<(b+1)*n/nblock; ++s ) {
+			if ( tl.tiled ) {
+				if ( TIFFWriteRawTile(fimg, s, mem[b].data.data() + offset[s], count[s]) < 0 ) err = -1;
+			} else {
+				if ( TIFFWriteRawStrip(fimg, s, mem[b].data.data() + offset[s], count[s]) < 0 ) err = -1;
+			}
+		}
+		if ( fm[b] ) TIFFClose(fm[b]);
+	}
+	
+	return err;
+}
+
 /**
 @brief	Writing a TIFF image file format.
 @param	*p			the image structure.
@@ -467,7 +841,12 @@ A 2D and 3D image format commonly used for graphics.
 	TIFF 6.0 library of Sam Lefler.
 	flags:
 	1		write tiled TIFF images (default scanline)
-	2+		write compressed images.
+	4		LZW compression (5 is also accepted)
+	8		deflate compression
+	16		with compression: floating point predictor for floating point
+			data, horizontal differencing for integer data
+	Compressed data is written in strips, or in tiles if requested and
+	for 3D images, that are encoded concurrently by the libtiff codecs.
 **/
 int 	writeTIFF(Bimage* p, int flags)
 {
@@ -478,7 +857,10 @@ int 	writeTIFF(Bimage* p, int flags)
 	int 			istiled = flags & 1;
 //	unsigned short	compression = flags & 62;
 //	unsigned short	compression(COMPRESSION_LZW);
-	unsigned short	compression(flags & COMPRESSION_LZW);
+	unsigned short	compression(COMPRESSION_NONE);
+	if ( flags & 8 ) compression = COMPRESSION_ADOBE_DEFLATE;
+	else if ( flags & 4 ) compression = COMPRESSION_LZW;
+	int				encode = ( compression != COMPRESSION_NONE && p->data_type() > Bit );
 	long   			i, j, y, z, n;
 	unsigned short	min = (unsigned short) p->minimum();
 	unsigned short	max = (unsigned short) p->maximum();
@@ -507,7 +889,38 @@ int 	writeTIFF(Bimage* p, int flags)
 	long tiley = (int) (unitsize*floor(p->sizeY()*1.0/unitsize + 0.99999));
 	long tilez(1);
 	
-	if ( compression ) (*p)["compression"] = compression;
+	// Compressed data is encoded concurrently in strips of about 256 KB,
+	// or in tiles of up to 256 x 256 when requested and for 3D images
+	unsigned short	predictor(PREDICTOR_NONE);
+	TIFFlayout		tl;
+	if ( encode ) {
+		if ( p->sizeZ() > 1 ) istiled = 1;
+		if ( flags & 16 )
+			predictor = ( p->data_type() >= Float )? PREDICTOR_FLOATINGPOINT: PREDICTOR_HORIZONTAL;
+		tl.tiled = istiled;
+		tl.nx = p->sizeX();
+		tl.ny = p->sizeY();
+		tl.nz = p->sizeZ();
+		tl.stride = p->channels();
+		tl.bps = datatypesize;
+		tl.elementsize = tl.stride*tl.bps;
+		if ( istiled ) {
+			tl.tx = 16*((p->sizeX() + 15)/16);
+			tl.ty = 16*((p->sizeY() + 15)/16);
+			if ( tl.tx > 256 ) tl.tx = 256;
+			if ( tl.ty > 256 ) tl.ty = 256;
+			tilex = tl.tx;
+			tiley = tl.ty;
+		} else {
+			tl.tx = p->sizeX();
+			tl.ty = 262144/linesize;
+			if ( tl.ty < 1 ) tl.ty = 1;
+			if ( tl.ty > p->sizeY() ) tl.ty = p->sizeY();
+		}
+		tl.tz = 1;
+	}
+	
+	if ( compression != COMPRESSION_NONE ) (*p)["compression"] = compression;
 	
 	tm*		t = p->get_localtime();
 	char	timestring[20];
@@ -525,11 +938,15 @@ int 	writeTIFF(Bimage* p, int flags)
 			TIFFSetField(fimg, TIFFTAG_TILEWIDTH, tilex);
 			TIFFSetField(fimg, TIFFTAG_TILELENGTH, tiley);
 			TIFFSetField(fimg, TIFFTAG_TILEDEPTH, tilez);
-		} else
+		} else if ( encode )
+			TIFFSetField(fimg, TIFFTAG_ROWSPERSTRIP, tl.ty);
+		else
 			TIFFSetField(fimg, TIFFTAG_ROWSPERSTRIP,
 	    		TIFFDefaultStripSize(fimg, rowsperstrip));
-		if ( compression )
+		if ( compression != COMPRESSION_NONE )
 			TIFFSetField(fimg, TIFFTAG_COMPRESSION, compression);
+		if ( predictor != PREDICTOR_NONE )
+			TIFFSetField(fimg, TIFFTAG_PREDICTOR, predictor);
 	
 		if ( verbose & VERB_DEBUG ) {
 			cout << "DEBUG writeTIFF: Image " << n << ": size " << p->sizeX() << " " 
@@ -601,6 +1018,10 @@ int 	writeTIFF(Bimage* p, int flags)
 				TIFFSetField(fimg, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
 				TIFFSetField(fimg, TIFFTAG_BITSPERSAMPLE, 64);
 				break;
+			case Half:
+				TIFFSetField(fimg, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
+				TIFFSetField(fimg, TIFFTAG_BITSPERSAMPLE, 16);
+				break;
 			default:
 				TIFFSetField(fimg, TIFFTAG_BITSPERSAMPLE, 8);
 		}
@@ -639,7 +1060,13 @@ int 	writeTIFF(Bimage* p, int flags)
 			cout << "DEBUG writeTIFF: Pages: ";
 		}
 	
-		if ( istiled ) {
+		if ( encode ) {
+			if ( writeTIFF_parallel(fimg, p, n, tl) < 0 ) {
+				cerr << "Error: TIFF image " << n << " could not be written!" << endl;
+				TIFFClose(fimg);
+				return -1;
+			}
+		} else if ( istiled ) {
 			pagesize = TIFFTileSize(fimg);
 			page = new char[pagesize];
 			tilerowsize = TIFFTileRowSize(fimg);
@@ -3,7 +3,7 @@
 @brief	Library for 2D and 3D image I/O
 @author Bernard Heymann
 @date	Created: 19990321
-@date 	Modified: 20210628
+@date 	Modified: 20261018
 **/
 
 #include "rwimg.h"
@@ -276,7 +276,8 @@ Bimage* 	read_img(string filename, int readdata, int img_select)
 @brief	General driver function to write multiple image formats
 @param 	filename		file name (plus any tags for the RAW format).
 @param	*p				the image structure.
-@param	compression		compression type: 0=none, 5=LZW(Tiff)
+@param	compression		compression type: 0=none, 4=4-bit packing (MRC), 5=LZW(Tiff),
+							8=deflate(Tiff), +16=predictor(Tiff)
 @return	int				error code (<0 means failure).
 	This is the only image writing function that should be called
 	from programs.
@@ -395,9 +396,9 @@ int 		write_img(string filename, Bimage* p, int compression)
 	else if ( ext.find("mif") != string::npos )
 		err = writeMIFF(p);
 	else if ( ext.find("mrc") != string::npos || ext == "stk" )
-		err = writeMRC(p);
+		err = writeMRC(p, flags);
 	else if ( ext == "st" || ext.find("ali") != string::npos || ext.find("rec") != string::npos )	// IMOD extensions
-		err = writeMRC(p);
+		err = writeMRC(p, flags);
 	else if ( ext.find("pif") != string::npos || ext.find("sf") != string::npos )
 		err = writePIF(p);
 	else if ( ext.find("bp") != string::npos || ext.find("bq") != string::npos )
@@ -31,6 +31,7 @@ Bmd*		md_init()
 	memset(md, 0, sizeof(Bmd));
 	
 	md->cutoff = 5;
+	md->skin = 1;
 	md->sepdist = 4;
 	md->VdWcoeff1 = 1.0/12.0;
 	md->VdWcoeff2 = 1.0/6.0;
@@ -3,7 +3,7 @@
 @brief	Library routines to read and write micrograph parameters in STAR format
 @author Bernard Heymann
 @date	Created: 20010206
-@date	Modified: 20220113
+@date	Modified: 20261018
 **/
 
 #include "mg_processing.h"
@@ -150,6 +150,8 @@ Bframe*		frame_from_starblock(BstarBlock& block)
 					frame->sel = to_integer(ir[j]);
 				if ( ( j = il.find(MICROGRAPH_FRAME_FOM) ) >= 0 )
 					frame->fom = to_real(ir[j]);
+				if ( ( j = il.find(MICROGRAPH_FRAME_LOCAL) ) >= 0 && ir[j].length() > 2 )
+					frame->local = parse_real_vector(ir[j].substr(1));
 			}
 		}
 	}
@@ -916,13 +918,16 @@ int		frame_to_starblock(Bframe* frame, BstarBlock& block)
 	loop.tags()[MICROGRAPH_FRAME_SHIFT_Y] = 2;
 	loop.tags()[MICROGRAPH_FRAME_SELECT] = 3;
 	loop.tags()[MICROGRAPH_FRAME_FOM] = 4;
+	long			ncol(5);
+	if ( frame && frame->local.size() ) loop.tags()[MICROGRAPH_FRAME_LOCAL] = ncol++;
 	for ( Bframe* f = frame; f; f = f->next ) {
-		vector<string>&	vs = loop.add_row(5);
+		vector<string>&	vs = loop.add_row(ncol);
 		vs[0] = to_string(f->id);
 		vs[1] = to_string(f->shift[0]);
 		vs[2] = to_string(f->shift[1]);
 		vs[3] = to_string(f->sel);
 		vs[4] = to_string(f->fom);
+		if ( ncol > 5 ) vs[5] = "[" + concatenate(f->local) + "]";
 	}
 	
 	return 0;
@@ -3,7 +3,7 @@
 @brief	Reads and writes micrograph XML files
 @author Bernard Heymann
 @date	Created: 20050920
-@date	Modified: 20220110
+@date	Modified: 20261018
 **/
 
 #ifdef HAVE_XML
@@ -325,6 +325,8 @@ Bframe*		frame_from_xml(xmlNodePtr node, Bframe** framelist)
 	frame->shift[1] = xml_get_real(node, MICROGRAPH_FRAME_SHIFT_Y);
 	frame->fom = xml_get_real(node, MICROGRAPH_FRAME_FOM);
 	frame->sel = xml_get_integer(node, MICROGRAPH_FRAME_SELECT);
+	if ( xml_find_node(node, MICROGRAPH_FRAME_LOCAL) )
+		frame->local = parse_real_vector(xml_get_string(node, MICROGRAPH_FRAME_LOCAL).substr(1));
 
 	return frame;
 }
@@ -759,6 +761,7 @@ int			frame_to_xml(Bframe* framelist, xmlNodePtr parent)
 	int				nframe(0);
 	Bframe*			frame = NULL;
 	xmlNodePtr		frame_node = NULL;
+	string			ls;
 
 	for ( frame=framelist; frame; frame=frame->next, nframe++ ) {
 		frame_node = xmlNewChild(parent, NULL, BAD_CAST MICROGRAPH_FRAME, NULL);
@@ -767,6 +770,10 @@ int			frame_to_xml(Bframe* framelist, xmlNodePtr parent)
 		xml_set_real(frame_node, MICROGRAPH_FRAME_SHIFT_Y, frame->shift[1], "%7.3f");
 		xml_set_real(frame_node, MICROGRAPH_FRAME_FOM, frame->fom, "%7.4lf");
 		xml_set_integer(frame_node, MICROGRAPH_FRAME_SELECT, frame->sel, "%4d");
+		if ( frame->local.size() ) {
+			ls = "[" + concatenate(frame->local) + "]";
+			xmlNewChild(frame_node, NULL, BAD_CAST MICROGRAPH_FRAME_LOCAL, BAD_CAST ls.c_str());
+		}
 	}
 	
 	return nframe;
@@ -3,11 +3,12 @@
 @brief	Clustering functions
 @author Bernard Heymann 
 @date	Created: 20070417
-@date	Modified: 20210508
+@date	Modified: 20261018
 **/
 
 #include "cluster.h"
 #include "utilities.h"
+#include <random>
 
 //#ifndef DBL_MAX
 //#define DBL_MAX 1.7976e308
@@ -16,69 +17,320 @@
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
 
+/*
+	Assigns the points in a chunk to the nearest centres and accumulates
+	the sums and counts for the chunk.
+	Returns the number of points that changed membership.
+*/
+static long		k_means_assign_chunk(long start, long end, long d, float* data,
+				long k, double* cen, long* sel, double* sum, long* num, double* dist)
+{
+	long			i, j, ik, jk, change(0);
+	double			dd, v, dmin;
+	float*			x;
+	
+	for ( i=start; i<end; i++ ) {
+		x = data + i*d;
+		dmin = 1e300;
+		for ( ik=jk=0; ik<k; ik++ ) {
+			for ( j=0, dd=0; j<d; j++ ) {
+				v = x[j] - cen[ik*d+j];
+				dd += v*v;
+			}
+			if ( dmin > dd ) {
+				dmin = dd;
+				jk = ik;
+			}
+		}
+		if ( sum ) {
+			for ( j=0; j<d; j++ ) sum[jk*d+j] += x[j];
+			num[jk]++;
+		}
+		if ( dist ) dist[i] = dmin;
+		change += (sel[i] != jk);
+		sel[i] = jk;
+	}
+	
+	return change;
+}
+
+/*
+	Assigns all the points to the nearest centres in parallel chunks and
+	adds the chunk sums and counts in order.
+*/
+static long		k_means_assign(long n, long d, float* data, long k, double* cen,
+				long* sel, vector<double>& sum, vector<long>& num, double* dist,
+				long chunk_size)
+{
+	long			nchunk((n - 1)/chunk_size + 1);
+	vector<double>	csum(nchunk*k*d, 0);
+	vector<long>	cnum(nchunk*k, 0), cchange(nchunk, 0);
+	double*			cs = csum.data();
+	long*			cn = cnum.data();
+	long*			cc = cchange.data();
+	
+#ifdef HAVE_GCD
+	dispatch_apply(nchunk, dispatch_get_global_queue(0, 0), ^(size_t ic){
+		long	end = (ic+1)*chunk_size;
+		if ( end > n ) end = n;
+		cc[ic] = k_means_assign_chunk(ic*chunk_size, end, d, data, k, cen, sel,
+			cs + ic*k*d, cn + ic*k, dist);
+	});
+#else
+#pragma omp parallel for
+	for ( long ic=0; ic<nchunk; ++ic ) {
+		long	end = (ic+1)*chunk_size;
+		if ( end > n ) end = n;
+		cc[ic] = k_means_assign_chunk(ic*chunk_size, end, d, data, k, cen, sel,
+			cs + ic*k*d, cn + ic*k, dist);
+	}
+#endif
+
+	long			i, ic, change(0);
+	
+	sum.assign(k*d, 0);
+	num.assign(k, 0);
+	for ( ic=0; ic<nchunk; ++ic ) {
+		for ( i=0; i<k*d; ++i ) sum[i] += cs[ic*k*d + i];
+		for ( i=0; i<k; ++i ) num[i] += cn[ic*k + i];
+		change += cc[ic];
+	}
+	
+	return change;
+}
+
+/*
+	Selects initial centres from a set of points with greedy k-means++ seeding:
+	Candidates for each new centre are drawn with a probability proportional
+	to the squared distance to the nearest centre already chosen, and the
+	candidate giving the smallest total distance is kept.
+	Arthur, D. and S. Vassilvitskii (2007). "k-means++: the advantages of
+	careful seeding." Proc. 18th ACM-SIAM SODA: 1027-35.
+*/
+static vector<double>	k_means_seed(long n, long d, float* data, long* idx,
+				long k, mt19937& gen)
+{
+	long			i, j, ik, ic, ntrial(2 + (long) log(k));
+	double			dsum, r, best;
+	vector<double>	cen(k*d, 0), dist(n, 1e300);
+	vector<long>	cand(ntrial);
+	uniform_real_distribution<double>	uni(0, 1);
+	
+	i = (long) (uni(gen)*n);
+	if ( i >= n ) i = n - 1;
+	for ( j=0; j<d; j++ ) cen[j] = data[idx[i]*d+j];
+	
+	for ( ik=1; ik<=k; ik++ ) {
+		// Update the distances with the last centre chosen
+		double*		c = cen.data() + (ik-1)*d;
+#pragma omp parallel for
+		for ( long m=0; m<n; m++ ) {
+			float*	x = data + idx[m]*d;
+			double	dd(0), v;
+			for ( long l=0; l<d; l++ ) {
+				v = x[l] - c[l];
+				dd += v*v;
+			}
+			if ( dist[m] > dd ) dist[m] = dd;
+		}
+		if ( ik == k ) break;
+		for ( i=0, dsum=0; i<n; i++ ) dsum += dist[i];
+		if ( dsum <= 0 ) {		// Fewer distinct points than classes
+			i = (long) (uni(gen)*n);
+			if ( i >= n ) i = n - 1;
+			for ( j=0; j<d; j++ ) cen[ik*d+j] = data[idx[i]*d+j];
+			continue;
+		}
+		for ( ic=0; ic<ntrial; ic++ ) {
+			r = uni(gen)*dsum;
+			for ( i=0; i<n-1 && r >= dist[i]; i++ ) r -= dist[i];
+			cand[ic] = idx[i];
+		}
+		// Total distance for each candidate
+		vector<double>	pot(ntrial, 0);
+		for ( ic=0; ic<ntrial; ic++ ) {
+			float*	y = data + cand[ic]*d;
+			double	p(0);
+#pragma omp parallel for reduction(+:p)
+			for ( long m=0; m<n; m++ ) {
+				float*	x = data + idx[m]*d;
+				double	dd(0), v;
+				for ( long l=0; l<d; l++ ) {
+					v = x[l] - y[l];
+					dd += v*v;
+				}
+				p += (dist[m] < dd)? dist[m]: dd;
+			}
+			pot[ic] = p;
+		}
+		for ( ic=1, j=0, best=pot[0]; ic<ntrial; ic++ )
+			if ( best > pot[ic] ) {
+				best = pot[ic];
+				j = ic;
+			}
+		for ( i=0; i<d; i++ ) cen[ik*d+i] = data[cand[j]*d+i];
+	}
+	
+	return cen;
+}
+
 /**
 @brief 	Generate clusters using a K-means algorithm.
 @param 	n			number of data elements.
-@param 	*data		floating point array.
+@param 	d			number of features per element.
+@param 	*data		n x d floating point array (features of each element contiguous).
 @param 	k			number of classes.
+@param 	seed		random number generator seed for initial centres.
+@param 	batch		mini-batch size (0 = use all the data in every iteration).
+@param 	&centres	k x d array of class centres (returned).
 @return	vector<long>	vector of cluster memberships.
 
+	The initial centres are selected with k-means++ seeding using a
+	generator initialized with the given seed, so that the result is
+	reproducible.
+	In each iteration, the elements are assigned to the nearest centre
+	and the centres updated to the averages of their members, until the
+	memberships do not change.
+	The assignment is done in parallel chunks, each with its own partial
+	sums for the update.
+	A class that loses all its members is restarted at the element
+	furthest from its centre.
+	With a positive batch size, each iteration assigns a random sample of
+	that many elements and moves the centres towards them with a
+	per-centre learning rate (Sculley, D. (2010). "Web-scale k-means
+	clustering." Proc. 19th WWW: 1177-8).
+	The seeding is then done on a sample of four batches, and all elements
+	are assigned to the final centres.
+	Classes are numbered in order of the first feature of their centres.
 
 **/
-vector<long>	k_means(long n, float* data, long k)
+vector<long>	k_means(long n, long d, float* data, long k, unsigned long seed,
+				long batch, vector<double>& centres)
 {
-	long			i, j, ik, jk, imax(100), nun[k], change(1);
-	double			min, max, d, dmin, avg[k], sum[k];
-	vector<long>	sel(n,0);
+	long			i, j, ik, it, imax(100), change(1);
+	vector<long>	sel(n, k), num(k, 0);
+	vector<double>	sum, dist;
+	mt19937			gen(seed);
 	
-	min = max = data[0];
-	for ( j=0; j<n; j++ ) {
-		sel[j] = k;
-		if ( min > data[j] ) min = data[j];
-		if ( max < data[j] ) max = data[j];
-	}
-
-	for ( ik=0; ik<k; ik++ ) avg[ik] = (ik + 0.5)*(max - min)/k + min;
-
-//	cout << avg[0] << tab << avg[1] << endl;
+	if ( d < 1 ) d = 1;
+	if ( k > n ) k = n;
+	if ( k < 1 ) return sel;
+	if ( batch >= n ) batch = 0;
 	
-	for ( i=0; i<imax && change; i++ ) {
-		change = 0;
-		for ( ik=0; ik<k; ik++ ) {
-			sum[ik] = 0;
-			nun[ik] = 0;
-		}
-		for ( j=0; j<n; j++ ) {
-			dmin = 1e37;
-			for ( ik=jk=0; ik<k; ik++ ) {
-				d = fabs(data[j] - avg[ik]);
-				if ( dmin > d ) {
-					dmin = d;
-					jk = ik;
+	long			chunk_size(get_chunk_size(n));
+	long			nseed((batch > 0 && 4*batch < n)? 4*batch: n);
+	vector<long>	idx(n);
+	
+	for ( i=0; i<n; i++ ) idx[i] = i;
+	if ( nseed < n ) shuffle(idx.begin(), idx.end(), gen);
+	
+	centres = k_means_seed(nseed, d, data, idx.data(), k, gen);
+	
+	if ( batch > 0 ) {
+		// Mini-batch iterations
+		uniform_int_distribution<long>	pick(0, n-1);
+		vector<long>	bidx(batch), bsel(batch), cnt(k, 0);
+		vector<float>	bdata(batch*d);
+		long			batch_chunk(get_chunk_size(batch));
+		double			eta, shift, v;
+		for ( it=0; it<imax; it++ ) {
+			for ( i=0; i<batch; i++ ) {
+				bidx[i] = pick(gen);
+				for ( j=0; j<d; j++ ) bdata[i*d+j] = data[bidx[i]*d+j];
+			}
+			k_means_assign(batch, d, bdata.data(), k, centres.data(),
+				bsel.data(), sum, num, NULL, batch_chunk);
+			for ( i=0, shift=0; i<batch; i++ ) {
+				ik = bsel[i];
+				cnt[ik]++;
+				eta = 1.0/cnt[ik];
+				for ( j=0; j<d; j++ ) {
+					v = eta*(bdata[i*d+j] - centres[ik*d+j]);
+					centres[ik*d+j] += v;
+					shift += v*v;
 				}
 			}
-			sum[jk] += data[j];
-			nun[jk]++;
-			change += (sel[j] != jk);
-			sel[j] = jk;
+			if ( shift < 1e-12 ) break;
 		}
-		for ( ik=0; ik<k; ik++ ) {
-			if ( nun[ik] ) avg[ik] = sum[ik]/nun[ik];
-			else avg[ik] = (ik + 0.5)*(max - min)/k + min;
+		k_means_assign(n, d, data, k, centres.data(), sel.data(), sum, num,
+			NULL, chunk_size);
+	} else {
+		for ( it=0; it<imax && change; it++ ) {
+			change = k_means_assign(n, d, data, k, centres.data(), sel.data(),
+				sum, num, NULL, chunk_size);
+			for ( ik=0; ik<k && num[ik]; ik++ ) ;
+			if ( ik < k ) {		// Distances needed to restart empty classes
+				dist.resize(n);
+				k_means_assign(n, d, data, k, centres.data(), sel.data(),
+					sum, num, dist.data(), chunk_size);
+			}
+			for ( ik=0; ik<k; ik++ ) {
+				if ( num[ik] ) {
+					for ( j=0; j<d; j++ ) centres[ik*d+j] = sum[ik*d+j]/num[ik];
+				} else {
+					for ( i=j=0; i<n; i++ ) if ( dist[j] < dist[i] ) j = i;
+					for ( i=0; i<d; i++ ) centres[ik*d+i] = data[j*d+i];
+					dist[j] = 0;
+					change++;
+				}
+			}
 		}
-//		cout << i << tab << avg[0] << tab << nun[0] << tab << avg[1] << tab << nun[1] << endl;
+	}
+	
+	// Number the classes in order of the first feature of the centres
+	vector<long>	order(k), rank(k);
+	vector<double>	cs(centres);
+	for ( ik=0; ik<k; ik++ ) order[ik] = ik;
+	sort(order.begin(), order.end(), [&cs, d](long a, long b) { return cs[a*d] < cs[b*d]; });
+	for ( ik=0; ik<k; ik++ ) {
+		rank[order[ik]] = ik;
+		for ( j=0; j<d; j++ ) centres[ik*d+j] = cs[order[ik]*d+j];
+	}
+	for ( ik=0; ik<k; ik++ ) num[ik] = 0;
+	for ( i=0; i<n; i++ ) {
+		sel[i] = rank[sel[i]];
+		num[sel[i]]++;
 	}
 	
 	if ( verbose & VERB_PROCESS ) {
 		cout << "K-means clustering:" << endl;
-		for ( ik=0; ik<k; ik++ )
-			cout << "Class " << ik << ":          " << avg[ik] << " (" << nun[ik] << ")" << endl;
+		cout << "Elements:                       " << n << endl;
+		cout << "Features:                       " << d << endl;
+		cout << "Seed:                           " << seed << endl;
+		if ( batch > 0 )
+			cout << "Mini-batch size:                " << batch << endl;
+		cout << "Iterations:                     " << it << endl;
+		for ( ik=0; ik<k; ik++ ) {
+			cout << "Class " << ik << ":          " << centres[ik*d];
+			for ( j=1; j<d && j<4; j++ ) cout << tab << centres[ik*d+j];
+			if ( d > 4 ) cout << " ...";
+			cout << " (" << num[ik] << ")" << endl;
+		}
 		cout << endl;
 	}
 	
 	return sel;
 }
 
+/**
+@brief 	Generate clusters using a K-means algorithm.
+@param 	n			number of data elements.
+@param 	*data		floating point array.
+@param 	k			number of classes.
+@return	vector<long>	vector of cluster memberships.
+
+	The values are clustered as one-dimensional features with a fixed seed
+	(see the general k_means function).
+	The classes are numbered in order of increasing averages.
+
+**/
+vector<long>	k_means(long n, float* data, long k)
+{
+	vector<double>	centres;
+	
+	return k_means(n, 1, data, k, 1, 0, centres);
+}
+
 
 /**
 @brief 	Generate clusters from a similarity matrix using affinity propagation.  
@@ -394,3 +646,227 @@ vector<long>	affin_prop_clustering(Matrix s, long maxit, long convit, double lam
 	
 	return idx;
 }
+
+/**
+@brief 	Generate clusters from a sparse similarity list using affinity propagation.  
+@param 	n			number of points.
+@param 	&row		n+1 offsets of each point's neighbors in the lists.
+@param 	&col		neighbor indices.
+@param 	&sim		similarities to the neighbors.
+@param 	maxit		maximum iterations.
+@param 	convit		convergence iterations.
+@param 	lambda		damping factor.
+@param 	&ncluster	number of clusters.
+@return	vector<long>	vector of cluster memberships.
+
+	The similarities are given in compressed sparse row form: the neighbors
+	of point j are col[row[j]] to col[row[j+1]-1] with similarities in sim.
+	Each point must include itself as a neighbor, with the preference as
+	its similarity.
+	Pairs not in the list are taken to have infinitely low similarity, so
+	that the responsibilities and availabilities are only calculated and
+	stored for the listed pairs (typically the k nearest neighbors).
+	The responsibilities are updated in parallel over the points and the
+	availabilities in parallel over the candidate exemplars.
+	The damping and convergence controls are the same as for the dense
+	version, and a fully connected list gives the same result.
+	A point with no exemplar among its neighbors is assigned to itself.
+
+**/
+vector<long>	affin_prop_clustering(long n, vector<long>& row, vector<long>& col,
+				vector<double>& sim, long maxit, long convit, double lambda, long& ncluster)
+{
+	if ( n < 2 || (long)row.size() < n + 1 ) {
+		cerr << "Error: No input similarity list!" << endl;
+		return vector<long>(0);
+	}
+	
+	if ( lambda < 0.1 ) lambda = 0.1;
+	if ( lambda > 0.9 ) lambda = 0.9;
+	if ( convit < 2 ) convit = 2;
+	if ( maxit < 2*convit ) maxit = 2*convit;
+	
+	long			ne(row[n]);
+	long			it, cit, j, k, e, nc;
+	vector<long>	diag(n,-1);
+	
+	for ( j=0; j<n; j++ )
+		for ( e=row[j]; e<row[j+1]; e++ )
+			if ( col[e] == j ) diag[j] = e;
+	
+	for ( j=0; j<n; j++ ) if ( diag[j] < 0 ) {
+		cerr << "Error: Point " << j+1 << " has no preference in the similarity list!" << endl;
+		return vector<long>(0);
+	}
+	
+	// Index of the edges for each candidate exemplar
+	vector<long>	cbeg(n+1,0), cedge(ne);
+	for ( e=0; e<ne; e++ ) cbeg[col[e]+1]++;
+	for ( k=0; k<n; k++ ) cbeg[k+1] += cbeg[k];
+	vector<long>	cpos(cbeg.begin(), cbeg.end()-1);
+	for ( j=0; j<n; j++ )
+		for ( e=row[j]; e<row[j+1]; e++ )
+			cedge[cpos[col[e]]++] = e;
+	
+	vector<double>	a(ne,0);
+	vector<double>	r(ne,0);
+	vector<char>	c(n,0);
+	vector<long>	idx(n,0);
+	
+	if ( verbose & VERB_PROCESS ) {
+		cout << "Sparse affinity propagation:" << endl;
+		cout << "Number of points:               " << n << endl;
+		cout << "Number of similarities:         " << ne << endl;
+		cout << "Message memory:                 " <<
+			(2*ne*sizeof(double) + (ne + 2*n)*sizeof(long))/1048576.0 << " MB" << endl << endl;
+	}
+	
+	// The loop exits on two conditions:
+	// 1. Exceeding the set maximum number of iterations
+	// 2. No change in the cluster solution for the set number of convergence iterations
+	//		(i.e., when cit >= convit)
+	for ( it=cit=0; it<maxit && cit<convit; it++, cit++ ) {
+		// Calculate responsibilities
+#pragma omp parallel for
+		for ( long jj=0; jj<n; jj++ ) {
+			double		v, mx1(-DBL_MAX), mx2(-DBL_MAX);
+			for ( long ee=row[jj]; ee<row[jj+1]; ee++ ) {
+				v = a[ee] + sim[ee];
+				if ( mx1 < v ) {
+					mx2 = mx1;
+					mx1 = v;
+				} else if ( mx2 < v ) {
+					mx2 = v;
+				}
+			}
+			for ( long ee=row[jj]; ee<row[jj+1]; ee++ ) {
+				v = a[ee] + sim[ee];
+				if ( v == mx1 ) v = mx2;
+				else v = mx1;
+				r[ee] = lambda*r[ee] + (1-lambda)*(sim[ee] - v);
+			}
+		}
+		// Calculate availabilities
+#pragma omp parallel for
+		for ( long kk=0; kk<n; kk++ ) {
+			double		v, srp(0);
+			long		ee, ed(diag[kk]);
+			for ( long l=cbeg[kk]; l<cbeg[kk+1]; l++ )
+				if ( r[cedge[l]] > 0 ) srp += r[cedge[l]];
+			if ( r[ed] < 0 ) srp += r[ed];
+			for ( long l=cbeg[kk]; l<cbeg[kk+1]; l++ ) {
+				ee = cedge[l];
+				if ( ee == ed ) continue;
+				v = srp;
+				if( r[ee] > 0 ) v -= r[ee];
+				if ( v < 0 ) a[ee] = lambda*a[ee]+(1-lambda)*v;
+				else a[ee] = lambda*a[ee];
+			}
+			a[ed] = lambda*a[ed] + (1-lambda)*(srp - r[ed]);
+		}
+		// Update exemplars and test exit conditions
+		for( j=0, nc=0; j<n; j++ ) {
+			e = diag[j];
+			char	t = ( a[e] + r[e] > 0 )? 1: 0;
+			if ( c[j] != t ) cit = 0;	// Reset the convergence counter
+			c[j] = t;
+			nc += c[j];
+		}
+		if ( nc < 1 ) cit = 0;	// Reset the convergence counter
+		if ( verbose & VERB_FULL )
+			cout << it << tab << nc << endl;
+	}
+
+    double				netsim, dpsim(0), expref(0), smax;
+	for( j=0, nc=0; j<n; j++ ) nc += c[j];
+	
+	if ( nc > 0 ) {
+		for ( j=0; j<n; j++ ) {
+			if ( c[j] ) {
+				idx[j] = j;
+				expref += sim[diag[j]];
+				continue;
+			}
+			idx[j] = j;
+			smax = -DBL_MAX;
+			for ( e=row[j]; e<row[j+1]; e++ )
+				if ( c[col[e]] && smax < sim[e] ) {
+					smax = sim[e];
+					idx[j] = col[e];
+				}
+			if ( idx[j] != j ) dpsim += smax;
+			else expref += sim[diag[j]];
+		}
+	}
+	
+    netsim = dpsim + expref;
+
+	vector<long>	m(n,0);
+
+	for ( j=0; j<n; j++ ) m[idx[j]]++;
+
+	for ( j=ncluster=0; j<n; j++ ) if ( m[j] ) ncluster++;
+	
+	if ( verbose & VERB_RESULT ) {
+		cout << "Number of points:               " << n << endl;
+		cout << "Number of iterations:           " << it << endl;
+		cout << "Number of clusters:             " << nc << endl;
+		cout << "Fitness (net similarity):       " << netsim << endl;
+		cout << "  Similarities to exemplars:    " << dpsim << endl;
+		cout << "  Preferences of exemplars:     " << expref << endl << endl;
+		cout << "Cluster\tNumber" << endl;
+		for ( j=0; j<n; j++ ) if ( j == idx[j] )
+			cout << j+1 << tab << m[j] << endl;
+		cout << endl;
+	}
+	
+	return idx;
+}
+
+/**
+@brief 	Selects the most similar neighbors from a similarity matrix.
+@param 	&s			n x n similarity matrix (diagonal = preferences).
+@param 	nneighbors	number of neighbors for each point (excluding itself).
+@param 	&row		n+1 offsets of each point's neighbors in the lists.
+@param 	&col		neighbor indices.
+@param 	&sim		similarities to the neighbors.
+@return	long		number of similarities in the lists.
+
+	The lists are set up in compressed sparse row form for the sparse
+	affinity propagation, with each point listed as its own neighbor with
+	the preference from the diagonal.
+	The neighbors of each point are listed in order of index.
+
+**/
+long		similarity_neighbors(Matrix& s, long nneighbors, vector<long>& row,
+				vector<long>& col, vector<double>& sim)
+{
+	long			n(s.rows()), j, k;
+	
+	if ( nneighbors > n - 1 ) nneighbors = n - 1;
+	if ( nneighbors < 0 ) nneighbors = 0;
+	
+	row.resize(n+1);
+	col.resize(n*(nneighbors+1));
+	sim.resize(n*(nneighbors+1));
+	
+#pragma omp parallel for private(k)
+	for ( j=0; j<n; j++ ) {
+		vector<long>	nb;
+		for ( k=0; k<n; k++ ) if ( k != j ) nb.push_back(k);
+		partial_sort(nb.begin(), nb.begin()+nneighbors, nb.end(),
+			[&s, j](long a, long b) { return s[j][a] > s[j][b]; });
+		nb.resize(nneighbors);
+		nb.push_back(j);
+		sort(nb.begin(), nb.end());
+		row[j] = j*(nneighbors+1);
+		for ( k=0; k<=nneighbors; k++ ) {
+			col[row[j]+k] = nb[k];
+			sim[row[j]+k] = s[j][nb[k]];
+		}
+	}
+	
+	row[n] = n*(nneighbors+1);
+	
+	return row[n];
+}
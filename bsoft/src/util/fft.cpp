@@ -3,7 +3,7 @@
 @brief	General FFT for n-dimensional data
 @author Bernard Heymann
 @date	Created: 19980805
-@date	Modified: 20151002
+@date	Modified: 20261018
 
 		Implementing the FFTW library
 **/
@@ -14,6 +14,11 @@
 // Declaration of global variables
 extern int 	verbose;		// Level of output to the screen
 
+// The FFTW planner is not thread-safe: plans are created and destroyed one at a time
+#ifdef HAVE_GCD
+static dispatch_queue_t		fft_plan_queue = dispatch_queue_create("fft_plan", NULL);
+#endif
+
 /**
 @brief 	Sets up a plan for fast Fourier transforms.
 @param 	x			x dimension.
@@ -63,7 +68,17 @@ fft_plan	fft_setup_plan(long x, long y, long z, fft_direction dir, int opt)
 	if ( opt )
 		in = out = new fft_complex[x*y*z];
 	
-	fft_plan			plan = fftwf_plan_dft(rank, n, in, out, dir, flags);
+	int*				pn = n;
+#ifdef HAVE_GCD
+	__block fft_plan	plan;
+	dispatch_sync(fft_plan_queue, ^{
+		plan = fftwf_plan_dft(rank, pn, in, out, dir, flags);
+	});
+#else
+	fft_plan			plan;
+#pragma omp critical (fft_plan)
+	plan = fftwf_plan_dft(rank, pn, in, out, dir, flags);
+#endif
 
 	if ( opt )
 		delete[] in;
@@ -76,6 +91,82 @@ fft_plan	fft_setup_plan(Vector3<long> size, fft_direction dir, int opt)
 	return fft_setup_plan(size[0], size[1], size[2], dir, opt);
 }
 
+/**
+@brief 	Sets up a plan for a batch of contiguous fast Fourier transforms.
+@param 	size		size of each transform.
+@param 	nbatch		number of transforms in the batch.
+@param 	dir			direction of transformation (FFTW_FORWARD or FFTW_BACKWARD)
+@param 	opt			optimization (0=FFTW_ESTIMATE, 1=FFTW_MEASURE, 2=FFTW_PATIENT, 3=FFTW_EXHAUSTIVE).
+@param 	dist		distance between the starts of transforms (0=packed).
+@return fft_plan 	FFTW plan.
+
+	FFTW library (www.fftw.org).
+	By default the transforms are packed one after the other without gaps,
+	as in a multi-image data block, and executed with one call.
+	A distance larger than the transform size leaves gaps, e.g., to keep
+	each transform aligned in memory.
+
+**/
+fft_plan	fft_setup_plan_many(Vector3<long> size, long nbatch, fft_direction dir, int opt, long dist)
+{
+	int					rank = 0;
+	int					n[3] = {1, 1, 1};
+	if ( size[2] > 1 ) {
+		rank = 3;
+		n[0] = size[2];
+		n[1] = size[1];
+		n[2] = size[0];
+	} else if ( size[1] > 1 ) {
+		rank = 2;
+		n[0] = size[1];
+		n[1] = size[0];
+	} else {
+		rank = 1;
+		n[0] = size[0];
+	}
+	
+	long				imgsize = size.volume();
+	if ( dist > imgsize ) imgsize = dist;
+	
+	if ( verbose & VERB_DEBUG )
+		cout << "DEBUG fft_setup_plan_many: n=" << n[0] << "x" << n[1] << "x" << n[2] << " batch=" << nbatch << " dist=" << imgsize << " opt=" << opt << endl;
+
+	int					flags = FFTW_ESTIMATE;
+	
+	switch ( opt ) {
+		case 1: flags = FFTW_MEASURE; break;
+		case 2: flags = FFTW_PATIENT; break;
+		case 3: flags = FFTW_EXHAUSTIVE; break;
+		default: flags = FFTW_ESTIMATE;
+	}
+	
+	fft_complex*		in = NULL;
+	fft_complex*		out = in;
+	if ( opt )
+		in = out = new fft_complex[imgsize*nbatch];
+	
+	int*				pn = n;
+#ifdef HAVE_GCD
+	__block fft_plan	plan;
+	dispatch_sync(fft_plan_queue, ^{
+		plan = fftwf_plan_many_dft(rank, pn, nbatch,
+							in, NULL, 1, imgsize,
+							out, NULL, 1, imgsize, dir, flags);
+	});
+#else
+	fft_plan			plan;
+#pragma omp critical (fft_plan)
+	plan = fftwf_plan_many_dft(rank, pn, nbatch,
+							in, NULL, 1, imgsize,
+							out, NULL, 1, imgsize, dir, flags);
+#endif
+
+	if ( opt )
+		delete[] in;
+
+	return plan;
+}
+
 /**
 @brief 	Deallocates a plan for fast Fourier transforms.
 @param 	plan		FFTW plan.
@@ -86,7 +177,14 @@ fft_plan	fft_setup_plan(Vector3<long> size, fft_direction dir, int opt)
 **/
 int			fft_destroy_plan(fft_plan plan)
 {
+#ifdef HAVE_GCD
+	dispatch_sync(fft_plan_queue, ^{
+		fftwf_destroy_plan(plan);
+	});
+#else
+#pragma omp critical (fft_plan)
 	fftwf_destroy_plan(plan);
+#endif
 
 	return 0;
 }
@@ -3,7 +3,7 @@
 @brief	Nelder and Mead downhill simplex method for generalized parameter fitting
 @author Bernard Heymann
 @date	Created: 20000426
-@date	Modified: 20220301
+@date	Modified: 20261018
 
 	Adapted from Numerical Recipes, 2nd edition, Press et al. 1992
 **/
@@ -50,6 +50,7 @@ Bsimplex::Bsimplex(long nv, long np, long nc, long n, vector<double>& ax, vector
 	nparam = np;
 	nconstant = nc;
 	npoint = n;
+	rseed = 0;
 
 	if ( nparam && nvar ) x = ax;
 	
@@ -82,6 +83,11 @@ Bsimplex::Bsimplex(long nv, long np, long nc, long n, vector<double>& ax, vector
 	The objective is to lower the R value calculated in the evaluation function.
 	The tolerance or exit condition parameter is related to the evaluation function,
 	and must therefore be supplied by the calling function.
+	By default the random points are generated from the seeded global
+	random number generator.
+	If a seed is set (see Bsimplex::seed), the random points are generated
+	from a state local to the run, so that a fit is reproducible and
+	independent of other threads using random numbers.
 Reference: 	Press W.H. et al (1992) Numerical Recipes in C.
 
 **/
@@ -91,11 +97,13 @@ double		Bsimplex::run(long maxcycles, double tolerance, double (funk)(Bsimplex&)
 	long			converged(0), ilo(0), inhi(1), ihi(2);
 	long 			rand_max = get_rand_max();	// My own random maximum due to system differences
 	double			irm(1.0L/rand_max);
+	unsigned short	rs[3] = {0x330E, (unsigned short) (rseed & 0xFFFF),
+						(unsigned short) ((rseed >> 16) & 0xFFFF)};	// Own random state
 	double			r, Rtry, Rsave, reltol(tolerance/10);
 	
 	if ( maxcycles < 1 ) maxcycles = 1;
 	
-	random_seed();
+	if ( !rseed ) random_seed();
 	
 	if ( verbose & VERB_DEBUG ) {
 		for ( i=0; i<10; i++ )
@@ -122,7 +130,7 @@ double		Bsimplex::run(long maxcycles, double tolerance, double (funk)(Bsimplex&)
 	for ( i=1; i<npnt; i++ ) {						// Set up the other points
 		for ( j=0; j<nparam; j++ ) {
 			k = i*nparam+j;
-			r = random()*irm;
+			r = ( rseed )? erand48(rs): random()*irm;
 			if ( lo.size() && hi.size() ) { 		// Stay within limits
 				mp[k] = lo[j] + (hi[j] - lo[j])*(0.25 + 0.5*r);
 			} else {								// No limits are specified
@@ -162,7 +170,7 @@ double		Bsimplex::run(long maxcycles, double tolerance, double (funk)(Bsimplex&)
 			for ( i=1; i<npnt; i++ ) {			// Randomize other points
 				for ( j=0; j<nparam; j++ ) {		
 					k = i*nparam+j;
-					r = random()*irm;
+					r = ( rseed )? erand48(rs): random()*irm;
 					if ( lo[j] < hi[j] ) { // Stay within limits
 						mp[k] = lo[j] + (hi[j] - lo[j])*(0.25 + 0.5*r);
 					} else {					// If no limits are specified
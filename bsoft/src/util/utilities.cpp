@@ -3,7 +3,7 @@
 @brief	Library functions useful in all the package
 @author Bernard Heymann
 @date	Created: 19990722
-@date	Modified: 20220722
+@date	Modified: 20261018
 **/
 
 #include <errno.h>
@@ -323,6 +323,7 @@ DataType	getdatatype(char letter)
 		case 'l': type = Long; break;
 		case 'f': type = Float; break;
 		case 'd': type = Double; break;
+		case 'h': type = Half; break;
 		case 'S': type = Short; break;
 		case 'I': type = Integer; break;
 		case 'F': type = Float; break;